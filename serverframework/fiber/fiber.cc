@@ -157,15 +157,20 @@ void Fiber::Resume() {
       ASSERT2(false, "swapcontext");
     }
   }
+
+  // 回到这里时协程的上下文已经保存好，才可以把状态改为READY。
+  // 如果在Yield中swapcontext之前就改，协程在yield的过程中被其他线程调度时，
+  // 那个线程会resume一个还没保存完的上下文
+  if (state_ == RUNNING) {
+    state_ = READY;
+  }
 }
 
 void Fiber::Yield() {
   ASSERT(state_ == RUNNING || state_ == TERM);
   SetThis(t_thread_fiber.get());
-  // 协程运行完之后会自动yield一次，用于回到主协程，此时状态已为结束状态
-  if (state_ != TERM) {
-    state_ = READY;
-  }
+  // 协程运行完之后会自动yield一次，用于回到主协程，此时状态已为结束状态。
+  // 未结束时状态保持RUNNING，由Resume在上下文切换完成后改为READY
 
   // 如果协程参与调度器调度，那么应该和调度器的主协程进行swap，而不是线程主协程
   if (run_in_scheduler_) {
@@ -9,6 +9,7 @@
 
 #include <ucontext.h>
 
+#include <atomic>
 #include <functional>
 #include <memory>
 
@@ -71,14 +72,17 @@ class Fiber : public std::enable_shared_from_this<Fiber> {
   /**
    * @brief 将当前协程切到到执行状态
    * @details
-   * 当前协程和正在运行的协程进行交换，前者状态变为RUNNING，后者状态变为READY
+   * 当前协程和正在运行的协程进行交换，前者状态变为RUNNING。
+   * 协程yield回来之后，由Resume把它的状态改为READY，这时它的上下文已经保存完
    */
   void Resume();
 
   /**
    * @brief 当前协程让出执行权
    * @details
-   * 当前协程与上次resume时退到后台的协程进行交换，前者状态变为READY，后者状态变为RUNNING
+   * 当前协程与上次resume时退到后台的协程进行交换。未结束的协程在这里保持RUNNING，
+   * 切换完成、Resume返回后才变为READY。协程可以在yield之前把自己加入调度器，
+   * 其他线程的调度器看到RUNNING会跳过它，不会resume一个还没保存完的上下文
    */
   void Yield();
 
@@ -129,8 +133,8 @@ class Fiber : public std::enable_shared_from_this<Fiber> {
   uint64_t id_ = 0;
   // 协程栈大小
   uint32_t stack_size_ = 0;
-  // 协程状态
-  State state_ = READY;
+  // 协程状态，其他线程的调度器会读取它，判断协程是否可以resume
+  std::atomic<State> state_{READY};
   // 协程上下文
   ucontext_t ctx_;
   // 协程栈地址
@@ -15,11 +15,14 @@ static serverframework::Logger::ptr g_logger = LOG_NAME("system");
 static thread_local Scheduler *t_scheduler = nullptr;
 // 当前线程的调度协程，每个线程都独有一份
 static thread_local Fiber *t_scheduler_fiber = nullptr;
+// 当前线程在所属调度器thread_ids_中的下标
+static thread_local int t_thread_index = -1;
 
 Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name) {
   ASSERT(threads > 0);
 
   use_caller_ = use_caller;
+  local_tasks_.resize(threads);
   name_ = name;
 
   if (use_caller) {
@@ -40,6 +43,7 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name) {
     t_scheduler_fiber = root_fiber_.get();
     root_thread_ = serverframework::GetThreadId();
     thread_ids_.push_back(root_thread_);
+    t_thread_index = 0;
   } else {
     root_thread_ = -1;
   }
@@ -50,6 +54,24 @@ Scheduler *Scheduler::GetThis() { return t_scheduler; }
 
 Fiber *Scheduler::GetSchedulerFiber() { return t_scheduler_fiber; }
 
+int Scheduler::GetThreadIndex() { return t_thread_index; }
+
+int Scheduler::IndexOfThread(int thread) const {
+  if (thread == -1) {
+    return -1;
+  }
+  for (size_t i = 0; i < thread_ids_.size(); ++i) {
+    if (thread_ids_[i] == thread) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+bool Scheduler::IsCurrentThread(int index) const {
+  return t_scheduler == this && t_thread_index == index;
+}
+
 void Scheduler::SetThis() { t_scheduler = this; }
 
 Scheduler::~Scheduler() {
@@ -79,7 +101,8 @@ void Scheduler::Start() {
 
 bool Scheduler::Stopping() {
   MutexType::Lock lock(mutex_);
-  return stopping_ && tasks_.empty() && active_thread_count_ == 0;
+  return stopping_ && tasks_.empty() && pinned_count_ == 0 &&
+         active_thread_count_ == 0;
 }
 
 // 这里不做任何事，仅仅是忙等
@@ -108,13 +131,9 @@ void Scheduler::Stop() {
     ASSERT(GetThis() != this);
   }
 
-  // 唤醒每个调度线程
-  for (size_t i = 0; i < thread_count_; i++) {
-    Tickle();
-  }
-  // 如果调度器所在线程参与调度，则该操作很重要
-  if (root_fiber_) {
-    Tickle();
+  // 唤醒每个调度线程，如果调度器所在线程参与调度，也要唤醒它
+  for (size_t i = 0; i < local_tasks_.size(); i++) {
+    TickleThread(i);
   }
 
   // 在use caller情况下，调度器协程结束时，应该返回caller协程
@@ -143,50 +162,72 @@ void Scheduler::Run() {
     t_scheduler_fiber = serverframework::Fiber::GetThis().get();
   }
 
+  {
+    // Start持有锁直到所有线程创建完，这里thread_ids_已经完整
+    MutexType::Lock lock(mutex_);
+    t_thread_index = IndexOfThread(serverframework::GetThreadId());
+  }
+  ASSERT(t_thread_index >= 0);
+
   Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::Idle, this)));
   Fiber::ptr cb_fiber;
 
   ScheduleTask task;
+  std::vector<size_t> forward;
   while (true) {
     task.reset();
     bool tickle_me = false;  // 是否tickle其他线程进行任务调度
+    bool tickle_self = false;  // 本线程队列中的任务暂时不能执行，稍后再来
     {
       MutexType::Lock lock(mutex_);
-      auto it = tasks_.begin();
-      // 遍历所有调度任务
-      while (it != tasks_.end()) {
-        if (it->thread != -1 && it->thread != serverframework::GetThreadId()) {
-          // 指定了调度线程，但不是在当前线程上调度，标记一下需要通知其他线程进行调度，然后跳过这个任务，继续下一个
-          ++it;
-          tickle_me = true;
-          continue;
-        }
-
-        // 找到一个未指定线程，或是指定了当前线程的任务
-        ASSERT(it->fiber || it->cb);
-
-        // [BUG FIX]: hook
-        // IO相关的系统调用时，在检测到IO未就绪的情况下，会先添加对应的读写事件，再yield当前协程，等IO就绪后再resume当前协程
-        // 多线程高并发情境下，有可能发生刚添加事件就被触发的情况，如果此时当前协程还未来得及yield，则这里就有可能出现协程状态仍为RUNNING的情况
-        // 这里简单地跳过这种情况，以损失一点性能为代价，否则整个协程框架都要大改
-        if (it->fiber && it->fiber->GetState() == Fiber::RUNNING) {
-          ++it;
-          continue;
+      // [BUG FIX]: hook
+      // IO相关的系统调用时，在检测到IO未就绪的情况下，会先添加对应的读写事件，再yield当前协程，等IO就绪后再resume当前协程
+      // 多线程高并发情境下，有可能发生刚添加事件就被触发的情况，如果此时当前协程还未来得及yield，则这里就有可能出现协程状态仍为RUNNING的情况
+      // 这里简单地跳过这种情况，以损失一点性能为代价，否则整个协程框架都要大改。
+      // 协程yield之后，要等运行它的线程切换回调度协程，状态才会变为READY，在此之前同样跳过
+      auto take = [&](std::list<ScheduleTask> &queue, bool &skipped) {
+        for (auto it = queue.begin(); it != queue.end(); ++it) {
+          ASSERT(it->fiber || it->cb);
+          if (it->fiber && it->fiber->GetState() == Fiber::RUNNING) {
+            skipped = true;
+            continue;
+          }
+          task = *it;
+          queue.erase(it);
+          ++active_thread_count_;
+          return true;
         }
-
-        // 当前调度线程找到一个任务，准备开始调度，将其从任务队列中剔除，活动线程数加1
-        task = *it;
-        tasks_.erase(it++);
-        ++active_thread_count_;
-        break;
+        return false;
+      };
+      // 先取指定在本线程执行的任务，再取任意线程都可以执行的任务
+      std::list<ScheduleTask> &local = local_tasks_[t_thread_index];
+      if (take(local, tickle_self)) {
+        --pinned_count_;
+      } else {
+        take(tasks_, tickle_me);
       }
       // 当前线程拿完一个任务后，发现任务队列还有剩余，那么tickle一下其他线程
-      tickle_me |= (it != tasks_.end());
+      tickle_me |= !tasks_.empty();
+      // 不能只唤醒指定线程时，其他线程的任务可能被本线程收到的tickle消耗掉了，转告它们
+      if (!task.fiber && !task.cb && pinned_count_ > local.size()) {
+        for (size_t i = 0; i < local_tasks_.size(); ++i) {
+          if ((int)i != t_thread_index && !local_tasks_[i].empty()) {
+            forward.push_back(i);
+          }
+        }
+      }
     }
 
     if (tickle_me) {
       Tickle();
     }
+    if (tickle_self) {
+      TickleThread(t_thread_index);
+    }
+    for (size_t i : forward) {
+      TickleThread(i);
+    }
+    forward.clear();
 
     if (task.fiber) {
       // resume协程，resume返回时，协程要么执行完了，要么半路yield了，总之这个任务就算完成了，活跃线程数减一
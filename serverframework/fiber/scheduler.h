@@ -9,6 +9,7 @@
 #include <list>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "fiber/fiber.h"
 #include "log/log.h"
@@ -63,16 +64,49 @@ class Scheduler {
   template <class FiberOrCb>
   void Schedule(FiberOrCb fc, int thread = -1) {
     bool need_tickle = false;
+    int index = -1;
     {
       MutexType::Lock lock(mutex_);
-      need_tickle = ScheduleNoLock(fc, thread);
+      index = IndexOfThread(thread);
+      need_tickle = ScheduleNoLock(fc, index);
     }
 
     if (need_tickle) {
-      Tickle();  // 唤醒idle协程
+      // 唤醒idle协程，指定了线程的任务只唤醒该线程
+      if (index < 0) {
+        Tickle();
+      } else {
+        TickleThread(index);
+      }
     }
   }
 
+  /**
+   * @brief 批量添加调度任务，只加一次锁，最多唤醒一次
+   * @param[in] begin 任务数组的开始
+   * @param[in] end 任务数组的结束
+   */
+  template <class InputIterator>
+  void Schedule(InputIterator begin, InputIterator end) {
+    bool need_tickle = false;
+    {
+      MutexType::Lock lock(mutex_);
+      while (begin != end) {
+        need_tickle = ScheduleNoLock(*begin, -1) || need_tickle;
+        ++begin;
+      }
+    }
+
+    if (need_tickle) {
+      Tickle();
+    }
+  }
+
+  /**
+   * @brief 获取参与调度的线程id，use_caller时包括调度器所在线程
+   */
+  const std::vector<int> &GetThreadIds() const { return thread_ids_; }
+
   /**
    * @brief 启动调度器
    */
@@ -89,11 +123,23 @@ class Scheduler {
    */
   virtual void Tickle();
 
+  /**
+   * @brief 通知指定的调度线程有任务了
+   * @details 默认实现不能只唤醒某个线程，调用Tickle
+   * @param[in] index 线程在GetThreadIds()中的下标
+   */
+  virtual void TickleThread(size_t index) { Tickle(); }
+
   /**
    * @brief 协程调度函数
    */
   void Run();
 
+  /**
+   * @brief 当前线程在所属调度器GetThreadIds()中的下标，不是调度线程时返回-1
+   */
+  static int GetThreadIndex();
+
   /**
    * @brief 无任务调度时执行idle协程
    */
@@ -118,20 +164,40 @@ class Scheduler {
  private:
   /**
    * @brief 添加调度任务，无锁
+   * @details 指定了线程的任务放入该线程自己的队列，其他线程不需要跳过它们
    * @tparam FiberOrCb 调度任务类型，可以是协程对象或函数指针
    * @param[] fc 协程对象或指针
-   * @param[] thread 指定运行该任务的线程号，-1表示任意线程
+   * @param[] index 指定运行该任务的线程下标，-1表示任意线程
+   * @return 是否需要唤醒线程
    */
   template <class FiberOrCb>
-  bool ScheduleNoLock(FiberOrCb fc, int thread) {
-    bool need_tickle = tasks_.empty();
-    ScheduleTask task(fc, thread);
-    if (task.fiber || task.cb) {
-      tasks_.push_back(task);
+  bool ScheduleNoLock(FiberOrCb fc, int index) {
+    std::list<ScheduleTask> &queue = index < 0 ? tasks_ : local_tasks_[index];
+    bool need_tickle = queue.empty();
+    ScheduleTask task(fc, index);
+    if (!task.fiber && !task.cb) {
+      return need_tickle;
+    }
+    queue.push_back(task);
+    if (index < 0) {
+      return need_tickle;
     }
-    return need_tickle;
+    ++pinned_count_;
+    // 调度线程给自己投递的任务在回到调度循环时就会执行，不需要唤醒
+    return need_tickle && !IsCurrentThread(index);
   }
 
+  /**
+   * @brief 线程号在thread_ids_中的下标，不是本调度器的线程时返回-1
+   * @pre 已持有mutex_
+   */
+  int IndexOfThread(int thread) const;
+
+  /**
+   * @brief 当前线程是否是本调度器下标为index的线程
+   */
+  bool IsCurrentThread(int index) const;
+
  private:
   /**
    * @brief 调度任务，协程/函数二选一，可指定在哪个线程上调度
@@ -169,8 +235,12 @@ class Scheduler {
   MutexType mutex_;
   // 线程池
   std::vector<Thread::ptr> threads_;
-  // 任务队列
+  // 任务队列，没有指定线程的任务
   std::list<ScheduleTask> tasks_;
+  // 每个调度线程自己的任务队列，下标与thread_ids_一致
+  std::vector<std::list<ScheduleTask>> local_tasks_;
+  // 所有线程自己的队列中的任务总数
+  size_t pinned_count_ = 0;
   // 线程池的线程ID数组
   std::vector<int> thread_ids_;
   // 调度线程数量，这个值不包含调度器所在的线程
@@ -0,0 +1,220 @@
+#include "http/http.h"
+
+#include <stdio.h>
+
+namespace serverframework {
+
+static const char *s_method_names[] = {"GET",    "HEAD",    "POST", "PUT",
+                                       "DELETE", "OPTIONS", "PATCH"};
+
+HttpMethod StringToHttpMethod(const Slice &m) {
+  for (size_t i = 0; i < kHttpMethodCount; ++i) {
+    if (m.Equals(s_method_names[i])) {
+      return (HttpMethod)i;
+    }
+  }
+  return HttpMethod::INVALID;
+}
+
+const char *HttpMethodToString(HttpMethod m) {
+  size_t idx = (size_t)m;
+  return idx < kHttpMethodCount ? s_method_names[idx] : "<unknown>";
+}
+
+const char *HttpStatusToString(int status) {
+  switch (status) {
+    case 100: return "Continue";
+    case 200: return "OK";
+    case 201: return "Created";
+    case 204: return "No Content";
+    case 301: return "Moved Permanently";
+    case 302: return "Found";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 408: return "Request Timeout";
+    case 413: return "Payload Too Large";
+    case 414: return "URI Too Long";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    case 503: return "Service Unavailable";
+    case 505: return "HTTP Version Not Supported";
+    default: return "Unknown";
+  }
+}
+
+Slice HttpRequest::GetHeader(const char *name) const {
+  for (auto &header : headers_) {
+    if (header.name.EqualsIgnoreCase(name)) {
+      return header.value;
+    }
+  }
+  return Slice();
+}
+
+bool HttpRequest::HasHeader(const char *name) const {
+  for (auto &header : headers_) {
+    if (header.name.EqualsIgnoreCase(name)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string HttpRequest::GetBody() const {
+  std::string body;
+  body.reserve(body_size_);
+  for (auto &part : body_) {
+    body.append(part.data, part.size);
+  }
+  return body;
+}
+
+Slice HttpRequest::GetParam(const char *name) const {
+  for (auto &param : params_) {
+    if (param.first.Equals(name)) {
+      return param.second;
+    }
+  }
+  return Slice();
+}
+
+void HttpRequest::Reset() {
+  method_ = HttpMethod::INVALID;
+  path_ = Slice();
+  query_ = Slice();
+  version_ = 0x11;
+  headers_.clear();
+  keep_alive_ = true;
+  chunked_ = false;
+  content_length_ = 0;
+  body_.clear();
+  body_size_ = 0;
+  params_.clear();
+}
+
+void HttpResponse::SetHeader(const std::string &name,
+                             const std::string &value) {
+  for (auto &header : headers_) {
+    if (!strcasecmp(header.first.c_str(), name.c_str())) {
+      header.second = value;
+      return;
+    }
+  }
+  headers_.emplace_back(name, value);
+}
+
+void HttpResponse::AddChunk(std::string chunk) {
+  chunked_ = true;
+  // 空分块会被当成结束标记，直接丢掉
+  if (!chunk.empty()) {
+    chunks_.push_back(std::move(chunk));
+  }
+}
+
+void HttpResponse::Encode(uint8_t version, bool keep_alive, bool head,
+                          const char *date) {
+  char buf[64];
+  head_ = head;
+  head_buf_.clear();
+  head_buf_.append(version == 0x10 ? "HTTP/1.0 " : "HTTP/1.1 ");
+  snprintf(buf, sizeof(buf), "%d ", status_);
+  head_buf_.append(buf);
+  head_buf_.append(HttpStatusToString(status_));
+  head_buf_.append("\r\n");
+  for (auto &header : headers_) {
+    head_buf_.append(header.first);
+    head_buf_.append(": ");
+    head_buf_.append(header.second);
+    head_buf_.append("\r\n");
+  }
+  if (date) {
+    head_buf_.append("Date: ");
+    head_buf_.append(date);
+    head_buf_.append("\r\n");
+  }
+  // HTTP/1.0默认关闭连接，HTTP/1.1默认保持连接，只在和默认行为不同时写Connection
+  if (version == 0x10 && keep_alive) {
+    head_buf_.append("Connection: keep-alive\r\n");
+  } else if (version != 0x10 && !keep_alive) {
+    head_buf_.append("Connection: close\r\n");
+  }
+
+  // HTTP/1.0不支持chunked，合并成普通响应体
+  if (chunked_ && version == 0x10) {
+    for (auto &chunk : chunks_) {
+      body_.append(chunk);
+    }
+    chunks_.clear();
+    chunked_ = false;
+  }
+  chunk_buf_.clear();
+  chunk_offsets_.clear();
+  if (!chunked_) {
+    snprintf(buf, sizeof(buf), "Content-Length: %zu\r\n\r\n", body_.size());
+    head_buf_.append(buf);
+    return;
+  }
+  head_buf_.append("Transfer-Encoding: chunked\r\n\r\n");
+  // 第一个分块的长度行前没有CRLF，之后的长度行前是上一个分块的结尾CRLF
+  for (size_t i = 0; i < chunks_.size(); ++i) {
+    snprintf(buf, sizeof(buf), "%s%zx\r\n", i ? "\r\n" : "",
+             chunks_[i].size());
+    chunk_buf_.append(buf);
+    chunk_offsets_.push_back(chunk_buf_.size());
+  }
+  chunk_buf_.append(chunks_.empty() ? "0\r\n\r\n" : "\r\n0\r\n\r\n");
+}
+
+size_t HttpResponse::GetBuffers(std::vector<iovec> &iovs) const {
+  iovec iov;
+  iov.iov_base = (void *)head_buf_.data();
+  iov.iov_len = head_buf_.size();
+  iovs.push_back(iov);
+  size_t total = iov.iov_len;
+  if (head_) {
+    return total;
+  }
+  if (!chunked_) {
+    if (!body_.empty()) {
+      iov.iov_base = (void *)body_.data();
+      iov.iov_len = body_.size();
+      iovs.push_back(iov);
+      total += iov.iov_len;
+    }
+    return total;
+  }
+  size_t begin = 0;
+  for (size_t i = 0; i < chunks_.size(); ++i) {
+    iov.iov_base = (void *)(chunk_buf_.data() + begin);
+    iov.iov_len = chunk_offsets_[i] - begin;
+    iovs.push_back(iov);
+    iov.iov_base = (void *)chunks_[i].data();
+    iov.iov_len = chunks_[i].size();
+    iovs.push_back(iov);
+    total += chunk_offsets_[i] - begin + chunks_[i].size();
+    begin = chunk_offsets_[i];
+  }
+  iov.iov_base = (void *)(chunk_buf_.data() + begin);
+  iov.iov_len = chunk_buf_.size() - begin;
+  iovs.push_back(iov);
+  return total + iov.iov_len;
+}
+
+void HttpResponse::Reset() {
+  status_ = 200;
+  headers_.clear();
+  body_.clear();
+  chunks_.clear();
+  chunked_ = false;
+  close_ = false;
+  head_ = false;
+  head_buf_.clear();
+  chunk_buf_.clear();
+  chunk_offsets_.clear();
+}
+
+}  // namespace serverframework
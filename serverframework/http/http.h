@@ -0,0 +1,248 @@
+/**
+ * @file http.h
+ * @brief HTTP/1.1请求和响应
+ * @details 请求由HttpRequestParser解析，方法、路径和头部都是指向接收缓冲区的Slice，
+ *          只在请求处理期间有效，解析时不为每个头部分配std::string。响应由处理函数填写，
+ *          HttpServer把状态行和头部编码成一块连续内存，和响应体一起用writev发出
+ */
+#ifndef HTTP_H
+#define HTTP_H
+
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/uio.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace serverframework {
+
+/**
+ * @brief 不持有内存的字符串片段
+ */
+struct Slice {
+  Slice() {}
+  Slice(const char *d, size_t n) : data(d), size(n) {}
+
+  bool empty() const { return size == 0; }
+
+  std::string ToString() const { return std::string(data, size); }
+
+  /**
+   * @brief 是否等于以'\0'结尾的字符串
+   */
+  bool Equals(const char *str) const {
+    return strlen(str) == size && !memcmp(data, str, size);
+  }
+
+  /**
+   * @brief 忽略ASCII大小写比较
+   */
+  bool EqualsIgnoreCase(const char *str) const {
+    return strlen(str) == size && !strncasecmp(data, str, size);
+  }
+
+  const char *data = nullptr;
+  size_t size = 0;
+};
+
+/**
+ * @brief HTTP方法
+ */
+enum class HttpMethod : uint8_t {
+  GET = 0,
+  HEAD,
+  POST,
+  PUT,
+  DELETE,
+  OPTIONS,
+  PATCH,
+  INVALID
+};
+
+// 方法的个数，不包括INVALID
+static const size_t kHttpMethodCount = (size_t)HttpMethod::INVALID;
+
+/**
+ * @brief 方法名转成HttpMethod，不支持的方法返回INVALID
+ */
+HttpMethod StringToHttpMethod(const Slice &m);
+
+/**
+ * @brief HttpMethod转成方法名
+ */
+const char *HttpMethodToString(HttpMethod m);
+
+/**
+ * @brief 状态码对应的原因短语
+ */
+const char *HttpStatusToString(int status);
+
+/**
+ * @brief HTTP请求
+ */
+class HttpRequest {
+ public:
+  /**
+   * @brief 头部，名字和值都指向接收缓冲区
+   */
+  struct Header {
+    Slice name;
+    Slice value;
+  };
+
+  HttpMethod GetMethod() const { return method_; }
+
+  /**
+   * @brief 请求路径，不包括查询串，没有做百分号解码
+   */
+  const Slice &GetPath() const { return path_; }
+
+  /**
+   * @brief '?'之后的查询串
+   */
+  const Slice &GetQuery() const { return query_; }
+
+  /**
+   * @brief 版本号，0x11表示HTTP/1.1，0x10表示HTTP/1.0
+   */
+  uint8_t GetVersion() const { return version_; }
+
+  const std::vector<Header> &GetHeaders() const { return headers_; }
+
+  /**
+   * @brief 按名字(忽略大小写)取头部的值
+   * @return 没有这个头部时返回空Slice
+   */
+  Slice GetHeader(const char *name) const;
+
+  bool HasHeader(const char *name) const;
+
+  /**
+   * @brief 是否保持连接，取决于版本和Connection头部
+   */
+  bool IsKeepAlive() const { return keep_alive_; }
+
+  bool IsChunked() const { return chunked_; }
+
+  uint64_t GetContentLength() const { return content_length_; }
+
+  /**
+   * @brief 请求体的各段，指向接收缓冲区；chunked请求体是去掉分块格式后的数据
+   */
+  const std::vector<Slice> &GetBodyParts() const { return body_; }
+
+  /**
+   * @brief 请求体的长度
+   */
+  size_t GetBodySize() const { return body_size_; }
+
+  /**
+   * @brief 请求体拷贝成std::string
+   */
+  std::string GetBody() const;
+
+  /**
+   * @brief 路由匹配到的路径参数，例如/users/:id中的id
+   * @return 没有这个参数时返回空Slice
+   */
+  Slice GetParam(const char *name) const;
+
+  /**
+   * @brief 清空请求，保留容器的容量
+   */
+  void Reset();
+
+ private:
+  friend class HttpRequestParser;
+  friend class Router;
+
+  HttpMethod method_ = HttpMethod::INVALID;
+  Slice path_;
+  Slice query_;
+  uint8_t version_ = 0x11;
+  std::vector<Header> headers_;
+  bool keep_alive_ = true;
+  bool chunked_ = false;
+  uint64_t content_length_ = 0;
+  std::vector<Slice> body_;
+  size_t body_size_ = 0;
+  std::vector<std::pair<Slice, Slice>> params_;
+};
+
+/**
+ * @brief HTTP响应
+ * @details 没有调用AddChunk时按Content-Length发送响应体，调用后改为chunked分块发送
+ */
+class HttpResponse {
+ public:
+  int GetStatus() const { return status_; }
+  void SetStatus(int v) { status_ = v; }
+
+  /**
+   * @brief 添加头部，Content-Length、Transfer-Encoding、Connection和Date由服务器填写
+   */
+  void SetHeader(const std::string &name, const std::string &value);
+
+  /**
+   * @brief 设置响应体
+   */
+  void SetBody(std::string body) { body_ = std::move(body); }
+
+  const std::string &GetBody() const { return body_; }
+
+  /**
+   * @brief 追加一个分块，响应改为chunked编码
+   */
+  void AddChunk(std::string chunk);
+
+  bool IsChunked() const { return chunked_; }
+
+  /**
+   * @brief 处理完这个请求后关闭连接
+   */
+  void SetClose(bool v) { close_ = v; }
+
+  bool IsClose() const { return close_; }
+
+  /**
+   * @brief 编码状态行和头部，chunked时同时编码各分块的长度行
+   * @param[in] version 请求的版本号
+   * @param[in] keep_alive 是否保持连接
+   * @param[in] head 是否是HEAD请求，是时Flush不发响应体
+   * @param[in] date 当前时间的Date头部值
+   */
+  void Encode(uint8_t version, bool keep_alive, bool head, const char *date);
+
+  /**
+   * @brief 编码后的数据追加到iovs，指向响应自身的内存
+   * @return 字节数
+   */
+  size_t GetBuffers(std::vector<iovec> &iovs) const;
+
+  /**
+   * @brief 清空响应，保留字符串的容量
+   */
+  void Reset();
+
+ private:
+  int status_ = 200;
+  std::vector<std::pair<std::string, std::string>> headers_;
+  std::string body_;
+  std::vector<std::string> chunks_;
+  bool chunked_ = false;
+  bool close_ = false;
+  bool head_ = false;
+  // 编码后的状态行和头部
+  std::string head_buf_;
+  // chunked时各分块的长度行和结尾，连续存放
+  std::string chunk_buf_;
+  // 各分块长度行在chunk_buf_中的结束位置
+  std::vector<size_t> chunk_offsets_;
+};
+
+}  // namespace serverframework
+
+#endif
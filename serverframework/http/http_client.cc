@@ -0,0 +1,502 @@
+#include "http/http_client.h"
+
+#include <limits.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+
+#include "config/config.h"
+#include "env/mutex.h"
+#include "log/log.h"
+#include "util/clock.h"
+#include "util/macro.h"
+
+namespace serverframework {
+
+static serverframework::Logger::ptr g_logger = LOG_NAME("system");
+
+static serverframework::ConfigVar<uint64_t>::ptr g_http_client_timeout =
+    serverframework::Config::Lookup("http_client.timeout", (uint64_t)10000,
+                                    "http client request deadline in ms");
+
+static serverframework::ConfigVar<uint64_t>::ptr g_http_client_buffer_size =
+    serverframework::Config::Lookup(
+        "http_client.buffer_size", (uint64_t)(16 * 1024),
+        "http client receive buffer size, also the max response header size");
+
+// 剩余的响应体不超过这个大小时先读进接收缓冲区，顺带读入后面流水线响应的数据
+static const uint64_t kDirectReadSize = 4096;
+// 直接读进响应体时每次最多读取的字节数
+static const uint64_t kBodyReadSize = 64 * 1024;
+
+std::string HttpClientResponse::GetHeader(const std::string &name) const {
+  for (auto &header : headers_) {
+    if (!strcasecmp(header.first.c_str(), name.c_str())) {
+      return header.second;
+    }
+  }
+  return "";
+}
+
+std::string HttpClientResponse::GetBody() const {
+  return body_ ? body_->ToString() : "";
+}
+
+std::string HttpResult::ToString() const {
+  static const char *s_names[] = {"OK",        "CONNECT_FAIL", "SEND_FAIL",
+                                  "RECV_FAIL", "BAD_RESPONSE", "TIMEOUT"};
+  std::string str = s_names[result];
+  if (response) {
+    str += " " + std::to_string(response->GetStatus()) + " " +
+           response->GetReason();
+  }
+  return str;
+}
+
+HttpConnection::HttpConnection(Socket::ptr sock)
+    : sock_(sock), buffer_(g_http_client_buffer_size->GetValue()) {}
+
+bool HttpConnection::SendRequests(const HttpClientRequest *reqs, size_t count,
+                                  const std::string &host) {
+  std::string head;
+  std::vector<size_t> ends;
+  for (size_t i = 0; i < count; ++i) {
+    const HttpClientRequest &req = reqs[i];
+    head.append(HttpMethodToString(req.method));
+    head.append(" ");
+    head.append(req.path.empty() ? "/" : req.path);
+    head.append(" HTTP/1.1\r\nHost: ");
+    head.append(host);
+    head.append("\r\n");
+    for (auto &header : req.headers) {
+      head.append(header.first);
+      head.append(": ");
+      head.append(header.second);
+      head.append("\r\n");
+    }
+    if (!req.body.empty() || req.method == HttpMethod::POST ||
+        req.method == HttpMethod::PUT || req.method == HttpMethod::PATCH) {
+      head.append("Content-Length: ");
+      head.append(std::to_string(req.body.size()));
+      head.append("\r\n");
+    }
+    head.append("\r\n");
+    ends.push_back(head.size());
+  }
+
+  // 所有请求的头部连续存放，和各自的请求体交替组成iovec
+  std::vector<iovec> iovs;
+  size_t begin = 0;
+  for (size_t i = 0; i < count; ++i) {
+    iovec iov;
+    iov.iov_base = (void *)(head.data() + begin);
+    iov.iov_len = ends[i] - begin;
+    iovs.push_back(iov);
+    if (!reqs[i].body.empty()) {
+      iov.iov_base = (void *)reqs[i].body.data();
+      iov.iov_len = reqs[i].body.size();
+      iovs.push_back(iov);
+    }
+    begin = ends[i];
+  }
+  size_t idx = 0;
+  while (idx < iovs.size()) {
+    size_t n = std::min(iovs.size() - idx, (size_t)IOV_MAX);
+    int rt = sock_->send(&iovs[idx], n);
+    if (rt <= 0) {
+      return false;
+    }
+    size_t sent = rt;
+    while (sent && sent >= iovs[idx].iov_len) {
+      sent -= iovs[idx].iov_len;
+      ++idx;
+    }
+    if (sent) {
+      iovs[idx].iov_base = (char *)iovs[idx].iov_base + sent;
+      iovs[idx].iov_len -= sent;
+    }
+  }
+  return true;
+}
+
+int HttpConnection::Fill() {
+  if (begin_ == end_) {
+    begin_ = end_ = 0;
+  } else if (end_ == buffer_.size() && begin_) {
+    memmove(&buffer_[0], &buffer_[begin_], end_ - begin_);
+    end_ -= begin_;
+    begin_ = 0;
+  }
+  int rt = sock_->recv(&buffer_[end_], buffer_.size() - end_);
+  if (rt > 0) {
+    end_ += rt;
+  }
+  return rt;
+}
+
+int HttpConnection::ReadLine(std::string &line) {
+  while (true) {
+    const char *begin = buffer_.data() + begin_;
+    const char *p = (const char *)memmem(begin, end_ - begin_, "\r\n", 2);
+    if (p) {
+      line.assign(begin, p - begin);
+      begin_ += p - begin + 2;
+      return HttpResult::OK;
+    }
+    if (end_ - begin_ == buffer_.size()) {
+      return HttpResult::BAD_RESPONSE;
+    }
+    if (Fill() <= 0) {
+      return HttpResult::RECV_FAIL;
+    }
+  }
+}
+
+int HttpConnection::ReadBody(ByteArray::ptr body, uint64_t length) {
+  while (length) {
+    uint64_t n = std::min(length, (uint64_t)(end_ - begin_));
+    if (n) {
+      body->write(&buffer_[begin_], n);
+      begin_ += n;
+      length -= n;
+      continue;
+    }
+    if (length <= kDirectReadSize) {
+      if (Fill() <= 0) {
+        return HttpResult::RECV_FAIL;
+      }
+      continue;
+    }
+    // 只读剩余的长度，不会读到下一个响应的数据
+    std::vector<iovec> iovs;
+    size_t pos = body->GetPosition();
+    body->GetWriteBuffers(iovs, std::min(length, kBodyReadSize));
+    int rt = sock_->recv(&iovs[0], iovs.size());
+    if (rt <= 0) {
+      return HttpResult::RECV_FAIL;
+    }
+    body->SetPosition(pos + rt);
+    length -= rt;
+  }
+  return HttpResult::OK;
+}
+
+int HttpConnection::ParseHead(HttpClientResponse &rsp, const char *begin,
+                              const char *end) {
+  const char *eol = (const char *)memmem(begin, end - begin, "\r\n", 2);
+  if (!eol) {
+    eol = end;
+  }
+  // HTTP/1.x SSS reason
+  if (eol - begin < 12 || memcmp(begin, "HTTP/1.", 7) ||
+      (begin[7] != '0' && begin[7] != '1') || begin[8] != ' ') {
+    return HttpResult::BAD_RESPONSE;
+  }
+  rsp.version_ = begin[7] == '1' ? 0x11 : 0x10;
+  rsp.status_ = 0;
+  for (int i = 9; i < 12; ++i) {
+    if (begin[i] < '0' || begin[i] > '9') {
+      return HttpResult::BAD_RESPONSE;
+    }
+    rsp.status_ = rsp.status_ * 10 + begin[i] - '0';
+  }
+  rsp.reason_.assign(begin + std::min((long)(eol - begin), 13L), eol);
+  rsp.headers_.clear();
+  rsp.keep_alive_ = rsp.version_ == 0x11;
+
+  const char *line = eol + 2;
+  while (line < end) {
+    eol = (const char *)memmem(line, end - line, "\r\n", 2);
+    if (!eol) {
+      eol = end;
+    }
+    const char *colon = (const char *)memchr(line, ':', eol - line);
+    if (!colon || colon == line) {
+      return HttpResult::BAD_RESPONSE;
+    }
+    const char *value = colon + 1;
+    const char *value_end = eol;
+    while (value < value_end && (*value == ' ' || *value == '\t')) {
+      ++value;
+    }
+    while (value_end > value &&
+           (value_end[-1] == ' ' || value_end[-1] == '\t')) {
+      --value_end;
+    }
+    rsp.headers_.emplace_back(std::string(line, colon),
+                              std::string(value, value_end));
+    const std::string &v = rsp.headers_.back().second;
+    if (colon - line == 10 && !strncasecmp(line, "connection", 10)) {
+      if (!strcasecmp(v.c_str(), "close")) {
+        rsp.keep_alive_ = false;
+      } else if (!strcasecmp(v.c_str(), "keep-alive")) {
+        rsp.keep_alive_ = true;
+      }
+    }
+    line = eol + 2;
+  }
+  return HttpResult::OK;
+}
+
+int HttpConnection::RecvResponse(HttpClientResponse &rsp, bool head) {
+  while (true) {
+    const char *end;
+    while (!(end = (const char *)memmem(buffer_.data() + begin_, end_ - begin_,
+                                        "\r\n\r\n", 4))) {
+      if (end_ - begin_ == buffer_.size()) {
+        return HttpResult::BAD_RESPONSE;
+      }
+      if (Fill() <= 0) {
+        return HttpResult::RECV_FAIL;
+      }
+    }
+    int rt = ParseHead(rsp, buffer_.data() + begin_, end);
+    if (rt != HttpResult::OK) {
+      return rt;
+    }
+    begin_ = end + 4 - buffer_.data();
+    // 100 Continue等中间响应之后还有最终响应
+    if (rsp.status_ >= 200 || rsp.status_ == 101) {
+      break;
+    }
+  }
+
+  rsp.body_.reset(new ByteArray);
+  int rt = HttpResult::OK;
+  std::string encoding = rsp.GetHeader("Transfer-Encoding");
+  std::string length = rsp.GetHeader("Content-Length");
+  if (head || rsp.status_ == 204 || rsp.status_ == 304) {
+    // 没有响应体
+  } else if (encoding.size() >= 7 &&
+             !strcasecmp(encoding.c_str() + encoding.size() - 7, "chunked")) {
+    std::string line;
+    while ((rt = ReadLine(line)) == HttpResult::OK) {
+      char *p = nullptr;
+      uint64_t size = strtoull(line.c_str(), &p, 16);
+      if (p == line.c_str()) {
+        return HttpResult::BAD_RESPONSE;
+      }
+      if (!size) {
+        // 跳过trailer直到空行
+        while ((rt = ReadLine(line)) == HttpResult::OK && !line.empty()) {
+        }
+        break;
+      }
+      if ((rt = ReadBody(rsp.body_, size)) != HttpResult::OK ||
+          (rt = ReadLine(line)) != HttpResult::OK) {
+        break;
+      }
+      if (!line.empty()) {
+        return HttpResult::BAD_RESPONSE;
+      }
+    }
+  } else if (!length.empty()) {
+    char *p = nullptr;
+    uint64_t size = strtoull(length.c_str(), &p, 10);
+    if (*p) {
+      return HttpResult::BAD_RESPONSE;
+    }
+    rt = ReadBody(rsp.body_, size);
+  } else {
+    // 没有长度的响应体读到连接关闭为止
+    rsp.keep_alive_ = false;
+    if (end_ > begin_) {
+      rsp.body_->write(&buffer_[begin_], end_ - begin_);
+      begin_ = end_;
+    }
+    while (true) {
+      std::vector<iovec> iovs;
+      size_t pos = rsp.body_->GetPosition();
+      rsp.body_->GetWriteBuffers(iovs, kBodyReadSize);
+      int n = sock_->recv(&iovs[0], iovs.size());
+      if (n < 0) {
+        return HttpResult::RECV_FAIL;
+      }
+      if (n == 0) {
+        break;
+      }
+      rsp.body_->SetPosition(pos + n);
+    }
+  }
+  rsp.body_->SetPosition(0);
+  return rt;
+}
+
+HttpClient::HttpClient(Address::ptr addr, SocketPool *pool)
+    : addr_(addr), host_(addr->ToString()), pool_(pool) {
+  if (!pool_) {
+    own_pool_.reset(new SocketPool);
+    pool_ = own_pool_.get();
+  }
+}
+
+/**
+ * @brief 一次调用的截止时间
+ */
+struct HttpDeadline {
+  Mutex mutex;
+  int fd = -1;
+  // 调用已经结束，定时器不能再操作fd
+  bool done = false;
+  bool timed_out = false;
+};
+
+void HttpClient::Execute(const HttpClientRequest *reqs, size_t count,
+                         uint64_t timeout_ms, HttpResult *results) {
+  uint64_t timeout = timeout_ms == (uint64_t)-1
+                         ? g_http_client_timeout->GetValue()
+                         : timeout_ms;
+  uint64_t start = Clock::NowMS();
+  Socket::ptr sock = pool_->Checkout(addr_, timeout);
+  if (!sock) {
+    std::fill(results, results + count, HttpResult(HttpResult::CONNECT_FAIL));
+    return;
+  }
+  uint64_t elapsed = Clock::NowMS() - start;
+  if (elapsed >= timeout) {
+    std::fill(results, results + count, HttpResult(HttpResult::TIMEOUT));
+    return;
+  }
+
+  // 到期时关闭连接的读写，阻塞在recv/send上的协程随即返回
+  std::shared_ptr<HttpDeadline> deadline(new HttpDeadline);
+  deadline->fd = sock->GetSocket();
+  Timer::ptr timer;
+  IOManager *iom = IOManager::GetThis();
+  if (iom) {
+    timer = iom->AddTimer(timeout - elapsed, [deadline]() {
+      Mutex::Lock lock(deadline->mutex);
+      if (!deadline->done) {
+        deadline->timed_out = true;
+        ::shutdown(deadline->fd, SHUT_RDWR);
+      }
+    });
+  }
+
+  HttpConnection conn(sock);
+  bool reuse = conn.SendRequests(reqs, count, host_);
+  if (!reuse) {
+    std::fill(results, results + count, HttpResult(HttpResult::SEND_FAIL));
+  }
+  for (size_t i = 0; reuse && i < count; ++i) {
+    HttpClientResponse::ptr rsp(new HttpClientResponse);
+    int rt = conn.RecvResponse(*rsp, reqs[i].method == HttpMethod::HEAD);
+    if (rt != HttpResult::OK) {
+      std::fill(results + i, results + count, HttpResult(rt));
+      reuse = false;
+      break;
+    }
+    results[i] = HttpResult(HttpResult::OK, rsp);
+    if (!rsp->IsKeepAlive()) {
+      std::fill(results + i + 1, results + count,
+                HttpResult(HttpResult::RECV_FAIL));
+      reuse = false;
+    }
+  }
+
+  bool timed_out;
+  {
+    Mutex::Lock lock(deadline->mutex);
+    deadline->done = true;
+    timed_out = deadline->timed_out;
+  }
+  if (timer) {
+    timer->Cancel();
+  }
+  if (timed_out) {
+    for (size_t i = 0; i < count; ++i) {
+      if (!results[i].ok()) {
+        results[i].result = HttpResult::TIMEOUT;
+      }
+    }
+    reuse = false;
+  }
+  // 状态不确定的连接不归还
+  if (!reuse || conn.HasBuffered()) {
+    sock->close();
+  }
+}
+
+HttpResult HttpClient::Do(const HttpClientRequest &req, uint64_t timeout_ms) {
+  HttpResult result;
+  Execute(&req, 1, timeout_ms, &result);
+  return result;
+}
+
+HttpResult HttpClient::Get(const std::string &path, uint64_t timeout_ms) {
+  return Do(HttpClientRequest(HttpMethod::GET, path), timeout_ms);
+}
+
+HttpResult HttpClient::Post(const std::string &path, std::string body,
+                            uint64_t timeout_ms) {
+  return Do(HttpClientRequest(HttpMethod::POST, path, std::move(body)),
+            timeout_ms);
+}
+
+std::vector<HttpResult> HttpClient::Pipeline(
+    const std::vector<HttpClientRequest> &reqs, uint64_t timeout_ms) {
+  std::vector<HttpResult> results(reqs.size());
+  if (!reqs.empty()) {
+    Execute(&reqs[0], reqs.size(), timeout_ms, &results[0]);
+  }
+  return results;
+}
+
+/**
+ * @brief FanOut的共享状态
+ */
+struct HttpFanOut {
+  Mutex mutex;
+  // 下一个要发送的请求
+  size_t next = 0;
+  // 还在运行的工作协程数
+  size_t running = 0;
+  Scheduler *scheduler = nullptr;
+  Fiber::ptr fiber;
+  int thread = -1;
+};
+
+std::vector<HttpResult> HttpClient::FanOut(
+    const std::vector<HttpClientRequest> &reqs, size_t concurrency,
+    uint64_t timeout_ms) {
+  std::vector<HttpResult> results(reqs.size());
+  if (reqs.empty()) {
+    return results;
+  }
+  IOManager *iom = IOManager::GetThis();
+  ASSERT(iom);
+  size_t workers = concurrency ? std::min(concurrency, reqs.size())
+                               : reqs.size();
+  std::shared_ptr<HttpFanOut> state(new HttpFanOut);
+  state->running = workers;
+  state->scheduler = Scheduler::GetThis();
+  state->fiber = Fiber::GetThis();
+  state->thread = iom->GetAffinityThread();
+  // 工作协程依次领取请求，最后一个结束的唤醒调用者；
+  // 调用者等到全部结束才返回，工作协程可以引用reqs和results
+  auto worker = [this, state, &reqs, &results, timeout_ms]() {
+    while (true) {
+      size_t idx;
+      {
+        Mutex::Lock lock(state->mutex);
+        idx = state->next++;
+      }
+      if (idx >= reqs.size()) {
+        break;
+      }
+      results[idx] = Do(reqs[idx], timeout_ms);
+    }
+    Mutex::Lock lock(state->mutex);
+    if (--state->running == 0) {
+      state->scheduler->Schedule(state->fiber, state->thread);
+    }
+  };
+  for (size_t i = 0; i < workers; ++i) {
+    iom->Schedule(worker);
+  }
+  Fiber::GetThis()->Yield();
+  return results;
+}
+
+}  // namespace serverframework
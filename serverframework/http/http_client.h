@@ -0,0 +1,245 @@
+/**
+ * @file http_client.h
+ * @brief 协程HTTP/1.1客户端
+ * @details 建立在hook过的Socket之上，等待网络时只让出协程，不阻塞调度线程。
+ *          连接从SocketPool借出，响应允许保持连接时归还复用；同一连接上可以流水线发送多个请求；
+ *          响应体直接读进ByteArray；每次调用有一个总的截止时间，到期由定时器关闭连接上的读写
+ */
+#ifndef HTTP_CLIENT_H
+#define HTTP_CLIENT_H
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "http/http.h"
+#include "net/socket_pool.h"
+#include "util/bytearray.h"
+
+namespace serverframework {
+
+/**
+ * @brief 客户端请求
+ */
+struct HttpClientRequest {
+  HttpClientRequest(HttpMethod m = HttpMethod::GET,
+                    const std::string &p = "/", std::string b = "")
+      : method(m), path(p), body(std::move(b)) {}
+
+  /**
+   * @brief 添加头部，Host、Content-Length和Connection由客户端填写
+   */
+  void SetHeader(const std::string &name, const std::string &value) {
+    headers.emplace_back(name, value);
+  }
+
+  HttpMethod method;
+  // 路径，可以带查询串
+  std::string path;
+  std::vector<std::pair<std::string, std::string>> headers;
+  std::string body;
+};
+
+/**
+ * @brief 客户端收到的响应
+ */
+class HttpClientResponse {
+ public:
+  using ptr = std::shared_ptr<HttpClientResponse>;
+
+  int GetStatus() const { return status_; }
+  const std::string &GetReason() const { return reason_; }
+
+  /**
+   * @brief 版本号，0x11表示HTTP/1.1，0x10表示HTTP/1.0
+   */
+  uint8_t GetVersion() const { return version_; }
+
+  const std::vector<std::pair<std::string, std::string>> &GetHeaders() const {
+    return headers_;
+  }
+
+  /**
+   * @brief 按名字(忽略大小写)取头部的值，没有时返回空字符串
+   */
+  std::string GetHeader(const std::string &name) const;
+
+  /**
+   * @brief 响应体，读位置在开头；chunked响应体是去掉分块格式后的数据
+   */
+  ByteArray::ptr GetBodyData() const { return body_; }
+
+  /**
+   * @brief 响应体拷贝成std::string
+   */
+  std::string GetBody() const;
+
+  /**
+   * @brief 服务器是否允许保持连接
+   */
+  bool IsKeepAlive() const { return keep_alive_; }
+
+ private:
+  friend class HttpConnection;
+
+  int status_ = 0;
+  std::string reason_;
+  uint8_t version_ = 0x11;
+  std::vector<std::pair<std::string, std::string>> headers_;
+  ByteArray::ptr body_;
+  bool keep_alive_ = true;
+};
+
+/**
+ * @brief 一次请求的结果
+ */
+struct HttpResult {
+  enum Error {
+    OK = 0,
+    // 建立连接失败或等待空闲连接超时
+    CONNECT_FAIL,
+    // 发送请求失败
+    SEND_FAIL,
+    // 接收响应失败或连接被提前关闭
+    RECV_FAIL,
+    // 响应格式错误
+    BAD_RESPONSE,
+    // 超过截止时间
+    TIMEOUT
+  };
+
+  HttpResult(int r = OK, HttpClientResponse::ptr rsp = nullptr)
+      : result(r), response(rsp) {}
+
+  bool ok() const { return result == OK; }
+
+  std::string ToString() const;
+
+  int result;
+  HttpClientResponse::ptr response;
+};
+
+/**
+ * @brief 客户端一侧的HTTP连接
+ * @details 有自己的接收缓冲区，头部从缓冲区解析，响应体按剩余长度直接recv进ByteArray
+ */
+class HttpConnection {
+ public:
+  explicit HttpConnection(Socket::ptr sock);
+
+  /**
+   * @brief 用一次writev发出一批请求
+   * @param[in] host Host头部的值
+   */
+  bool SendRequests(const HttpClientRequest *reqs, size_t count,
+                    const std::string &host);
+
+  /**
+   * @brief 接收一个响应，跳过1xx中间响应
+   * @param[in] head 是否是HEAD请求的响应，是时没有响应体
+   * @return HttpResult::Error
+   */
+  int RecvResponse(HttpClientResponse &rsp, bool head);
+
+  /**
+   * @brief 接收缓冲区中是否还有没有解析的数据
+   */
+  bool HasBuffered() const { return begin_ != end_; }
+
+  Socket::ptr GetSocket() const { return sock_; }
+
+ private:
+  /**
+   * @brief 接收缓冲区中没有完整的行或头部时继续读取
+   * @return 读到的字节数，对端关闭返回0，出错返回-1
+   */
+  int Fill();
+
+  /**
+   * @brief 从接收缓冲区取出一行，不包括CRLF
+   */
+  int ReadLine(std::string &line);
+
+  /**
+   * @brief 读取length字节的响应体，先取接收缓冲区中的，剩下的直接读进body
+   */
+  int ReadBody(ByteArray::ptr body, uint64_t length);
+
+  /**
+   * @brief 解析状态行和头部
+   */
+  int ParseHead(HttpClientResponse &rsp, const char *begin, const char *end);
+
+ private:
+  Socket::ptr sock_;
+  std::vector<char> buffer_;
+  size_t begin_ = 0;
+  size_t end_ = 0;
+};
+
+/**
+ * @brief 访问一个目标地址的HTTP客户端，可以被多个协程同时使用
+ */
+class HttpClient {
+ public:
+  using ptr = std::shared_ptr<HttpClient>;
+
+  /**
+   * @brief 构造函数
+   * @param[in] addr 目标地址
+   * @param[in] pool 连接池，为空时使用客户端自己的连接池，必须比客户端活得更久
+   */
+  explicit HttpClient(Address::ptr addr, SocketPool *pool = nullptr);
+
+  /**
+   * @brief 设置Host头部，默认是目标地址
+   */
+  void SetHost(const std::string &v) { host_ = v; }
+  const std::string &GetHost() const { return host_; }
+
+  /**
+   * @brief 发送一个请求并等待响应
+   * @param[in] timeout_ms 截止时间，包括等待连接、发送和接收，-1表示使用http_client.timeout
+   */
+  HttpResult Do(const HttpClientRequest &req, uint64_t timeout_ms = -1);
+
+  HttpResult Get(const std::string &path, uint64_t timeout_ms = -1);
+
+  HttpResult Post(const std::string &path, std::string body,
+                  uint64_t timeout_ms = -1);
+
+  /**
+   * @brief 在同一个连接上流水线发送一批请求，一次writev发出后按顺序接收响应
+   * @details 服务器在中途关闭连接时，之后的请求返回RECV_FAIL
+   */
+  std::vector<HttpResult> Pipeline(const std::vector<HttpClientRequest> &reqs,
+                                   uint64_t timeout_ms = -1);
+
+  /**
+   * @brief 并发发送一批请求，每个请求一个协程、各自借一个连接，全部完成后返回
+   * @param[in] concurrency 最多同时进行的请求数，0表示不限制
+   */
+  std::vector<HttpResult> FanOut(const std::vector<HttpClientRequest> &reqs,
+                                 size_t concurrency = 0,
+                                 uint64_t timeout_ms = -1);
+
+  SocketPool *GetPool() const { return pool_; }
+
+ private:
+  /**
+   * @brief 在一个连接上发送count个请求，结果写入results
+   */
+  void Execute(const HttpClientRequest *reqs, size_t count,
+               uint64_t timeout_ms, HttpResult *results);
+
+ private:
+  Address::ptr addr_;
+  std::string host_;
+  std::unique_ptr<SocketPool> own_pool_;
+  SocketPool *pool_;
+};
+
+}  // namespace serverframework
+
+#endif
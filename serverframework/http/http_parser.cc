@@ -0,0 +1,480 @@
+#include "http/http_parser.h"
+
+#include <algorithm>
+
+#include "config/config.h"
+
+namespace serverframework {
+
+static serverframework::ConfigVar<uint64_t>::ptr g_http_max_header_size =
+    serverframework::Config::Lookup("http.max_header_size",
+                                    (uint64_t)(16 * 1024),
+                                    "max size of http request line and headers");
+
+static serverframework::ConfigVar<uint64_t>::ptr g_http_max_body_size =
+    serverframework::Config::Lookup("http.max_body_size",
+                                    (uint64_t)(8 * 1024 * 1024),
+                                    "max size of http request body");
+
+static inline bool IsControl(char c) {
+  return (unsigned char)c <= 0x20 || c == 0x7f;
+}
+
+static inline int HexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  c |= 0x20;
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  return -1;
+}
+
+/**
+ * @brief 逗号分隔的列表中是否有token，忽略大小写
+ */
+static bool HasToken(const Slice &value, const char *token) {
+  size_t len = strlen(token);
+  size_t i = 0;
+  while (i < value.size) {
+    while (i < value.size && (value.data[i] == ' ' || value.data[i] == '\t' ||
+                              value.data[i] == ',')) {
+      ++i;
+    }
+    size_t begin = i;
+    while (i < value.size && value.data[i] != ',') {
+      ++i;
+    }
+    size_t end = i;
+    while (end > begin &&
+           (value.data[end - 1] == ' ' || value.data[end - 1] == '\t')) {
+      --end;
+    }
+    if (end - begin == len && !strncasecmp(value.data + begin, token, len)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+HttpRequestParser::HttpRequestParser(size_t max_header_size,
+                                     uint64_t max_body_size)
+    : max_header_size_(max_header_size ? max_header_size
+                                       : g_http_max_header_size->GetValue()),
+      max_body_size_(max_body_size ? max_body_size
+                                   : g_http_max_body_size->GetValue()),
+      arena_(max_header_size_) {}
+
+void HttpRequestParser::Reset() {
+  state_ = METHOD;
+  error_ = 0;
+  request_.Reset();
+  header_size_ = 0;
+  in_token_ = false;
+  token_ = nullptr;
+  spilled_ = false;
+  spill_begin_ = 0;
+  arena_used_ = 0;
+  name_ = Slice();
+  remaining_ = 0;
+  chunk_digits_ = 0;
+  has_length_ = false;
+  expect_continue_ = false;
+}
+
+bool HttpRequestParser::TakeExpectContinue() {
+  bool rt = expect_continue_ && request_.body_size_ == 0 && state_ != DONE;
+  expect_continue_ = false;
+  return rt;
+}
+
+bool HttpRequestParser::Spill(const char *end) {
+  size_t n = end - token_;
+  if (!spilled_) {
+    spilled_ = true;
+    spill_begin_ = arena_used_;
+  }
+  if (arena_used_ + n > arena_.size()) {
+    return false;
+  }
+  memcpy(arena_.data() + arena_used_, token_, n);
+  arena_used_ += n;
+  return true;
+}
+
+bool HttpRequestParser::EndToken(const char *p, Slice &out) {
+  if (!in_token_) {
+    out = Slice();
+    return true;
+  }
+  in_token_ = false;
+  if (!spilled_) {
+    out = Slice(token_, p - token_);
+    return true;
+  }
+  // 片段跨越了输入，把剩下的部分也拷到缓存，拼成连续的内存
+  if (!Spill(p)) {
+    return false;
+  }
+  spilled_ = false;
+  out = Slice(arena_.data() + spill_begin_, arena_used_ - spill_begin_);
+  return true;
+}
+
+bool HttpRequestParser::OnHeader(Slice value) {
+  while (value.size && (value.data[value.size - 1] == ' ' ||
+                        value.data[value.size - 1] == '\t')) {
+    --value.size;
+  }
+  HttpRequest::Header header = {name_, value};
+  request_.headers_.push_back(header);
+  if (name_.EqualsIgnoreCase("content-length")) {
+    if (value.empty()) {
+      Fail(400);
+      return false;
+    }
+    uint64_t length = 0;
+    for (size_t i = 0; i < value.size; ++i) {
+      char c = value.data[i];
+      if (c < '0' || c > '9') {
+        Fail(400);
+        return false;
+      }
+      if (length > (UINT64_MAX - 9) / 10) {
+        Fail(413);
+        return false;
+      }
+      length = length * 10 + (c - '0');
+    }
+    // 多个不一致的Content-Length可能是请求走私
+    if (has_length_ && length != request_.content_length_) {
+      Fail(400);
+      return false;
+    }
+    has_length_ = true;
+    request_.content_length_ = length;
+  } else if (name_.EqualsIgnoreCase("transfer-encoding")) {
+    // 只支持chunked作为最后一个编码
+    if (value.size < 7 ||
+        strncasecmp(value.data + value.size - 7, "chunked", 7)) {
+      Fail(501);
+      return false;
+    }
+    request_.chunked_ = true;
+  } else if (name_.EqualsIgnoreCase("connection")) {
+    if (HasToken(value, "close")) {
+      request_.keep_alive_ = false;
+    } else if (HasToken(value, "keep-alive")) {
+      request_.keep_alive_ = true;
+    }
+  } else if (name_.EqualsIgnoreCase("expect")) {
+    expect_continue_ = request_.version_ == 0x11 &&
+                       value.EqualsIgnoreCase("100-continue");
+  }
+  return true;
+}
+
+bool HttpRequestParser::OnHeadersComplete() {
+  if (request_.chunked_) {
+    // 同时带有Transfer-Encoding时忽略Content-Length
+    request_.content_length_ = 0;
+    remaining_ = 0;
+    chunk_digits_ = 0;
+    state_ = CHUNK_SIZE;
+    return true;
+  }
+  if (request_.content_length_ > max_body_size_) {
+    Fail(413);
+    return false;
+  }
+  if (request_.content_length_) {
+    remaining_ = request_.content_length_;
+    state_ = BODY;
+  } else {
+    expect_continue_ = false;
+    state_ = DONE;
+  }
+  return true;
+}
+
+bool HttpRequestParser::OnChunkSize() {
+  chunk_digits_ = 0;
+  if (!remaining_) {
+    state_ = TRAILER_START;
+    return true;
+  }
+  if (request_.body_size_ + remaining_ > max_body_size_) {
+    Fail(413);
+    return false;
+  }
+  state_ = CHUNK_DATA;
+  return true;
+}
+
+size_t HttpRequestParser::ReadBody(const char *p, const char *end) {
+  size_t n = std::min(remaining_, (uint64_t)(end - p));
+  request_.body_.push_back(Slice(p, n));
+  request_.body_size_ += n;
+  remaining_ -= n;
+  return n;
+}
+
+int HttpRequestParser::Execute(const char *data, size_t length) {
+  if (state_ == DONE) {
+    return 0;
+  }
+  const char *p = data;
+  const char *end = data + length;
+  // 上一段输入结束时还在片段中间，片段在本段的部分从头开始
+  if (in_token_) {
+    token_ = data;
+  }
+  while (p < end) {
+    char c = *p;
+    if ((state_ <= HEADERS_END_LF || state_ == CHUNK_EXT ||
+         state_ >= TRAILER_START) &&
+        ++header_size_ > max_header_size_) {
+      return Fail(431);
+    }
+    switch (state_) {
+      case METHOD:
+        if (!in_token_) {
+          // 请求之间多余的空行
+          if (c == '\r' || c == '\n') {
+            --header_size_;
+            break;
+          }
+          StartToken(p);
+        }
+        if (c == ' ') {
+          Slice method;
+          if (!EndToken(p, method)) {
+            return Fail(431);
+          }
+          request_.method_ = StringToHttpMethod(method);
+          if (request_.method_ == HttpMethod::INVALID) {
+            return Fail(501);
+          }
+          state_ = PATH;
+        } else if (c < 'A' || c > 'Z') {
+          return Fail(400);
+        }
+        break;
+      case PATH:
+        if (!in_token_) {
+          StartToken(p);
+        }
+        if (c == ' ' || c == '?') {
+          if (!EndToken(p, request_.path_)) {
+            return Fail(431);
+          }
+          if (request_.path_.empty()) {
+            return Fail(400);
+          }
+          state_ = c == ' ' ? VERSION : QUERY;
+        } else if (IsControl(c)) {
+          return Fail(400);
+        }
+        break;
+      case QUERY:
+        if (!in_token_) {
+          StartToken(p);
+        }
+        if (c == ' ') {
+          if (!EndToken(p, request_.query_)) {
+            return Fail(431);
+          }
+          state_ = VERSION;
+        } else if (IsControl(c)) {
+          return Fail(400);
+        }
+        break;
+      case VERSION:
+        if (!in_token_) {
+          StartToken(p);
+        }
+        if (c == '\r' || c == '\n') {
+          Slice version;
+          if (!EndToken(p, version)) {
+            return Fail(431);
+          }
+          if (version.Equals("HTTP/1.1")) {
+            request_.version_ = 0x11;
+            request_.keep_alive_ = true;
+          } else if (version.Equals("HTTP/1.0")) {
+            request_.version_ = 0x10;
+            request_.keep_alive_ = false;
+          } else if (version.size == 8 && !memcmp(version.data, "HTTP/", 5)) {
+            return Fail(505);
+          } else {
+            return Fail(400);
+          }
+          state_ = c == '\r' ? REQUEST_LF : HEADER_START;
+        }
+        break;
+      case REQUEST_LF:
+      case HEADER_LF:
+        if (c != '\n') {
+          return Fail(400);
+        }
+        state_ = HEADER_START;
+        break;
+      case HEADER_START:
+        if (c == '\r') {
+          state_ = HEADERS_END_LF;
+        } else if (c == '\n') {
+          if (!OnHeadersComplete()) {
+            return -1;
+          }
+        } else if (IsControl(c) || c == ':') {
+          // 不支持已废弃的续行
+          return Fail(400);
+        } else {
+          StartToken(p);
+          state_ = HEADER_NAME;
+        }
+        break;
+      case HEADER_NAME:
+        if (c == ':') {
+          if (!EndToken(p, name_)) {
+            return Fail(431);
+          }
+          state_ = HEADER_VALUE_START;
+        } else if (IsControl(c)) {
+          return Fail(400);
+        }
+        break;
+      case HEADER_VALUE_START:
+        if (c == ' ' || c == '\t') {
+          break;
+        }
+        if (c == '\r' || c == '\n') {
+          if (!OnHeader(Slice())) {
+            return -1;
+          }
+          state_ = c == '\r' ? HEADER_LF : HEADER_START;
+          break;
+        }
+        StartToken(p);
+        state_ = HEADER_VALUE;
+        break;
+      case HEADER_VALUE:
+        if (c == '\r' || c == '\n') {
+          Slice value;
+          if (!EndToken(p, value)) {
+            return Fail(431);
+          }
+          if (!OnHeader(value)) {
+            return -1;
+          }
+          state_ = c == '\r' ? HEADER_LF : HEADER_START;
+        } else if (c == '\0') {
+          return Fail(400);
+        }
+        break;
+      case HEADERS_END_LF:
+        if (c != '\n') {
+          return Fail(400);
+        }
+        if (!OnHeadersComplete()) {
+          return -1;
+        }
+        break;
+      case BODY:
+        p += ReadBody(p, end) - 1;
+        if (!remaining_) {
+          state_ = DONE;
+        }
+        break;
+      case CHUNK_SIZE: {
+        int v = HexValue(c);
+        if (v >= 0) {
+          if (++chunk_digits_ > 15) {
+            return Fail(413);
+          }
+          remaining_ = remaining_ * 16 + v;
+        } else if (!chunk_digits_) {
+          return Fail(400);
+        } else if (c == ';' || c == ' ' || c == '\t') {
+          state_ = CHUNK_EXT;
+        } else if (c == '\r') {
+          state_ = CHUNK_SIZE_LF;
+        } else if (c == '\n') {
+          if (!OnChunkSize()) {
+            return -1;
+          }
+        } else {
+          return Fail(400);
+        }
+        break;
+      }
+      case CHUNK_EXT:
+        if (c == '\r') {
+          state_ = CHUNK_SIZE_LF;
+        } else if (c == '\n' && !OnChunkSize()) {
+          return -1;
+        }
+        break;
+      case CHUNK_SIZE_LF:
+        if (c != '\n') {
+          return Fail(400);
+        }
+        if (!OnChunkSize()) {
+          return -1;
+        }
+        break;
+      case CHUNK_DATA:
+        p += ReadBody(p, end) - 1;
+        if (!remaining_) {
+          state_ = CHUNK_DATA_CR;
+        }
+        break;
+      case CHUNK_DATA_CR:
+        if (c != '\r') {
+          return Fail(400);
+        }
+        state_ = CHUNK_DATA_LF;
+        break;
+      case CHUNK_DATA_LF:
+        if (c != '\n') {
+          return Fail(400);
+        }
+        state_ = CHUNK_SIZE;
+        break;
+      case TRAILER_START:
+        // 忽略trailer头部
+        if (c == '\r') {
+          state_ = TRAILER_END_LF;
+        } else if (c == '\n') {
+          state_ = DONE;
+        } else {
+          state_ = TRAILER_LINE;
+        }
+        break;
+      case TRAILER_LINE:
+        if (c == '\n') {
+          state_ = TRAILER_START;
+        }
+        break;
+      case TRAILER_END_LF:
+        if (c != '\n') {
+          return Fail(400);
+        }
+        state_ = DONE;
+        break;
+      case DONE:
+        break;
+    }
+    ++p;
+    if (state_ == DONE) {
+      return p - data;
+    }
+  }
+  if (in_token_ && !Spill(end)) {
+    return Fail(431);
+  }
+  return length;
+}
+
+}  // namespace serverframework
@@ -0,0 +1,168 @@
+/**
+ * @file http_parser.h
+ * @brief 增量HTTP/1.1请求解析器
+ * @details 逐字节推进的状态机，数据可以按任意位置切分、分多次输入。完整落在一段输入中的
+ *          方法、路径和头部直接指向输入的内存；跨越两段输入的那一个片段拷贝到连接独占的
+ *          固定大小缓存，缓存在构造时一次分配，不会移动，已解析的片段一直有效。
+ *          请求体不拷贝，直接记录指向输入的片段。所以输入的内存必须保持到请求处理完
+ */
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <vector>
+
+#include "http/http.h"
+
+namespace serverframework {
+
+class HttpRequestParser {
+ public:
+  /**
+   * @brief 构造函数
+   * @param[in] max_header_size 请求行加头部的最大字节数，0表示使用http.max_header_size
+   * @param[in] max_body_size 请求体的最大字节数，0表示使用http.max_body_size
+   */
+  explicit HttpRequestParser(size_t max_header_size = 0,
+                             uint64_t max_body_size = 0);
+
+  /**
+   * @brief 解析一段输入
+   * @details 解析完一个请求时立即返回，剩下的数据属于下一个请求，Reset后继续输入
+   * @return 消耗的字节数，出错返回-1，GetError()返回应答的状态码
+   */
+  int Execute(const char *data, size_t length);
+
+  /**
+   * @brief 是否已经解析出一个完整的请求
+   */
+  bool IsFinished() const { return state_ == DONE; }
+
+  /**
+   * @brief 是否还没有收到当前请求的任何数据
+   */
+  bool IsIdle() const { return state_ == METHOD && !in_token_; }
+
+  /**
+   * @brief 出错时应答的状态码：400、413、431、501或505
+   */
+  int GetError() const { return error_; }
+
+  HttpRequest &GetRequest() { return request_; }
+
+  /**
+   * @brief 请求带有Expect: 100-continue且还没收到请求体时返回true，只返回一次
+   * @details 服务器据此先回复100 Continue，客户端收到后才发送请求体
+   */
+  bool TakeExpectContinue();
+
+  /**
+   * @brief 开始解析下一个请求
+   */
+  void Reset();
+
+ private:
+  enum State {
+    METHOD = 0,
+    PATH,
+    QUERY,
+    VERSION,
+    REQUEST_LF,
+    HEADER_START,
+    HEADER_NAME,
+    HEADER_VALUE_START,
+    HEADER_VALUE,
+    HEADER_LF,
+    HEADERS_END_LF,
+    BODY,
+    CHUNK_SIZE,
+    CHUNK_EXT,
+    CHUNK_SIZE_LF,
+    CHUNK_DATA,
+    CHUNK_DATA_CR,
+    CHUNK_DATA_LF,
+    TRAILER_START,
+    TRAILER_LINE,
+    TRAILER_END_LF,
+    DONE
+  };
+
+  /**
+   * @brief 当前片段从p开始
+   */
+  void StartToken(const char *p) {
+    in_token_ = true;
+    token_ = p;
+  }
+
+  /**
+   * @brief 当前片段在p之前结束
+   * @return 片段跨越输入且缓存放不下时返回false
+   */
+  bool EndToken(const char *p, Slice &out);
+
+  /**
+   * @brief 输入结束时把未结束的片段拷贝到缓存
+   */
+  bool Spill(const char *end);
+
+  /**
+   * @brief 记录一个头部，处理Content-Length、Transfer-Encoding和Connection
+   */
+  bool OnHeader(Slice value);
+
+  /**
+   * @brief 头部结束，决定请求体的读取方式
+   * @return 请求体超过上限时返回false
+   */
+  bool OnHeadersComplete();
+
+  /**
+   * @brief 分块长度行结束
+   */
+  bool OnChunkSize();
+
+  /**
+   * @brief 读取请求体或分块数据
+   * @return 消耗的字节数
+   */
+  size_t ReadBody(const char *p, const char *end);
+
+  int Fail(int status) {
+    error_ = status;
+    return -1;
+  }
+
+ private:
+  size_t max_header_size_;
+  uint64_t max_body_size_;
+  State state_ = METHOD;
+  int error_ = 0;
+  HttpRequest request_;
+  // 已消耗的请求行和头部字节数
+  size_t header_size_ = 0;
+  // 是否在片段中间
+  bool in_token_ = false;
+  // 当前片段在本段输入中的起点
+  const char *token_ = nullptr;
+  // 当前片段是否已有部分拷贝到缓存
+  bool spilled_ = false;
+  // 当前片段在缓存中的起点
+  size_t spill_begin_ = 0;
+  // 跨越输入的片段的缓存
+  std::vector<char> arena_;
+  size_t arena_used_ = 0;
+  // 正在解析的头部名字
+  Slice name_;
+  // 当前请求体或分块剩余的字节数
+  uint64_t remaining_ = 0;
+  // 分块长度已读的十六进制位数
+  int chunk_digits_ = 0;
+  // 是否收到过Content-Length
+  bool has_length_ = false;
+  // 是否需要回复100 Continue
+  bool expect_continue_ = false;
+};
+
+}  // namespace serverframework
+
+#endif
@@ -0,0 +1,186 @@
+#include "http/http_server.h"
+
+#include <limits.h>
+#include <time.h>
+
+#include <algorithm>
+#include <sstream>
+
+#include "log/log.h"
+#include "util/bytearray.h"
+#include "util/clock.h"
+
+namespace serverframework {
+
+static serverframework::Logger::ptr g_logger = LOG_NAME("system");
+
+// 每次读取的字节数，也是接收缓冲区的节点大小
+static const size_t kReadSize = 16 * 1024;
+// 请求没有解析完时，接收缓冲区超过这个大小就换新的，旧的保留到请求处理完
+static const size_t kSwapSize = kReadSize * 4;
+// 一批最多积累的响应数
+static const size_t kMaxBatch = 128;
+
+/**
+ * @brief 当前线程缓存的Date头部值，每秒格式化一次
+ */
+static const char *GetDate() {
+  static thread_local time_t s_last = 0;
+  static thread_local char s_date[64];
+  time_t now = Clock::WallSeconds();
+  if (now != s_last) {
+    struct tm tm;
+    gmtime_r(&now, &tm);
+    strftime(s_date, sizeof(s_date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    s_last = now;
+  }
+  return s_date;
+}
+
+/**
+ * @brief writev发出所有数据，处理部分发送
+ */
+static bool SendAll(Socket::ptr sock, std::vector<iovec> &iovs) {
+  size_t idx = 0;
+  while (idx < iovs.size()) {
+    size_t count = std::min(iovs.size() - idx, (size_t)IOV_MAX);
+    int rt = sock->send(&iovs[idx], count);
+    if (rt <= 0) {
+      return false;
+    }
+    size_t n = rt;
+    while (n && n >= iovs[idx].iov_len) {
+      n -= iovs[idx].iov_len;
+      ++idx;
+    }
+    if (n) {
+      iovs[idx].iov_base = (char *)iovs[idx].iov_base + n;
+      iovs[idx].iov_len -= n;
+    }
+  }
+  return true;
+}
+
+HttpServer::HttpServer(bool keep_alive, IOManager *io_worker,
+                       IOManager *accept_worker)
+    : TcpServer(io_worker, accept_worker), keep_alive_(keep_alive) {
+  type_ = "http";
+}
+
+void HttpServer::HandleRequest(HttpRequest &req, HttpResponse &rsp) {
+  router_.Dispatch(req, rsp);
+}
+
+void HttpServer::HandleConnection(Connection::ptr conn) {
+  Socket::ptr sock = conn->GetSocket();
+  HttpRequestParser parser;
+  ByteArray::ptr buffer(new ByteArray(kReadSize));
+  // 当前请求引用的旧接收缓冲区
+  std::vector<ByteArray::ptr> pins;
+  // 响应对象在请求之间复用，保留字符串的容量
+  std::vector<HttpResponse> responses;
+  size_t count = 0;
+  std::vector<iovec> in;
+  std::vector<iovec> out;
+
+  auto flush = [&]() {
+    out.clear();
+    for (size_t i = 0; i < count; ++i) {
+      responses[i].GetBuffers(out);
+    }
+    count = 0;
+    return SendAll(sock, out);
+  };
+
+  bool running = true;
+  while (running) {
+    if (parser.IsIdle()) {
+      conn->SetIdle(true);
+      buffer->Clear();
+    } else if (buffer->GetSize() >= kSwapSize) {
+      pins.push_back(buffer);
+      buffer.reset(new ByteArray(kReadSize));
+    }
+    size_t begin = buffer->GetSize();
+    in.clear();
+    buffer->GetWriteBuffers(in, kReadSize);
+    int rt = sock->recv(&in[0], in.size());
+    if (rt <= 0) {
+      break;
+    }
+    buffer->SetPosition(begin + rt);
+    conn->SetIdle(false);
+    conn->Touch();
+
+    in.clear();
+    buffer->GetReadBuffers(in, rt, begin);
+    const char *date = GetDate();
+    for (size_t i = 0; running && i < in.size(); ++i) {
+      const char *p = (const char *)in[i].iov_base;
+      size_t left = in[i].iov_len;
+      while (running && left) {
+        int n = parser.Execute(p, left);
+        if (count == responses.size()) {
+          responses.emplace_back();
+        }
+        if (n < 0) {
+          HttpResponse &rsp = responses[count++];
+          rsp.Reset();
+          rsp.SetStatus(parser.GetError());
+          rsp.SetHeader("Content-Type", "text/plain");
+          rsp.SetBody(HttpStatusToString(parser.GetError()));
+          rsp.Encode(0x11, false, false, date);
+          LOG_WARN(g_logger) << "HttpServer bad request status="
+                             << parser.GetError() << " from " << *sock;
+          running = false;
+          break;
+        }
+        p += n;
+        left -= n;
+        if (!parser.IsFinished()) {
+          continue;
+        }
+        HttpRequest &req = parser.GetRequest();
+        HttpResponse &rsp = responses[count++];
+        rsp.Reset();
+        HandleRequest(req, rsp);
+        ++requests_;
+        bool keep_alive = keep_alive_ && req.IsKeepAlive() && !rsp.IsClose() &&
+                          !conn->IsDraining();
+        rsp.Encode(req.GetVersion(), keep_alive,
+                   req.GetMethod() == HttpMethod::HEAD, date);
+        running = keep_alive;
+        // 下一个请求从当前缓冲区开始，旧缓冲区不再被引用
+        parser.Reset();
+        pins.clear();
+        if (count >= kMaxBatch && !flush()) {
+          running = false;
+          count = 0;
+        }
+      }
+    }
+    if (count && !flush()) {
+      break;
+    }
+    if (conn->IsDraining() && parser.IsIdle()) {
+      break;
+    }
+    if (running && parser.TakeExpectContinue()) {
+      static const char kContinue[] = "HTTP/1.1 100 Continue\r\n\r\n";
+      if (sock->send(kContinue, sizeof(kContinue) - 1) <= 0) {
+        break;
+      }
+    }
+  }
+  sock->close();
+}
+
+std::string HttpServer::ToString(const std::string &prefix) {
+  std::stringstream ss;
+  ss << prefix << "[http keep_alive=" << keep_alive_
+     << " requests=" << requests_ << "]" << std::endl;
+  ss << TcpServer::ToString(prefix);
+  return ss.str();
+}
+
+}  // namespace serverframework
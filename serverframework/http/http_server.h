@@ -0,0 +1,70 @@
+/**
+ * @file http_server.h
+ * @brief HTTP/1.1服务器
+ * @details 每个连接一个协程：读入socket中已到达的数据，增量解析出其中所有完整的请求，
+ *          按顺序分发到路由，这一批请求的响应用writev一次发出。支持keep-alive、流水线请求、
+ *          chunked请求体和响应体。请求的各片段指向接收缓冲区，请求之间复用缓冲区
+ */
+#ifndef HTTP_SERVER_H
+#define HTTP_SERVER_H
+
+#include "http/http_parser.h"
+#include "http/router.h"
+#include "tcp/tcp_server.h"
+
+namespace serverframework {
+
+class HttpServer : public TcpServer {
+ public:
+  using ptr = std::shared_ptr<HttpServer>;
+
+  /**
+   * @brief 构造函数
+   * @param[in] keep_alive 是否支持长连接，false时每个响应之后关闭连接
+   * @param[in] io_worker socket客户端工作的协程调度器
+   * @param[in] accept_worker 服务器socket执行接收socket连接的协程调度器
+   */
+  HttpServer(bool keep_alive = true,
+             IOManager* io_worker = IOManager::GetThis(),
+             IOManager* accept_worker = IOManager::GetThis());
+
+  /**
+   * @brief 返回路由，在Start之前注册
+   */
+  Router& GetRouter() { return router_; }
+
+  bool IsKeepAlive() const { return keep_alive_; }
+
+  /**
+   * @brief 返回处理过的请求数
+   */
+  uint64_t GetRequestCount() const { return requests_; }
+
+  std::string ToString(const std::string& prefix = "") override;
+
+ protected:
+  /**
+   * @brief 处理一个请求，默认交给路由分发
+   * @param[in] req 请求，各片段只在调用期间有效
+   * @param[out] rsp 响应
+   */
+  virtual void HandleRequest(HttpRequest& req, HttpResponse& rsp);
+
+  /**
+   * @brief 循环读取、解析、分发请求并批量发出响应
+   * @details 没有未解析完的请求时连接标记为空闲；排空时回复Connection: close后关闭连接
+   */
+  void HandleConnection(Connection::ptr conn) override;
+
+ private:
+  // 是否支持长连接
+  bool keep_alive_;
+  // 路由
+  Router router_;
+  // 处理过的请求数
+  std::atomic<uint64_t> requests_{0};
+};
+
+}  // namespace serverframework
+
+#endif
@@ -0,0 +1,164 @@
+#include "http/router.h"
+
+#include "log/log.h"
+
+namespace serverframework {
+
+static serverframework::Logger::ptr g_logger = LOG_NAME("system");
+
+bool Router::Node::HasHandler() const {
+  for (size_t i = 0; i < kHttpMethodCount; ++i) {
+    if (handlers[i]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+Router::Router() {
+  not_found_ = [](HttpRequest &req, HttpResponse &rsp) {
+    rsp.SetStatus(404);
+    rsp.SetHeader("Content-Type", "text/plain");
+    rsp.SetBody(HttpStatusToString(404));
+  };
+}
+
+bool Router::Add(HttpMethod method, const std::string &pattern,
+                 Handler handler) {
+  if (method == HttpMethod::INVALID || !handler) {
+    return false;
+  }
+  Node *node = &root_;
+  size_t pos = 0;
+  while (pos < pattern.size()) {
+    if (pattern[pos] == '/') {
+      ++pos;
+      continue;
+    }
+    size_t end = pattern.find('/', pos);
+    if (end == std::string::npos) {
+      end = pattern.size();
+    }
+    std::string seg = pattern.substr(pos, end - pos);
+    pos = end;
+    if (seg[0] == ':' || seg[0] == '*') {
+      Node::ptr &child = seg[0] == ':' ? node->param : node->wildcard;
+      std::string name = seg.substr(1);
+      if (seg[0] == '*' && pattern.find_first_not_of('/', pos) !=
+                               std::string::npos) {
+        LOG_ERROR(g_logger) << "Router wildcard must be the last segment: "
+                            << pattern;
+        return false;
+      }
+      if (!child) {
+        child.reset(new Node);
+        child->name = name;
+      } else if (child->name != name) {
+        LOG_ERROR(g_logger) << "Router conflicting parameter name " << seg
+                            << " in " << pattern << ", already :"
+                            << child->name;
+        return false;
+      }
+      node = child.get();
+      continue;
+    }
+    Node *next = nullptr;
+    for (auto &child : node->children) {
+      if (child.first == seg) {
+        next = child.second.get();
+        break;
+      }
+    }
+    if (!next) {
+      next = new Node;
+      node->children.emplace_back(seg, Node::ptr(next));
+    }
+    node = next;
+  }
+  node->handlers[(size_t)method] = handler;
+  return true;
+}
+
+bool Router::Any(const std::string &pattern, Handler handler) {
+  for (size_t i = 0; i < kHttpMethodCount; ++i) {
+    if (!Add((HttpMethod)i, pattern, handler)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+const Router::Node *Router::Match(const Node *node, const Slice &path,
+                                  size_t pos, HttpRequest &req) const {
+  while (pos < path.size && path.data[pos] == '/') {
+    ++pos;
+  }
+  if (pos == path.size) {
+    return node->HasHandler() ? node : nullptr;
+  }
+  size_t end = pos;
+  while (end < path.size && path.data[end] != '/') {
+    ++end;
+  }
+  Slice seg(path.data + pos, end - pos);
+  for (auto &child : node->children) {
+    if (child.first.size() == seg.size &&
+        !memcmp(child.first.data(), seg.data, seg.size)) {
+      const Node *rt = Match(child.second.get(), path, end, req);
+      if (rt) {
+        return rt;
+      }
+      break;
+    }
+  }
+  if (node->param) {
+    const Node *param = node->param.get();
+    req.params_.emplace_back(Slice(param->name.data(), param->name.size()),
+                             seg);
+    const Node *rt = Match(param, path, end, req);
+    if (rt) {
+      return rt;
+    }
+    req.params_.pop_back();
+  }
+  if (node->wildcard) {
+    const Node *wildcard = node->wildcard.get();
+    req.params_.emplace_back(
+        Slice(wildcard->name.data(), wildcard->name.size()),
+        Slice(path.data + pos, path.size - pos));
+    return wildcard;
+  }
+  return nullptr;
+}
+
+void Router::Dispatch(HttpRequest &req, HttpResponse &rsp) const {
+  req.params_.clear();
+  const Node *node = Match(&root_, req.GetPath(), 0, req);
+  if (!node) {
+    not_found_(req, rsp);
+    return;
+  }
+  const Handler *handler = &node->handlers[(size_t)req.GetMethod()];
+  if (!*handler && req.GetMethod() == HttpMethod::HEAD) {
+    handler = &node->handlers[(size_t)HttpMethod::GET];
+  }
+  if (*handler) {
+    (*handler)(req, rsp);
+    return;
+  }
+  std::string allow;
+  for (size_t i = 0; i < kHttpMethodCount; ++i) {
+    if (node->handlers[i]) {
+      if (!allow.empty()) {
+        allow += ", ";
+      }
+      allow += HttpMethodToString((HttpMethod)i);
+    }
+  }
+  rsp.SetStatus(405);
+  rsp.SetHeader("Allow", allow);
+  rsp.SetHeader("Content-Type", "text/plain");
+  rsp.SetBody(HttpStatusToString(405));
+}
+
+}  // namespace serverframework
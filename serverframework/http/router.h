@@ -0,0 +1,84 @@
+/**
+ * @file router.h
+ * @brief HTTP路由
+ * @details 按'/'分隔的路径段建前缀树。每个节点有精确匹配的子节点、一个:name参数子节点和一个
+ *          *name通配子节点，匹配时依次尝试，精确匹配优先。每个节点按方法保存处理函数。
+ *          路由在服务器启动前注册，运行时只读，不加锁
+ */
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "http/http.h"
+
+namespace serverframework {
+
+class Router {
+ public:
+  using Handler = std::function<void(HttpRequest &, HttpResponse &)>;
+
+  Router();
+
+  /**
+   * @brief 注册路由
+   * @param[in] method 方法
+   * @param[in] pattern 路径模式。:name匹配一个路径段，例如/users/:id；
+   *                    *name匹配剩下的所有路径段，只能作为最后一段
+   * @param[in] handler 处理函数
+   * @return 模式不合法时返回false
+   */
+  bool Add(HttpMethod method, const std::string &pattern, Handler handler);
+
+  /**
+   * @brief 注册所有方法的路由
+   */
+  bool Any(const std::string &pattern, Handler handler);
+
+  /**
+   * @brief 设置没有匹配到路由时的处理函数，默认返回404
+   */
+  void SetNotFound(Handler handler) { not_found_ = handler; }
+
+  /**
+   * @brief 分发请求
+   * @details 匹配到的路径参数写入请求；路径匹配但方法没有注册时返回405并带上Allow头部。
+   *          HEAD请求没有注册时使用GET的处理函数
+   */
+  void Dispatch(HttpRequest &req, HttpResponse &rsp) const;
+
+ private:
+  struct Node {
+    using ptr = std::unique_ptr<Node>;
+    // 精确匹配的子节点，子节点通常不多，线性查找不需要为路径段构造std::string
+    std::vector<std::pair<std::string, ptr>> children;
+    // :name参数子节点
+    ptr param;
+    // *name通配子节点
+    ptr wildcard;
+    // 参数名
+    std::string name;
+    // 按方法保存的处理函数
+    Handler handlers[kHttpMethodCount];
+    bool HasHandler() const;
+  };
+
+  /**
+   * @brief 从node开始匹配path[pos, end)
+   * @return 匹配到的节点，失败返回nullptr
+   */
+  const Node *Match(const Node *node, const Slice &path, size_t pos,
+                    HttpRequest &req) const;
+
+ private:
+  Node root_;
+  Handler not_found_;
+};
+
+}  // namespace serverframework
+
+#endif
@@ -483,7 +483,7 @@ std::string FileLogAppender::ToYamlString() {
 }
 
 Logger::Logger(const std::string &name)
-    : name_(name), level_(LogLevel::INFO), create_time_(GetElapsedMS()) {}
+    : name_(name), level_(LogLevel::INFO), create_time_(Clock::NowMS()) {}
 
 void Logger::AddAppender(LogAppender::ptr appender) {
   MutexType::Lock lock(mutex_);
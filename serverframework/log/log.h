@@ -17,6 +17,7 @@
 #include <vector>
 
 #include "env/mutex.h"
+#include "util/clock.h"
 #include "util/singleton.h"
 #include "util/util.h"
 
@@ -42,9 +43,10 @@
       logger,                                                            \
       serverframework::LogEvent::ptr(new serverframework::LogEvent(      \
           logger->GetName(), level, __FILE__, __LINE__,                  \
-          serverframework::GetElapsedMS() - logger->GetCreateTime(),     \
+          serverframework::Clock::NowMS() - logger->GetCreateTime(),     \
           serverframework::GetThreadId(), serverframework::GetFiberId(), \
-          time(0), serverframework::GetThreadName())))                   \
+          serverframework::Clock::WallSeconds(),                         \
+          serverframework::GetThreadName())))                            \
       .GetLogEvent()                                                     \
       ->GetSS()
 
@@ -76,9 +78,10 @@
       logger,                                                            \
       serverframework::LogEvent::ptr(new serverframework::LogEvent(      \
           logger->GetName(), level, __FILE__, __LINE__,                  \
-          serverframework::GetElapsedMS() - logger->GetCreateTime(),     \
+          serverframework::Clock::NowMS() - logger->GetCreateTime(),     \
           serverframework::GetThreadId(), serverframework::GetFiberId(), \
-          time(0), serverframework::GetThreadName())))                   \
+          serverframework::Clock::WallSeconds(),                         \
+          serverframework::GetThreadName())))                            \
       .GetLogEvent()                                                     \
       ->Printf(fmt, __VA_ARGS__)
 
@@ -1,11 +1,17 @@
 #include "net/address.h"
 
+#include <arpa/inet.h>
+#include <ctype.h>
 #include <ifaddrs.h>
 #include <netdb.h>
 #include <stddef.h>
 
 #include <sstream>
 
+#include "config/config.h"
+#include "fiber/scheduler.h"
+#include "net/dns.h"
+#include "net/hook.h"
 #include "util/endian_conv.h"
 #include "log/log.h"
 
@@ -13,6 +19,38 @@ namespace serverframework {
 
 static serverframework::Logger::ptr g_logger = LOG_NAME("system");
 
+static serverframework::ConfigVar<bool>::ptr g_dns_async =
+    serverframework::Config::Lookup(
+        "dns.async", false,
+        "resolve host names in Address::Lookup with the fiber dns resolver");
+
+/**
+ * @brief 能否用DnsResolver解析
+ * @details 只在开启了hook的协程中使用，getaddrinfo在那里会阻塞整个线程。
+ *          DnsResolver不做resolv.conf的search/ndots扩展，也不经过nsswitch，
+ *          所以默认关闭，由dns.async开启
+ *          数字地址、非数字的服务名和带标志的查询仍然交给getaddrinfo
+ */
+static bool CanResolveAsync(const std::string &node, const char *service,
+                            int family) {
+  if (!g_dns_async->GetValue() || !Scheduler::GetThis() || !IsHookEnable()) {
+    return false;
+  }
+  if (family != AF_INET && family != AF_INET6 && family != AF_UNSPEC) {
+    return false;
+  }
+  if (service) {
+    for (const char *p = service; *p; ++p) {
+      if (!isdigit(*p)) {
+        return false;
+      }
+    }
+  }
+  in6_addr buf;
+  return !node.empty() && inet_pton(AF_INET, node.c_str(), &buf) != 1 &&
+         inet_pton(AF_INET6, node.c_str(), &buf) != 1;
+}
+
 template <class T>
 static T CreateMask(uint32_t bits) {
   return (1 << (sizeof(T) * 8 - bits)) - 1;
@@ -95,6 +133,23 @@ bool Address::Lookup(std::vector<Address::ptr> &result, const std::string &host,
   if (node.empty()) {
     node = host;
   }
+
+  if (CanResolveAsync(node, service, family)) {
+    std::vector<IPAddress::ptr> addrs;
+    if (!DnsMgr::GetInstance()->Resolve(node, family, addrs)) {
+      LOG_DEBUG(g_logger) << "Address::Lookup resolve(" << host << ", "
+                          << family << ") failed";
+      return false;
+    }
+    // 与getaddrinfo不同，每个地址只返回一次，不按套接字类型重复
+    uint16_t port = service ? atoi(service) : 0;
+    for (auto &i : addrs) {
+      i->SetPort(port);
+      result.push_back(i);
+    }
+    return true;
+  }
+
   int error = getaddrinfo(node.c_str(), service, &hints, &results);
   if (error) {
     LOG_DEBUG(g_logger) << "Address::Lookup getaddress(" << host << ", "
@@ -0,0 +1,585 @@
+/**
+ * @file dns.cc
+ * @brief 异步DNS解析实现
+ */
+#include "net/dns.h"
+
+#include <arpa/inet.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <sstream>
+
+#include "config/config.h"
+#include "log/log.h"
+#include "net/iomanager.h"
+#include "net/socket.h"
+#include "net/socket_stream.h"
+#include "util/clock.h"
+#include "util/macro.h"
+#include "util/util.h"
+
+namespace serverframework {
+
+static serverframework::Logger::ptr g_logger = LOG_NAME("system");
+
+static serverframework::ConfigVar<std::vector<std::string>>::ptr
+    g_dns_servers = serverframework::Config::Lookup(
+        "dns.servers", std::vector<std::string>(),
+        "dns servers as ip[:port], empty to read /etc/resolv.conf");
+
+static serverframework::ConfigVar<uint32_t>::ptr g_dns_timeout =
+    serverframework::Config::Lookup("dns.timeout", (uint32_t)2000,
+                                    "dns query timeout per attempt in ms");
+
+static serverframework::ConfigVar<uint32_t>::ptr g_dns_attempts =
+    serverframework::Config::Lookup("dns.attempts", (uint32_t)2,
+                                    "dns query attempts per server");
+
+static serverframework::ConfigVar<uint32_t>::ptr g_dns_negative_ttl =
+    serverframework::Config::Lookup(
+        "dns.negative_ttl", (uint32_t)30,
+        "seconds to cache a negative answer that carries no SOA");
+
+static serverframework::ConfigVar<uint32_t>::ptr g_dns_max_ttl =
+    serverframework::Config::Lookup("dns.max_ttl", (uint32_t)3600,
+                                    "upper bound of cached ttl in seconds");
+
+static serverframework::ConfigVar<uint32_t>::ptr g_dns_cache_size =
+    serverframework::Config::Lookup("dns.cache_size", (uint32_t)4096,
+                                    "max cached dns entries");
+
+// DNS报文中用到的常量，参考RFC 1035
+static const uint16_t kTypeA = 1;
+static const uint16_t kTypeCNAME = 5;
+static const uint16_t kTypeSOA = 6;
+static const uint16_t kTypeAAAA = 28;
+static const uint16_t kClassIN = 1;
+static const uint16_t kFlagQR = 0x8000;
+static const uint16_t kFlagTC = 0x0200;
+static const uint16_t kFlagRD = 0x0100;
+static const uint16_t kRcodeNXDomain = 3;
+static const size_t kHeaderSize = 12;
+// 不带EDNS时UDP应答不超过512字节
+static const size_t kMaxUdpSize = 512;
+// ParseResponse返回值，应答被截断
+static const int kTruncated = 2;
+
+static uint16_t ReadU16(const uint8_t *p) { return (p[0] << 8) | p[1]; }
+
+static uint32_t ReadU32(const uint8_t *p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+         ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void WriteU16(uint8_t *p, uint16_t v) {
+  p[0] = v >> 8;
+  p[1] = v & 0xff;
+}
+
+/**
+ * @brief 读取报文中的名字，支持压缩指针
+ * @param[in, out] pos 名字的起始位置，返回时指向名字之后
+ * @param[out] out 小写的名字，不需要时传nullptr
+ * @return 名字是否合法
+ */
+static bool ReadName(const uint8_t *buf, size_t len, size_t &pos,
+                     std::string *out) {
+  size_t p = pos;
+  bool jumped = false;
+  // 压缩指针最多跳转的次数，防止循环
+  int hops = 0;
+  while (true) {
+    if (p >= len) {
+      return false;
+    }
+    uint8_t l = buf[p];
+    if ((l & 0xc0) == 0xc0) {
+      if (p + 1 >= len || ++hops > 16) {
+        return false;
+      }
+      if (!jumped) {
+        pos = p + 2;
+        jumped = true;
+      }
+      p = ((l & 0x3f) << 8) | buf[p + 1];
+      continue;
+    }
+    if (l & 0xc0) {
+      return false;
+    }
+    if (l == 0) {
+      if (!jumped) {
+        pos = p + 1;
+      }
+      return true;
+    }
+    if (p + 1 + l > len) {
+      return false;
+    }
+    if (out) {
+      if (!out->empty()) {
+        out->push_back('.');
+      }
+      for (size_t i = 0; i < l; ++i) {
+        out->push_back(tolower(buf[p + 1 + i]));
+      }
+    }
+    p += 1 + l;
+  }
+}
+
+/**
+ * @brief 构造查询报文
+ * @return 报文长度，名字不合法时返回0
+ */
+static size_t BuildQuery(const std::string &name, uint16_t qtype, uint16_t id,
+                         uint8_t *buf, size_t size) {
+  if (name.size() > 253 || size < kHeaderSize + name.size() + 6) {
+    return 0;
+  }
+  memset(buf, 0, kHeaderSize);
+  WriteU16(buf, id);
+  WriteU16(buf + 2, kFlagRD);
+  WriteU16(buf + 4, 1);
+  size_t pos = kHeaderSize;
+  size_t begin = 0;
+  while (begin <= name.size()) {
+    size_t end = name.find('.', begin);
+    if (end == std::string::npos) {
+      end = name.size();
+    }
+    size_t l = end - begin;
+    if (l == 0 || l > 63) {
+      return 0;
+    }
+    buf[pos++] = l;
+    memcpy(buf + pos, name.data() + begin, l);
+    pos += l;
+    begin = end + 1;
+  }
+  buf[pos++] = 0;
+  WriteU16(buf + pos, qtype);
+  WriteU16(buf + pos + 2, kClassIN);
+  return pos + 4;
+}
+
+/**
+ * @brief 复制地址，缓存中的地址不会交给调用者修改
+ */
+static IPAddress::ptr CloneAddress(const IPAddress::ptr &addr) {
+  return std::dynamic_pointer_cast<IPAddress>(
+      Address::Create(addr->GetAddrGetFamily(), addr->GetAddrLen()));
+}
+
+/**
+ * @brief 解析ip[:port]或[ipv6]:port形式的服务器地址，默认端口53
+ */
+static IPAddress::ptr ParseServer(const std::string &str) {
+  std::string host = str;
+  uint16_t port = 53;
+  if (!str.empty() && str[0] == '[') {
+    size_t end = str.find(']');
+    if (end == std::string::npos) {
+      return nullptr;
+    }
+    host = str.substr(1, end - 1);
+    if (end + 1 < str.size() && str[end + 1] == ':') {
+      port = atoi(str.c_str() + end + 2);
+    }
+  } else if (std::count(str.begin(), str.end(), ':') == 1) {
+    size_t colon = str.find(':');
+    host = str.substr(0, colon);
+    port = atoi(str.c_str() + colon + 1);
+  }
+  return IPAddress::Create(host.c_str(), port);
+}
+
+/**
+ * @brief 读取/etc/resolv.conf中的nameserver
+ */
+static std::vector<IPAddress::ptr> ReadResolvConf() {
+  std::vector<IPAddress::ptr> servers;
+  std::ifstream ifs("/etc/resolv.conf");
+  std::string line;
+  while (std::getline(ifs, line)) {
+    std::istringstream iss(line);
+    std::string key, value;
+    if (iss >> key >> value && key == "nameserver") {
+      IPAddress::ptr addr = IPAddress::Create(value.c_str(), 53);
+      if (addr) {
+        servers.push_back(addr);
+      }
+    }
+  }
+  return servers;
+}
+
+static std::vector<IPAddress::ptr> ParseServers(
+    const std::vector<std::string> &strs) {
+  if (strs.empty()) {
+    return ReadResolvConf();
+  }
+  std::vector<IPAddress::ptr> servers;
+  for (auto &i : strs) {
+    IPAddress::ptr addr = ParseServer(i);
+    if (addr) {
+      servers.push_back(addr);
+    } else {
+      LOG_ERROR(g_logger) << "invalid dns server: " << i;
+    }
+  }
+  return servers;
+}
+
+DnsResolver::DnsResolver()
+    : query_count_(0), cache_hit_count_(0), coalesced_count_(0) {
+  servers_ = ParseServers(g_dns_servers->GetValue());
+  g_dns_servers->AddListener([this](const std::vector<std::string> &old_value,
+                                    const std::vector<std::string> &new_value) {
+    SetServers(ParseServers(new_value));
+  });
+  LoadHosts();
+}
+
+void DnsResolver::SetServers(const std::vector<IPAddress::ptr> &servers) {
+  RWMutex::WriteLock lock(servers_mutex_);
+  servers_ = servers;
+}
+
+void DnsResolver::ClearCache() {
+  for (auto &shard : shards_) {
+    MutexType::Lock lock(shard.mutex);
+    shard.cache.clear();
+  }
+}
+
+void DnsResolver::LoadHosts() {
+  std::ifstream ifs("/etc/hosts");
+  std::string line;
+  while (std::getline(ifs, line)) {
+    size_t comment = line.find('#');
+    if (comment != std::string::npos) {
+      line.resize(comment);
+    }
+    std::istringstream iss(line);
+    std::string ip, name;
+    if (!(iss >> ip)) {
+      continue;
+    }
+    IPAddress::ptr addr = IPAddress::Create(ip.c_str(), 0);
+    if (!addr) {
+      continue;
+    }
+    while (iss >> name) {
+      hosts_[ToLower(name)].push_back(addr);
+    }
+  }
+}
+
+DnsResolver::Shard &DnsResolver::GetShard(const std::string &key) {
+  return shards_[std::hash<std::string>()(key) % kShards];
+}
+
+bool DnsResolver::Resolve(const std::string &name, int family,
+                          std::vector<IPAddress::ptr> &result) {
+  std::string lower = ToLower(name);
+  if (!lower.empty() && lower.back() == '.') {
+    lower.pop_back();
+  }
+  if (lower.empty()) {
+    return false;
+  }
+
+  size_t before = result.size();
+  auto it = hosts_.find(lower);
+  if (it != hosts_.end()) {
+    for (auto &addr : it->second) {
+      if (family == AF_UNSPEC || addr->GetFamily() == family) {
+        result.push_back(CloneAddress(addr));
+      }
+    }
+    if (result.size() > before) {
+      ++cache_hit_count_;
+      return true;
+    }
+  }
+
+  if (family == AF_INET || family == AF_UNSPEC) {
+    Query(lower, kTypeA, result);
+  }
+  if (family == AF_INET6 || family == AF_UNSPEC) {
+    Query(lower, kTypeAAAA, result);
+  }
+  return result.size() > before;
+}
+
+bool DnsResolver::Query(const std::string &name, uint16_t qtype,
+                        std::vector<IPAddress::ptr> &result) {
+  std::string key = name + (qtype == kTypeA ? "/A" : "/AAAA");
+  Shard &shard = GetShard(key);
+  std::shared_ptr<Inflight> inflight;
+  bool owner = false;
+  {
+    MutexType::Lock lock(shard.mutex);
+    auto it = shard.cache.find(key);
+    if (it != shard.cache.end()) {
+      if (it->second.expire > Clock::NowMS()) {
+        ++cache_hit_count_;
+        for (auto &addr : it->second.addrs) {
+          result.push_back(CloneAddress(addr));
+        }
+        return true;
+      }
+      shard.cache.erase(it);
+    }
+    auto fit = shard.inflight.find(key);
+    if (fit != shard.inflight.end()) {
+      inflight = fit->second;
+      IOManager *iom = IOManager::GetThis();
+      inflight->waiters.push_back({Scheduler::GetThis(), Fiber::GetThis(),
+                                   iom ? iom->GetAffinityThread() : -1});
+      ++coalesced_count_;
+    } else {
+      inflight.reset(new Inflight);
+      shard.inflight[key] = inflight;
+      owner = true;
+    }
+  }
+
+  if (!owner) {
+    // 发出查询的协程填好结果之后才会调度等待者
+    Fiber::GetThis()->Yield();
+    MutexType::Lock lock(shard.mutex);
+    ASSERT(inflight->done);
+    for (auto &addr : inflight->entry.addrs) {
+      result.push_back(CloneAddress(addr));
+    }
+    return inflight->answered;
+  }
+
+  Entry entry;
+  bool answered = Exchange(name, qtype, entry);
+  std::vector<Waiter> waiters;
+  {
+    MutexType::Lock lock(shard.mutex);
+    inflight->done = true;
+    inflight->answered = answered;
+    inflight->entry = entry;
+    if (answered && entry.expire > Clock::NowMS()) {
+      size_t capacity =
+          std::max<size_t>(g_dns_cache_size->GetValue() / kShards, 1);
+      if (shard.cache.size() >= capacity) {
+        uint64_t now = Clock::NowMS();
+        for (auto it = shard.cache.begin(); it != shard.cache.end();) {
+          if (it->second.expire <= now) {
+            it = shard.cache.erase(it);
+          } else {
+            ++it;
+          }
+        }
+        if (shard.cache.size() >= capacity) {
+          shard.cache.erase(shard.cache.begin());
+        }
+      }
+      shard.cache[key] = entry;
+    }
+    shard.inflight.erase(key);
+    waiters.swap(inflight->waiters);
+  }
+  for (auto &i : waiters) {
+    i.scheduler->Schedule(i.fiber, i.thread);
+  }
+  for (auto &addr : entry.addrs) {
+    result.push_back(CloneAddress(addr));
+  }
+  return answered;
+}
+
+bool DnsResolver::Exchange(const std::string &name, uint16_t qtype,
+                           Entry &entry) {
+  std::vector<IPAddress::ptr> servers;
+  {
+    RWMutex::ReadLock lock(servers_mutex_);
+    servers = servers_;
+  }
+  if (servers.empty()) {
+    LOG_ERROR(g_logger) << "no dns server to resolve " << name;
+    return false;
+  }
+
+  static thread_local std::mt19937 s_random(std::random_device{}() ^
+                                            GetThreadId());
+  uint8_t query[kMaxUdpSize];
+  uint8_t buf[kMaxUdpSize];
+  uint32_t timeout = g_dns_timeout->GetValue();
+  size_t attempts = g_dns_attempts->GetValue() * servers.size();
+  for (size_t attempt = 0; attempt < attempts; ++attempt) {
+    const IPAddress::ptr &server = servers[attempt % servers.size()];
+    uint16_t id = s_random();
+    size_t qlen = BuildQuery(name, qtype, id, query, sizeof(query));
+    if (!qlen) {
+      LOG_DEBUG(g_logger) << "invalid dns name: " << name;
+      return false;
+    }
+    // 每次查询用新的socket，由内核分配随机的源端口
+    Socket::ptr sock = Socket::CreateUDP(server);
+    sock->SetRecvTimeout(timeout);
+    if (!sock->connect(server)) {
+      continue;
+    }
+    ++query_count_;
+    if (sock->send(query, qlen) != (int)qlen) {
+      continue;
+    }
+    while (true) {
+      int n = sock->recv(buf, sizeof(buf));
+      if (n <= 0) {
+        LOG_DEBUG(g_logger) << "dns query " << name << " to "
+                            << server->ToString() << " timeout";
+        break;
+      }
+      int rt = ParseResponse(buf, n, id, name, qtype, entry);
+      if (rt == kTruncated) {
+        // 截断的应答可能缺少记录，不能缓存，改用TCP取完整的应答
+        if (ExchangeTcp(server, query, qlen, id, name, qtype, entry)) {
+          return true;
+        }
+        break;
+      }
+      if (rt > 0) {
+        return true;
+      }
+      if (rt < 0) {
+        break;
+      }
+      // 不是对这次查询的应答，继续等待
+    }
+  }
+  return false;
+}
+
+bool DnsResolver::ExchangeTcp(const IPAddress::ptr &server,
+                              const uint8_t *query, size_t qlen, uint16_t id,
+                              const std::string &name, uint16_t qtype,
+                              Entry &entry) {
+  uint32_t timeout = g_dns_timeout->GetValue();
+  Socket::ptr sock = Socket::CreateTCP(server);
+  sock->SetRecvTimeout(timeout);
+  sock->SetSendTimeout(timeout);
+  if (!sock->connect(server, timeout)) {
+    return false;
+  }
+  ++query_count_;
+  // TCP上每个报文前有2字节的长度，参考RFC 1035 4.2.2
+  std::vector<uint8_t> buf(2 + qlen);
+  WriteU16(&buf[0], qlen);
+  memcpy(&buf[2], query, qlen);
+  SocketStream stream(sock);
+  if (stream.WriteFixSize(&buf[0], buf.size()) <= 0 || stream.Flush() < 0 ||
+      stream.ReadFixSize(&buf[0], 2) <= 0) {
+    LOG_DEBUG(g_logger) << "dns tcp query " << name << " to "
+                        << server->ToString() << " failed";
+    return false;
+  }
+  size_t len = ReadU16(&buf[0]);
+  if (len == 0) {
+    return false;
+  }
+  buf.resize(len);
+  if (stream.ReadFixSize(&buf[0], len) <= 0) {
+    return false;
+  }
+  return ParseResponse(&buf[0], len, id, name, qtype, entry) == 1;
+}
+
+int DnsResolver::ParseResponse(const uint8_t *buf, size_t len, uint16_t id,
+                               const std::string &name, uint16_t qtype,
+                               Entry &entry) {
+  if (len < kHeaderSize || ReadU16(buf) != id) {
+    return 0;
+  }
+  uint16_t flags = ReadU16(buf + 2);
+  uint16_t qdcount = ReadU16(buf + 4);
+  uint16_t ancount = ReadU16(buf + 6);
+  uint16_t nscount = ReadU16(buf + 8);
+  if (!(flags & kFlagQR) || qdcount != 1) {
+    return 0;
+  }
+
+  size_t pos = kHeaderSize;
+  std::string qname;
+  if (!ReadName(buf, len, pos, &qname) || pos + 4 > len || qname != name ||
+      ReadU16(buf + pos) != qtype || ReadU16(buf + pos + 2) != kClassIN) {
+    return 0;
+  }
+  pos += 4;
+  if (flags & kFlagTC) {
+    return kTruncated;
+  }
+
+  uint16_t rcode = flags & 0xf;
+  if (rcode != 0 && rcode != kRcodeNXDomain) {
+    LOG_DEBUG(g_logger) << "dns query " << name << " rcode=" << rcode;
+    return -1;
+  }
+
+  entry.addrs.clear();
+  uint32_t ttl = g_dns_max_ttl->GetValue();
+  for (uint16_t i = 0; i < ancount; ++i) {
+    if (!ReadName(buf, len, pos, nullptr) || pos + 10 > len) {
+      return -1;
+    }
+    uint16_t type = ReadU16(buf + pos);
+    uint16_t cls = ReadU16(buf + pos + 2);
+    uint32_t rttl = ReadU32(buf + pos + 4);
+    uint16_t rdlen = ReadU16(buf + pos + 8);
+    pos += 10;
+    if (pos + rdlen > len) {
+      return -1;
+    }
+    if (cls == kClassIN && (type == qtype || type == kTypeCNAME)) {
+      ttl = std::min(ttl, rttl);
+      if (type == kTypeA && rdlen == 4) {
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        memcpy(&addr.sin_addr, buf + pos, 4);
+        entry.addrs.emplace_back(new IPv4Address(addr));
+      } else if (type == kTypeAAAA && rdlen == 16) {
+        entry.addrs.emplace_back(new IPv6Address(buf + pos));
+      }
+    }
+    pos += rdlen;
+  }
+
+  if (entry.addrs.empty()) {
+    // 否定应答，按RFC 2308取权威部分SOA记录的TTL和MINIMUM中较小的一个
+    ttl = g_dns_negative_ttl->GetValue();
+    for (uint16_t i = 0; i < nscount; ++i) {
+      if (!ReadName(buf, len, pos, nullptr) || pos + 10 > len) {
+        break;
+      }
+      uint16_t type = ReadU16(buf + pos);
+      uint32_t rttl = ReadU32(buf + pos + 4);
+      uint16_t rdlen = ReadU16(buf + pos + 8);
+      pos += 10;
+      if (pos + rdlen > len) {
+        break;
+      }
+      if (type == kTypeSOA && rdlen >= 20) {
+        ttl = std::min(rttl, ReadU32(buf + pos + rdlen - 4));
+        break;
+      }
+      pos += rdlen;
+    }
+    ttl = std::min(ttl, g_dns_max_ttl->GetValue());
+  }
+  entry.expire = Clock::NowMS() + (uint64_t)ttl * 1000;
+  return 1;
+}
+
+}  // namespace serverframework
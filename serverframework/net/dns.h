@@ -0,0 +1,192 @@
+/**
+ * @file dns.h
+ * @brief 异步DNS解析
+ * @details 通过hook过的UDP socket向DNS服务器发送A/AAAA查询，等待应答时只让出协程，不阻塞线程。
+ *          解析结果按记录的TTL缓存，NXDOMAIN和没有对应记录的应答按SOA的TTL做否定缓存；
+ *          缓存按名字哈希分片，每片一把锁。同一个名字同时只有一个查询在进行，其他协程等待它的结果。
+ *          UDP应答带TC位时改用TCP向同一个服务器重查，截断的应答不缓存。查询前先查/etc/hosts。
+ *          不做resolv.conf的search/ndots扩展，也不读nsswitch.conf
+ */
+#ifndef DNS_H
+#define DNS_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "env/mutex.h"
+#include "fiber/fiber.h"
+#include "fiber/scheduler.h"
+#include "net/address.h"
+#include "util/singleton.h"
+
+namespace serverframework {
+
+/**
+ * @brief 异步DNS解析器
+ */
+class DnsResolver {
+ public:
+  using ptr = std::shared_ptr<DnsResolver>;
+  using MutexType = Mutex;
+
+  /**
+   * @brief 构造函数
+   * @details DNS服务器取自配置项dns.servers，为空时读取/etc/resolv.conf
+   */
+  DnsResolver();
+  DnsResolver(const DnsResolver &) = delete;
+  DnsResolver &operator=(const DnsResolver &) = delete;
+
+  /**
+   * @brief 解析主机名
+   * @details 必须在IOManager的协程中调用。数字形式的地址不在这里处理
+   * @param[in] name 主机名
+   * @param[in] family AF_INET查A记录，AF_INET6查AAAA记录，AF_UNSPEC两者都查
+   * @param[out] result 解析到的地址追加到末尾，端口为0
+   * @return 是否解析到地址
+   */
+  bool Resolve(const std::string &name, int family,
+               std::vector<IPAddress::ptr> &result);
+
+  /**
+   * @brief 设置DNS服务器，按顺序重试
+   */
+  void SetServers(const std::vector<IPAddress::ptr> &servers);
+
+  /**
+   * @brief 清空缓存
+   */
+  void ClearCache();
+
+  /**
+   * @brief 发出的DNS查询数
+   */
+  uint64_t GetQueryCount() const { return query_count_; }
+
+  /**
+   * @brief 命中缓存(包括否定缓存和/etc/hosts)的次数
+   */
+  uint64_t GetCacheHitCount() const { return cache_hit_count_; }
+
+  /**
+   * @brief 等待其他协程正在进行的同名查询的次数
+   */
+  uint64_t GetCoalescedCount() const { return coalesced_count_; }
+
+ private:
+  /**
+   * @brief 一个名字和记录类型的解析结果
+   */
+  struct Entry {
+    // 解析到的地址，为空表示否定结果
+    std::vector<IPAddress::ptr> addrs;
+    // 过期时间(毫秒，Clock::NowMS)
+    uint64_t expire = 0;
+  };
+
+  /**
+   * @brief 等待同名查询结果的协程
+   */
+  struct Waiter {
+    Scheduler *scheduler;
+    Fiber::ptr fiber;
+    // 开启线程亲和时固定调度回原来的线程，否则为-1
+    int thread;
+  };
+
+  /**
+   * @brief 正在进行的查询
+   */
+  struct Inflight {
+    // 查询是否完成
+    bool done = false;
+    // 查询是否得到了应答(肯定或否定)，超时或服务器出错时为false
+    bool answered = false;
+    // 查询结果
+    Entry entry;
+    // 等待结果的协程
+    std::vector<Waiter> waiters;
+  };
+
+  /**
+   * @brief 缓存分片
+   */
+  struct Shard {
+    MutexType mutex;
+    std::unordered_map<std::string, Entry> cache;
+    std::unordered_map<std::string, std::shared_ptr<Inflight>> inflight;
+  };
+
+  /**
+   * @brief 查询一种记录，先查缓存，再等待同名查询或者自己发出查询
+   * @param[in] name 小写的主机名
+   * @param[in] qtype 记录类型，1为A，28为AAAA
+   * @param[out] result 解析到的地址追加到末尾
+   * @return 是否得到了应答，否定应答也返回true
+   */
+  bool Query(const std::string &name, uint16_t qtype,
+             std::vector<IPAddress::ptr> &result);
+
+  /**
+   * @brief 向DNS服务器发出查询并等待应答，按服务器顺序重试
+   * @param[out] entry 应答的结果和过期时间
+   * @return 是否得到了应答
+   */
+  bool Exchange(const std::string &name, uint16_t qtype, Entry &entry);
+
+  /**
+   * @brief UDP应答被截断后，通过TCP向同一个服务器重发查询
+   * @param[in] query 查询报文，长度为qlen
+   * @param[out] entry 应答的结果和过期时间
+   * @return 是否得到了完整的应答
+   */
+  bool ExchangeTcp(const IPAddress::ptr &server, const uint8_t *query,
+                   size_t qlen, uint16_t id, const std::string &name,
+                   uint16_t qtype, Entry &entry);
+
+  /**
+   * @brief 解析应答报文
+   * @param[in] id 查询的id
+   * @param[out] entry 应答的结果和过期时间
+   * @return 1表示得到了应答(包括NXDOMAIN)，0表示不是对这个查询的应答，
+   *         -1表示服务器出错或报文损坏，应换下一个服务器重试，
+   *         2表示应答带TC位被截断，应改用TCP重查
+   */
+  static int ParseResponse(const uint8_t *buf, size_t len, uint16_t id,
+                           const std::string &name, uint16_t qtype,
+                           Entry &entry);
+
+  /**
+   * @brief 读取/etc/hosts
+   */
+  void LoadHosts();
+
+  /**
+   * @brief 名字所在的缓存分片
+   */
+  Shard &GetShard(const std::string &key);
+
+ private:
+  static const size_t kShards = 16;
+  Shard shards_[kShards];
+  // DNS服务器
+  RWMutex servers_mutex_;
+  std::vector<IPAddress::ptr> servers_;
+  // /etc/hosts中的记录，构造后只读
+  std::unordered_map<std::string, std::vector<IPAddress::ptr>> hosts_;
+  std::atomic<uint64_t> query_count_;
+  std::atomic<uint64_t> cache_hit_count_;
+  std::atomic<uint64_t> coalesced_count_;
+};
+
+// DNS解析器单例
+using DnsMgr = Singleton<DnsResolver>;
+
+}  // namespace serverframework
+
+#endif
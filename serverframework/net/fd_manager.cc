@@ -7,35 +7,34 @@
  */
 #include "net/fd_manager.h"
 
+#include <sched.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include "net/hook.h"
+#include "util/macro.h"
 
 namespace serverframework {
 
 FdCtx::FdCtx(int fd)
-    : is_init_(false),
+    : state_(kFree),
+      is_init_(false),
       is_socket_(false),
       sys_nonblock_(false),
       user_nonblock_(false),
+      is_stream_(false),
       is_closed_(false),
+      not_ready_(0),
       fd_(fd),
       recv_timeout_(-1),
       send_timeout_(-1) {
-  Init();
+  event_ctx_.fd = fd;
 }
 
 FdCtx::~FdCtx() {}
 
 bool FdCtx::Init() {
-  if (is_init_) {
-    return true;
-  }
-  recv_timeout_ = -1;
-  send_timeout_ = -1;
-
   struct stat fd_stat;
   if (-1 == fstat(fd_, &fd_stat)) {
     is_init_ = false;
@@ -46,18 +45,42 @@ bool FdCtx::Init() {
   }
 
   if (is_socket_) {
+    int type = 0;
+    socklen_t len = sizeof(type);
+    InitSocket(getsockopt_f(fd_, SOL_SOCKET, SO_TYPE, &type, &len) == 0 &&
+                   type == SOCK_STREAM,
+               false);
+    return is_init_;
+  }
+
+  recv_timeout_ = -1;
+  send_timeout_ = -1;
+  sys_nonblock_ = false;
+  is_stream_ = false;
+  not_ready_.store(0, std::memory_order_relaxed);
+  user_nonblock_ = false;
+  is_closed_.store(false, std::memory_order_relaxed);
+  return is_init_;
+}
+
+void FdCtx::InitSocket(bool is_stream, bool nonblock) {
+  recv_timeout_ = -1;
+  send_timeout_ = -1;
+  is_init_ = true;
+  is_socket_ = true;
+  is_stream_ = is_stream;
+
+  if (!nonblock) {
     int flags = fcntl_f(fd_, F_GETFL, 0);
     if (!(flags & O_NONBLOCK)) {
       fcntl_f(fd_, F_SETFL, flags | O_NONBLOCK);
     }
-    sys_nonblock_ = true;
-  } else {
-    sys_nonblock_ = false;
   }
+  sys_nonblock_ = true;
+  not_ready_.store(0, std::memory_order_relaxed);
 
   user_nonblock_ = false;
-  is_closed_ = false;
-  return is_init_;
+  is_closed_.store(false, std::memory_order_relaxed);
 }
 
 void FdCtx::SetTimeout(int type, uint64_t v) {
@@ -76,39 +99,110 @@ uint64_t FdCtx::GetTimeout(int type) {
   }
 }
 
-FdManager::FdManager() { datas_.resize(64); }
+FdManager::FdManager() {}
 
-FdCtx::ptr FdManager::Get(int fd, bool auto_create) {
-  if (fd == -1) {
+FdCtx *FdManager::Get(int fd, bool auto_create) {
+  FdCtx *ctx = GetSlot(fd, auto_create);
+  if (!ctx) {
     return nullptr;
   }
-  RWMutexType::ReadLock lock(mutex_);
-  if ((int)datas_.size() <= fd) {
-    if (auto_create == false) {
-      return nullptr;
+  if (ctx->IsInUse()) {
+    return ctx;
+  }
+  if (!auto_create) {
+    return nullptr;
+  }
+  return Claim(ctx, [ctx]() { ctx->Init(); });
+}
+
+FdCtx *FdManager::GetCreated(int fd) {
+  FdCtx *ctx = GetSlot(fd, true);
+  if (!ctx) {
+    return nullptr;
+  }
+  if (UNLIKELY(ctx->IsInUse())) {
+    DropStale(ctx);
+  }
+  return Claim(ctx, [ctx]() { ctx->Init(); });
+}
+
+FdCtx *FdManager::GetAccepted(int fd, int listen_fd, bool nonblock) {
+  FdCtx *listener = Get(listen_fd);
+  if (!listener || !listener->IsSocket()) {
+    return GetCreated(fd);
+  }
+  FdCtx *ctx = GetSlot(fd, true);
+  if (!ctx) {
+    return nullptr;
+  }
+  if (UNLIKELY(ctx->IsInUse())) {
+    DropStale(ctx);
+  }
+  bool is_stream = listener->IsStream();
+  return Claim(ctx, [ctx, is_stream, nonblock]() {
+    ctx->InitSocket(is_stream, nonblock);
+  });
+}
+
+template <class InitFunc>
+FdCtx *FdManager::Claim(FdCtx *ctx, InitFunc init) {
+  uint32_t state = ctx->state_.load(std::memory_order_acquire);
+  uint32_t claimed;
+  while (true) {
+    uint32_t flag = state & FdCtx::kStateMask;
+    if (flag == FdCtx::kInUse) {
+      return ctx;
     }
-  } else {
-    if (datas_[fd] || !auto_create) {
-      return datas_[fd];
+    if (flag == FdCtx::kIniting) {
+      // 其他线程正在初始化同一个fd，初始化只有几个系统调用，让出CPU等它完成
+      sched_yield();
+      state = ctx->state_.load(std::memory_order_acquire);
+      continue;
+    }
+    claimed = ((state & ~FdCtx::kStateMask) + FdCtx::kGenerationOne) |
+              FdCtx::kIniting;
+    if (ctx->state_.compare_exchange_weak(state, claimed,
+                                          std::memory_order_acquire,
+                                          std::memory_order_acquire)) {
+      break;
     }
   }
-  lock.unlock();
-
-  RWMutexType::WriteLock lock2(mutex_);
-  FdCtx::ptr ctx(new FdCtx(fd));
-  if (fd >= (int)datas_.size()) {
-    datas_.resize(fd * 1.5);
+  init();
+  // 初始化期间fd被Del时状态已经不是claimed，CAS失败，槽位保持kFree
+  uint32_t in_use = (claimed & ~FdCtx::kStateMask) | FdCtx::kInUse;
+  if (!ctx->state_.compare_exchange_strong(claimed, in_use,
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed)) {
+    return nullptr;
   }
-  datas_[fd] = ctx;
   return ctx;
 }
 
+void FdManager::DropStale(FdCtx *ctx) {
+  // 槽位上的事件可能由其他IOManager注册，CancelAll会转交给注册它的IOManager
+  IOManager *iom = IOManager::GetThis();
+  if (iom) {
+    iom->CancelAll(ctx->fd_);
+  }
+  Del(ctx->fd_);
+}
+
 void FdManager::Del(int fd) {
-  RWMutexType::WriteLock lock(mutex_);
-  if ((int)datas_.size() <= fd) {
+  FdCtx *ctx = GetSlot(fd, false);
+  if (!ctx) {
     return;
   }
-  datas_[fd].reset();
+  ctx->is_closed_.store(true, std::memory_order_release);
+  // 保留分配代数，只把状态改为kFree，正在初始化的线程据此发现fd已被关闭
+  uint32_t state = ctx->state_.load(std::memory_order_relaxed);
+  while (!ctx->state_.compare_exchange_weak(
+      state, (state & ~FdCtx::kStateMask) | FdCtx::kFree,
+      std::memory_order_release, std::memory_order_relaxed)) {
+  }
+}
+
+FdCtx *FdManager::GetSlot(int fd, bool auto_create) {
+  return auto_create ? table_.GetOrCreate(fd) : table_.Get(fd);
 }
 
 }  // namespace serverframework
@@ -6,26 +6,34 @@
 #ifndef FD_MANAGER_H
 #define FD_MANAGER_H
 
-#include <memory>
-#include <vector>
+#include <atomic>
 
-#include "util/singleton.h"
 #include "env/thread.h"
+#include "net/fd_table.h"
+#include "net/iomanager.h"
+#include "util/singleton.h"
 
 namespace serverframework {
 
 /**
  * @brief 文件句柄上下文类
  * @details 管理文件句柄类型(是否socket)
- *          是否阻塞,是否关闭,读/写超时时间
+ *          是否阻塞,是否关闭,读/写超时时间，以及IOManager使用的fd事件上下文。
+ *          FdCtx对象保存在FdManager的分段表中，一旦创建就不会释放，fd关闭后再次打开时复用同一个对象，
+ *          所以持有FdCtx指针不需要引用计数
  */
-class FdCtx : public std::enable_shared_from_this<FdCtx> {
+class FdCtx {
+  friend class FdManager;
+  friend class IOManager;
+
  public:
-  using ptr = std::shared_ptr<FdCtx>;
   /**
    * @brief 通过文件句柄构造FdCtx
+   * @details 只做最基本的初始化，由FdManager::Get(fd, true)调用Init()完成初始化
    */
   FdCtx(int fd);
+  FdCtx(const FdCtx &) = delete;
+  FdCtx &operator=(const FdCtx &) = delete;
   /**
    * @brief 析构函数
    */
@@ -36,15 +44,27 @@ class FdCtx : public std::enable_shared_from_this<FdCtx> {
    */
   bool IsInit() const { return is_init_; }
 
+  /**
+   * @brief 是否被FdManager分配使用
+   */
+  bool IsInUse() const {
+    return (state_.load(std::memory_order_acquire) & kStateMask) == kInUse;
+  }
+
   /**
    * @brief 是否socket
    */
   bool IsSocket() const { return is_socket_; }
 
+  /**
+   * @brief 是否流式socket(SOCK_STREAM)
+   */
+  bool IsStream() const { return is_stream_; }
+
   /**
    * @brief 是否已关闭
    */
-  bool IsClose() const { return is_closed_; }
+  bool IsClose() const { return is_closed_.load(std::memory_order_acquire); }
 
   /**
    * @brief 设置用户主动设置非阻塞
@@ -82,13 +102,52 @@ class FdCtx : public std::enable_shared_from_this<FdCtx> {
    */
   uint64_t GetTimeout(int type);
 
+  /**
+   * @brief 事件是否已知未就绪
+   * @details 边缘触发下，读写返回EAGAIN，或者流式socket的读写没有满足请求的长度，
+   *          说明内核缓冲区已经读空/写满，在下一次事件到来之前再做系统调用只会得到EAGAIN
+   * @param[in] event IOManager::Event
+   */
+  bool IsNotReady(uint32_t event) const {
+    return not_ready_.load(std::memory_order_relaxed) & event;
+  }
+
+  /**
+   * @brief 设置事件是否已知未就绪
+   * @param[in] event IOManager::Event
+   * @param[in] v 是否未就绪
+   */
+  void SetNotReady(uint32_t event, bool v) {
+    if (v) {
+      not_ready_.fetch_or(event, std::memory_order_relaxed);
+    } else if (not_ready_.load(std::memory_order_relaxed) & event) {
+      not_ready_.fetch_and(~event, std::memory_order_relaxed);
+    }
+  }
+
  private:
+  // state_的低2位是槽位状态，其余位是分配代数，每次抢占槽位加一
+  static const uint32_t kFree = 0;
+  static const uint32_t kIniting = 1;
+  static const uint32_t kInUse = 2;
+  static const uint32_t kStateMask = 3;
+  static const uint32_t kGenerationOne = 4;
+
   /**
    * @brief 初始化
    */
   bool Init();
 
+  /**
+   * @brief 按已知的socket类型初始化，跳过fstat和getsockopt
+   * @param[in] is_stream 是否流式socket
+   * @param[in] nonblock fd是否已经是O_NONBLOCK(如accept4带SOCK_NONBLOCK)，是则不再调用fcntl
+   */
+  void InitSocket(bool is_stream, bool nonblock);
+
  private:
+  // 槽位状态和分配代数，fd关闭后回到kFree，对象留待fd复用
+  std::atomic<uint32_t> state_;
   // 是否初始化
   bool is_init_ : 1;
   // 是否socket
@@ -97,22 +156,29 @@ class FdCtx : public std::enable_shared_from_this<FdCtx> {
   bool sys_nonblock_ : 1;
   // 是否用户主动设置非阻塞
   bool user_nonblock_ : 1;
-  // 是否关闭
-  bool is_closed_ : 1;
+  // 是否流式socket
+  bool is_stream_ : 1;
+  // 是否关闭，Del可能和其他线程的读取同时发生，不能和上面的位域共用内存
+  std::atomic<bool> is_closed_;
+  // 已知未就绪的事件(IOManager::Event)，只是跳过系统调用的提示，由hook的do_io维护
+  std::atomic<uint32_t> not_ready_;
   // 文件句柄
   int fd_;
   // 读超时时间毫秒
   uint64_t recv_timeout_;
   // 写超时时间毫秒
   uint64_t send_timeout_;
+  // IOManager的fd事件上下文，由IOManager管理
+  IOManager::FdContext event_ctx_;
 };
 
 /**
  * @brief 文件句柄管理类
+ * @details 所有fd的上下文保存在一张无锁分段表中，FdManager和IOManager共用这张表，
+ *          查找fd上下文不需要加锁
  */
 class FdManager {
  public:
-  using RWMutexType = RWMutex;
   /**
    * @brief 无参构造函数
    */
@@ -122,21 +188,72 @@ class FdManager {
    * @brief 获取/创建文件句柄类FdCtx
    * @param[in] fd 文件句柄
    * @param[in] auto_create 是否自动创建
-   * @return 返回对应文件句柄类FdCtx::ptr
+   * @return 返回对应文件句柄类FdCtx，fd未被分配使用且不自动创建时返回nullptr
    */
-  FdCtx::ptr Get(int fd, bool auto_create = false);
+  FdCtx *Get(int fd, bool auto_create = false);
+
+  /**
+   * @brief 为刚由内核分配的fd创建FdCtx
+   * @details fd号是新分配的，槽位仍在使用中说明之前使用这个号的fd没有经过hook的close关闭，
+   *          先取消留下的事件(唤醒等待者、清除常驻注册)再重新初始化
+   * @param[in] fd socket等系统调用返回的文件句柄
+   */
+  FdCtx *GetCreated(int fd);
+
+  /**
+   * @brief 为accept得到的fd创建FdCtx
+   * @details 新连接的socket类型与监听fd相同，不需要再fstat和getsockopt；
+   *          nonblock为true时也不需要fcntl。监听fd不是由hook创建时退化为GetCreated(fd)
+   * @param[in] fd accept返回的文件句柄
+   * @param[in] listen_fd 监听的文件句柄
+   * @param[in] nonblock fd是否已经是O_NONBLOCK
+   */
+  FdCtx *GetAccepted(int fd, int listen_fd, bool nonblock);
 
   /**
    * @brief 删除文件句柄类
+   * @details 只是把fd标记为未使用，FdCtx对象留在表中等待fd复用
    * @param[in] fd 文件句柄
    */
   void Del(int fd);
 
+  /**
+   * @brief 获取fd在表中的槽位，不论fd是否被FdManager分配使用
+   * @details 供IOManager访问任意fd(包括未经hook创建的fd)的事件上下文
+   * @param[in] fd 文件句柄
+   * @param[in] auto_create 槽位所在段未分配时是否分配
+   */
+  FdCtx *GetSlot(int fd, bool auto_create);
+
+  /**
+   * @brief 遍历表中所有已分配的槽位
+   */
+  template <class Func>
+  void ForEachSlot(Func cb) {
+    table_.ForEach(cb);
+  }
+
+ private:
+  /**
+   * @brief 抢占一个未使用的槽位并初始化
+   * @details 复用的槽位可能被多个线程同时Get(fd, true)，只有CAS抢到的线程调用init，
+   *          其他线程等它完成；初始化期间fd被Del时不再标记为使用中
+   * @param[in] ctx fd的槽位
+   * @param[in] init 初始化函数，抢到槽位后调用
+   * @return 初始化期间fd被Del时返回nullptr
+   */
+  template <class InitFunc>
+  FdCtx *Claim(FdCtx *ctx, InitFunc init);
+
+  /**
+   * @brief 回收未经hook关闭的fd留下的槽位
+   * @details 由当前线程的IOManager取消槽位上的事件，再把槽位标记为未使用
+   */
+  void DropStale(FdCtx *ctx);
+
  private:
-  // 读写锁
-  RWMutexType mutex_;
-  // 文件句柄集合
-  std::vector<FdCtx::ptr> datas_;
+  // 以fd为下标的无锁分段表
+  FdTable<FdCtx> table_;
 };
 
 // 文件句柄单例
@@ -0,0 +1,133 @@
+/**
+ * @file fd_table.h
+ * @brief 以fd为下标的无锁分段表
+ * @details 两级结构：第一级是固定长度的段指针数组，第二级是按需分配的段，每段保存kSegmentSize个元素。
+ *          段一旦分配就不再移动和释放(直到表析构)，所以扩容不会使已经拿到的元素指针失效，
+ *          查找只需要两次load，不需要加锁，也没有引用计数开销
+ */
+#ifndef FD_TABLE_H
+#define FD_TABLE_H
+
+#include <stddef.h>
+
+#include <atomic>
+#include <new>
+
+namespace serverframework {
+
+/**
+ * @brief 以fd为下标的无锁分段表
+ * @tparam T 元素类型，必须可以用fd构造：T(int fd)
+ * @tparam SegmentBits 每段元素个数的位数
+ * @tparam MaxSegments 最大段数，表的最大容量为MaxSegments << SegmentBits
+ */
+template <class T, size_t SegmentBits = 10, size_t MaxSegments = 4096>
+class FdTable {
+ public:
+  // 每段元素个数
+  static const size_t kSegmentSize = (size_t)1 << SegmentBits;
+  // 表的最大容量
+  static const size_t kCapacity = kSegmentSize * MaxSegments;
+
+  FdTable() {
+    for (size_t i = 0; i < MaxSegments; ++i) {
+      segments_[i].store(nullptr, std::memory_order_relaxed);
+    }
+  }
+
+  FdTable(const FdTable &) = delete;
+  FdTable &operator=(const FdTable &) = delete;
+
+  ~FdTable() {
+    for (size_t i = 0; i < MaxSegments; ++i) {
+      T *seg = segments_[i].load(std::memory_order_relaxed);
+      if (seg) {
+        FreeSegment(seg);
+      }
+    }
+  }
+
+  /**
+   * @brief 获取fd对应的元素，所在段未分配时返回nullptr
+   */
+  T *Get(int fd) const {
+    if (fd < 0 || (size_t)fd >= kCapacity) {
+      return nullptr;
+    }
+    T *seg = segments_[(size_t)fd >> SegmentBits].load(
+        std::memory_order_acquire);
+    return seg ? seg + ((size_t)fd & (kSegmentSize - 1)) : nullptr;
+  }
+
+  /**
+   * @brief 获取fd对应的元素，所在段未分配时分配该段
+   * @return fd超出表容量时返回nullptr
+   */
+  T *GetOrCreate(int fd) {
+    if (fd < 0 || (size_t)fd >= kCapacity) {
+      return nullptr;
+    }
+    size_t idx = (size_t)fd >> SegmentBits;
+    T *seg = segments_[idx].load(std::memory_order_acquire);
+    if (!seg) {
+      // 多个线程同时分配同一段时，只有一个CAS成功，其他线程释放自己分配的段
+      T *fresh = AllocSegment(idx << SegmentBits);
+      if (segments_[idx].compare_exchange_strong(seg, fresh,
+                                                 std::memory_order_acq_rel,
+                                                 std::memory_order_acquire)) {
+        seg = fresh;
+      } else {
+        FreeSegment(fresh);
+      }
+    }
+    return seg + ((size_t)fd & (kSegmentSize - 1));
+  }
+
+  /**
+   * @brief 遍历所有已分配段中的元素
+   * @param[in] cb 回调函数，参数为元素指针
+   */
+  template <class Func>
+  void ForEach(Func cb) {
+    for (size_t i = 0; i < MaxSegments; ++i) {
+      T *seg = segments_[i].load(std::memory_order_acquire);
+      if (!seg) {
+        continue;
+      }
+      for (size_t j = 0; j < kSegmentSize; ++j) {
+        cb(seg + j);
+      }
+    }
+  }
+
+ private:
+  /**
+   * @brief 分配一段，并以fd构造段内所有元素
+   * @param[in] base 段内第一个元素对应的fd
+   */
+  static T *AllocSegment(size_t base) {
+    T *seg = static_cast<T *>(::operator new(sizeof(T) * kSegmentSize));
+    for (size_t i = 0; i < kSegmentSize; ++i) {
+      new (seg + i) T((int)(base + i));
+    }
+    return seg;
+  }
+
+  /**
+   * @brief 析构并释放一段
+   */
+  static void FreeSegment(T *seg) {
+    for (size_t i = 0; i < kSegmentSize; ++i) {
+      seg[i].~T();
+    }
+    ::operator delete(seg);
+  }
+
+ private:
+  // 段指针数组
+  std::atomic<T *> segments_[MaxSegments];
+};
+
+}  // namespace serverframework
+
+#endif
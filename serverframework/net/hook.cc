@@ -2,6 +2,8 @@
 
 #include <dlfcn.h>
 
+#include <atomic>
+
 #include "config/config.h"
 #include "net/fd_manager.h"
 #include "fiber/fiber.h"
@@ -16,6 +18,11 @@ static serverframework::ConfigVar<int>::ptr g_tcp_connect_timeout =
     serverframework::Config::Lookup("tcp.connect.timeout", 5000,
                                     "tcp connect timeout");
 
+static serverframework::ConfigVar<bool>::ptr g_hook_readiness_hint =
+    serverframework::Config::Lookup(
+        "hook.readiness_hint", true,
+        "skip the read/write syscall when the socket is known not ready");
+
 static thread_local bool t_hook_enable = false;
 
 #define HOOK_FUN(XX) \
@@ -25,16 +32,21 @@ static thread_local bool t_hook_enable = false;
   XX(socket)         \
   XX(connect)        \
   XX(accept)         \
+  XX(accept4)        \
   XX(read)           \
   XX(readv)          \
   XX(recv)           \
   XX(recvfrom)       \
   XX(recvmsg)        \
+  XX(recvmmsg)       \
   XX(write)          \
   XX(writev)         \
   XX(send)           \
   XX(sendto)         \
   XX(sendmsg)        \
+  XX(sendmmsg)       \
+  XX(sendfile)       \
+  XX(splice)         \
   XX(close)          \
   XX(fcntl)          \
   XX(ioctl)          \
@@ -52,10 +64,12 @@ void hook_init() {
 }
 
 static uint64_t s_connect_timeout = -1;
+static bool s_readiness_hint = true;
 struct _HookIniter {
   _HookIniter() {
     hook_init();
     s_connect_timeout = g_tcp_connect_timeout->GetValue();
+    s_readiness_hint = g_hook_readiness_hint->GetValue();
 
     g_tcp_connect_timeout->AddListener(
         [](const int &old_value, const int &new_value) {
@@ -63,6 +77,12 @@ struct _HookIniter {
                              << " to " << new_value;
           s_connect_timeout = new_value;
         });
+    g_hook_readiness_hint->AddListener(
+        [](const bool &old_value, const bool &new_value) {
+          LOG_INFO(g_logger) << "hook readiness hint changed from "
+                             << old_value << " to " << new_value;
+          s_readiness_hint = new_value;
+        });
   }
 };
 
@@ -78,14 +98,57 @@ struct timer_info {
   int cancelled = 0;
 };
 
+/**
+ * @brief do_io等待IO事件时的超时状态
+ * @details 保存在do_io的栈上，协程挂起期间栈不会释放，超时回调只捕获它的地址，
+ *          std::function可以直接存下回调，不需要分配内存
+ */
+struct IoWait {
+  IoWait(serverframework::IOManager *i, int f, uint32_t e)
+      : iom(i), fd(f), event(e) {}
+  serverframework::IOManager *iom;
+  int fd;
+  uint32_t event;
+  // 超时回调的执行阶段：0未触发，1已超时，2回调执行完毕
+  std::atomic<int> state = {0};
+};
+
+static void OnIoTimeout(IoWait *wait) {
+  wait->state = 1;
+  wait->iom->CancelEvent(wait->fd,
+                         (serverframework::IOManager::Event)(wait->event));
+  wait->state = 2;
+}
+
+// 每个线程缓存一个IO超时定时器，等待结束后放回，下次等待时复用
+static thread_local serverframework::Timer::ptr t_io_timer;
+
+// do_io不维护就绪提示：系统调用返回EAGAIN或读写不满可能是另一个fd造成的
+static const size_t kNoHint = (size_t)-1;
+
+static size_t IovLen(const struct iovec *iov, int iovcnt) {
+  size_t len = 0;
+  for (int i = 0; i < iovcnt; ++i) {
+    len += iov[i].iov_len;
+  }
+  return len;
+}
+
+/**
+ * @brief hook的IO函数的通用实现
+ * @param[in] len 请求读写的字节数，用于判断流式socket是否已经读空/写满，0表示不做判断。
+ *                MSG_PEEK不会取走数据，读不满也不能说明已经读空，传0。
+ *                kNoHint表示既不跳过系统调用，也不标记未就绪
+ */
 template <typename OriginFun, typename... Args>
 static ssize_t do_io(int fd, OriginFun fun, const char *hook_fun_name,
-                     uint32_t event, int timeout_so, Args &&...args) {
+                     uint32_t event, int timeout_so, size_t len,
+                     Args &&...args) {
   if (!serverframework::t_hook_enable) {
     return fun(fd, std::forward<Args>(args)...);
   }
 
-  serverframework::FdCtx::ptr ctx =
+  serverframework::FdCtx *ctx =
       serverframework::FdMgr::GetInstance()->Get(fd);
   if (!ctx) {
     return fun(fd, std::forward<Args>(args)...);
@@ -101,53 +164,73 @@ static ssize_t do_io(int fd, OriginFun fun, const char *hook_fun_name,
   }
 
   uint64_t to = ctx->GetTimeout(timeout_so);
-  std::shared_ptr<timer_info> tinfo(new timer_info);
-
-retry:
-  ssize_t n = fun(fd, std::forward<Args>(args)...);
-  while (n == -1 && errno == EINTR) {
-    n = fun(fd, std::forward<Args>(args)...);
+  auto call = [&]() {
+    ssize_t rt = fun(fd, args...);
+    while (rt == -1 && errno == EINTR) {
+      rt = fun(fd, args...);
+    }
+    return rt;
+  };
+
+  ssize_t n = -1;
+  // 已知未就绪时跳过必然返回EAGAIN的系统调用，直接等待事件。
+  // 注册事件时内核会检查当前的就绪状态，提示过时也不会漏掉事件
+  bool use_hint = len != kNoHint;
+  if (use_hint && serverframework::s_readiness_hint &&
+      ctx->IsNotReady(event)) {
+    errno = EAGAIN;
+  } else {
+    n = call();
   }
-  if (n == -1 && errno == EAGAIN) {
+
+  while (n == -1 && errno == EAGAIN) {
+    if (use_hint) {
+      ctx->SetNotReady(event, true);
+    }
     serverframework::IOManager *iom = serverframework::IOManager::GetThis();
+    IoWait wait(iom, fd, event);
     serverframework::Timer::ptr timer;
-    std::weak_ptr<timer_info> winfo(tinfo);
-
     if (to != (uint64_t)-1) {
-      timer = iom->AddConditionTimer(
-          to,
-          [winfo, fd, iom, event]() {
-            auto t = winfo.lock();
-            if (!t || t->cancelled) {
-              return;
-            }
-            t->cancelled = ETIMEDOUT;
-            iom->CancelEvent(fd, (serverframework::IOManager::Event)(event));
-          },
-          winfo);
+      IoWait *w = &wait;
+      auto cb = [w]() { OnIoTimeout(w); };
+      if (t_io_timer && iom->RearmTimer(t_io_timer, to, cb)) {
+        timer.swap(t_io_timer);
+      } else {
+        timer = iom->AddTimer(to, cb);
+      }
     }
 
     int rt = iom->AddEvent(fd, (serverframework::IOManager::Event)(event));
     if (UNLIKELY(rt)) {
       LOG_ERROR(g_logger) << hook_fun_name << " AddEvent(" << fd << ", "
                           << event << ")";
-      if (timer) {
-        timer->Cancel();
-      }
-      return -1;
     } else {
       serverframework::Fiber::GetThis()->Yield();
-      if (timer) {
-        timer->Cancel();
-      }
-      if (tinfo->cancelled) {
-        errno = tinfo->cancelled;
-        return -1;
+    }
+    if (timer && !timer->Cancel()) {
+      // 定时器已经触发，回调引用了栈上的wait，必须等回调执行完才能返回
+      while (wait.state != 2) {
+        iom->Schedule(serverframework::Fiber::GetThis(),
+                      iom->GetAffinityThread());
+        serverframework::Fiber::GetThis()->Yield();
       }
-      goto retry;
     }
+    if (timer && !t_io_timer) {
+      t_io_timer.swap(timer);
+    }
+    if (UNLIKELY(rt)) {
+      return -1;
+    }
+    if (wait.state) {
+      errno = ETIMEDOUT;
+      return -1;
+    }
+    n = call();
   }
 
+  // 流式socket读写不满说明内核缓冲区已经读空/写满，边缘触发下要等下一次事件才会就绪
+  ctx->SetNotReady(event, use_hint && n > 0 && len && (size_t)n < len &&
+                              ctx->IsStream());
   return n;
 }
 
@@ -167,7 +250,7 @@ unsigned int sleep(unsigned int seconds) {
                 std::bind((void(serverframework::Scheduler::*)(
                               serverframework::Fiber::ptr, int thread)) &
                               serverframework::IOManager::Schedule,
-                          iom, fiber, -1));
+                          iom, fiber, iom->GetAffinityThread()));
   serverframework::Fiber::GetThis()->Yield();
   return 0;
 }
@@ -182,7 +265,7 @@ int usleep(useconds_t usec) {
                 std::bind((void(serverframework::Scheduler::*)(
                               serverframework::Fiber::ptr, int thread)) &
                               serverframework::IOManager::Schedule,
-                          iom, fiber, -1));
+                          iom, fiber, iom->GetAffinityThread()));
   serverframework::Fiber::GetThis()->Yield();
   return 0;
 }
@@ -199,7 +282,7 @@ int nanosleep(const struct timespec *req, struct timespec *rem) {
                 std::bind((void(serverframework::Scheduler::*)(
                               serverframework::Fiber::ptr, int thread)) &
                               serverframework::IOManager::Schedule,
-                          iom, fiber, -1));
+                          iom, fiber, iom->GetAffinityThread()));
   serverframework::Fiber::GetThis()->Yield();
   return 0;
 }
@@ -212,7 +295,7 @@ int socket(int domain, int type, int protocol) {
   if (fd == -1) {
     return fd;
   }
-  serverframework::FdMgr::GetInstance()->Get(fd, true);
+  serverframework::FdMgr::GetInstance()->GetCreated(fd);
   return fd;
 }
 
@@ -221,7 +304,7 @@ int connect_with_timeout(int fd, const struct sockaddr *addr, socklen_t addrlen,
   if (!serverframework::t_hook_enable) {
     return connect_f(fd, addr, addrlen);
   }
-  serverframework::FdCtx::ptr ctx =
+  serverframework::FdCtx *ctx =
       serverframework::FdMgr::GetInstance()->Get(fd);
   if (!ctx || ctx->IsClose()) {
     errno = EBADF;
@@ -299,63 +382,125 @@ int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
 
 int accept(int s, struct sockaddr *addr, socklen_t *addrlen) {
   int fd = do_io(s, accept_f, "accept", serverframework::IOManager::READ,
-                 SO_RCVTIMEO, addr, addrlen);
+                 SO_RCVTIMEO, 0, addr, addrlen);
   if (fd >= 0) {
-    serverframework::FdMgr::GetInstance()->Get(fd, true);
+    serverframework::FdMgr::GetInstance()->GetAccepted(fd, s, false);
+  }
+  return fd;
+}
+
+int accept4(int s, struct sockaddr *addr, socklen_t *addrlen, int flags) {
+  int fd = do_io(s, accept4_f, "accept4", serverframework::IOManager::READ,
+                 SO_RCVTIMEO, 0, addr, addrlen, flags);
+  if (fd >= 0) {
+    serverframework::FdMgr::GetInstance()->GetAccepted(fd, s,
+                                                      flags & SOCK_NONBLOCK);
   }
   return fd;
 }
 
 ssize_t read(int fd, void *buf, size_t count) {
   return do_io(fd, read_f, "read", serverframework::IOManager::READ,
-               SO_RCVTIMEO, buf, count);
+               SO_RCVTIMEO, count, buf, count);
 }
 
 ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
   return do_io(fd, readv_f, "readv", serverframework::IOManager::READ,
-               SO_RCVTIMEO, iov, iovcnt);
+               SO_RCVTIMEO, IovLen(iov, iovcnt), iov, iovcnt);
 }
 
 ssize_t recv(int sockfd, void *buf, size_t len, int flags) {
   return do_io(sockfd, recv_f, "recv", serverframework::IOManager::READ,
-               SO_RCVTIMEO, buf, len, flags);
+               SO_RCVTIMEO, flags & MSG_PEEK ? 0 : len, buf, len, flags);
 }
 
 ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags,
                  struct sockaddr *src_addr, socklen_t *addrlen) {
   return do_io(sockfd, recvfrom_f, "recvfrom", serverframework::IOManager::READ,
-               SO_RCVTIMEO, buf, len, flags, src_addr, addrlen);
+               SO_RCVTIMEO, flags & MSG_PEEK ? 0 : len, buf, len, flags, src_addr,
+               addrlen);
 }
 
 ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
   return do_io(sockfd, recvmsg_f, "recvmsg", serverframework::IOManager::READ,
-               SO_RCVTIMEO, msg, flags);
+               SO_RCVTIMEO,
+               flags & MSG_PEEK ? 0 : IovLen(msg->msg_iov, msg->msg_iovlen),
+               msg, flags);
+}
+
+int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags,
+             struct timespec *timeout) {
+  return do_io(sockfd, recvmmsg_f, "recvmmsg",
+               serverframework::IOManager::READ, SO_RCVTIMEO, 0, msgvec, vlen,
+               flags, timeout);
 }
 
 ssize_t write(int fd, const void *buf, size_t count) {
   return do_io(fd, write_f, "write", serverframework::IOManager::WRITE,
-               SO_SNDTIMEO, buf, count);
+               SO_SNDTIMEO, count, buf, count);
 }
 
 ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
   return do_io(fd, writev_f, "writev", serverframework::IOManager::WRITE,
-               SO_SNDTIMEO, iov, iovcnt);
+               SO_SNDTIMEO, IovLen(iov, iovcnt), iov, iovcnt);
 }
 
 ssize_t send(int s, const void *msg, size_t len, int flags) {
   return do_io(s, send_f, "send", serverframework::IOManager::WRITE,
-               SO_SNDTIMEO, msg, len, flags);
+               SO_SNDTIMEO, flags & MSG_ZEROCOPY ? 0 : len, msg, len, flags);
 }
 
 ssize_t sendto(int s, const void *msg, size_t len, int flags,
                const struct sockaddr *to, socklen_t tolen) {
   return do_io(s, sendto_f, "sendto", serverframework::IOManager::WRITE,
-               SO_SNDTIMEO, msg, len, flags, to, tolen);
+               SO_SNDTIMEO, flags & MSG_ZEROCOPY ? 0 : len, msg, len, flags, to,
+               tolen);
 }
 
 ssize_t sendmsg(int s, const struct msghdr *msg, int flags) {
+  // MSG_ZEROCOPY的发送在锁定内存或完成通知的配额用完时也会发送不满，不能说明已经写满
   return do_io(s, sendmsg_f, "sendmsg", serverframework::IOManager::WRITE,
-               SO_SNDTIMEO, msg, flags);
+               SO_SNDTIMEO,
+               flags & MSG_ZEROCOPY ? 0 : IovLen(msg->msg_iov, msg->msg_iovlen),
+               msg, flags);
+}
+
+int sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
+             int flags) {
+  return do_io(sockfd, sendmmsg_f, "sendmmsg",
+               serverframework::IOManager::WRITE, SO_SNDTIMEO, 0, msgvec, vlen,
+               flags);
+}
+
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
+  // 读到文件末尾时也会发送不满，只有返回EAGAIN说明socket写满
+  return do_io(out_fd, sendfile_f, "sendfile",
+               serverframework::IOManager::WRITE, SO_SNDTIMEO, 0, in_fd,
+               offset, count);
+}
+
+/**
+ * @brief 以写端为第一个参数调用splice，供do_io等待写端的写事件
+ */
+static ssize_t splice_out(int fd_out, int fd_in, loff_t *off_in,
+                          loff_t *off_out, size_t len, unsigned int flags) {
+  return splice_f(fd_in, off_in, fd_out, off_out, len, flags);
+}
+
+ssize_t splice(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out,
+               size_t len, unsigned int flags) {
+  // splice的两端有一端是管道，读端是socket时等待读事件，否则等待写端的写事件。
+  // 管道一端应使用SPLICE_F_NONBLOCK，并保证不会因为管道满/空返回EAGAIN
+  serverframework::FdCtx *ctx =
+      serverframework::t_hook_enable
+          ? serverframework::FdMgr::GetInstance()->Get(fd_in)
+          : nullptr;
+  if (ctx && ctx->IsSocket()) {
+    return do_io(fd_in, splice_f, "splice", serverframework::IOManager::READ,
+                 SO_RCVTIMEO, kNoHint, off_in, fd_out, off_out, len, flags);
+  }
+  return do_io(fd_out, splice_out, "splice", serverframework::IOManager::WRITE,
+               SO_SNDTIMEO, kNoHint, fd_in, off_in, off_out, len, flags);
 }
 
 int close(int fd) {
@@ -363,14 +508,11 @@ int close(int fd) {
     return close_f(fd);
   }
 
-  serverframework::FdCtx::ptr ctx =
-      serverframework::FdMgr::GetInstance()->Get(fd);
-  if (ctx) {
-    auto iom = serverframework::IOManager::GetThis();
-    if (iom) {
-      iom->CancelAll(fd);
-    }
-    serverframework::FdMgr::GetInstance()->Del(fd);
+  // fd事件上下文与FdCtx共用一张表，即使fd不是经由hook创建的，也要清除其事件
+  serverframework::FdMgr::GetInstance()->Del(fd);
+  auto iom = serverframework::IOManager::GetThis();
+  if (iom) {
+    return iom->Close(fd, close_f);
   }
   return close_f(fd);
 }
@@ -382,7 +524,7 @@ int fcntl(int fd, int cmd, ... /* arg */) {
     case F_SETFL: {
       int arg = va_arg(va, int);
       va_end(va);
-      serverframework::FdCtx::ptr ctx =
+      serverframework::FdCtx *ctx =
           serverframework::FdMgr::GetInstance()->Get(fd);
       if (!ctx || ctx->IsClose() || !ctx->IsSocket()) {
         return fcntl_f(fd, cmd, arg);
@@ -398,7 +540,7 @@ int fcntl(int fd, int cmd, ... /* arg */) {
     case F_GETFL: {
       va_end(va);
       int arg = fcntl_f(fd, cmd);
-      serverframework::FdCtx::ptr ctx =
+      serverframework::FdCtx *ctx =
           serverframework::FdMgr::GetInstance()->Get(fd);
       if (!ctx || ctx->IsClose() || !ctx->IsSocket()) {
         return arg;
@@ -462,7 +604,7 @@ int ioctl(int d, unsigned long int request, ...) {
 
   if (FIONBIO == request) {
     bool user_nonblock = !!*(int *)arg;
-    serverframework::FdCtx::ptr ctx =
+    serverframework::FdCtx *ctx =
         serverframework::FdMgr::GetInstance()->Get(d);
     if (!ctx || ctx->IsClose() || !ctx->IsSocket()) {
       return ioctl_f(d, request, arg);
@@ -484,7 +626,7 @@ int setsockopt(int sockfd, int level, int optname, const void *optval,
   }
   if (level == SOL_SOCKET) {
     if (optname == SO_RCVTIMEO || optname == SO_SNDTIMEO) {
-      serverframework::FdCtx::ptr ctx =
+      serverframework::FdCtx *ctx =
           serverframework::FdMgr::GetInstance()->Get(sockfd);
       if (ctx) {
         const timeval *v = (const timeval *)optval;
@@ -9,6 +9,7 @@
 #include <fcntl.h>
 #include <stdint.h>
 #include <sys/ioctl.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <time.h>
@@ -48,6 +49,10 @@ extern connect_fun connect_f;
 typedef int (*accept_fun)(int s, struct sockaddr *addr, socklen_t *addrlen);
 extern accept_fun accept_f;
 
+typedef int (*accept4_fun)(int s, struct sockaddr *addr, socklen_t *addrlen,
+                           int flags);
+extern accept4_fun accept4_f;
+
 // read
 typedef ssize_t (*read_fun)(int fd, void *buf, size_t count);
 extern read_fun read_f;
@@ -65,6 +70,11 @@ extern recvfrom_fun recvfrom_f;
 typedef ssize_t (*recvmsg_fun)(int sockfd, struct msghdr *msg, int flags);
 extern recvmsg_fun recvmsg_f;
 
+typedef int (*recvmmsg_fun)(int sockfd, struct mmsghdr *msgvec,
+                            unsigned int vlen, int flags,
+                            struct timespec *timeout);
+extern recvmmsg_fun recvmmsg_f;
+
 // write
 typedef ssize_t (*write_fun)(int fd, const void *buf, size_t count);
 extern write_fun write_f;
@@ -82,6 +92,19 @@ extern sendto_fun sendto_f;
 typedef ssize_t (*sendmsg_fun)(int s, const struct msghdr *msg, int flags);
 extern sendmsg_fun sendmsg_f;
 
+typedef int (*sendmmsg_fun)(int sockfd, struct mmsghdr *msgvec,
+                            unsigned int vlen, int flags);
+extern sendmmsg_fun sendmmsg_f;
+
+// zero copy
+typedef ssize_t (*sendfile_fun)(int out_fd, int in_fd, off_t *offset,
+                                size_t count);
+extern sendfile_fun sendfile_f;
+
+typedef ssize_t (*splice_fun)(int fd_in, loff_t *off_in, int fd_out,
+                              loff_t *off_out, size_t len, unsigned int flags);
+extern splice_fun splice_f;
+
 typedef int (*close_fun)(int fd);
 extern close_fun close_f;
 
@@ -6,16 +6,34 @@
 #include "net/iomanager.h"
 
 #include <fcntl.h>      // for fcntl()
+#include <limits.h>     // for INT_MAX
 #include <sys/epoll.h>  // for epoll_xxx()
+#include <sys/eventfd.h>  // for eventfd()
 #include <unistd.h>     // for pipe()
 
+#include <algorithm>
+
+#include "config/config.h"
 #include "log/log.h"
+#include "net/fd_manager.h"
+#include "util/clock.h"
 #include "util/macro.h"
 
 namespace serverframework {
 
 static serverframework::Logger::ptr g_logger = LOG_NAME("system");
 
+static serverframework::ConfigVar<bool>::ptr g_iomanager_persistent_events =
+    serverframework::Config::Lookup("iomanager.persistent_events", false,
+                                    "keep fds registered in epoll for their "
+                                    "lifetime with EPOLLIN|EPOLLOUT|EPOLLET");
+
+static serverframework::ConfigVar<bool>::ptr g_iomanager_affinity =
+    serverframework::Config::Lookup(
+        "iomanager.affinity", false,
+        "give every thread its own epoll and keep each fd and the fibers "
+        "it wakes on the thread that first waits on it");
+
 enum EpollCtlOp {};
 
 static std::ostream &operator<<(std::ostream &os, const EpollCtlOp &op) {
@@ -92,17 +110,76 @@ void IOManager::FdContext::TriggerEvent(IOManager::Event event) {
   events = (Event)(events & ~event);
   // 调度对应的协程
   EventContext &ctx = GetEventContext(event);
+  // 亲和模式下回到fd所在epoll的线程执行
+  int pin = ctx.scheduler == owner ? thread : -1;
   if (ctx.cb) {
-    ctx.scheduler->Schedule(ctx.cb);
+    ctx.scheduler->Schedule(ctx.cb, pin);
   } else {
-    ctx.scheduler->Schedule(ctx.fiber);
+    ctx.scheduler->Schedule(ctx.fiber, pin);
   }
   ResetEventContext(ctx);
   return;
 }
 
+/**
+ * @brief 以微秒精度等待epoll事件
+ * @details 优先使用epoll_pwait2(Linux 5.11+)，内核不支持时退化为epoll_wait，超时时间向上取整到毫秒
+ * @param[in] timeout_us 超时时间(微秒)，~0ull表示一直阻塞
+ */
+static int EpollWaitUS(int epfd, epoll_event *events, int maxevents,
+                       uint64_t timeout_us) {
+#if defined(__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 35))
+  static std::atomic<bool> s_has_epoll_pwait2 = {true};
+  if (s_has_epoll_pwait2) {
+    struct timespec ts;
+    struct timespec *pts = nullptr;
+    if (timeout_us != ~0ull) {
+      ts.tv_sec = timeout_us / 1000000;
+      ts.tv_nsec = (timeout_us % 1000000) * 1000;
+      pts = &ts;
+    }
+    int rt = epoll_pwait2(epfd, events, maxevents, pts, nullptr);
+    if (rt >= 0 || errno != ENOSYS) {
+      return rt;
+    }
+    s_has_epoll_pwait2 = false;
+  }
+#endif
+  int timeout_ms = -1;
+  if (timeout_us != ~0ull) {
+    timeout_ms = (int)std::min<uint64_t>((timeout_us + 999) / 1000, INT_MAX);
+  }
+  return epoll_wait(epfd, events, maxevents, timeout_ms);
+}
+
 IOManager::IOManager(size_t threads, bool use_caller, const std::string &name)
-    : Scheduler(threads, use_caller, name) {
+    : Scheduler(threads, use_caller, name), TimerManager(threads) {
+  persistent_events_ = g_iomanager_persistent_events->GetValue();
+  affinity_ = g_iomanager_affinity->GetValue() && threads > 1;
+
+  if (affinity_) {
+    // 每个调度线程一个epoll，用自己的eventfd唤醒
+    for (size_t i = 0; i < threads; ++i) {
+      std::unique_ptr<ThreadContext> ctx(new ThreadContext);
+      ctx->epfd = epoll_create(5000);
+      ASSERT(ctx->epfd > 0);
+      ctx->tickle_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      ASSERT(ctx->tickle_fd >= 0);
+      epoll_event event;
+      memset(&event, 0, sizeof(epoll_event));
+      event.events = EPOLLIN | EPOLLET;
+      event.data.fd = ctx->tickle_fd;
+      int rt = epoll_ctl(ctx->epfd, EPOLL_CTL_ADD, ctx->tickle_fd, &event);
+      ASSERT(!rt);
+      thread_ctxs_.push_back(std::move(ctx));
+    }
+    epfd_ = -1;
+    tickle_fds_[0] = tickle_fds_[1] = -1;
+    Start();
+    return;
+  }
+
   epfd_ = epoll_create(5000);
   ASSERT(epfd_ > 0);
 
@@ -122,51 +199,95 @@ IOManager::IOManager(size_t threads, bool use_caller, const std::string &name)
   rt = epoll_ctl(epfd_, EPOLL_CTL_ADD, tickle_fds_[0], &event);
   ASSERT(!rt);
 
-  ContextResize(32);
-
   Start();
 }
 
 IOManager::~IOManager() {
   Stop();
-  close(epfd_);
-  close(tickle_fds_[0]);
-  close(tickle_fds_[1]);
+  if (affinity_) {
+    for (auto &ctx : thread_ctxs_) {
+      close(ctx->epfd);
+      close(ctx->tickle_fd);
+    }
+  } else {
+    close(epfd_);
+    close(tickle_fds_[0]);
+    close(tickle_fds_[1]);
+  }
 
-  for (size_t i = 0; i < fd_contexts_.size(); ++i) {
-    if (fd_contexts_[i]) {
-      delete fd_contexts_[i];
+  // fd事件上下文由所有IOManager共用，清除仍然指向本IOManager的注册信息
+  FdMgr::GetInstance()->ForEachSlot([this](FdCtx *ctx) {
+    FdContext *fd_ctx = &ctx->event_ctx_;
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    if (fd_ctx->owner != this) {
+      return;
     }
+    fd_ctx->ResetEventContext(fd_ctx->read);
+    fd_ctx->ResetEventContext(fd_ctx->write);
+    fd_ctx->events = NONE;
+    fd_ctx->registered = false;
+    fd_ctx->ready = NONE;
+    fd_ctx->hangup = NONE;
+    fd_ctx->errqueue_cb = nullptr;
+    fd_ctx->owner = nullptr;
+    fd_ctx->epfd = -1;
+    fd_ctx->thread = -1;
+  });
+}
+
+int IOManager::GetAffinityThread() const {
+  if (!affinity_ || Scheduler::GetThis() != this) {
+    return -1;
   }
+  return serverframework::GetThreadId();
 }
 
-void IOManager::ContextResize(size_t size) {
-  fd_contexts_.resize(size);
+void IOManager::BindEpoll(FdContext *fd_ctx) {
+  if (!affinity_) {
+    fd_ctx->epfd = epfd_;
+    fd_ctx->thread = -1;
+    return;
+  }
+  int index = Scheduler::GetThis() == this ? GetThreadIndex() : -1;
+  if (index < 0) {
+    index = next_thread_++ % thread_ctxs_.size();
+  }
+  fd_ctx->epfd = thread_ctxs_[index]->epfd;
+  fd_ctx->thread = GetThreadIds()[index];
+}
 
-  for (size_t i = 0; i < fd_contexts_.size(); ++i) {
-    if (!fd_contexts_[i]) {
-      fd_contexts_[i] = new FdContext;
-      fd_contexts_[i]->fd = i;
-    }
+IOManager::FdContext *IOManager::GetFdContext(int fd, bool auto_create) {
+  FdCtx *ctx = FdMgr::GetInstance()->GetSlot(fd, auto_create);
+  return ctx ? &ctx->event_ctx_ : nullptr;
+}
+
+IOManager *IOManager::ForeignOwner(FdContext *fd_ctx) const {
+  if (fd_ctx->owner == this ||
+      (!fd_ctx->events && !fd_ctx->registered && !fd_ctx->errqueue_cb)) {
+    return nullptr;
   }
+  return fd_ctx->owner;
 }
 
 int IOManager::AddEvent(int fd, Event event, std::function<void()> cb) {
   // 找到fd对应的FdContext，如果不存在，那就分配一个
-  FdContext *fd_ctx = nullptr;
-  RWMutexType::ReadLock lock(mutex_);
-  if ((int)fd_contexts_.size() > fd) {
-    fd_ctx = fd_contexts_[fd];
-    lock.unlock();
-  } else {
-    lock.unlock();
-    RWMutexType::WriteLock lock2(mutex_);
-    ContextResize(fd * 1.5);
-    fd_ctx = fd_contexts_[fd];
+  FdContext *fd_ctx = GetFdContext(fd, true);
+  if (UNLIKELY(!fd_ctx)) {
+    LOG_ERROR(g_logger) << "AddEvent fd=" << fd << " out of range";
+    return -1;
   }
 
-  // 同一个fd不允许重复添加相同的事件
   FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+  // 同一时间fd的事件只能由一个IOManager管理
+  if (UNLIKELY(ForeignOwner(fd_ctx))) {
+    LOG_ERROR(g_logger) << "AddEvent fd=" << fd
+                        << " is registered by IOManager "
+                        << fd_ctx->owner->GetName();
+    return -1;
+  }
+  fd_ctx->owner = this;
+
+  // 同一个fd不允许重复添加相同的事件
   if (UNLIKELY(fd_ctx->events & event)) {
     LOG_ERROR(g_logger) << "AddEvent assert fd=" << fd
                         << " event=" << (EPOLL_EVENTS)event
@@ -174,15 +295,30 @@ int IOManager::AddEvent(int fd, Event event, std::function<void()> cb) {
     ASSERT(!(fd_ctx->events & event));
   }
 
+  if (persistent_events_) {
+    return AddEventPersistent(fd_ctx, event, std::move(cb));
+  }
+
   // 将新的事件加入epoll_wait，使用epoll_event的私有指针存储FdContext的位置
-  int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+  // 监听错误队列的fd即使没有事件也在epoll中
+  int op =
+      fd_ctx->events || fd_ctx->errqueue_cb ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+  if (op == EPOLL_CTL_ADD) {
+    BindEpoll(fd_ctx);
+  }
   epoll_event epevent;
   epevent.events = EPOLLET | fd_ctx->events | event;
   epevent.data.ptr = fd_ctx;
 
-  int rt = epoll_ctl(epfd_, op, fd, &epevent);
+  int rt = epoll_ctl(fd_ctx->epfd, op, fd, &epevent);
+  if (rt && op == EPOLL_CTL_MOD && errno == ENOENT) {
+    // 之前的fd未经hook关闭，内核已经把它移出epoll，fd号复用后槽位仍留着旧的注册，重新添加
+    op = EPOLL_CTL_ADD;
+    BindEpoll(fd_ctx);
+    rt = epoll_ctl(fd_ctx->epfd, op, fd, &epevent);
+  }
   if (rt) {
-    LOG_ERROR(g_logger) << "epoll_ctl(" << epfd_ << ", " << (EpollCtlOp)op
+    LOG_ERROR(g_logger) << "epoll_ctl(" << fd_ctx->epfd << ", " << (EpollCtlOp)op
                         << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events
                         << "):" << rt << " (" << errno << ") ("
                         << strerror(errno)
@@ -211,30 +347,92 @@ int IOManager::AddEvent(int fd, Event event, std::function<void()> cb) {
   return 0;
 }
 
+int IOManager::RegisterPersistent(FdContext *fd_ctx) {
+  // 整个生命周期只注册一次，读写事件都关注，后续不再修改
+  if (fd_ctx->registered) {
+    return 0;
+  }
+  BindEpoll(fd_ctx);
+  epoll_event epevent;
+  epevent.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  epevent.data.ptr = fd_ctx;
+  int op = EPOLL_CTL_ADD;
+  int rt = epoll_ctl(fd_ctx->epfd, op, fd_ctx->fd, &epevent);
+  if (rt && errno == EEXIST) {
+    // fd被dup或者之前未经CancelAll关闭，沿用已有注册
+    op = EPOLL_CTL_MOD;
+    rt = epoll_ctl(fd_ctx->epfd, op, fd_ctx->fd, &epevent);
+  }
+  if (rt) {
+    LOG_ERROR(g_logger) << "epoll_ctl(" << fd_ctx->epfd << ", " << (EpollCtlOp)op
+                        << ", " << fd_ctx->fd << ", "
+                        << (EPOLL_EVENTS)epevent.events << "):" << rt << " ("
+                        << errno << ") (" << strerror(errno) << ")";
+    return -1;
+  }
+  // 注册时如果fd已经就绪，内核会立即上报一次事件，不会丢失边沿
+  fd_ctx->registered = true;
+  return 0;
+}
+
+int IOManager::AddEventPersistent(FdContext *fd_ctx, Event event,
+                                  std::function<void()> cb) {
+  if (RegisterPersistent(fd_ctx)) {
+    return -1;
+  }
+
+  ++pending_event_count_;
+  fd_ctx->events = (Event)(fd_ctx->events | event);
+  FdContext::EventContext &event_ctx = fd_ctx->GetEventContext(event);
+  ASSERT(!event_ctx.scheduler && !event_ctx.fiber && !event_ctx.cb);
+  event_ctx.scheduler = Scheduler::GetThis();
+  if (cb) {
+    event_ctx.cb.swap(cb);
+  } else {
+    event_ctx.fiber = Fiber::GetThis();
+    ASSERT2(event_ctx.fiber->GetState() == Fiber::RUNNING,
+            "state=" << event_ctx.fiber->GetState());
+  }
+
+  // 事件在没有等待者时已经就绪，或者对端已经关闭，直接完成，不需要等待下一个边沿
+  if ((fd_ctx->ready | fd_ctx->hangup) & event) {
+    fd_ctx->ready = (Event)(fd_ctx->ready & ~event);
+    fd_ctx->TriggerEvent(event);
+    --pending_event_count_;
+  }
+  return 0;
+}
+
 bool IOManager::DelEvent(int fd, Event event) {
   // 找到fd对应的FdContext
-  RWMutexType::ReadLock lock(mutex_);
-  if ((int)fd_contexts_.size() <= fd) {
+  FdContext *fd_ctx = GetFdContext(fd, false);
+  if (!fd_ctx) {
     return false;
   }
-  FdContext *fd_ctx = fd_contexts_[fd];
-  lock.unlock();
 
   FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+  // fd的事件由其他IOManager注册时，交给对应的IOManager处理
+  IOManager *owner = ForeignOwner(fd_ctx);
+  if (owner) {
+    lock2.unlock();
+    return owner->DelEvent(fd, event);
+  }
   if (UNLIKELY(!(fd_ctx->events & event))) {
     return false;
   }
 
   // 清除指定的事件，表示不关心这个事件了，如果清除之后结果为0，则从epoll_wait中删除该文件描述符
+  // 常驻注册模式下fd的注册保持不变，只清除事件上下文
   Event new_events = (Event)(fd_ctx->events & ~event);
-  int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+  int op =
+      new_events || fd_ctx->errqueue_cb ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
   epoll_event epevent;
   epevent.events = EPOLLET | new_events;
   epevent.data.ptr = fd_ctx;
 
-  int rt = epoll_ctl(epfd_, op, fd, &epevent);
+  int rt = persistent_events_ ? 0 : epoll_ctl(fd_ctx->epfd, op, fd, &epevent);
   if (rt) {
-    LOG_ERROR(g_logger) << "epoll_ctl(" << epfd_ << ", " << (EpollCtlOp)op
+    LOG_ERROR(g_logger) << "epoll_ctl(" << fd_ctx->epfd << ", " << (EpollCtlOp)op
                         << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events
                         << "):" << rt << " (" << errno << ") ("
                         << strerror(errno) << ")";
@@ -252,28 +450,33 @@ bool IOManager::DelEvent(int fd, Event event) {
 
 bool IOManager::CancelEvent(int fd, Event event) {
   // 找到fd对应的FdContext
-  RWMutexType::ReadLock lock(mutex_);
-  if ((int)fd_contexts_.size() <= fd) {
+  FdContext *fd_ctx = GetFdContext(fd, false);
+  if (!fd_ctx) {
     return false;
   }
-  FdContext *fd_ctx = fd_contexts_[fd];
-  lock.unlock();
 
   FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+  // fd的事件由其他IOManager注册时，交给对应的IOManager处理
+  IOManager *owner = ForeignOwner(fd_ctx);
+  if (owner) {
+    lock2.unlock();
+    return owner->CancelEvent(fd, event);
+  }
   if (UNLIKELY(!(fd_ctx->events & event))) {
     return false;
   }
 
-  // 删除事件
+  // 删除事件，常驻注册模式下不修改epoll注册
   Event new_events = (Event)(fd_ctx->events & ~event);
-  int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+  int op =
+      new_events || fd_ctx->errqueue_cb ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
   epoll_event epevent;
   epevent.events = EPOLLET | new_events;
   epevent.data.ptr = fd_ctx;
 
-  int rt = epoll_ctl(epfd_, op, fd, &epevent);
+  int rt = persistent_events_ ? 0 : epoll_ctl(fd_ctx->epfd, op, fd, &epevent);
   if (rt) {
-    LOG_ERROR(g_logger) << "epoll_ctl(" << epfd_ << ", " << (EpollCtlOp)op
+    LOG_ERROR(g_logger) << "epoll_ctl(" << fd_ctx->epfd << ", " << (EpollCtlOp)op
                         << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events
                         << "):" << rt << " (" << errno << ") ("
                         << strerror(errno) << ")";
@@ -289,15 +492,40 @@ bool IOManager::CancelEvent(int fd, Event event) {
 
 bool IOManager::CancelAll(int fd) {
   // 找到fd对应的FdContext
-  RWMutexType::ReadLock lock(mutex_);
-  if ((int)fd_contexts_.size() <= fd) {
+  FdContext *fd_ctx = GetFdContext(fd, false);
+  if (!fd_ctx) {
     return false;
   }
-  FdContext *fd_ctx = fd_contexts_[fd];
-  lock.unlock();
 
   FdContext::MutexType::Lock lock2(fd_ctx->mutex);
-  if (!fd_ctx->events) {
+  // fd的事件由其他IOManager注册时，交给对应的IOManager处理
+  IOManager *owner = ForeignOwner(fd_ctx);
+  if (owner) {
+    lock2.unlock();
+    return owner->CancelAll(fd);
+  }
+  return CancelAllLocked(fd_ctx);
+}
+
+int IOManager::Close(int fd, int (*close_fun)(int)) {
+  FdContext *fd_ctx = GetFdContext(fd, false);
+  if (!fd_ctx) {
+    return close_fun(fd);
+  }
+
+  FdContext::MutexType::Lock lock(fd_ctx->mutex);
+  IOManager *owner = ForeignOwner(fd_ctx);
+  if (owner) {
+    lock.unlock();
+    return owner->Close(fd, close_fun);
+  }
+  CancelAllLocked(fd_ctx);
+  return close_fun(fd);
+}
+
+bool IOManager::CancelAllLocked(FdContext *fd_ctx) {
+  int fd = fd_ctx->fd;
+  if (!fd_ctx->events && !fd_ctx->registered && !fd_ctx->errqueue_cb) {
     return false;
   }
 
@@ -307,9 +535,20 @@ bool IOManager::CancelAll(int fd) {
   epevent.events = 0;
   epevent.data.ptr = fd_ctx;
 
-  int rt = epoll_ctl(epfd_, op, fd, &epevent);
+  int rt = epoll_ctl(fd_ctx->epfd, op, fd, &epevent);
+  fd_ctx->errqueue_cb = nullptr;
+  if (fd_ctx->registered) {
+    // 常驻注册的fd在这里结束生命周期，fd可能已经被关闭，忽略删除失败
+    fd_ctx->registered = false;
+    fd_ctx->ready = NONE;
+    fd_ctx->hangup = NONE;
+    rt = 0;
+  } else if (rt && (errno == ENOENT || errno == EBADF)) {
+    // fd已经未经hook关闭，内核移除了注册，只需要唤醒留下的等待者
+    rt = 0;
+  }
   if (rt) {
-    LOG_ERROR(g_logger) << "epoll_ctl(" << epfd_ << ", " << (EpollCtlOp)op
+    LOG_ERROR(g_logger) << "epoll_ctl(" << fd_ctx->epfd << ", " << (EpollCtlOp)op
                         << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events
                         << "):" << rt << " (" << errno << ") ("
                         << strerror(errno) << ")";
@@ -330,6 +569,44 @@ bool IOManager::CancelAll(int fd) {
   return true;
 }
 
+int IOManager::WatchErrQueue(int fd, std::function<void()> cb) {
+  FdContext *fd_ctx = GetFdContext(fd, true);
+  if (UNLIKELY(!fd_ctx)) {
+    LOG_ERROR(g_logger) << "WatchErrQueue fd=" << fd << " out of range";
+    return -1;
+  }
+
+  FdContext::MutexType::Lock lock(fd_ctx->mutex);
+  if (UNLIKELY(ForeignOwner(fd_ctx))) {
+    LOG_ERROR(g_logger) << "WatchErrQueue fd=" << fd
+                        << " is registered by IOManager "
+                        << fd_ctx->owner->GetName();
+    return -1;
+  }
+
+  if (persistent_events_) {
+    if (RegisterPersistent(fd_ctx)) {
+      return -1;
+    }
+  } else if (!fd_ctx->events && !fd_ctx->errqueue_cb) {
+    // 不关注读写事件，EPOLLERR总是会上报
+    epoll_event epevent;
+    epevent.events = EPOLLET;
+    epevent.data.ptr = fd_ctx;
+    BindEpoll(fd_ctx);
+    int rt = epoll_ctl(fd_ctx->epfd, EPOLL_CTL_ADD, fd, &epevent);
+    if (rt) {
+      LOG_ERROR(g_logger) << "epoll_ctl(" << fd_ctx->epfd << ", EPOLL_CTL_ADD, " << fd
+                          << ", EPOLLET):" << rt << " (" << errno << ") ("
+                          << strerror(errno) << ")";
+      return -1;
+    }
+  }
+  fd_ctx->owner = this;
+  fd_ctx->errqueue_cb.swap(cb);
+  return 0;
+}
+
 IOManager *IOManager::GetThis() {
   return dynamic_cast<IOManager *>(Scheduler::GetThis());
 }
@@ -344,20 +621,43 @@ void IOManager::Tickle() {
   if (!HasIdleThreads()) {
     return;
   }
+  if (affinity_) {
+    // 优先唤醒阻塞在epoll_wait上的线程，找不到时轮流唤醒一个
+    size_t n = thread_ctxs_.size();
+    size_t start = next_tickle_++;
+    for (size_t i = 0; i < n; ++i) {
+      if (thread_ctxs_[(start + i) % n]->idle) {
+        TickleThread((start + i) % n);
+        return;
+      }
+    }
+    TickleThread(start % n);
+    return;
+  }
   int rt = write(tickle_fds_[1], "T", 1);
   ASSERT(rt == 1);
 }
 
+void IOManager::TickleThread(size_t index) {
+  if (!affinity_) {
+    Tickle();
+    return;
+  }
+  // eventfd的计数会累加，线程忙时多次唤醒只让它下一次epoll_wait立即返回一次
+  uint64_t one = 1;
+  int rt = write(thread_ctxs_[index]->tickle_fd, &one, sizeof(one));
+  ASSERT(rt == sizeof(one));
+}
+
 bool IOManager::Stopping() {
-  uint64_t timeout = 0;
-  return Stopping(timeout);
+  // 对于IOManager而言，必须等所有待调度的IO事件都执行完了才可以退出
+  // 增加定时器功能后，还应该保证所有线程的分片中都没有剩余的定时器待触发
+  return !HasTimer() && pending_event_count_ == 0 && Scheduler::Stopping();
 }
 
 bool IOManager::Stopping(uint64_t &timeout) {
-  // 对于IOManager而言，必须等所有待调度的IO事件都执行完了才可以退出
-  // 增加定时器功能后，还应该保证没有剩余的定时器待触发
   timeout = GetNextTimer();
-  return timeout == ~0ull && pending_event_count_ == 0 && Scheduler::Stopping();
+  return Stopping();
 }
 
 /**
@@ -374,38 +674,60 @@ void IOManager::Idle() {
   std::shared_ptr<epoll_event> shared_events(
       events, [](epoll_event *ptr) { delete[] ptr; });
 
+  // 亲和模式下等待本线程自己的epoll
+  ThreadContext *local = affinity_ ? thread_ctxs_[GetThreadIndex()].get()
+                                   : nullptr;
+  int epfd = local ? local->epfd : epfd_;
+  int tickle_fd = local ? local->tickle_fd : tickle_fds_[0];
+  // 亲和模式下本线程分片中到期的定时器回调也在本线程执行
+  int pin = local ? serverframework::GetThreadId() : -1;
+
   while (true) {
     // 获取下一个定时器的超时时间，顺便判断调度器是否停止
     uint64_t next_timeout = 0;
     if (UNLIKELY(Stopping(next_timeout))) {
       LOG_DEBUG(g_logger) << "name=" << GetName() << "Idle Stopping exit";
+      // 定时器分散在各线程的分片中，其他线程可能在最后一个定时器触发前已经阻塞在epoll_wait上，逐个唤醒
+      if (local) {
+        for (size_t i = 0; i < thread_ctxs_.size(); ++i) {
+          if (thread_ctxs_[i].get() != local) {
+            TickleThread(i);
+          }
+        }
+      } else {
+        Tickle();
+      }
+      Clock::Invalidate();
       break;
     }
 
     // 阻塞在epoll_wait上，等待事件发生或定时器超时
+    // 没有定时器时一直阻塞，新任务、其他线程投递的更早的定时器和停止调度都会通过tickle唤醒
     int rt = 0;
+    if (local) {
+      local->idle = true;
+    }
     do {
-      // 默认超时时间5秒，如果下一个定时器的超时时间大于5秒，仍以5秒来计算超时，避免定时器超时时间太大时，epoll_wait一直阻塞
-      static const int MAX_TIMEOUT = 5000;
-      if (next_timeout != ~0ull) {
-        next_timeout = std::min((int)next_timeout, MAX_TIMEOUT);
-      } else {
-        next_timeout = MAX_TIMEOUT;
-      }
-      rt = epoll_wait(epfd_, events, MAX_EVNETS, (int)next_timeout);
+      rt = EpollWaitUS(epfd, events, MAX_EVNETS, next_timeout);
       if (rt < 0 && errno == EINTR) {
         continue;
       } else {
         break;
       }
     } while (true);
+    if (local) {
+      local->idle = false;
+    }
+
+    // 每轮循环刷新一次本线程缓存的时间戳，定时器和本轮调度的任务都使用它
+    Clock::Update();
 
     // 收集所有已超时的定时器，执行回调函数
     std::vector<std::function<void()>> cbs;
     ListExpiredCb(cbs);
     if (!cbs.empty()) {
       for (const auto &cb : cbs) {
-        Schedule(cb);
+        Schedule(cb, pin);
       }
       cbs.clear();
     }
@@ -413,16 +735,23 @@ void IOManager::Idle() {
     // 遍历所有发生的事件，根据epoll_event的私有指针找到对应的FdContext，进行事件处理
     for (int i = 0; i < rt; ++i) {
       epoll_event &event = events[i];
-      if (event.data.fd == tickle_fds_[0]) {
+      if (event.data.fd == tickle_fd) {
         // ticklefd[0]用于通知协程调度，这时只需要把管道里的内容读完即可
         uint8_t dummy[256];
-        while (read(tickle_fds_[0], dummy, sizeof(dummy)) > 0)
+        while (read(tickle_fd, dummy, sizeof(dummy)) > 0)
           ;
         continue;
       }
 
       FdContext *fd_ctx = (FdContext *)event.data.ptr;
       FdContext::MutexType::Lock lock(fd_ctx->mutex);
+      if ((event.events & EPOLLERR) && fd_ctx->errqueue_cb) {
+        // 错误队列中有通知，调度回调读取。没有EPOLLHUP时不是连接错误，不唤醒读写事件
+        Schedule(fd_ctx->errqueue_cb, fd_ctx->thread);
+        if (!(event.events & EPOLLHUP)) {
+          event.events &= ~EPOLLERR;
+        }
+      }
       /**
        * EPOLLERR: 出错，比如写读端已经关闭的pipe
        * EPOLLHUP: 套接字对端关闭
@@ -439,19 +768,42 @@ void IOManager::Idle() {
         real_events |= WRITE;
       }
 
+      if (persistent_events_) {
+        // 常驻注册模式：有等待者的事件直接触发，没有等待者的事件锁存起来，不调用epoll_ctl
+        if (event.events & (EPOLLERR | EPOLLHUP)) {
+          real_events |= READ | WRITE;
+          fd_ctx->hangup = (Event)(READ | WRITE);
+        } else if (event.events & EPOLLRDHUP) {
+          real_events |= READ;
+          fd_ctx->hangup = (Event)(fd_ctx->hangup | READ);
+        }
+        int fired = fd_ctx->events & real_events;
+        fd_ctx->ready = (Event)(fd_ctx->ready | (real_events & ~fired));
+        if (fired & READ) {
+          fd_ctx->TriggerEvent(READ);
+          --pending_event_count_;
+        }
+        if (fired & WRITE) {
+          fd_ctx->TriggerEvent(WRITE);
+          --pending_event_count_;
+        }
+        continue;
+      }
+
       if ((fd_ctx->events & real_events) == NONE) {
         continue;
       }
 
       // 剔除已经发生的事件，将剩下的事件重新加入epoll_wait
       int left_events = (fd_ctx->events & ~real_events);
-      int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+      int op =
+          left_events || fd_ctx->errqueue_cb ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
       event.events = EPOLLET | left_events;
 
-      int rt2 = epoll_ctl(epfd_, op, fd_ctx->fd, &event);
+      int rt2 = epoll_ctl(fd_ctx->epfd, op, fd_ctx->fd, &event);
       if (rt2) {
         LOG_ERROR(g_logger)
-            << "epoll_ctl(" << epfd_ << ", " << (EpollCtlOp)op << ", "
+            << "epoll_ctl(" << fd_ctx->epfd << ", " << (EpollCtlOp)op << ", "
             << fd_ctx->fd << ", " << (EPOLL_EVENTS)event.events << "):" << rt2
             << " (" << errno << ") (" << strerror(errno) << ")";
         continue;
@@ -480,6 +832,9 @@ void IOManager::Idle() {
   }  // end while(true)
 }
 
-void IOManager::OnTimerInsertedAtFront() { Tickle(); }
+void IOManager::OnTimerInsertedAtFront(int thread) {
+  // 调度一个指定线程的空任务，把该线程从epoll_wait中唤醒
+  Schedule([]() {}, thread);
+}
 
 }  // end namespace serverframework
\ No newline at end of file
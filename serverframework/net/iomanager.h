@@ -11,7 +11,11 @@
 
 namespace serverframework {
 
+class FdCtx;
+
 class IOManager : public Scheduler, public TimerManager {
+  friend class FdCtx;
+
  public:
   using ptr = std::shared_ptr<IOManager>;
   using RWMutexType = RWMutex;
@@ -37,6 +41,9 @@ class IOManager : public Scheduler, public TimerManager {
    */
   struct FdContext {
     using MutexType = Mutex;
+    FdContext() = default;
+    FdContext(const FdContext &) = delete;
+    FdContext &operator=(const FdContext &) = delete;
     /**
      * @brief 事件上下文类
      * @details
@@ -80,6 +87,21 @@ class IOManager : public Scheduler, public TimerManager {
     int fd = 0;
     // 该fd添加了哪些事件的回调函数，或者说该fd关心哪些事件
     Event events = NONE;
+    // 注册该fd事件的IOManager，fd上有事件或常驻注册时有效
+    IOManager *owner = nullptr;
+    // fd所在的epoll，亲和模式下是某个调度线程自己的epoll，fd在epoll中时有效
+    int epfd = -1;
+    // 亲和模式下fd所在epoll的线程号，事件唤醒的协程在该线程上执行，非亲和模式为-1
+    int thread = -1;
+    // 常驻注册模式下，fd是否已经以EPOLLIN|EPOLLOUT|EPOLLET注册到epoll中
+    bool registered = false;
+    // 常驻注册模式下，已经就绪但还没有等待者的事件，由下一次AddEvent直接消费
+    Event ready = NONE;
+    // 常驻注册模式下，对端关闭或连接出错后一直就绪的事件。短读可能在边沿上报之后才读完数据，
+    // 此时对端的FIN不会再产生新的边沿，后续等待读事件要直接完成
+    Event hangup = NONE;
+    // 错误队列回调，fd上报EPOLLERR时调度执行，用于读取MSG_ZEROCOPY的完成通知等
+    std::function<void()> errqueue_cb;
     // 事件的Mutex
     MutexType mutex;
   };
@@ -135,11 +157,57 @@ class IOManager : public Scheduler, public TimerManager {
    */
   bool CancelAll(int fd);
 
+  /**
+   * @brief 取消所有事件并关闭fd
+   * @details 取消和关闭在同一次加锁中完成。先CancelAll再close时，其他线程可能在两者之间为fd注册事件，
+   *          fd关闭后内核把它从epoll中移除，这个事件再也不会触发，等待的协程和调度器的退出都会挂起
+   * @param[in] fd 文件句柄
+   * @param[in] close_fun 实际关闭fd的函数
+   * @return close_fun的返回值
+   */
+  int Close(int fd, int (*close_fun)(int));
+
+  /**
+   * @brief 监听fd的错误队列
+   * @details fd一直留在epoll中(不计入待执行事件数)，上报EPOLLERR时调度cb读取错误队列。
+   *          没有同时上报EPOLLHUP的EPOLLERR只当作错误队列的通知，不再唤醒读写事件，
+   *          真正的连接错误会同时带有EPOLLHUP。CancelAll时移除
+   * @param[in] fd socket句柄
+   * @param[in] cb 错误队列回调，在调度器中执行，必须自行读空错误队列
+   * @return 成功返回0，失败返回-1
+   */
+  int WatchErrQueue(int fd, std::function<void()> cb);
+
   /**
    * @brief 返回当前的IOManager
    */
   static IOManager *GetThis();
 
+  /**
+   * @brief 是否处于常驻注册模式
+   * @details 由配置项iomanager.persistent_events在构造时决定。常驻注册模式下，fd在第一次AddEvent时
+   * 以EPOLLIN|EPOLLOUT|EPOLLET注册到epoll，直到CancelAll(关闭fd)才移除，事件触发时不再调用epoll_ctl剔除事件，
+   * 没有等待者的就绪事件被锁存在FdContext中
+   * @attention fd应当经由hook的close关闭(或先调用CancelAll)。未经hook关闭时，fd号被hook的socket/accept
+   * 复用会先清除旧的注册；由其他途径创建的fd复用这个号时，常驻注册模式下不会重新注册
+   */
+  bool IsPersistentEvents() const { return persistent_events_; }
+
+  /**
+   * @brief 是否处于连接亲和模式
+   * @details 由配置项iomanager.affinity在构造时决定。亲和模式下每个调度线程有自己的epoll，
+   *          fd注册到第一次为它等待事件的线程的epoll中，直到从epoll中移除；事件唤醒的协程和
+   *          本线程到期的定时器回调都指定在该线程上执行。连接的协程和FdContext始终在同一个线程上，
+   *          不会在线程之间来回迁移
+   */
+  bool IsAffinity() const { return affinity_; }
+
+  /**
+   * @brief 亲和模式下返回当前线程号，用于把协程重新调度回当前线程
+   * @return 非亲和模式或当前线程不属于本调度器时返回-1
+   */
+  int GetAffinityThread() const;
+
  protected:
   /**
    * @brief 通知调度器有任务要调度
@@ -148,6 +216,12 @@ class IOManager : public Scheduler, public TimerManager {
    */
   void Tickle() override;
 
+  /**
+   * @brief 唤醒指定的调度线程
+   * @details 亲和模式下写该线程自己的eventfd，非亲和模式下所有线程共用一个epoll，等同于Tickle
+   */
+  void TickleThread(size_t index) override;
+
   /**
    * @brief 判断是否可以停止
    * @details
@@ -164,22 +238,73 @@ class IOManager : public Scheduler, public TimerManager {
 
   /**
    * @brief 判断是否可以停止，同时获取最近一个定时器的超时时间
-   * @param[out] timeout 最近一个定时器的超时时间，用于idle协程的epoll_wait
+   * @param[out] timeout 最近一个定时器的超时时间(微秒)，用于idle协程的epoll_wait
    * @return 返回是否可以停止
    */
   bool Stopping(uint64_t &timeout);
 
   /**
    * @brief
-   * 当有定时器插入到头部时，要重新更新epoll_wait的超时时间，这里是唤醒idle协程以便于使用新的超时时间
+   * 当有定时器插入到某个线程分片的头部时，要重新更新该线程epoll_wait的超时时间，这里是唤醒该线程的idle协程以便于使用新的超时时间
    */
-  void OnTimerInsertedAtFront() override;
+  void OnTimerInsertedAtFront(int thread) override;
 
   /**
-   * @brief 重置socket句柄上下文的容器大小
-   * @param[in] size 容量大小
+   * @brief 常驻注册模式下把fd以EPOLLIN|EPOLLOUT|EPOLLET注册到epoll，已注册时直接返回
+   * @pre 已持有fd_ctx->mutex
+   * @return 成功返回0,失败返回-1
    */
-  void ContextResize(size_t size);
+  int RegisterPersistent(FdContext *fd_ctx);
+
+  /**
+   * @brief 取消fd上的所有事件，CancelAll和Close的实现
+   * @pre 已持有fd_ctx->mutex，fd的事件由本IOManager管理
+   */
+  bool CancelAllLocked(FdContext *fd_ctx);
+
+  /**
+   * @brief 常驻注册模式下添加事件
+   * @details fd只在第一次添加事件时注册到epoll，如果事件已经被锁存为就绪，则立即触发
+   * @pre 已持有fd_ctx->mutex
+   * @return 添加成功返回0,失败返回-1
+   */
+  int AddEventPersistent(FdContext *fd_ctx, Event event,
+                         std::function<void()> cb);
+
+  /**
+   * @brief 获取fd的事件上下文
+   * @details fd事件上下文保存在FdManager的无锁分段表中，由所有IOManager共用
+   * @param[in] fd socket句柄
+   * @param[in] auto_create 不存在时是否创建
+   */
+  static FdContext *GetFdContext(int fd, bool auto_create);
+
+  /**
+   * @brief fd的事件不是由当前IOManager注册时，返回注册事件的IOManager
+   * @pre 已持有fd_ctx->mutex
+   * @return 由当前IOManager负责或没有事件时返回nullptr
+   */
+  IOManager *ForeignOwner(FdContext *fd_ctx) const;
+
+  /**
+   * @brief fd加入epoll之前，选择它所在的epoll
+   * @details 亲和模式下是当前调度线程的epoll，调用者不是本调度器的线程时轮流选择一个线程
+   * @pre 已持有fd_ctx->mutex，fd不在epoll中
+   */
+  void BindEpoll(FdContext *fd_ctx);
+
+ private:
+  /**
+   * @brief 亲和模式下每个调度线程自己的epoll和唤醒句柄
+   */
+  struct ThreadContext {
+    // epoll 文件句柄
+    int epfd = -1;
+    // 唤醒该线程的eventfd
+    int tickle_fd = -1;
+    // 是否阻塞在epoll_wait上
+    std::atomic<bool> idle = {false};
+  };
 
  private:
   // epoll 文件句柄
@@ -188,10 +313,16 @@ class IOManager : public Scheduler, public TimerManager {
   int tickle_fds_[2];
   // 当前等待执行的IO事件数量
   std::atomic<size_t> pending_event_count_ = {0};
-  // IOManager的Mutex
-  RWMutexType mutex_;
-  // socket事件上下文的容器
-  std::vector<FdContext *> fd_contexts_;
+  // 是否常驻注册fd，避免每次事件触发和添加都调用epoll_ctl
+  bool persistent_events_ = false;
+  // 是否连接亲和模式
+  bool affinity_ = false;
+  // 亲和模式下每个调度线程的epoll，下标与GetThreadIds()一致
+  std::vector<std::unique_ptr<ThreadContext>> thread_ctxs_;
+  // 调度器以外的线程注册fd时，下一个选择的线程
+  std::atomic<size_t> next_thread_ = {0};
+  // 唤醒任意线程时，下一个开始查找空闲线程的位置
+  std::atomic<size_t> next_tickle_ = {0};
 };
 
 }  // end namespace serverframework
@@ -1,10 +1,19 @@
 #include "net/socket.h"
 
+#include <fcntl.h>
 #include <limits.h>
+#include <linux/errqueue.h>
+#include <netinet/udp.h>
+#include <unistd.h>
 
+#include <algorithm>
+
+#include "config/config.h"
+#include "env/mutex.h"
 #include "net/fd_manager.h"
 #include "net/hook.h"
 #include "net/iomanager.h"
+#include "net/zerocopy.h"
 #include "log/log.h"
 #include "util/macro.h"
 
@@ -12,6 +21,66 @@ namespace serverframework {
 
 static serverframework::Logger::ptr g_logger = LOG_NAME("system");
 
+static serverframework::ConfigVar<uint32_t>::ptr g_zerocopy_threshold =
+    serverframework::Config::Lookup<uint32_t>(
+        "socket.zerocopy_threshold", 16 * 1024,
+        "minimum send size that uses MSG_ZEROCOPY, smaller sends are copied");
+
+static uint32_t s_zerocopy_threshold = 16 * 1024;
+
+struct _ZeroCopyIniter {
+  _ZeroCopyIniter() {
+    s_zerocopy_threshold = g_zerocopy_threshold->GetValue();
+    g_zerocopy_threshold->AddListener(
+        [](const uint32_t &old_value, const uint32_t &new_value) {
+          s_zerocopy_threshold = new_value;
+        });
+  }
+};
+
+static _ZeroCopyIniter s_zerocopy_initer;
+
+/**
+ * @brief 读空错误队列，处理零拷贝发送的完成通知
+ */
+static void ReapZeroCopy(std::weak_ptr<ZeroCopyState> weak_state) {
+  std::shared_ptr<ZeroCopyState> state = weak_state.lock();
+  if (!state) {
+    return;
+  }
+  int fd = -1;
+  {
+    Mutex::Lock lock(state->mutex);
+    fd = state->fd;
+  }
+  char control[128];
+  while (fd != -1) {
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    // 直接调用原始的recvmsg，错误队列为空时返回EAGAIN，不需要等待
+    if (recvmsg_f(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+      break;
+    }
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+            (cmsg->cmsg_level == SOL_IPV6 &&
+             cmsg->cmsg_type == IPV6_RECVERR))) {
+        continue;
+      }
+      sock_extended_err err;
+      memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+      if (err.ee_errno != 0 || err.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+        continue;
+      }
+      state->Complete(err.ee_info, err.ee_data,
+                      err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+    }
+  }
+}
+
 Socket::ptr Socket::CreateTCP(serverframework::Address::ptr address) {
   Socket::ptr sock(new Socket(address->GetFamily(), TCP, 0));
   return sock;
@@ -58,17 +127,38 @@ Socket::ptr Socket::CreateUnixUDPSocket() {
   return sock;
 }
 
+Socket::ptr Socket::CreateFromFd(int fd) {
+  int family = 0;
+  int type = 0;
+  socklen_t len = sizeof(int);
+  if (getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &family, &len)) {
+    return nullptr;
+  }
+  len = sizeof(int);
+  if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len)) {
+    return nullptr;
+  }
+  FdCtx *ctx = FdMgr::GetInstance()->Get(fd, true);
+  if (!ctx || !ctx->IsSocket()) {
+    return nullptr;
+  }
+  Socket::ptr sock(new Socket(family, type, 0));
+  sock->sock_ = fd;
+  return sock;
+}
+
 Socket::Socket(int family, int type, int protocol)
     : sock_(-1),
       family_(family),
       type_(type),
       protocol_(protocol),
-      is_connected_(false) {}
+      is_connected_(false),
+      peer_addr_len_(0) {}
 
 Socket::~Socket() { close(); }
 
 int64_t Socket::GetSendTimeout() {
-  FdCtx::ptr ctx = FdMgr::GetInstance()->Get(sock_);
+  FdCtx *ctx = FdMgr::GetInstance()->Get(sock_);
   if (ctx) {
     return ctx->GetTimeout(SO_SNDTIMEO);
   }
@@ -83,7 +173,7 @@ void Socket::SetSendTimeout(int64_t v) {
 }
 
 int64_t Socket::GetRecvTimeout() {
-  FdCtx::ptr ctx = FdMgr::GetInstance()->Get(sock_);
+  FdCtx *ctx = FdMgr::GetInstance()->Get(sock_);
   if (ctx) {
     return ctx->GetTimeout(SO_RCVTIMEO);
   }
@@ -120,27 +210,80 @@ bool Socket::SetOption(int level, int option, const void *result,
 }
 
 Socket::ptr Socket::accept() {
-  Socket::ptr sock(new Socket(family_, type_, protocol_));
-  int newsock = ::accept(sock_, nullptr, nullptr);
+  // Socket对象和引用计数一次分配
+  Socket::ptr sock = std::make_shared<Socket>(family_, type_, protocol_);
+  // Unix域socket的对端地址长度不固定，留给getpeername
+  bool capture = family_ == AF_INET || family_ == AF_INET6;
+  socklen_t addrlen = sizeof(sock->peer_addr_);
+  int newsock =
+      ::accept4(sock_, capture ? &sock->peer_addr_.sa : nullptr,
+                capture ? &addrlen : nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
   if (newsock == -1) {
     LOG_ERROR(g_logger) << "accept(" << sock_ << ") errno=" << errno
                         << " errstr=" << strerror(errno);
     return nullptr;
   }
+  if (capture && addrlen <= sizeof(sock->peer_addr_)) {
+    sock->peer_addr_len_ = addrlen;
+  }
   if (sock->Init(newsock)) {
     return sock;
   }
   return nullptr;
 }
 
+Socket::ptr Socket::AcceptNoWait() {
+  // 监听fd不是hook创建的非阻塞fd时，直接调用accept4会阻塞线程
+  FdCtx *ctx = FdMgr::GetInstance()->Get(sock_);
+  if (!ctx || !ctx->GetSysNonblock()) {
+    return nullptr;
+  }
+  Socket::ptr sock = std::make_shared<Socket>(family_, type_, protocol_);
+  bool capture = family_ == AF_INET || family_ == AF_INET6;
+  socklen_t addrlen = sizeof(sock->peer_addr_);
+  // 绕过hook，没有排队的连接时直接返回EAGAIN，不让出协程
+  int newsock =
+      accept4_f(sock_, capture ? &sock->peer_addr_.sa : nullptr,
+                capture ? &addrlen : nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (newsock == -1) {
+    if (errno == EAGAIN) {
+      ctx->SetNotReady(IOManager::READ, true);
+    } else {
+      LOG_ERROR(g_logger) << "accept4(" << sock_ << ") errno=" << errno
+                          << " errstr=" << strerror(errno);
+    }
+    return nullptr;
+  }
+  FdMgr::GetInstance()->GetAccepted(newsock, sock_, true);
+  if (capture && addrlen <= sizeof(sock->peer_addr_)) {
+    sock->peer_addr_len_ = addrlen;
+  }
+  if (sock->Init(newsock)) {
+    return sock;
+  }
+  return nullptr;
+}
+
+size_t Socket::AcceptBatch(std::vector<Socket::ptr> &clients, size_t max) {
+  Socket::ptr sock = accept();
+  if (!sock) {
+    return 0;
+  }
+  clients.push_back(sock);
+  size_t n = 1;
+  while (n < max && (sock = AcceptNoWait())) {
+    clients.push_back(sock);
+    ++n;
+  }
+  return n;
+}
+
 bool Socket::Init(int sock) {
-  FdCtx::ptr ctx = FdMgr::GetInstance()->Get(sock);
+  FdCtx *ctx = FdMgr::GetInstance()->Get(sock);
   if (ctx && ctx->IsSocket() && !ctx->IsClose()) {
     sock_ = sock;
     is_connected_ = true;
-    InitSock();
-    GetLocalAddress();
-    GetRemoteAddress();
+    // 新连接从监听socket继承SO_REUSEADDR和TCP_NODELAY，不再InitSock；地址延迟到用时再取
     return true;
   }
   return false;
@@ -226,11 +369,19 @@ bool Socket::connect(const Address::ptr addr, uint64_t timeout_ms) {
     }
   }
   is_connected_ = true;
-  GetRemoteAddress();
-  GetLocalAddress();
   return true;
 }
 
+bool Socket::SetReusePort(bool on) {
+  if (!IsValid()) {
+    NewSock();
+    if (UNLIKELY(!IsValid())) {
+      return false;
+    }
+  }
+  return SetOption(SOL_SOCKET, SO_REUSEPORT, (int)on);
+}
+
 bool Socket::listen(int backlog) {
   if (!IsValid()) {
     LOG_ERROR(g_logger) << "listen error sock=-1";
@@ -249,6 +400,11 @@ bool Socket::close() {
     return true;
   }
   is_connected_ = false;
+  if (zerocopy_) {
+    // 未完成的零拷贝发送随Socket一起释放，关闭之前应等待GetZeroCopyPending()为0
+    Mutex::Lock lock(zerocopy_->mutex);
+    zerocopy_->fd = -1;
+  }
   if (sock_ != -1) {
     ::close(sock_);
     sock_ = -1;
@@ -339,10 +495,194 @@ int Socket::RecvFrom(iovec *buffers, size_t length, Address::ptr from,
   return -1;
 }
 
+int Socket::RecvBatch(struct mmsghdr *msgs, unsigned int count, int flags) {
+  if (IsConnected()) {
+    return ::recvmmsg(sock_, msgs, count, flags, nullptr);
+  }
+  return -1;
+}
+
+int Socket::SendBatch(struct mmsghdr *msgs, unsigned int count, int flags) {
+  if (IsConnected()) {
+    return ::sendmmsg(sock_, msgs, count, flags);
+  }
+  return -1;
+}
+
+bool Socket::SetGsoSegment(uint16_t size) {
+  int val = size;
+  return SetOption(SOL_UDP, UDP_SEGMENT, val);
+}
+
+bool Socket::SetGro(bool on) {
+  int val = on ? 1 : 0;
+  return SetOption(SOL_UDP, UDP_GRO, val);
+}
+
+uint16_t Socket::GetGroSegment(const struct msghdr &msg) {
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+       cmsg = CMSG_NXTHDR((struct msghdr *)&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+      int size = 0;
+      memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+      return size;
+    }
+  }
+  return 0;
+}
+
+bool Socket::SetZeroCopy(bool on) {
+  if (!on) {
+    if (zerocopy_) {
+      Mutex::Lock lock(zerocopy_->mutex);
+      zerocopy_->fd = -1;
+    }
+    zerocopy_.reset();
+    return SetOption(SOL_SOCKET, SO_ZEROCOPY, 0);
+  }
+  if (zerocopy_) {
+    return true;
+  }
+  IOManager *iom = IOManager::GetThis();
+  if (!iom || (family_ != AF_INET && family_ != AF_INET6) ||
+      !SetOption(SOL_SOCKET, SO_ZEROCOPY, 1)) {
+    return false;
+  }
+  std::shared_ptr<ZeroCopyState> state(new ZeroCopyState);
+  state->fd = sock_;
+  std::weak_ptr<ZeroCopyState> weak_state(state);
+  if (iom->WatchErrQueue(sock_, std::bind(&ReapZeroCopy, weak_state))) {
+    SetOption(SOL_SOCKET, SO_ZEROCOPY, 0);
+    return false;
+  }
+  zerocopy_ = state;
+  return true;
+}
+
+int Socket::SendZeroCopy(const void *buffer, size_t length,
+                         std::shared_ptr<void> pin, int flags) {
+  if (!zerocopy_ || length < s_zerocopy_threshold) {
+    return send(buffer, length, flags);
+  }
+  iovec iov;
+  iov.iov_base = (void *)buffer;
+  iov.iov_len = length;
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  // 序号由成功的发送依次占用，同一个socket不能由多个协程同时零拷贝发送。
+  // 发送可能让出协程，不能持有锁
+  int rt = IsConnected() ? ::sendmsg(sock_, &msg, flags | MSG_ZEROCOPY) : -1;
+  if (rt >= 0) {
+    zerocopy_->Register(std::move(pin));
+  }
+  return rt;
+}
+
+int Socket::SendZeroCopy(ByteArray::ptr ba, size_t length, int flags) {
+  std::vector<iovec> iovs;
+  length = ba->GetReadBuffers(iovs, length);
+  if (!zerocopy_ || length < s_zerocopy_threshold) {
+    return send(&iovs[0], iovs.size(), flags);
+  }
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iovs[0];
+  msg.msg_iovlen = iovs.size();
+  int rt = IsConnected() ? ::sendmsg(sock_, &msg, flags | MSG_ZEROCOPY) : -1;
+  if (rt >= 0) {
+    zerocopy_->Register(ba);
+  }
+  return rt;
+}
+
+size_t Socket::GetZeroCopyPending() const {
+  if (!zerocopy_) {
+    return 0;
+  }
+  Mutex::Lock lock(zerocopy_->mutex);
+  return zerocopy_->pending;
+}
+
+uint64_t Socket::GetZeroCopyCopied() const {
+  if (!zerocopy_) {
+    return 0;
+  }
+  Mutex::Lock lock(zerocopy_->mutex);
+  return zerocopy_->copied;
+}
+
+int64_t Socket::SendFile(int fd, off_t offset, size_t length) {
+  if (!IsConnected()) {
+    return -1;
+  }
+  int64_t total = 0;
+  while ((size_t)total < length) {
+    ssize_t rt = ::sendfile(sock_, fd, &offset, length - total);
+    if (rt <= 0) {
+      if (rt < 0 && total == 0) {
+        return -1;
+      }
+      break;
+    }
+    total += rt;
+  }
+  return total;
+}
+
+int64_t Socket::SpliceTo(Socket::ptr to, uint64_t max) {
+  if (!IsConnected() || !to->IsConnected()) {
+    return -1;
+  }
+  // 管道两端非阻塞，每次写入管道的数据都立即搬到目标socket，管道不会满，
+  // splice返回EAGAIN时总是因为socket没有就绪，由hook让出协程等待
+  int pipefd[2];
+  if (pipe2(pipefd, O_NONBLOCK | O_CLOEXEC)) {
+    LOG_ERROR(g_logger) << "SpliceTo pipe2 errno=" << errno
+                        << " errstr=" << strerror(errno);
+    return -1;
+  }
+  static const size_t kChunk = 64 * 1024;
+  const unsigned int flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+  int64_t total = 0;
+  bool error = false;
+  while ((uint64_t)total < max) {
+    ssize_t n = ::splice(sock_, nullptr, pipefd[1], nullptr,
+                         std::min<uint64_t>(kChunk, max - total), flags);
+    if (n <= 0) {
+      error = n < 0;
+      break;
+    }
+    ssize_t left = n;
+    while (left > 0) {
+      ssize_t m =
+          ::splice(pipefd[0], nullptr, to->sock_, nullptr, left, flags);
+      if (m <= 0) {
+        error = true;
+        break;
+      }
+      left -= m;
+    }
+    if (left > 0) {
+      // 已经读进管道但没能发出去的数据丢弃
+      break;
+    }
+    total += n;
+  }
+  ::close(pipefd[0]);
+  ::close(pipefd[1]);
+  return error && total == 0 ? -1 : total;
+}
+
 Address::ptr Socket::GetRemoteAddress() {
   if (remote_address_) {
     return remote_address_;
   }
+  if (peer_addr_len_) {
+    remote_address_ = Address::Create(&peer_addr_.sa, peer_addr_len_);
+    return remote_address_;
+  }
 
   Address::ptr result;
   switch (family_) {
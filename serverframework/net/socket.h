@@ -10,12 +10,16 @@
 #include <sys/types.h>
 
 #include <memory>
+#include <vector>
 
 #include "net/address.h"
+#include "util/bytearray.h"
 
 
 namespace serverframework {
 
+struct ZeroCopyState;
+
 /**
  * @brief Socket封装类
  */
@@ -88,6 +92,13 @@ class Socket : public std::enable_shared_from_this<Socket> {
    */
   static Socket::ptr CreateUnixUDPSocket();
 
+  /**
+   * @brief 用已有的socket句柄创建Socket，例如热重启时从旧进程收到的监听socket
+   * @details 地址族和类型从句柄上获取，地址在用到时才获取。Socket析构时关闭句柄
+   * @return 句柄不是socket时返回nullptr
+   */
+  static Socket::ptr CreateFromFd(int fd);
+
   /**
    * @brief Socket构造函数
    * @param[in] family 协议簇
@@ -152,11 +163,23 @@ class Socket : public std::enable_shared_from_this<Socket> {
 
   /**
    * @brief 接收connect链接
+   * @details 用accept4直接得到非阻塞、close-on-exec的fd，对端地址取自accept4的输出参数，
+   *          本地地址在第一次GetLocalAddress时才获取
    * @return 成功返回新连接的socket,失败返回nullptr
    * @pre Socket必须 bind , listen  成功
    */
   virtual Socket::ptr accept();
 
+  /**
+   * @brief 批量接收连接
+   * @details 用accept等待第一个连接，之后不再等待，把已经排队的连接一起取出，直到EAGAIN或取满max个。
+   *          取到EAGAIN时记下监听fd未就绪，下一次accept直接等待事件
+   * @param[out] clients 新连接追加到末尾
+   * @param[in] max 最多接收的连接数
+   * @return 接收的连接数，0表示第一个accept就失败了
+   */
+  size_t AcceptBatch(std::vector<Socket::ptr> &clients, size_t max);
+
   /**
    * @brief 绑定地址
    * @param[in] addr 地址
@@ -181,6 +204,12 @@ class Socket : public std::enable_shared_from_this<Socket> {
    */
   virtual bool listen(int backlog = SOMAXCONN);
 
+  /**
+   * @brief 设置SO_REUSEPORT，多个socket可以绑定同一个地址，由内核在它们之间分发连接
+   * @details 必须在bind之前调用，socket还没有创建时先创建
+   */
+  bool SetReusePort(bool on);
+
   /**
    * @brief 关闭socket
    */
@@ -290,13 +319,132 @@ class Socket : public std::enable_shared_from_this<Socket> {
   virtual int RecvFrom(iovec *buffers, size_t length, Address::ptr from,
                        int flags = 0);
 
+  /**
+   * @brief 批量接收数据报，一次系统调用接收多个，参考recvmmsg(2)
+   * @param[in,out] msgs
+   * 接收数据报的mmsghdr数组，返回时msg_len为每个数据报的长度，msg_name为发送端地址
+   * @param[in] count 数组长度
+   * @param[in] flags 标志字
+   * @return
+   *      @retval >0 接收到的数据报个数
+   *      @retval <0 socket出错
+   */
+  virtual int RecvBatch(struct mmsghdr *msgs, unsigned int count,
+                        int flags = 0);
+
+  /**
+   * @brief 批量发送数据报，一次系统调用发送多个，参考sendmmsg(2)
+   * @param[in,out] msgs 待发送数据报的mmsghdr数组，返回时msg_len为每个数据报发送的长度
+   * @param[in] count 数组长度
+   * @param[in] flags 标志字
+   * @return
+   *      @retval >0 发送成功的数据报个数
+   *      @retval <0 socket出错
+   */
+  virtual int SendBatch(struct mmsghdr *msgs, unsigned int count,
+                        int flags = 0);
+
+  /**
+   * @brief 设置UDP GSO分段大小，参考udp(7)的UDP_SEGMENT
+   * @details 设置后发送一个大于分段大小的缓冲区，由内核在协议栈底部切分成多个数据报，
+   *          只经过一次协议栈，0表示关闭
+   */
+  bool SetGsoSegment(uint16_t size);
+
+  /**
+   * @brief 开启/关闭UDP GRO，参考udp(7)的UDP_GRO
+   * @details 开启后一次接收可能收到多个合并在一起的同样大小的数据报，
+   *          接收时需要带控制消息缓冲区，分段大小用GetGroSegment取出
+   */
+  bool SetGro(bool on);
+
+  /**
+   * @brief 从recvmsg/recvmmsg返回的控制消息中取出GRO分段大小
+   * @return 不是合并的数据报时返回0
+   */
+  static uint16_t GetGroSegment(const struct msghdr &msg);
+
+  /**
+   * @brief 开启/关闭零拷贝发送(SO_ZEROCOPY)
+   * @details 开启后SendZeroCopy发送不小于阈值(配置项socket.zerocopy_threshold)的数据时带MSG_ZEROCOPY，
+   *          内核直接引用用户内存，发送完成后在错误队列中通知，由当前IOManager调度回调读取。
+   *          只支持TCP/UDP socket，需要在IOManager中调用
+   * @return 是否成功
+   */
+  bool SetZeroCopy(bool on);
+
+  /**
+   * @brief 是否开启了零拷贝发送
+   */
+  bool IsZeroCopy() const { return (bool)zerocopy_; }
+
+  /**
+   * @brief 零拷贝发送数据
+   * @details 数据小于阈值或未开启零拷贝时退化为普通的拷贝发送。零拷贝发送的数据在内核通知发送完成之前，
+   *          一直持有pin，调用方通过pin保证内存不被释放或修改
+   * @param[in] buffer 待发送数据的内存
+   * @param[in] length 待发送数据的长度
+   * @param[in] pin 持有待发送数据内存的对象
+   * @param[in] flags 标志字
+   * @return
+   *      @retval >0 发送成功对应大小的数据
+   *      @retval =0 socket被关闭
+   *      @retval <0 socket出错
+   */
+  int SendZeroCopy(const void *buffer, size_t length, std::shared_ptr<void> pin,
+                   int flags = 0);
+
+  /**
+   * @brief 零拷贝发送ByteArray中从当前读位置开始的数据
+   * @details 不移动ByteArray的读位置，发送完成之前持有ByteArray，期间不能修改其中的数据
+   * @param[in] ba 待发送的数据
+   * @param[in] length 待发送数据的长度，超过可读长度时只发送可读部分
+   * @param[in] flags 标志字
+   * @return 同SendZeroCopy
+   */
+  int SendZeroCopy(ByteArray::ptr ba, size_t length, int flags = 0);
+
+  /**
+   * @brief 已经零拷贝发送、内核还没有通知完成的次数
+   */
+  size_t GetZeroCopyPending() const;
+
+  /**
+   * @brief 内核通知完成时实际做了拷贝的次数，比如发往回环地址的数据
+   */
+  uint64_t GetZeroCopyCopied() const;
+
+  /**
+   * @brief 用sendfile把文件内容直接从内核发送到socket，不经过用户态缓冲区
+   * @param[in] fd 文件句柄
+   * @param[in] offset 文件中的起始偏移，不修改文件自身的读写位置
+   * @param[in] length 发送的字节数，遇到文件末尾提前结束
+   * @return
+   *      @retval >=0 发送的字节数
+   *      @retval <0 一个字节都没有发送就出错
+   */
+  virtual int64_t SendFile(int fd, off_t offset, size_t length);
+
+  /**
+   * @brief 通过管道用splice把本socket收到的数据转发给另一个socket，数据不经过用户态
+   * @details 用于代理转发，直到本socket被对端关闭、转发完max字节或出错
+   * @param[in] to 转发的目标socket
+   * @param[in] max 最多转发的字节数
+   * @return
+   *      @retval >=0 转发的字节数
+   *      @retval <0 一个字节都没有转发就出错
+   */
+  int64_t SpliceTo(Socket::ptr to, uint64_t max = ~0ull);
+
   /**
    * @brief 获取远端地址
+   * @details 第一次调用时才创建Address对象，accept得到的socket用accept4记下的地址，不再getpeername
    */
   Address::ptr GetRemoteAddress();
 
   /**
    * @brief 获取本地地址
+   * @details 第一次调用时才通过getsockname获取
    */
   Address::ptr GetLocalAddress();
 
@@ -378,6 +526,12 @@ class Socket : public std::enable_shared_from_this<Socket> {
    */
   virtual bool Init(int sock);
 
+  /**
+   * @brief 不等待地accept一个已经排队的连接
+   * @return 没有排队的连接或出错时返回nullptr
+   */
+  Socket::ptr AcceptNoWait();
+
  protected:
   // socket句柄
   int sock_;
@@ -393,6 +547,15 @@ class Socket : public std::enable_shared_from_this<Socket> {
   Address::ptr local_address_;
   // 远端地址
   Address::ptr remote_address_;
+  // accept4得到的对端地址，remote_address_为空时用来延迟创建，长度为0表示没有
+  union {
+    sockaddr sa;
+    sockaddr_in in;
+    sockaddr_in6 in6;
+  } peer_addr_;
+  socklen_t peer_addr_len_;
+  // 零拷贝发送状态，未开启时为空
+  std::shared_ptr<ZeroCopyState> zerocopy_;
 };
 
 /**
@@ -0,0 +1,379 @@
+#include "net/socket_pool.h"
+
+#include <errno.h>
+
+#include <algorithm>
+#include <functional>
+
+#include "config/config.h"
+#include "log/log.h"
+#include "net/hook.h"
+#include "util/clock.h"
+#include "util/macro.h"
+#include "util/util.h"
+
+namespace serverframework {
+
+static serverframework::Logger::ptr g_logger = LOG_NAME("system");
+
+static serverframework::ConfigVar<uint32_t>::ptr g_pool_max_idle =
+    serverframework::Config::Lookup("socket_pool.max_idle", (uint32_t)16,
+                                    "max idle connections per address");
+
+static serverframework::ConfigVar<uint32_t>::ptr g_pool_min_idle =
+    serverframework::Config::Lookup("socket_pool.min_idle", (uint32_t)0,
+                                    "min idle connections per address");
+
+static serverframework::ConfigVar<uint32_t>::ptr g_pool_max_total =
+    serverframework::Config::Lookup("socket_pool.max_total", (uint32_t)64,
+                                    "max connections per address");
+
+static serverframework::ConfigVar<uint32_t>::ptr g_pool_idle_timeout =
+    serverframework::Config::Lookup("socket_pool.idle_timeout",
+                                    (uint32_t)30000,
+                                    "idle connection timeout in ms");
+
+static serverframework::ConfigVar<uint32_t>::ptr g_pool_connect_timeout =
+    serverframework::Config::Lookup("socket_pool.connect_timeout",
+                                    (uint32_t)3000, "connect timeout in ms");
+
+static serverframework::ConfigVar<uint32_t>::ptr g_pool_checkout_timeout =
+    serverframework::Config::Lookup(
+        "socket_pool.checkout_timeout", (uint32_t)3000,
+        "max time to wait for a connection when the pool is full in ms");
+
+SocketPool::SocketPool(IOManager *iom)
+    : iom_(iom),
+      max_idle_(g_pool_max_idle->GetValue()),
+      min_idle_(g_pool_min_idle->GetValue()),
+      max_total_(std::max<uint32_t>(g_pool_max_total->GetValue(), 1)),
+      idle_timeout_(g_pool_idle_timeout->GetValue()),
+      connect_timeout_(g_pool_connect_timeout->GetValue()),
+      checkout_timeout_(g_pool_checkout_timeout->GetValue()) {
+  if (iom_) {
+    timer_ = iom_->AddTimer(std::max<uint64_t>(idle_timeout_ / 2, 1),
+                            std::bind(&SocketPool::OnTimer, this), true);
+  }
+}
+
+SocketPool::~SocketPool() {
+  if (timer_) {
+    timer_->Cancel();
+  }
+  for (auto &i : hosts_) {
+    // 借出的、正在建立的连接都计入total，它们的删除器和任务还会访问连接池
+    ASSERT2(i.second->total == i.second->idle,
+            "SocketPool destroyed with connections in use: " + i.first);
+    for (auto &shard : i.second->shards) {
+      for (auto &idle : shard.conns) {
+        delete idle.sock;
+      }
+    }
+  }
+}
+
+void SocketPool::SetIdleTimeout(uint64_t v) {
+  idle_timeout_ = v;
+  if (timer_) {
+    timer_->reset(std::max<uint64_t>(v / 2, 1), true);
+  }
+}
+
+SocketPool::Host::ptr SocketPool::GetHost(Address::ptr addr, bool create) {
+  std::string key = addr->ToString();
+  {
+    RWMutex::ReadLock lock(hosts_mutex_);
+    auto it = hosts_.find(key);
+    if (it != hosts_.end()) {
+      return it->second;
+    }
+  }
+  if (!create) {
+    return nullptr;
+  }
+  RWMutex::WriteLock lock(hosts_mutex_);
+  Host::ptr &host = hosts_[key];
+  if (!host) {
+    host.reset(new Host);
+    host->addr = addr;
+  }
+  return host;
+}
+
+size_t SocketPool::GetIdleCount(Address::ptr addr) {
+  Host::ptr host = GetHost(addr, false);
+  return host ? host->idle.load() : 0;
+}
+
+size_t SocketPool::GetTotalCount(Address::ptr addr) {
+  Host::ptr host = GetHost(addr, false);
+  return host ? host->total.load() : 0;
+}
+
+bool SocketPool::PopIdle(Host::ptr host, Idle &idle) {
+  if (host->idle == 0) {
+    return false;
+  }
+  size_t self = GetThreadId() % kShards;
+  for (size_t i = 0; i < kShards; ++i) {
+    Shard &shard = host->shards[(self + i) % kShards];
+    MutexType::Lock lock(shard.mutex);
+    if (!shard.conns.empty()) {
+      idle = shard.conns.back();
+      shard.conns.pop_back();
+      --host->idle;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool SocketPool::Usable(const Idle &idle) {
+  return Clock::NowMS() - idle.time < idle_timeout_ && Alive(idle.sock);
+}
+
+bool SocketPool::Alive(Socket *sock) {
+  // 对端关闭时读到0，有残留数据说明上一次请求的应答没有读完，都不能复用
+  char c;
+  int rt = recv_f(sock->GetSocket(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+  return rt < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+bool SocketPool::WakeWaiter(Host::ptr host, Socket *sock) {
+  if (host->waiting == 0) {
+    return false;
+  }
+  std::shared_ptr<Waiter> waiter;
+  {
+    MutexType::Lock lock(host->mutex);
+    if (host->waiters.empty()) {
+      return false;
+    }
+    waiter = host->waiters.front();
+    host->waiters.pop_front();
+    --host->waiting;
+    waiter->done = true;
+    waiter->sock = sock;
+  }
+  waiter->scheduler->Schedule(waiter->fiber, waiter->thread);
+  return true;
+}
+
+Socket *SocketPool::Connect(Host::ptr host) {
+  Socket *sock = new Socket(host->addr->GetFamily(), Socket::TCP, 0);
+  if (!sock->connect(host->addr, connect_timeout_)) {
+    delete sock;
+    return nullptr;
+  }
+  ++connect_count_;
+  return sock;
+}
+
+void SocketPool::Discard(Socket *sock, Host::ptr host) {
+  delete sock;
+  --host->total;
+  // 空出了一个连接名额，让一个等待者去新建连接
+  WakeWaiter(host, nullptr);
+}
+
+Socket::ptr SocketPool::Wrap(Socket *sock, Host::ptr host) {
+  return Socket::ptr(sock, std::bind(&SocketPool::ReleasePtr, this,
+                                     std::placeholders::_1, host));
+}
+
+void SocketPool::ReleasePtr(Socket *sock, Host::ptr host) {
+  if (!sock->IsConnected()) {
+    Discard(sock, host);
+    return;
+  }
+  if (WakeWaiter(host, sock)) {
+    return;
+  }
+  if (host->idle >= max_idle_) {
+    Discard(sock, host);
+    return;
+  }
+  Shard &shard = host->shards[GetThreadId() % kShards];
+  {
+    MutexType::Lock lock(shard.mutex);
+    shard.conns.push_back(Idle{sock, Clock::NowMS()});
+    ++host->idle;
+  }
+  // 放入分片之后再看一次有没有等待者，与Checkout中先登记等待再查分片对应，
+  // 两边至少有一边能看到对方
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  Idle idle;
+  if (host->waiting > 0 && PopIdle(host, idle)) {
+    if (!WakeWaiter(host, idle.sock)) {
+      MutexType::Lock lock(shard.mutex);
+      shard.conns.push_back(idle);
+      ++host->idle;
+    }
+  }
+}
+
+Socket::ptr SocketPool::Checkout(Address::ptr addr, uint64_t timeout_ms) {
+  if (timeout_ms == (uint64_t)-1) {
+    timeout_ms = checkout_timeout_;
+  }
+  uint64_t deadline = Clock::NowMS() + timeout_ms;
+  Host::ptr host = GetHost(addr);
+  while (true) {
+    Idle idle;
+    if (PopIdle(host, idle)) {
+      if (Usable(idle)) {
+        ++reuse_count_;
+        return Wrap(idle.sock, host);
+      }
+      Discard(idle.sock, host);
+      continue;
+    }
+
+    std::shared_ptr<Waiter> waiter;
+    bool popped = false;
+    {
+      MutexType::Lock lock(host->mutex);
+      if (host->total < max_total_) {
+        ++host->total;
+      } else {
+        ++host->waiting;
+        popped = PopIdle(host, idle);
+        if (popped) {
+          --host->waiting;
+        } else {
+          IOManager *iom = IOManager::GetThis();
+          waiter.reset(new Waiter);
+          waiter->scheduler = Scheduler::GetThis();
+          waiter->fiber = Fiber::GetThis();
+          waiter->thread = iom ? iom->GetAffinityThread() : -1;
+          host->waiters.push_back(waiter);
+        }
+      }
+    }
+    if (popped) {
+      if (Usable(idle)) {
+        ++reuse_count_;
+        return Wrap(idle.sock, host);
+      }
+      Discard(idle.sock, host);
+      continue;
+    }
+
+    if (!waiter) {
+      Socket *sock = Connect(host);
+      if (!sock) {
+        Discard(nullptr, host);
+        return nullptr;
+      }
+      return Wrap(sock, host);
+    }
+
+    ++wait_count_;
+    uint64_t now = Clock::NowMS();
+    IOManager *iom = IOManager::GetThis();
+    Timer::ptr timer;
+    if (iom) {
+      std::weak_ptr<Waiter> weak(waiter);
+      timer = iom->AddConditionTimer(
+          deadline > now ? deadline - now : 0,
+          [weak, host]() {
+            std::shared_ptr<Waiter> waiter = weak.lock();
+            if (!waiter) {
+              return;
+            }
+            {
+              MutexType::Lock lock(host->mutex);
+              if (waiter->done) {
+                return;
+              }
+              waiter->done = true;
+              host->waiters.erase(std::find(host->waiters.begin(),
+                                            host->waiters.end(), waiter));
+              --host->waiting;
+            }
+            waiter->scheduler->Schedule(waiter->fiber, waiter->thread);
+          },
+          weak);
+    }
+    Fiber::GetThis()->Yield();
+    if (timer) {
+      timer->Cancel();
+    }
+    Socket *sock;
+    {
+      MutexType::Lock lock(host->mutex);
+      sock = waiter->sock;
+    }
+    if (sock) {
+      ++reuse_count_;
+      return Wrap(sock, host);
+    }
+    if (Clock::NowMS() >= deadline) {
+      LOG_DEBUG(g_logger) << "SocketPool checkout " << addr->ToString()
+                          << " timeout=" << timeout_ms;
+      return nullptr;
+    }
+  }
+}
+
+void SocketPool::OnTimer() {
+  std::vector<Host::ptr> hosts;
+  {
+    RWMutex::ReadLock lock(hosts_mutex_);
+    for (auto &i : hosts_) {
+      hosts.push_back(i.second);
+    }
+  }
+  uint64_t now = Clock::NowMS();
+  size_t min_idle = min_idle_;
+  uint64_t idle_timeout = idle_timeout_;
+  // 定时器的周期，保留的连接空闲超过一个周期就重新计时，到下一次检查之前不会过期
+  uint64_t refresh = std::max<uint64_t>(idle_timeout / 2, 1);
+  for (auto &host : hosts) {
+    // 从最早归还的开始关闭空闲过久的连接，至少保留min_idle个
+    std::vector<Socket *> expired;
+    for (auto &shard : host->shards) {
+      MutexType::Lock lock(shard.mutex);
+      for (size_t n = shard.conns.size(); n > 0; --n) {
+        Idle idle = shard.conns.front();
+        bool retain = host->idle <= min_idle;
+        if (now - idle.time < (retain ? refresh : idle_timeout)) {
+          break;
+        }
+        shard.conns.pop_front();
+        if (retain && Alive(idle.sock)) {
+          idle.time = now;
+          shard.conns.push_back(idle);
+        } else {
+          expired.push_back(idle.sock);
+          --host->idle;
+        }
+      }
+    }
+    for (auto sock : expired) {
+      Discard(sock, host);
+    }
+
+    while (host->idle + host->warming < min_idle) {
+      {
+        MutexType::Lock lock(host->mutex);
+        if (host->total >= max_total_) {
+          break;
+        }
+        ++host->total;
+      }
+      ++host->warming;
+      iom_->Schedule([this, host]() {
+        Socket *sock = Connect(host);
+        --host->warming;
+        if (!sock) {
+          Discard(nullptr, host);
+          return;
+        }
+        ReleasePtr(sock, host);
+      });
+    }
+  }
+}
+
+}  // namespace serverframework
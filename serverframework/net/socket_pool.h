@@ -0,0 +1,225 @@
+/**
+ * @file socket_pool.h
+ * @brief 客户端连接池
+ * @details 按目标地址缓存空闲的TCP连接，复用连接省去每次请求的三次握手和connect超时定时器。
+ *          空闲连接按线程分片存放，同一线程取还连接只锁自己的分片；取出时先探测连接是否还活着。
+ *          到达最大连接数时，取连接的协程排队让出，直到有连接归还或超时。
+ *          IOManager上的定时器定期关闭空闲过久的连接，并补足最少空闲连接数
+ */
+#ifndef SOCKET_POOL_H
+#define SOCKET_POOL_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "env/mutex.h"
+#include "fiber/fiber.h"
+#include "net/iomanager.h"
+#include "net/socket.h"
+
+namespace serverframework {
+
+/**
+ * @brief 客户端连接池
+ * @details 参数的默认值取自配置项socket_pool.*。借出连接的删除器和补足空闲连接的任务都直接引用连接池，
+ *          连接池必须比借出的连接和正在建立的连接活得更久，析构时检查没有这样的连接
+ */
+class SocketPool {
+ public:
+  using ptr = std::shared_ptr<SocketPool>;
+  using MutexType = Mutex;
+
+  /**
+   * @brief 构造函数
+   * @param[in] iom 运行空闲连接回收定时器的IOManager，为空时不回收
+   */
+  SocketPool(IOManager *iom = IOManager::GetThis());
+  SocketPool(const SocketPool &) = delete;
+  SocketPool &operator=(const SocketPool &) = delete;
+
+  /**
+   * @brief 析构函数，关闭所有空闲连接
+   * @attention 所有借出的连接必须已经归还，回收定时器补足空闲连接的任务必须已经完成
+   */
+  ~SocketPool();
+
+  /**
+   * @brief 取出一个到addr的连接
+   * @details 优先取当前线程分片中最近归还的连接，其次取其他分片的，都没有时新建连接；
+   *          连接数已满时排队等待。返回的Socket析构时连接自动归还，
+   *          请求出错、连接状态不确定时应先调用Socket::close，归还时会丢弃该连接
+   * @param[in] addr 目标地址
+   * @param[in] timeout_ms 等待空闲连接的超时时间，-1表示使用配置项socket_pool.checkout_timeout
+   * @return 连接，连接失败或等待超时返回nullptr
+   */
+  Socket::ptr Checkout(Address::ptr addr, uint64_t timeout_ms = -1);
+
+  /**
+   * @brief 到addr的空闲连接数
+   */
+  size_t GetIdleCount(Address::ptr addr);
+
+  /**
+   * @brief 到addr的连接总数，包括空闲和借出的
+   */
+  size_t GetTotalCount(Address::ptr addr);
+
+  /**
+   * @brief 新建的连接数
+   */
+  uint64_t GetConnectCount() const { return connect_count_; }
+
+  /**
+   * @brief 复用空闲连接的次数
+   */
+  uint64_t GetReuseCount() const { return reuse_count_; }
+
+  /**
+   * @brief 取连接时排队等待的次数
+   */
+  uint64_t GetWaitCount() const { return wait_count_; }
+
+  void SetMaxIdle(size_t v) { max_idle_ = v; }
+  void SetMinIdle(size_t v) { min_idle_ = v; }
+  void SetMaxTotal(size_t v) { max_total_ = v; }
+  void SetConnectTimeout(uint64_t v) { connect_timeout_ = v; }
+  void SetCheckoutTimeout(uint64_t v) { checkout_timeout_ = v; }
+
+  /**
+   * @brief 设置空闲连接的最长空闲时间，回收定时器的周期为它的一半
+   */
+  void SetIdleTimeout(uint64_t v);
+
+ private:
+  /**
+   * @brief 空闲连接
+   */
+  struct Idle {
+    Socket *sock;
+    // 归还的时间(毫秒)
+    uint64_t time;
+  };
+
+  /**
+   * @brief 空闲连接的一个线程分片
+   */
+  struct Shard {
+    MutexType mutex;
+    std::deque<Idle> conns;
+  };
+
+  /**
+   * @brief 等待连接的协程
+   */
+  struct Waiter {
+    Scheduler *scheduler;
+    Fiber::ptr fiber;
+    // 开启线程亲和时固定调度回原来的线程，否则为-1
+    int thread;
+    // 归还给它的连接，为空时表示有连接被关闭，可以重试
+    Socket *sock = nullptr;
+    // 是否已被唤醒或已超时
+    bool done = false;
+  };
+
+  static const size_t kShards = 16;
+
+  /**
+   * @brief 一个目标地址的连接
+   */
+  struct Host {
+    using ptr = std::shared_ptr<Host>;
+    Address::ptr addr;
+    Shard shards[kShards];
+    // 保护waiters和total的增加
+    MutexType mutex;
+    std::deque<std::shared_ptr<Waiter>> waiters;
+    std::atomic<size_t> waiting{0};
+    // 连接总数，包括空闲、借出和正在建立的
+    std::atomic<size_t> total{0};
+    // 空闲连接数
+    std::atomic<size_t> idle{0};
+    // 回收定时器为补足空闲连接正在建立的连接数
+    std::atomic<size_t> warming{0};
+  };
+
+  /**
+   * @brief 取得目标地址的Host，不存在时创建
+   */
+  Host::ptr GetHost(Address::ptr addr, bool create = true);
+
+  /**
+   * @brief 从分片中取出一个空闲连接，从当前线程的分片开始找，优先取最近归还的
+   */
+  bool PopIdle(Host::ptr host, Idle &idle);
+
+  /**
+   * @brief 空闲连接是否可以复用：没有空闲过久，并且对端没有关闭、没有残留数据
+   */
+  bool Usable(const Idle &idle);
+
+  /**
+   * @brief 空闲连接的对端是否没有关闭、没有残留数据
+   */
+  static bool Alive(Socket *sock);
+
+  /**
+   * @brief 唤醒第一个等待者
+   * @param[in] sock 交给它的连接，为空时让它重试
+   * @return 是否有等待者
+   */
+  bool WakeWaiter(Host::ptr host, Socket *sock);
+
+  /**
+   * @brief 新建连接
+   */
+  Socket *Connect(Host::ptr host);
+
+  /**
+   * @brief 借出的连接析构时调用，归还或关闭连接
+   */
+  void ReleasePtr(Socket *sock, Host::ptr host);
+
+  /**
+   * @brief 关闭连接，唤醒一个等待者重试
+   */
+  void Discard(Socket *sock, Host::ptr host);
+
+  /**
+   * @brief 包装成析构时归还的Socket::ptr
+   */
+  Socket::ptr Wrap(Socket *sock, Host::ptr host);
+
+  /**
+   * @brief 回收定时器，关闭空闲过久的连接并补足最少空闲连接数
+   * @details 为最少空闲连接数保留的连接，探测到对端没有关闭时重新计时，取出时不会被当作空闲过久丢弃
+   */
+  void OnTimer();
+
+ private:
+  IOManager *iom_;
+  RWMutex hosts_mutex_;
+  std::unordered_map<std::string, Host::ptr> hosts_;
+  Timer::ptr timer_;
+  // 每个目标地址最多保留的空闲连接数
+  std::atomic<size_t> max_idle_;
+  // 每个目标地址最少保持的空闲连接数
+  std::atomic<size_t> min_idle_;
+  // 每个目标地址最多的连接数
+  std::atomic<size_t> max_total_;
+  std::atomic<uint64_t> idle_timeout_;
+  std::atomic<uint64_t> connect_timeout_;
+  std::atomic<uint64_t> checkout_timeout_;
+  std::atomic<uint64_t> connect_count_{0};
+  std::atomic<uint64_t> reuse_count_{0};
+  std::atomic<uint64_t> wait_count_{0};
+};
+
+}  // namespace serverframework
+
+#endif
@@ -0,0 +1,280 @@
+#include "net/socket_stream.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "config/config.h"
+
+namespace serverframework {
+
+static serverframework::ConfigVar<uint32_t>::ptr g_read_buffer_size =
+    serverframework::Config::Lookup("socket_stream.read_buffer_size",
+                                    (uint32_t)(16 * 1024),
+                                    "socket stream read buffer size");
+
+static serverframework::ConfigVar<uint32_t>::ptr g_write_buffer_size =
+    serverframework::Config::Lookup("socket_stream.write_buffer_size",
+                                    (uint32_t)(16 * 1024),
+                                    "socket stream write buffer size");
+
+SocketStream::SocketStream(Socket::ptr sock, bool owner)
+    : socket_(sock),
+      owner_(owner),
+      read_buf_(std::max<uint32_t>(g_read_buffer_size->GetValue(), 1)),
+      write_buf_(std::max<uint32_t>(g_write_buffer_size->GetValue(), 1)) {}
+
+SocketStream::~SocketStream() {
+  if (owner_ && socket_) {
+    close();
+  }
+}
+
+bool SocketStream::IsConnected() const {
+  return socket_ && socket_->IsConnected();
+}
+
+int SocketStream::Fill() {
+  if (read_pos_ == read_end_) {
+    read_pos_ = read_end_ = 0;
+  } else if (read_end_ == read_buf_.size() && read_pos_ > 0) {
+    memmove(&read_buf_[0], &read_buf_[read_pos_], read_end_ - read_pos_);
+    read_end_ -= read_pos_;
+    read_pos_ = 0;
+  }
+  int rt = socket_->recv(&read_buf_[read_end_], read_buf_.size() - read_end_);
+  if (rt > 0) {
+    read_end_ += rt;
+  }
+  return rt;
+}
+
+int SocketStream::read(void *buffer, size_t length) {
+  if (!IsConnected()) {
+    return -1;
+  }
+  if (length == 0) {
+    return 0;
+  }
+  size_t buffered = GetReadBuffered();
+  if (buffered) {
+    size_t n = std::min(buffered, length);
+    memcpy(buffer, &read_buf_[read_pos_], n);
+    read_pos_ += n;
+    return n;
+  }
+  // 缓冲区为空，一次readv同时读到用户内存和读缓冲区
+  read_pos_ = read_end_ = 0;
+  iovec iovs[2];
+  iovs[0].iov_base = buffer;
+  iovs[0].iov_len = length;
+  iovs[1].iov_base = &read_buf_[0];
+  iovs[1].iov_len = read_buf_.size();
+  int rt = socket_->recv(iovs, 2);
+  if (rt <= 0) {
+    return rt;
+  }
+  if ((size_t)rt > length) {
+    read_end_ = rt - length;
+    return length;
+  }
+  return rt;
+}
+
+int SocketStream::read(ByteArray::ptr ba, size_t length) {
+  if (!IsConnected()) {
+    return -1;
+  }
+  if (length == 0) {
+    return 0;
+  }
+  size_t buffered = GetReadBuffered();
+  if (buffered) {
+    size_t n = std::min(buffered, length);
+    ba->write(&read_buf_[read_pos_], n);
+    read_pos_ += n;
+    return n;
+  }
+  std::vector<iovec> iovs;
+  ba->GetWriteBuffers(iovs, length);
+  int rt = socket_->recv(&iovs[0], iovs.size());
+  if (rt > 0) {
+    ba->SetPosition(ba->GetPosition() + rt);
+  }
+  return rt;
+}
+
+int SocketStream::Peek(void *buffer, size_t length) {
+  if (!IsConnected()) {
+    return -1;
+  }
+  length = std::min(length, read_buf_.size());
+  while (GetReadBuffered() < length) {
+    int rt = Fill();
+    if (rt <= 0) {
+      if (GetReadBuffered() == 0) {
+        return rt;
+      }
+      break;
+    }
+  }
+  size_t n = std::min(length, GetReadBuffered());
+  memcpy(buffer, &read_buf_[read_pos_], n);
+  return n;
+}
+
+int SocketStream::ReadUntil(std::string &out, const std::string &delimiter) {
+  out.clear();
+  if (!IsConnected() || delimiter.empty()) {
+    return -1;
+  }
+  // 已经查找过的位置(相对read_pos_)，新数据到来后只需从这里往后找
+  size_t scanned = 0;
+  while (true) {
+    const char *begin = &read_buf_[read_pos_];
+    const char *end = begin + GetReadBuffered();
+    const char *found = std::search(begin + scanned, end, delimiter.begin(),
+                                    delimiter.end());
+    if (found != end) {
+      size_t n = found - begin + delimiter.size();
+      out.assign(begin, n);
+      read_pos_ += n;
+      return n;
+    }
+    if (GetReadBuffered() == read_buf_.size()) {
+      errno = EMSGSIZE;
+      return -1;
+    }
+    if (GetReadBuffered() >= delimiter.size()) {
+      scanned = GetReadBuffered() - delimiter.size() + 1;
+    }
+    int rt = Fill();
+    if (rt <= 0) {
+      return rt;
+    }
+  }
+}
+
+int SocketStream::write(const void *buffer, size_t length) {
+  if (!IsConnected()) {
+    return -1;
+  }
+  while (true) {
+    if (write_len_ + length <= write_buf_.size()) {
+      memcpy(&write_buf_[write_len_], buffer, length);
+      write_len_ += length;
+      return length;
+    }
+    // 缓冲区放不下，缓冲数据和用户数据一起发出
+    iovec iovs[2];
+    size_t n = 0;
+    if (write_len_) {
+      iovs[n].iov_base = &write_buf_[0];
+      iovs[n].iov_len = write_len_;
+      ++n;
+    }
+    iovs[n].iov_base = (void *)buffer;
+    iovs[n].iov_len = length;
+    ++n;
+    int rt = socket_->send(iovs, n);
+    if (rt <= 0) {
+      return rt;
+    }
+    if ((size_t)rt >= write_len_) {
+      size_t sent = rt - write_len_;
+      write_len_ = 0;
+      if (sent) {
+        return sent;
+      }
+      continue;
+    }
+    memmove(&write_buf_[0], &write_buf_[rt], write_len_ - rt);
+    write_len_ -= rt;
+  }
+}
+
+int SocketStream::write(ByteArray::ptr ba, size_t length) {
+  if (!IsConnected()) {
+    return -1;
+  }
+  length = std::min<size_t>(length, ba->GetReadSize());
+  while (true) {
+    if (write_len_ + length <= write_buf_.size()) {
+      ba->read(&write_buf_[write_len_], length);
+      write_len_ += length;
+      return length;
+    }
+    std::vector<iovec> iovs;
+    if (write_len_) {
+      iovec iov;
+      iov.iov_base = &write_buf_[0];
+      iov.iov_len = write_len_;
+      iovs.push_back(iov);
+    }
+    ba->GetReadBuffers(iovs, length);
+    int rt = socket_->send(&iovs[0], iovs.size());
+    if (rt <= 0) {
+      return rt;
+    }
+    if ((size_t)rt >= write_len_) {
+      size_t sent = rt - write_len_;
+      write_len_ = 0;
+      if (sent) {
+        ba->SetPosition(ba->GetPosition() + sent);
+        return sent;
+      }
+      continue;
+    }
+    memmove(&write_buf_[0], &write_buf_[rt], write_len_ - rt);
+    write_len_ -= rt;
+  }
+}
+
+int SocketStream::Flush() {
+  size_t total = write_len_;
+  size_t offset = 0;
+  while (offset < write_len_) {
+    int rt = socket_->send(&write_buf_[offset], write_len_ - offset);
+    if (rt <= 0) {
+      // 未发出的数据留在缓冲区
+      memmove(&write_buf_[0], &write_buf_[offset], write_len_ - offset);
+      write_len_ -= offset;
+      return rt < 0 ? rt : -1;
+    }
+    offset += rt;
+  }
+  write_len_ = 0;
+  return total;
+}
+
+void SocketStream::close() {
+  if (socket_) {
+    if (write_len_ && socket_->IsConnected()) {
+      Flush();
+    }
+    if (owner_) {
+      socket_->close();
+    }
+  }
+}
+
+Address::ptr SocketStream::GetRemoteAddress() {
+  return socket_ ? socket_->GetRemoteAddress() : nullptr;
+}
+
+Address::ptr SocketStream::GetLocalAddress() {
+  return socket_ ? socket_->GetLocalAddress() : nullptr;
+}
+
+std::string SocketStream::GetRemoteAddressString() {
+  Address::ptr addr = GetRemoteAddress();
+  return addr ? addr->ToString() : "";
+}
+
+std::string SocketStream::GetLocalAddressString() {
+  Address::ptr addr = GetLocalAddress();
+  return addr ? addr->ToString() : "";
+}
+
+}  // namespace serverframework
@@ -0,0 +1,157 @@
+/**
+ * @file socket_stream.h
+ * @brief Socket流
+ * @details 带读缓冲和写缓冲的Stream实现。读时一次recv尽量多读，后续的小读取直接从缓冲区取；
+ *          写时先合并到写缓冲区，缓冲区放不下或调用Flush时才send，缓冲数据和用户数据用一次writev发出
+ */
+#ifndef SOCKET_STREAM_H
+#define SOCKET_STREAM_H
+
+#include <string>
+#include <vector>
+
+#include "net/socket.h"
+#include "util/stream.h"
+
+namespace serverframework {
+
+/**
+ * @brief Socket流
+ * @details 不是线程安全的，同一时间只应由一个协程读、一个协程写
+ */
+class SocketStream : public Stream {
+ public:
+  using ptr = std::shared_ptr<SocketStream>;
+
+  /**
+   * @brief 构造函数
+   * @param[in] sock Socket
+   * @param[in] owner 是否由流负责关闭socket
+   * @details 读写缓冲区的大小取自配置项socket_stream.read_buffer_size和socket_stream.write_buffer_size
+   */
+  SocketStream(Socket::ptr sock, bool owner = true);
+
+  /**
+   * @brief 析构函数
+   * @details owner为true时关闭socket，写缓冲区中的数据会先发出
+   */
+  ~SocketStream();
+
+  /**
+   * @brief 读数据
+   * @details 先返回读缓冲区中的数据；缓冲区为空时用readv同时读到buffer和读缓冲区
+   * @return
+   *      @retval >0 返回实际读到的数据长度
+   *      @retval =0 socket被远端关闭
+   *      @retval <0 socket错误
+   */
+  int read(void *buffer, size_t length) override;
+
+  /**
+   * @brief 读数据到ByteArray
+   * @details 数据从ba的当前位置写入，并移动ba的位置
+   * @return 同read(void*, size_t)
+   */
+  int read(ByteArray::ptr ba, size_t length) override;
+
+  /**
+   * @brief 写数据
+   * @details 放得进写缓冲区时只拷贝不发送，需要调用Flush发出
+   * @return
+   *      @retval >0 返回实际写入的数据长度
+   *      @retval =0 socket被远端关闭
+   *      @retval <0 socket错误
+   */
+  int write(const void *buffer, size_t length) override;
+
+  /**
+   * @brief 写ByteArray中的数据
+   * @details 从ba的当前位置读取，并移动ba的位置
+   * @return 同write(const void*, size_t)
+   */
+  int write(ByteArray::ptr ba, size_t length) override;
+
+  /**
+   * @brief 发出写缓冲区中的全部数据
+   * @return
+   *      @retval >=0 发出的字节数
+   *      @retval <0 socket错误
+   */
+  int Flush();
+
+  /**
+   * @brief 查看数据但不取走
+   * @details 读缓冲区中不足length字节时从socket读取，直到凑够length字节或缓冲区满
+   * @return
+   *      @retval >0 拷贝到buffer的字节数，只有对端关闭或缓冲区满时才会小于length
+   *      @retval =0 socket被远端关闭
+   *      @retval <0 socket错误
+   */
+  int Peek(void *buffer, size_t length);
+
+  /**
+   * @brief 读到分隔符为止
+   * @param[out] out 读到的数据，包括分隔符
+   * @param[in] delimiter 分隔符，不能为空
+   * @return
+   *      @retval >0 out的长度
+   *      @retval =0 读到分隔符之前socket被远端关闭
+   *      @retval <0 socket错误；读缓冲区满了还没有分隔符时errno为EMSGSIZE
+   */
+  int ReadUntil(std::string &out, const std::string &delimiter);
+
+  /**
+   * @brief 读缓冲区中还未取走的字节数
+   */
+  size_t GetReadBuffered() const { return read_end_ - read_pos_; }
+
+  /**
+   * @brief 写缓冲区中还未发出的字节数
+   */
+  size_t GetWriteBuffered() const { return write_len_; }
+
+  /**
+   * @brief 关闭流
+   * @details 先发出写缓冲区中的数据，owner为true时关闭socket
+   */
+  void close() override;
+
+  /**
+   * @brief 返回Socket
+   */
+  Socket::ptr GetSocket() const { return socket_; }
+
+  /**
+   * @brief 返回是否连接
+   */
+  bool IsConnected() const;
+
+  Address::ptr GetRemoteAddress();
+  Address::ptr GetLocalAddress();
+  std::string GetRemoteAddressString();
+  std::string GetLocalAddressString();
+
+ private:
+  /**
+   * @brief 从socket读取数据追加到读缓冲区
+   * @return 同recv
+   */
+  int Fill();
+
+ private:
+  // Socket
+  Socket::ptr socket_;
+  // 是否由流负责关闭socket
+  bool owner_;
+  // 读缓冲区，[read_pos_, read_end_)是还未取走的数据
+  std::vector<char> read_buf_;
+  size_t read_pos_ = 0;
+  size_t read_end_ = 0;
+  // 写缓冲区，[0, write_len_)是还未发出的数据
+  std::vector<char> write_buf_;
+  size_t write_len_ = 0;
+};
+
+}  // namespace serverframework
+
+#endif
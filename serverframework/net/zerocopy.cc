@@ -0,0 +1,56 @@
+#include "net/zerocopy.h"
+
+#include <vector>
+
+namespace serverframework {
+
+// 序号差按32位回绕计算，小于2^31的视为在base之后
+static const uint32_t kSeqWindow = 1u << 31;
+
+void ZeroCopyState::Register(std::shared_ptr<void> ref) {
+  Mutex::Lock lock(mutex);
+  uint32_t idx = next++ - base;
+  if (idx >= kSeqWindow) {
+    // 完成通知先到达，占位已经被弹出
+    return;
+  }
+  if (idx >= pins.size()) {
+    pins.resize(idx + 1);
+  }
+  if (pins[idx].state == EMPTY) {
+    pins[idx].ref = std::move(ref);
+    pins[idx].state = PENDING;
+    ++pending;
+  }
+}
+
+void ZeroCopyState::Complete(uint32_t lo, uint32_t hi, bool was_copied) {
+  // 在锁外释放用户内存
+  std::vector<std::shared_ptr<void> > released;
+  Mutex::Lock lock(mutex);
+  for (uint32_t seq = lo;; ++seq) {
+    uint32_t idx = seq - base;
+    if (idx < kSeqWindow) {
+      if (idx >= pins.size()) {
+        pins.resize(idx + 1);
+      }
+      if (pins[idx].state == PENDING) {
+        released.push_back(std::move(pins[idx].ref));
+        --pending;
+      }
+      if (pins[idx].state != DONE && was_copied) {
+        ++copied;
+      }
+      pins[idx].state = DONE;
+    }
+    if (seq == hi) {
+      break;
+    }
+  }
+  while (!pins.empty() && pins.front().state == DONE) {
+    pins.pop_front();
+    ++base;
+  }
+}
+
+}  // namespace serverframework
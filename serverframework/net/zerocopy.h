@@ -0,0 +1,67 @@
+/**
+ * @file zerocopy.h
+ * @brief 零拷贝发送的完成跟踪
+ * @details 每次带MSG_ZEROCOPY成功的发送，内核按顺序分配一个32位序号，发送完成后在错误队列中
+ *          通知一段完成的序号区间。Socket用ZeroCopyState把序号和发送引用的用户内存对应起来
+ */
+#ifndef ZEROCOPY_H
+#define ZEROCOPY_H
+
+#include <stdint.h>
+
+#include <deque>
+#include <memory>
+
+#include "env/mutex.h"
+
+namespace serverframework {
+
+/**
+ * @brief 零拷贝发送的状态
+ * @details pins[i]对应序号base + i的发送，持有它引用的用户内存。
+ *          多线程调度时完成通知可能先于发送方登记到达，此时先占位标记为已完成；
+ *          占位被Complete弹出之后再登记的序号落在base之前，同样视为已完成
+ */
+struct ZeroCopyState {
+  enum PinState {
+    // 发送方还没有登记
+    EMPTY,
+    // 已登记，等待完成
+    PENDING,
+    // 已完成
+    DONE
+  };
+
+  struct Pin {
+    std::shared_ptr<void> ref;
+    PinState state = EMPTY;
+  };
+
+  /**
+   * @brief 登记一次成功的零拷贝发送
+   * @details 这次发送已经完成时不持有ref，也不计入pending
+   */
+  void Register(std::shared_ptr<void> ref);
+
+  /**
+   * @brief 序号区间[lo, hi]的发送完成，释放对应的用户内存
+   */
+  void Complete(uint32_t lo, uint32_t hi, bool copied);
+
+  Mutex mutex;
+  // socket句柄，socket关闭后为-1，防止回调读到fd复用后其他socket的错误队列
+  int fd = -1;
+  // 下一次零拷贝发送的序号
+  uint32_t next = 0;
+  // pins[0]的序号
+  uint32_t base = 0;
+  std::deque<Pin> pins;
+  // 未完成的发送次数
+  size_t pending = 0;
+  // 内核实际做了拷贝的发送次数
+  uint64_t copied = 0;
+};
+
+}  // namespace serverframework
+
+#endif
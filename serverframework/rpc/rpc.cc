@@ -0,0 +1,223 @@
+#include "rpc/rpc.h"
+
+#include <limits.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "log/log.h"
+
+namespace serverframework {
+
+static serverframework::Logger::ptr g_logger = LOG_NAME("system");
+
+/**
+ * @brief varint编码后的字节数
+ */
+static size_t VarintSize(uint64_t v) {
+  size_t n = 1;
+  while (v >= 0x80) {
+    v >>= 7;
+    ++n;
+  }
+  return n;
+}
+
+/**
+ * @brief Int32的zigzag编码，和ByteArray::WriteInt32相同
+ */
+static uint32_t ZigZag32(int32_t v) {
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+const char *RpcStatusToString(int32_t status) {
+  switch (status) {
+    case RPC_OK: return "OK";
+    case RPC_NOT_FOUND: return "NOT_FOUND";
+    case RPC_DEADLINE_EXCEEDED: return "DEADLINE_EXCEEDED";
+    case RPC_CANCELLED: return "CANCELLED";
+    case RPC_CLOSED: return "CLOSED";
+    case RPC_BAD_MESSAGE: return "BAD_MESSAGE";
+    default: return status > 0 ? "APPLICATION_ERROR" : "UNKNOWN";
+  }
+}
+
+bool RpcMessage::Decode(const Frame &frame) {
+  if (!frame.data || !frame.length) {
+    return false;
+  }
+  ByteArray::ptr data = frame.data;
+  size_t saved = data->GetPosition();
+  size_t end = frame.position + frame.length;
+  bool ok = true;
+  data->SetPosition(frame.position);
+  try {
+    type = data->ReadFuint8();
+    id = data->ReadUint64();
+    switch (type) {
+      case REQUEST:
+        method = data->ReadStringVint();
+        timeout = data->ReadUint64();
+        break;
+      case RESPONSE:
+        status = data->ReadInt32();
+        break;
+      case CANCEL:
+        break;
+      default:
+        ok = false;
+    }
+    if (ok && data->GetPosition() > end) {
+      ok = false;
+    }
+    if (ok) {
+      size_t pos = data->GetPosition();
+      payload.resize(end - pos);
+      if (end > pos) {
+        data->read(&payload[0], end - pos, pos);
+      }
+    }
+  } catch (std::out_of_range &e) {
+    ok = false;
+  }
+  data->SetPosition(saved);
+  return ok;
+}
+
+RpcChannel::RpcChannel(Socket::ptr sock, IOManager *iom)
+    : sock_(sock), iom_(iom), out_(new ByteArray) {}
+
+bool RpcChannel::SendRequest(uint64_t id, const std::string &method,
+                             uint64_t timeout, const std::string &payload,
+                             bool flush) {
+  uint64_t length = 1 + VarintSize(id) + VarintSize(method.size()) +
+                    method.size() + VarintSize(timeout) + payload.size();
+  {
+    MutexType::Lock lock(mutex_);
+    if (closed_) {
+      return false;
+    }
+    out_->WriteUint64(length);
+    out_->WriteFuint8(RpcMessage::REQUEST);
+    out_->WriteUint64(id);
+    out_->WriteStringVint(method);
+    out_->WriteUint64(timeout);
+    out_->write(payload.data(), payload.size());
+  }
+  ScheduleFlush(flush);
+  return true;
+}
+
+bool RpcChannel::SendResponse(uint64_t id, int32_t status,
+                              const std::string &payload, bool flush) {
+  uint64_t length =
+      1 + VarintSize(id) + VarintSize(ZigZag32(status)) + payload.size();
+  {
+    MutexType::Lock lock(mutex_);
+    if (closed_) {
+      return false;
+    }
+    out_->WriteUint64(length);
+    out_->WriteFuint8(RpcMessage::RESPONSE);
+    out_->WriteUint64(id);
+    out_->WriteInt32(status);
+    out_->write(payload.data(), payload.size());
+  }
+  ScheduleFlush(flush);
+  return true;
+}
+
+bool RpcChannel::SendCancel(uint64_t id, bool flush) {
+  {
+    MutexType::Lock lock(mutex_);
+    if (closed_) {
+      return false;
+    }
+    out_->WriteUint64(1 + VarintSize(id));
+    out_->WriteFuint8(RpcMessage::CANCEL);
+    out_->WriteUint64(id);
+  }
+  ScheduleFlush(flush);
+  return true;
+}
+
+void RpcChannel::ScheduleFlush(bool flush) {
+  if (!flush) {
+    return;
+  }
+  {
+    MutexType::Lock lock(mutex_);
+    if (writing_ || flush_scheduled_) {
+      return;
+    }
+    flush_scheduled_ = true;
+  }
+  RpcChannel::ptr self = shared_from_this();
+  iom_->Schedule([self]() { self->Flush(); });
+}
+
+void RpcChannel::Flush() {
+  MutexType::Lock lock(mutex_);
+  flush_scheduled_ = false;
+  if (writing_) {
+    return;
+  }
+  writing_ = true;
+  std::vector<iovec> iovs;
+  bool ok = true;
+  while (ok && !closed_ && out_->GetSize()) {
+    ByteArray::ptr buffer = out_;
+    out_ = spare_ ? spare_ : ByteArray::ptr(new ByteArray);
+    spare_.reset();
+    lock.unlock();
+
+    iovs.clear();
+    buffer->GetReadBuffers(iovs, buffer->GetSize(), 0);
+    size_t idx = 0;
+    while (idx < iovs.size()) {
+      size_t count = std::min(iovs.size() - idx, (size_t)IOV_MAX);
+      // 对端已关闭时返回EPIPE而不是让进程收到SIGPIPE
+      int rt = sock_->send(&iovs[idx], count, MSG_NOSIGNAL);
+      if (rt <= 0) {
+        // 让读取的协程读到EOF，由它关闭连接
+        LOG_DEBUG(g_logger) << "RpcChannel send fail rt=" << rt
+                            << " errno=" << errno << " " << *sock_;
+        ::shutdown(sock_->GetSocket(), SHUT_RDWR);
+        ok = false;
+        break;
+      }
+      size_t n = rt;
+      while (n && n >= iovs[idx].iov_len) {
+        n -= iovs[idx].iov_len;
+        ++idx;
+      }
+      if (n) {
+        iovs[idx].iov_base = (char *)iovs[idx].iov_base + n;
+        iovs[idx].iov_len -= n;
+      }
+    }
+    buffer->Clear();
+
+    lock.lock();
+    spare_ = buffer;
+  }
+  writing_ = false;
+  if (closed_) {
+    sock_->close();
+  }
+}
+
+void RpcChannel::Close() {
+  MutexType::Lock lock(mutex_);
+  if (closed_) {
+    return;
+  }
+  closed_ = true;
+  // 正在发送时由发送的协程关闭
+  if (!writing_) {
+    sock_->close();
+  }
+}
+
+}  // namespace serverframework
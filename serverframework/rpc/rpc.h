@@ -0,0 +1,137 @@
+/**
+ * @file rpc.h
+ * @brief RPC协议和连接的发送端
+ * @details 一个连接上同时进行多个调用，用请求id区分。每条消息是一个varint长度前缀的帧(见frame_codec.h)，
+ *          帧内用ByteArray的编码器依次写入：
+ *          - 请求：Fuint8类型 | Uint64 id | StringVint方法名 | Uint64剩余超时毫秒(0表示不限) | 请求数据
+ *          - 响应：Fuint8类型 | Uint64 id | Int32状态码 | 响应数据
+ *          - 取消：Fuint8类型 | Uint64 id
+ */
+#ifndef RPC_H
+#define RPC_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "env/mutex.h"
+#include "net/iomanager.h"
+#include "net/socket.h"
+#include "tcp/frame_codec.h"
+#include "util/bytearray.h"
+
+namespace serverframework {
+
+/**
+ * @brief 框架定义的状态码，都是负数；处理函数返回的0表示成功，正数由业务定义
+ */
+enum RpcStatus {
+  RPC_OK = 0,
+  // 方法不存在
+  RPC_NOT_FOUND = -1,
+  // 超过截止时间
+  RPC_DEADLINE_EXCEEDED = -2,
+  // 调用被取消
+  RPC_CANCELLED = -3,
+  // 连接已关闭
+  RPC_CLOSED = -4,
+  // 消息格式错误
+  RPC_BAD_MESSAGE = -5
+};
+
+/**
+ * @brief 状态码的名字
+ */
+const char *RpcStatusToString(int32_t status);
+
+/**
+ * @brief 解码后的消息
+ */
+struct RpcMessage {
+  enum Type { REQUEST = 0, RESPONSE = 1, CANCEL = 2 };
+
+  /**
+   * @brief 从帧解码
+   * @details 帧所在的ByteArray的读写位置会被临时移动，只能在读取该连接的协程中调用
+   * @return 格式错误返回false
+   */
+  bool Decode(const Frame &frame);
+
+  uint8_t type = REQUEST;
+  uint64_t id = 0;
+  std::string method;
+  uint64_t timeout = 0;
+  int32_t status = RPC_OK;
+  std::string payload;
+};
+
+/**
+ * @brief 连接的发送端，多个协程可以同时发送
+ * @details 消息在锁内直接编码进待发送的ByteArray。没有协程在发送时，第一个发送者在IOManager上
+ *          安排一个刷新任务，在此之前各协程追加的消息由这个任务用一次writev发出；正在发送时追加的
+ *          消息由发送的协程在下一轮发出
+ */
+class RpcChannel : public std::enable_shared_from_this<RpcChannel> {
+ public:
+  using ptr = std::shared_ptr<RpcChannel>;
+  using MutexType = Mutex;
+
+  /**
+   * @brief 构造函数
+   * @param[in] sock 连接
+   * @param[in] iom 执行刷新任务的IOManager
+   */
+  RpcChannel(Socket::ptr sock, IOManager *iom);
+
+  /**
+   * @brief 发送请求
+   * @param[in] flush 是否安排刷新任务，false时由调用者之后调用Flush
+   */
+  bool SendRequest(uint64_t id, const std::string &method, uint64_t timeout,
+                   const std::string &payload, bool flush = true);
+
+  bool SendResponse(uint64_t id, int32_t status, const std::string &payload,
+                    bool flush = true);
+
+  bool SendCancel(uint64_t id, bool flush = true);
+
+  /**
+   * @brief 在当前协程中发出所有待发送的消息
+   */
+  void Flush();
+
+  /**
+   * @brief 关闭连接，正在发送时由发送的协程发完这一轮后关闭
+   */
+  void Close();
+
+  bool IsClosed() const { return closed_; }
+
+  Socket::ptr GetSocket() const { return sock_; }
+
+ private:
+  /**
+   * @brief 追加消息之后调用，需要时安排刷新任务
+   */
+  void ScheduleFlush(bool flush);
+
+ private:
+  Socket::ptr sock_;
+  IOManager *iom_;
+  MutexType mutex_;
+  // 待发送的消息
+  ByteArray::ptr out_;
+  // 发送完的缓冲区，清空后复用
+  ByteArray::ptr spare_;
+  // 是否有协程在发送
+  bool writing_ = false;
+  // 是否已经安排了刷新任务
+  bool flush_scheduled_ = false;
+  std::atomic<bool> closed_{false};
+};
+
+}  // namespace serverframework
+
+#endif
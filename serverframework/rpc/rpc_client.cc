@@ -0,0 +1,212 @@
+#include "rpc/rpc_client.h"
+
+#include <sys/socket.h>
+
+#include "config/config.h"
+#include "log/log.h"
+#include "util/macro.h"
+
+namespace serverframework {
+
+static serverframework::Logger::ptr g_logger = LOG_NAME("system");
+
+static serverframework::ConfigVar<uint64_t>::ptr g_rpc_timeout =
+    serverframework::Config::Lookup("rpc.timeout", (uint64_t)5000,
+                                    "rpc call timeout in ms, 0 means none");
+
+std::string RpcResult::ToString() const {
+  return std::string(RpcStatusToString(status)) + "(" +
+         std::to_string(status) + ")";
+}
+
+bool RpcFuture::IsDone() const {
+  Mutex::Lock lock(mutex_);
+  return done_;
+}
+
+const RpcResult &RpcFuture::Wait() {
+  {
+    Mutex::Lock lock(mutex_);
+    if (done_) {
+      return result_;
+    }
+    scheduler_ = Scheduler::GetThis();
+    fiber_ = Fiber::GetThis();
+    IOManager *iom = IOManager::GetThis();
+    thread_ = iom ? iom->GetAffinityThread() : -1;
+  }
+  // Complete可能在让出之前就调度了本协程，调度器会等它让出后再执行
+  Fiber::GetThis()->Yield();
+  return result_;
+}
+
+bool RpcFuture::Complete(int32_t status, std::string &&response) {
+  Scheduler *scheduler;
+  Fiber::ptr fiber;
+  Timer::ptr timer;
+  {
+    Mutex::Lock lock(mutex_);
+    if (done_) {
+      return false;
+    }
+    done_ = true;
+    result_.status = status;
+    result_.response.swap(response);
+    scheduler = scheduler_;
+    fiber.swap(fiber_);
+    timer.swap(timer_);
+  }
+  if (timer) {
+    timer->Cancel();
+  }
+  if (fiber) {
+    scheduler->Schedule(fiber, thread_);
+  }
+  return true;
+}
+
+void RpcFuture::SetTimer(Timer::ptr timer) {
+  {
+    Mutex::Lock lock(mutex_);
+    if (!done_) {
+      timer_ = timer;
+      return;
+    }
+  }
+  timer->Cancel();
+}
+
+RpcClient::RpcClient() {}
+
+RpcClient::~RpcClient() {
+  if (channel_) {
+    channel_->Close();
+  }
+}
+
+bool RpcClient::Connect(Address::ptr addr, uint64_t timeout_ms) {
+  iom_ = IOManager::GetThis();
+  ASSERT(iom_);
+  Socket::ptr sock = Socket::CreateTCP(addr);
+  if (!sock->connect(addr, timeout_ms)) {
+    LOG_ERROR(g_logger) << "RpcClient connect " << addr->ToString()
+                        << " fail errno=" << errno;
+    return false;
+  }
+  channel_.reset(new RpcChannel(sock, iom_));
+  connected_ = true;
+  RpcClient::ptr self = shared_from_this();
+  iom_->Schedule([self]() { self->ReadLoop(); });
+  return true;
+}
+
+RpcFuture::ptr RpcClient::CallAsync(const std::string &method,
+                                    const std::string &request,
+                                    uint64_t timeout_ms) {
+  if (timeout_ms == (uint64_t)-1) {
+    timeout_ms = g_rpc_timeout->GetValue();
+  }
+  uint64_t id = ++next_id_;
+  RpcFuture::ptr future(new RpcFuture(id));
+  {
+    Mutex::Lock lock(mutex_);
+    if (!connected_) {
+      lock.unlock();
+      future->Complete(RPC_CLOSED, std::string());
+      return future;
+    }
+    pending_[id] = future;
+  }
+  if (timeout_ms) {
+    std::weak_ptr<RpcClient> weak(shared_from_this());
+    future->SetTimer(iom_->AddTimer(timeout_ms, [weak, id]() {
+      RpcClient::ptr self = weak.lock();
+      if (self) {
+        self->Finish(id, RPC_DEADLINE_EXCEEDED, std::string(), true);
+      }
+    }));
+  }
+  if (!channel_->SendRequest(id, method, timeout_ms, request)) {
+    Finish(id, RPC_CLOSED, std::string(), false);
+  }
+  return future;
+}
+
+RpcResult RpcClient::Call(const std::string &method, const std::string &request,
+                          uint64_t timeout_ms) {
+  return CallAsync(method, request, timeout_ms)->Wait();
+}
+
+bool RpcClient::Cancel(RpcFuture::ptr future) {
+  return Finish(future->GetId(), RPC_CANCELLED, std::string(), true);
+}
+
+size_t RpcClient::GetPendingCount() const {
+  Mutex::Lock lock(mutex_);
+  return pending_.size();
+}
+
+bool RpcClient::Finish(uint64_t id, int32_t status, std::string &&response,
+                       bool send_cancel) {
+  RpcFuture::ptr future;
+  {
+    Mutex::Lock lock(mutex_);
+    auto it = pending_.find(id);
+    if (it == pending_.end()) {
+      return false;
+    }
+    future.swap(it->second);
+    pending_.erase(it);
+  }
+  if (send_cancel) {
+    channel_->SendCancel(id);
+  }
+  return future->Complete(status, std::move(response));
+}
+
+void RpcClient::Close() {
+  if (channel_) {
+    // 读协程读到EOF后结束所有未完成的调用
+    ::shutdown(channel_->GetSocket()->GetSocket(), SHUT_RDWR);
+  }
+}
+
+void RpcClient::ReadLoop() {
+  Socket::ptr sock = channel_->GetSocket();
+  FrameDecoder decoder(Frame::VARINT);
+  bool running = true;
+  while (running) {
+    int rt = decoder.ReadFrom(sock);
+    if (rt <= 0) {
+      break;
+    }
+    Frame frame;
+    RpcMessage msg;
+    while ((rt = decoder.Decode(frame)) > 0) {
+      if (!msg.Decode(frame) || msg.type != RpcMessage::RESPONSE) {
+        LOG_WARN(g_logger) << "RpcClient bad message from " << *sock;
+        running = false;
+        break;
+      }
+      // 已经超时或取消的调用不在pending_中，响应直接丢弃
+      Finish(msg.id, msg.status, std::move(msg.payload), false);
+    }
+    if (rt < 0) {
+      LOG_WARN(g_logger) << "RpcClient bad frame from " << *sock;
+      running = false;
+    }
+  }
+
+  std::unordered_map<uint64_t, RpcFuture::ptr> pending;
+  {
+    Mutex::Lock lock(mutex_);
+    connected_ = false;
+    pending.swap(pending_);
+  }
+  for (auto &i : pending) {
+    i.second->Complete(RPC_CLOSED, std::string());
+  }
+  channel_->Close();
+}
+
+}  // namespace serverframework
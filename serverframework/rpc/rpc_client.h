@@ -0,0 +1,163 @@
+/**
+ * @file rpc_client.h
+ * @brief RPC客户端
+ * @details 一个RpcClient对应一条连接，任意多个协程可以同时发起调用。请求在发送缓冲区中合并后批量发出，
+ *          后台读协程按请求id把响应交给对应的RpcFuture，唤醒等待的协程
+ */
+#ifndef RPC_CLIENT_H
+#define RPC_CLIENT_H
+
+#include <atomic>
+#include <string>
+#include <unordered_map>
+
+#include "fiber/fiber.h"
+#include "fiber/scheduler.h"
+#include "rpc/rpc.h"
+#include "util/timer.h"
+
+namespace serverframework {
+
+/**
+ * @brief 调用结果
+ */
+struct RpcResult {
+  bool ok() const { return status == RPC_OK; }
+
+  std::string ToString() const;
+
+  // 状态码，负数见RpcStatus，正数由服务端的处理函数返回
+  int32_t status = RPC_OK;
+  std::string response;
+};
+
+/**
+ * @brief 一次异步调用
+ * @details 同一时间只允许一个协程Wait
+ */
+class RpcFuture {
+ public:
+  using ptr = std::shared_ptr<RpcFuture>;
+
+  explicit RpcFuture(uint64_t id) : id_(id) {}
+
+  uint64_t GetId() const { return id_; }
+
+  /**
+   * @brief 是否已经完成
+   */
+  bool IsDone() const;
+
+  /**
+   * @brief 让出当前协程直到调用完成
+   * @pre 在协程中调用
+   */
+  const RpcResult &Wait();
+
+ private:
+  friend class RpcClient;
+
+  /**
+   * @brief 设置结果并唤醒等待的协程
+   * @return 已经完成过返回false
+   */
+  bool Complete(int32_t status, std::string &&response);
+
+  /**
+   * @brief 设置截止时间定时器，调用完成时取消
+   */
+  void SetTimer(Timer::ptr timer);
+
+ private:
+  mutable Mutex mutex_;
+  uint64_t id_;
+  bool done_ = false;
+  RpcResult result_;
+  Timer::ptr timer_;
+  // 等待的协程
+  Scheduler *scheduler_ = nullptr;
+  Fiber::ptr fiber_;
+  int thread_ = -1;
+};
+
+class RpcClient : public std::enable_shared_from_this<RpcClient> {
+ public:
+  using ptr = std::shared_ptr<RpcClient>;
+
+  RpcClient();
+
+  ~RpcClient();
+
+  /**
+   * @brief 连接服务器并启动读协程
+   * @details 读协程持有客户端，不再使用时需要Close
+   * @param[in] timeout_ms 连接超时(毫秒)
+   * @pre 在IOManager的协程中调用，只能调用一次
+   */
+  bool Connect(Address::ptr addr, uint64_t timeout_ms = -1);
+
+  /**
+   * @brief 发起调用
+   * @param[in] timeout_ms 超时(毫秒)，到期时结果为RPC_DEADLINE_EXCEEDED并通知服务端取消；
+   *            0表示不限，-1表示使用配置项rpc.timeout
+   * @pre Connect成功之后调用
+   */
+  RpcFuture::ptr CallAsync(const std::string &method,
+                           const std::string &request,
+                           uint64_t timeout_ms = -1);
+
+  /**
+   * @brief 发起调用并等待结果
+   */
+  RpcResult Call(const std::string &method, const std::string &request,
+                 uint64_t timeout_ms = -1);
+
+  /**
+   * @brief 取消调用，结果为RPC_CANCELLED并通知服务端
+   * @return 调用已经完成返回false
+   */
+  bool Cancel(RpcFuture::ptr future);
+
+  /**
+   * @brief 关闭连接，未完成的调用结果为RPC_CLOSED
+   */
+  void Close();
+
+  bool IsConnected() const { return connected_; }
+
+  /**
+   * @brief 等待响应的调用数
+   */
+  size_t GetPendingCount() const;
+
+  /**
+   * @brief 发起过的调用数
+   */
+  uint64_t GetCallCount() const { return next_id_; }
+
+ private:
+  /**
+   * @brief 读协程，分发响应
+   */
+  void ReadLoop();
+
+  /**
+   * @brief 结束一次调用
+   * @param[in] send_cancel 是否通知服务端取消
+   */
+  bool Finish(uint64_t id, int32_t status, std::string &&response,
+              bool send_cancel);
+
+ private:
+  IOManager *iom_ = nullptr;
+  RpcChannel::ptr channel_;
+  mutable Mutex mutex_;
+  // 等待响应的调用
+  std::unordered_map<uint64_t, RpcFuture::ptr> pending_;
+  std::atomic<uint64_t> next_id_{0};
+  std::atomic<bool> connected_{false};
+};
+
+}  // namespace serverframework
+
+#endif
@@ -0,0 +1,242 @@
+#include "rpc/rpc_server.h"
+
+#include <sstream>
+
+#include "fiber/fiber.h"
+#include "fiber/scheduler.h"
+#include "log/log.h"
+#include "util/clock.h"
+
+namespace serverframework {
+
+static serverframework::Logger::ptr g_logger = LOG_NAME("system");
+
+bool RpcContext::IsExpired() const {
+  return deadline_ && Clock::NowMS() >= deadline_;
+}
+
+/**
+ * @brief 一个连接上调度出去执行的调用
+ */
+struct RpcSession {
+  Mutex mutex;
+  // 执行中的调用，用于取消
+  std::unordered_map<uint64_t, RpcContext::ptr> calls;
+  // 读协程是否在没有未处理数据的情况下等待读取
+  bool reading = false;
+  // 连接结束时等待执行中的调用的读协程
+  Scheduler *scheduler = nullptr;
+  Fiber::ptr waiter;
+  int thread = -1;
+};
+
+RpcServer::RpcServer(IOManager *io_worker, IOManager *accept_worker)
+    : TcpServer(io_worker, accept_worker) {
+  type_ = "rpc";
+}
+
+bool RpcServer::Register(const std::string &method, Handler handler,
+                         bool inline_call) {
+  std::unique_ptr<Method> &m = methods_[method];
+  if (m) {
+    LOG_WARN(g_logger) << "RpcServer method " << method << " exists";
+    return false;
+  }
+  m.reset(new Method);
+  m->handler = handler;
+  m->inline_call = inline_call;
+  return true;
+}
+
+const RpcMethodStats *RpcServer::GetStats(const std::string &method) const {
+  auto it = methods_.find(method);
+  return it == methods_.end() ? nullptr : &it->second->stats;
+}
+
+bool RpcServer::Invoke(Method &method, RpcContext::ptr ctx,
+                       const std::string &request, int32_t &status,
+                       std::string &response) {
+  RpcMethodStats &stats = method.stats;
+  ++stats.calls;
+  if (ctx->IsExpired()) {
+    ++stats.deadline_exceeded;
+    status = RPC_DEADLINE_EXCEEDED;
+    return true;
+  }
+  uint64_t begin = Clock::NowUS();
+  status = method.handler(ctx, request, response);
+  uint64_t used = Clock::NowUS() - begin;
+  stats.total_us += used;
+  uint64_t max = stats.max_us;
+  while (used > max && !stats.max_us.compare_exchange_weak(max, used)) {
+  }
+  // 客户端已经不再等待，不用回复
+  if (ctx->IsCancelled()) {
+    ++stats.cancelled;
+    return false;
+  }
+  if (ctx->IsExpired()) {
+    ++stats.deadline_exceeded;
+    status = RPC_DEADLINE_EXCEEDED;
+    response.clear();
+  } else if (status != RPC_OK) {
+    ++stats.errors;
+  }
+  return true;
+}
+
+void RpcServer::HandleConnection(Connection::ptr conn) {
+  Socket::ptr sock = conn->GetSocket();
+  IOManager *iom = IOManager::GetThis();
+  RpcChannel::ptr channel(new RpcChannel(sock, iom));
+  std::shared_ptr<RpcSession> session(new RpcSession);
+  FrameDecoder decoder(Frame::VARINT);
+  bool running = true;
+  // 连接是否已经断开或出错，此时执行中的调用不必再回复
+  bool broken = false;
+  while (running) {
+    {
+      Mutex::Lock lock(session->mutex);
+      session->reading = !decoder.GetPending();
+      conn->SetIdle(session->reading && session->calls.empty());
+    }
+    int rt = decoder.ReadFrom(sock);
+    {
+      Mutex::Lock lock(session->mutex);
+      session->reading = false;
+      conn->SetIdle(false);
+    }
+    if (rt <= 0) {
+      broken = true;
+      break;
+    }
+    conn->Touch();
+
+    Frame frame;
+    RpcMessage msg;
+    while (running && (rt = decoder.Decode(frame)) > 0) {
+      if (!msg.Decode(frame) || msg.type == RpcMessage::RESPONSE) {
+        LOG_WARN(g_logger) << "RpcServer bad message from " << *sock;
+        running = false;
+        broken = true;
+        break;
+      }
+      if (msg.type == RpcMessage::CANCEL) {
+        Mutex::Lock lock(session->mutex);
+        auto it = session->calls.find(msg.id);
+        if (it != session->calls.end()) {
+          it->second->Cancel();
+        }
+        continue;
+      }
+
+      auto it = methods_.find(msg.method);
+      if (it == methods_.end()) {
+        ++not_found_;
+        channel->SendResponse(msg.id, RPC_NOT_FOUND, "", false);
+        continue;
+      }
+      Method *method = it->second.get();
+      uint64_t deadline = msg.timeout ? Clock::NowMS() + msg.timeout : 0;
+      RpcContext::ptr ctx(
+          new RpcContext(msg.id, std::move(msg.method), deadline));
+      if (method->inline_call) {
+        int32_t status;
+        std::string response;
+        if (Invoke(*method, ctx, msg.payload, status, response)) {
+          channel->SendResponse(msg.id, status, response, false);
+        }
+        continue;
+      }
+
+      // 请求数据记入缓冲预算，调用完成后释放
+      size_t size = msg.payload.size();
+      conn->Reserve(size);
+      {
+        Mutex::Lock lock(session->mutex);
+        session->calls[msg.id] = ctx;
+      }
+      std::shared_ptr<std::string> request(new std::string);
+      request->swap(msg.payload);
+      iom->Schedule([this, conn, channel, session, method, ctx, request,
+                     size]() {
+        int32_t status;
+        std::string response;
+        if (Invoke(*method, ctx, *request, status, response)) {
+          // 排空时连接随后可能被半关闭，要在标记空闲之前发出
+          bool draining = conn->IsDraining();
+          channel->SendResponse(ctx->GetId(), status, response, !draining);
+          if (draining) {
+            channel->Flush();
+          }
+        }
+        conn->Release(size);
+        Mutex::Lock lock(session->mutex);
+        session->calls.erase(ctx->GetId());
+        if (!session->calls.empty()) {
+          return;
+        }
+        if (session->waiter) {
+          session->scheduler->Schedule(session->waiter, session->thread);
+          session->waiter.reset();
+        } else if (session->reading) {
+          conn->SetIdle(true);
+        }
+      });
+    }
+    if (rt < 0) {
+      LOG_WARN(g_logger) << "RpcServer bad frame from " << *sock;
+      running = false;
+      broken = true;
+    }
+    // 这一批内联调用的响应一次发出
+    channel->Flush();
+    if (conn->IsOverBudget() && !conn->WaitBudget()) {
+      broken = true;
+      break;
+    }
+    if (conn->IsDraining() && !decoder.GetPending()) {
+      break;
+    }
+  }
+
+  // 等执行中的调用结束，它们还持有连接
+  bool wait = false;
+  {
+    Mutex::Lock lock(session->mutex);
+    if (!session->calls.empty()) {
+      if (broken) {
+        for (auto &i : session->calls) {
+          i.second->Cancel();
+        }
+      }
+      session->scheduler = Scheduler::GetThis();
+      session->waiter = Fiber::GetThis();
+      session->thread = iom->GetAffinityThread();
+      wait = true;
+    }
+  }
+  if (wait) {
+    Fiber::GetThis()->Yield();
+  }
+  channel->Close();
+}
+
+std::string RpcServer::ToString(const std::string &prefix) {
+  std::stringstream ss;
+  ss << prefix << "[rpc methods=" << methods_.size()
+     << " not_found=" << not_found_ << "]" << std::endl;
+  for (auto &i : methods_) {
+    const RpcMethodStats &stats = i.second->stats;
+    uint64_t calls = stats.calls;
+    ss << prefix << "    " << i.first << " calls=" << calls
+       << " errors=" << stats.errors << " cancelled=" << stats.cancelled
+       << " deadline_exceeded=" << stats.deadline_exceeded
+       << " avg_us=" << (calls ? stats.total_us / calls : 0)
+       << " max_us=" << stats.max_us << std::endl;
+  }
+  ss << TcpServer::ToString(prefix);
+  return ss.str();
+}
+
+}  // namespace serverframework
@@ -0,0 +1,151 @@
+/**
+ * @file rpc_server.h
+ * @brief RPC服务器
+ * @details 每个连接一个读协程，把已到达的数据中所有完整的请求依次处理。内联方法直接在读协程中执行，
+ *          这一批响应用一次writev发出；其余方法作为新协程调度到当前IOManager上执行，
+ *          完成后各自发出响应，同一连接上的调用互不阻塞
+ */
+#ifndef RPC_SERVER_H
+#define RPC_SERVER_H
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+#include "rpc/rpc.h"
+#include "tcp/tcp_server.h"
+
+namespace serverframework {
+
+/**
+ * @brief 一次调用的上下文
+ */
+class RpcContext {
+ public:
+  using ptr = std::shared_ptr<RpcContext>;
+
+  /**
+   * @brief 构造函数
+   * @param[in] deadline 截止时间(毫秒，Clock::NowMS)，0表示不限
+   */
+  RpcContext(uint64_t id, std::string &&method, uint64_t deadline)
+      : id_(id), method_(std::move(method)), deadline_(deadline) {}
+
+  uint64_t GetId() const { return id_; }
+
+  const std::string &GetMethod() const { return method_; }
+
+  uint64_t GetDeadline() const { return deadline_; }
+
+  /**
+   * @brief 客户端是否已经取消或断开，耗时的处理函数应该定期检查
+   */
+  bool IsCancelled() const { return cancelled_; }
+
+  /**
+   * @brief 是否已过截止时间
+   */
+  bool IsExpired() const;
+
+  void Cancel() { cancelled_ = true; }
+
+ private:
+  uint64_t id_;
+  std::string method_;
+  uint64_t deadline_;
+  std::atomic<bool> cancelled_{false};
+};
+
+/**
+ * @brief 每个方法的统计，各字段单独原子更新
+ */
+struct RpcMethodStats {
+  // 调用次数
+  std::atomic<uint64_t> calls{0};
+  // 返回非0状态码的次数
+  std::atomic<uint64_t> errors{0};
+  // 处理期间被取消的次数
+  std::atomic<uint64_t> cancelled{0};
+  // 收到时或处理完时已过截止时间的次数
+  std::atomic<uint64_t> deadline_exceeded{0};
+  // 累计处理时间(微秒)
+  std::atomic<uint64_t> total_us{0};
+  // 最长处理时间(微秒)
+  std::atomic<uint64_t> max_us{0};
+};
+
+class RpcServer : public TcpServer {
+ public:
+  using ptr = std::shared_ptr<RpcServer>;
+  /**
+   * @brief 处理函数
+   * @param[in] ctx 调用上下文
+   * @param[in] request 请求数据
+   * @param[out] response 响应数据
+   * @return 状态码，0表示成功，正数由业务定义
+   */
+  using Handler = std::function<int32_t(
+      RpcContext::ptr ctx, const std::string &request, std::string &response)>;
+
+  /**
+   * @brief 构造函数
+   * @param[in] io_worker socket客户端工作的协程调度器
+   * @param[in] accept_worker 服务器socket执行接收socket连接的协程调度器
+   */
+  RpcServer(IOManager *io_worker = IOManager::GetThis(),
+            IOManager *accept_worker = IOManager::GetThis());
+
+  /**
+   * @brief 注册方法，在Start之前调用
+   * @param[in] inline_call 是否在读协程中直接执行，只适合不会阻塞的短小方法，
+   *            执行期间同一连接上的其他请求要等它返回
+   * @return 方法已存在返回false
+   */
+  bool Register(const std::string &method, Handler handler,
+                bool inline_call = false);
+
+  /**
+   * @brief 返回方法的统计，方法不存在返回nullptr
+   */
+  const RpcMethodStats *GetStats(const std::string &method) const;
+
+  /**
+   * @brief 请求不存在的方法的次数
+   */
+  uint64_t GetNotFoundCount() const { return not_found_; }
+
+  std::string ToString(const std::string &prefix = "") override;
+
+ protected:
+  /**
+   * @brief 循环读取、解码、分发请求
+   * @details 没有未处理的数据且没有执行中的调用时连接标记为空闲；排空时等执行中的调用发出响应后关闭连接，
+   *          连接断开时执行中的调用被标记为取消
+   */
+  void HandleConnection(Connection::ptr conn) override;
+
+ private:
+  struct Method {
+    Handler handler;
+    bool inline_call;
+    RpcMethodStats stats;
+  };
+
+  /**
+   * @brief 执行一次调用并记录统计
+   * @param[out] status 响应的状态码
+   * @return 是否需要回复，调用已被取消时返回false
+   */
+  bool Invoke(Method &method, RpcContext::ptr ctx, const std::string &request,
+              int32_t &status, std::string &response);
+
+ private:
+  // 方法表，Start之后只读
+  std::unordered_map<std::string, std::unique_ptr<Method>> methods_;
+  std::atomic<uint64_t> not_found_{0};
+};
+
+}  // namespace serverframework
+
+#endif
@@ -12,16 +12,33 @@
 #include "env/thread.h"
 #include "fiber/fiber.h"
 #include "fiber/scheduler.h"
+#include "http/http.h"
+#include "http/http_client.h"
+#include "http/http_parser.h"
+#include "http/http_server.h"
+#include "http/router.h"
 #include "log/log.h"
 #include "net/address.h"
+#include "net/dns.h"
 #include "net/fd_manager.h"
 #include "net/hook.h"
 #include "net/iomanager.h"
 #include "net/socket.h"
+#include "net/socket_pool.h"
+#include "net/socket_stream.h"
+#include "rpc/rpc.h"
+#include "rpc/rpc_client.h"
+#include "rpc/rpc_server.h"
+#include "tcp/connection.h"
+#include "tcp/frame_codec.h"
+#include "tcp/frame_server.h"
+#include "tcp/hot_restart.h"
  #include "tcp/tcp_server.h"
 #include "util/bytearray.h"
+#include "util/clock.h"
 #include "util/daemon.h"
 #include "util/endian_conv.h"
+#include "util/histogram.h"
 #include "util/macro.h"
 #include "util/singleton.h"
 #include "util/util.h"
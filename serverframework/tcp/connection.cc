@@ -0,0 +1,353 @@
+#include "tcp/connection.h"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+
+#include "log/log.h"
+#include "net/iomanager.h"
+#include "util/clock.h"
+
+namespace serverframework {
+
+static serverframework::Logger::ptr g_logger = LOG_NAME("system");
+
+const size_t ConnectionRegistry::kSlots;
+const uint64_t ConnectionRegistry::kMinTick;
+
+Connection::Connection(Socket::ptr sock, ConnectionRegistry *registry,
+                       size_t budget)
+    : socket_(sock),
+      registry_(registry),
+      id_(++registry->next_id_),
+      budget_(budget),
+      last_active_(Clock::NowMS()) {}
+
+void Connection::Touch() {
+  last_active_.store(Clock::NowMS(), std::memory_order_relaxed);
+}
+
+bool Connection::Reserve(size_t n) {
+  size_t now = buffered_.fetch_add(n) + n;
+  registry_->buffered_ += n;
+  return !budget_ || now <= budget_;
+}
+
+void Connection::Release(size_t n) {
+  size_t prev = buffered_.fetch_sub(n);
+  registry_->buffered_ -= n;
+  // 只在从超出预算降回预算以内时唤醒
+  if (budget_ && prev > budget_ && prev - n <= budget_) {
+    Wake();
+  }
+}
+
+bool Connection::WaitBudget() {
+  while (true) {
+    {
+      MutexType::Lock lock(mutex_);
+      if (shutdown_) {
+        return false;
+      }
+      if (!IsOverBudget()) {
+        return true;
+      }
+      IOManager *iom = IOManager::GetThis();
+      waiter_scheduler_ = Scheduler::GetThis();
+      waiter_ = Fiber::GetThis();
+      waiter_thread_ = iom ? iom->GetAffinityThread() : -1;
+    }
+    Fiber::GetThis()->Yield();
+  }
+}
+
+void Connection::Wake() {
+  Scheduler *scheduler;
+  Fiber::ptr fiber;
+  int thread;
+  {
+    MutexType::Lock lock(mutex_);
+    if (!waiter_) {
+      return;
+    }
+    scheduler = waiter_scheduler_;
+    fiber.swap(waiter_);
+    thread = waiter_thread_;
+  }
+  scheduler->Schedule(fiber, thread);
+}
+
+void Connection::SetIdle(bool v) {
+  idle_ = v;
+  // 和StartDrain先置标志再检查的顺序相反，两边至少有一边会看到对方
+  if (v && registry_->draining_) {
+    HalfClose();
+  }
+}
+
+bool Connection::IsDraining() const { return registry_->draining_; }
+
+void Connection::HalfClose() {
+  if (half_closed_.exchange(true) || shutdown_) {
+    return;
+  }
+  if (socket_->IsValid()) {
+    ::shutdown(socket_->GetSocket(), SHUT_WR);
+  }
+}
+
+void Connection::Shutdown() {
+  if (shutdown_.exchange(true)) {
+    return;
+  }
+  if (socket_->IsValid()) {
+    ::shutdown(socket_->GetSocket(), SHUT_RDWR);
+  }
+  Wake();
+}
+
+ConnectionRegistry::ConnectionRegistry(uint64_t idle_timeout,
+                                       size_t max_connections)
+    : slots_(kSlots + 1),
+      idle_timeout_(0),
+      tick_(kMinTick),
+      current_(0),
+      max_connections_(max_connections) {
+  SetIdleTimeout(idle_timeout);
+}
+
+Connection::ptr ConnectionRegistry::Add(Socket::ptr sock, size_t budget) {
+  size_t max = max_connections_;
+  MutexType::Lock lock(mutex_);
+  // 检查和占用名额在同一把锁内完成，并发的Add不会超过最大连接数
+  if (max && count_ >= max) {
+    ++rejected_;
+    return nullptr;
+  }
+  ++count_;
+  ++accepted_;
+  Connection::ptr conn(new Connection(sock, this, budget));
+  conn->registered_ = true;
+  Link(conn, current_);
+  return conn;
+}
+
+void ConnectionRegistry::Remove(Connection::ptr conn) {
+  size_t buffered = conn->buffered_.exchange(0);
+  buffered_ -= buffered;
+  std::shared_ptr<Waiter> waiter;
+  {
+    MutexType::Lock lock(mutex_);
+    if (!conn->registered_) {
+      return;
+    }
+    slots_[conn->slot_].erase(conn->pos_);
+    if (draining_) {
+      ++drained_;
+    }
+    waiter = Unregister(conn);
+  }
+  WakeWaiter(waiter);
+}
+
+std::shared_ptr<ConnectionRegistry::Waiter> ConnectionRegistry::Unregister(
+    Connection::ptr conn) {
+  conn->registered_ = false;
+  std::shared_ptr<Waiter> waiter;
+  if (--count_ == 0) {
+    waiter.swap(waiter_);
+  }
+  return waiter;
+}
+
+void ConnectionRegistry::WakeWaiter(std::shared_ptr<Waiter> waiter) {
+  if (!waiter) {
+    return;
+  }
+  {
+    MutexType::Lock lock(mutex_);
+    if (waiter->done) {
+      return;
+    }
+    waiter->done = true;
+    if (waiter_ == waiter) {
+      waiter_.reset();
+    }
+  }
+  waiter->scheduler->Schedule(waiter->fiber, waiter->thread);
+}
+
+void ConnectionRegistry::Link(Connection::ptr conn, uint64_t first_tick) {
+  if (idle_timeout_) {
+    uint64_t tick =
+        std::max((conn->last_active_ + idle_timeout_) / tick_, first_tick);
+    conn->slot_ = tick % kSlots;
+  } else {
+    conn->slot_ = kSlots;
+  }
+  std::list<Connection::ptr> &slot = slots_[conn->slot_];
+  conn->pos_ = slot.insert(slot.end(), conn);
+}
+
+uint64_t ConnectionRegistry::GetKernelActive(Socket::ptr sock,
+                                             uint64_t now_ms) {
+  if (sock->GetType() != SOCK_STREAM ||
+      (sock->GetFamily() != AF_INET && sock->GetFamily() != AF_INET6)) {
+    return 0;
+  }
+  struct tcp_info info;
+  socklen_t len = sizeof(info);
+  if (getsockopt(sock->GetSocket(), IPPROTO_TCP, TCP_INFO, &info, &len)) {
+    return 0;
+  }
+  uint64_t idle = std::min(info.tcpi_last_data_recv, info.tcpi_last_data_sent);
+  return now_ms > idle ? now_ms - idle : 0;
+}
+
+void ConnectionRegistry::Reap(uint64_t now_ms,
+                              std::vector<Connection::ptr> &idle) {
+  std::shared_ptr<Waiter> waiter;
+  {
+    MutexType::Lock lock(mutex_);
+    if (!idle_timeout_) {
+      return;
+    }
+    uint64_t now_tick = now_ms / tick_;
+    if (current_ > now_tick) {
+      return;
+    }
+    // 落后超过一圈时扫描一圈就覆盖了所有槽位
+    uint64_t end = std::min(now_tick, current_ + kSlots - 1);
+    for (uint64_t t = current_; t <= end; ++t) {
+      std::list<Connection::ptr> list;
+      list.swap(slots_[t % kSlots]);
+      while (!list.empty()) {
+        Connection::ptr conn = list.front();
+        uint64_t active = conn->last_active_;
+        if (active + idle_timeout_ <= now_ms) {
+          uint64_t kernel = GetKernelActive(conn->socket_, now_ms);
+          if (kernel > active) {
+            active = kernel;
+            conn->last_active_ = kernel;
+          }
+        }
+        if (active + idle_timeout_ <= now_ms) {
+          list.pop_front();
+          ++reaped_;
+          idle.push_back(conn);
+          std::shared_ptr<Waiter> w = Unregister(conn);
+          if (w) {
+            waiter = w;
+          }
+          continue;
+        }
+        // 还活跃的连接按新的到期时间挂到后面的槽位，Touch时不移动
+        uint64_t tick =
+            std::max((active + idle_timeout_) / tick_, now_tick + 1);
+        conn->slot_ = tick % kSlots;
+        std::list<Connection::ptr> &slot = slots_[conn->slot_];
+        slot.splice(slot.end(), list, list.begin());
+        conn->pos_ = std::prev(slot.end());
+      }
+    }
+    current_ = now_tick + 1;
+  }
+  WakeWaiter(waiter);
+}
+
+void ConnectionRegistry::StartDrain() {
+  std::vector<Connection::ptr> idle;
+  {
+    MutexType::Lock lock(mutex_);
+    draining_ = true;
+    for (auto &slot : slots_) {
+      for (auto &conn : slot) {
+        if (conn->idle_) {
+          idle.push_back(conn);
+        }
+      }
+    }
+  }
+  for (auto &conn : idle) {
+    conn->HalfClose();
+  }
+  LOG_INFO(g_logger) << "ConnectionRegistry drain " << count_
+                     << " connections, " << idle.size() << " idle";
+}
+
+void ConnectionRegistry::StopDrain() {
+  MutexType::Lock lock(mutex_);
+  draining_ = false;
+  waiter_.reset();
+}
+
+bool ConnectionRegistry::WaitEmpty(uint64_t timeout_ms) {
+  uint64_t deadline = Clock::NowMS() + timeout_ms;
+  while (true) {
+    std::shared_ptr<Waiter> waiter(new Waiter);
+    uint64_t now = Clock::NowMS();
+    {
+      MutexType::Lock lock(mutex_);
+      if (!count_) {
+        return true;
+      }
+      if (now >= deadline) {
+        return false;
+      }
+      IOManager *iom = IOManager::GetThis();
+      waiter->scheduler = Scheduler::GetThis();
+      waiter->fiber = Fiber::GetThis();
+      waiter->thread = iom ? iom->GetAffinityThread() : -1;
+      waiter_ = waiter;
+    }
+    std::weak_ptr<Waiter> weak(waiter);
+    Timer::ptr timer = IOManager::GetThis()->AddTimer(
+        deadline - now, [this, weak]() { WakeWaiter(weak.lock()); });
+    Fiber::GetThis()->Yield();
+    timer->Cancel();
+  }
+}
+
+size_t ConnectionRegistry::KillAll() {
+  std::vector<Connection::ptr> conns;
+  std::shared_ptr<Waiter> waiter;
+  {
+    MutexType::Lock lock(mutex_);
+    for (auto &slot : slots_) {
+      for (auto &conn : slot) {
+        conns.push_back(conn);
+        std::shared_ptr<Waiter> w = Unregister(conn);
+        if (w) {
+          waiter = w;
+        }
+      }
+      slot.clear();
+    }
+    killed_ += conns.size();
+  }
+  for (auto &conn : conns) {
+    conn->Shutdown();
+  }
+  WakeWaiter(waiter);
+  return conns.size();
+}
+
+void ConnectionRegistry::SetIdleTimeout(uint64_t v) {
+  MutexType::Lock lock(mutex_);
+  std::vector<Connection::ptr> conns;
+  for (auto &slot : slots_) {
+    conns.insert(conns.end(), slot.begin(), slot.end());
+    slot.clear();
+  }
+  idle_timeout_ = v;
+  // 到期时间最多在kSlots-2个tick之后，留出当前tick和取整的余量
+  tick_ = std::max(v / (kSlots - 2), kMinTick);
+  current_ = Clock::NowMS() / tick_;
+  for (auto &conn : conns) {
+    Link(conn, current_);
+  }
+}
+
+}  // namespace serverframework
@@ -0,0 +1,353 @@
+/**
+ * @file connection.h
+ * @brief 服务端连接登记
+ * @details TcpServer为每个接收的连接创建一个Connection，记录最近活跃时间和已缓冲的字节数。
+ *          ConnectionRegistry把连接挂在按tick划分槽位的时间轮上：Touch只写一个原子时间戳，
+ *          回收时只扫描到期槽位中的连接，仍然活跃的按新的到期时间挂到后面的槽位，
+ *          空闲超时的连接被shutdown，由处理它的协程读到EOF后自己关闭。
+ *          排空(drain)时半关闭空闲的长连接，等正在处理请求的连接结束，到期后强制shutdown剩下的连接
+ */
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <vector>
+
+#include "env/mutex.h"
+#include "fiber/fiber.h"
+#include "fiber/scheduler.h"
+#include "net/socket.h"
+
+namespace serverframework {
+
+class ConnectionRegistry;
+
+/**
+ * @brief 服务端连接
+ * @details 缓冲预算用于反压：处理连接的代码每读入一段暂时不能处理完的数据就Reserve，
+ *          处理或发出后Release；超过预算时读协程调用WaitBudget让出，不再从socket读取，
+ *          内核接收缓冲区满后由TCP流控让对端停止发送，而不是在用户态无限缓冲
+ */
+class Connection {
+ public:
+  using ptr = std::shared_ptr<Connection>;
+  using MutexType = Mutex;
+
+  /**
+   * @brief 构造函数
+   * @param[in] sock 连接的socket
+   * @param[in] registry 所属的登记表，必须比连接活得更久
+   * @param[in] budget 缓冲预算(字节)，0表示不限制
+   */
+  Connection(Socket::ptr sock, ConnectionRegistry *registry, size_t budget);
+  Connection(const Connection &) = delete;
+  Connection &operator=(const Connection &) = delete;
+
+  /**
+   * @brief 连接序号，同一个登记表内唯一
+   */
+  uint64_t GetId() const { return id_; }
+
+  /**
+   * @brief 返回连接的socket
+   */
+  Socket::ptr GetSocket() const { return socket_; }
+
+  /**
+   * @brief 记录一次活跃
+   * @details 只写一个时间戳，不加锁，也不移动时间轮上的位置
+   */
+  void Touch();
+
+  /**
+   * @brief 最近活跃的时间(毫秒)
+   */
+  uint64_t GetLastActive() const { return last_active_; }
+
+  /**
+   * @brief 记入n字节缓冲
+   * @return 记入后是否还在预算内，返回false时读协程应先WaitBudget再读
+   */
+  bool Reserve(size_t n);
+
+  /**
+   * @brief 释放n字节缓冲，降到预算以内时唤醒等待的读协程
+   */
+  void Release(size_t n);
+
+  /**
+   * @brief 等待缓冲降到预算以内
+   * @details 同一时间只允许一个协程(读协程)等待
+   * @return 缓冲降到预算以内返回true，连接被shutdown返回false
+   */
+  bool WaitBudget();
+
+  /**
+   * @brief 是否超过缓冲预算
+   */
+  bool IsOverBudget() const { return budget_ && buffered_ > budget_; }
+
+  /**
+   * @brief 已缓冲的字节数
+   */
+  size_t GetBuffered() const { return buffered_; }
+
+  /**
+   * @brief 缓冲预算(字节)，0表示不限制
+   */
+  size_t GetBudget() const { return budget_; }
+
+  /**
+   * @brief 设置连接是否空闲
+   * @details 长连接等待下一个请求之前SetIdle(true)，读到请求后SetIdle(false)。
+   *          排空时空闲的连接立即被半关闭；没有调用过的连接视为一直在处理请求
+   */
+  void SetIdle(bool v);
+
+  /**
+   * @brief 连接是否空闲
+   */
+  bool IsIdle() const { return idle_; }
+
+  /**
+   * @brief 所属的登记表是否正在排空，处理完当前请求后不应再等待下一个请求
+   */
+  bool IsDraining() const;
+
+  /**
+   * @brief 关闭连接的读写两个方向
+   * @details 阻塞在读写上的协程被唤醒，等待预算的协程返回false，
+   *          socket由处理连接的协程自己close，避免句柄被复用后旧协程误操作新连接
+   */
+  void Shutdown();
+
+  /**
+   * @brief 是否已被shutdown
+   */
+  bool IsShutdown() const { return shutdown_; }
+
+ private:
+  friend class ConnectionRegistry;
+
+  /**
+   * @brief 唤醒等待预算的协程
+   */
+  void Wake();
+
+  /**
+   * @brief 关闭写方向，对端读到EOF后关闭连接，处理连接的协程随后读到EOF
+   */
+  void HalfClose();
+
+ private:
+  Socket::ptr socket_;
+  ConnectionRegistry *registry_;
+  uint64_t id_;
+  size_t budget_;
+  std::atomic<uint64_t> last_active_;
+  std::atomic<size_t> buffered_{0};
+  std::atomic<bool> shutdown_{false};
+  std::atomic<bool> idle_{false};
+  std::atomic<bool> half_closed_{false};
+  // 等待预算的协程
+  MutexType mutex_;
+  Scheduler *waiter_scheduler_ = nullptr;
+  Fiber::ptr waiter_;
+  int waiter_thread_ = -1;
+  // 是否还在登记表中、所在的链表和位置，只在持有登记表的锁时访问
+  bool registered_ = false;
+  size_t slot_ = 0;
+  std::list<ptr>::iterator pos_;
+};
+
+/**
+ * @brief 连接登记表
+ * @details 时间轮固定kSlots个槽位，tick为空闲超时的1/(kSlots-2)，最小kMinTick毫秒，
+ *          连接的到期时间最多在一圈之内。回收的精度是一个tick
+ */
+class ConnectionRegistry {
+ public:
+  using MutexType = Mutex;
+
+  /**
+   * @brief 构造函数
+   * @param[in] idle_timeout 空闲超时(毫秒)，0表示不回收
+   * @param[in] max_connections 最大连接数，0表示不限制
+   */
+  ConnectionRegistry(uint64_t idle_timeout = 0, size_t max_connections = 0);
+  ConnectionRegistry(const ConnectionRegistry &) = delete;
+  ConnectionRegistry &operator=(const ConnectionRegistry &) = delete;
+
+  /**
+   * @brief 登记新连接
+   * @param[in] sock 连接的socket
+   * @param[in] budget 连接的缓冲预算(字节)，0表示不限制
+   * @return 连接数已满时返回nullptr
+   */
+  Connection::ptr Add(Socket::ptr sock, size_t budget);
+
+  /**
+   * @brief 连接处理完毕，从登记表中删除
+   * @details 连接还没有Release的缓冲一并从总数中扣除，之后不应再对它Reserve/Release
+   */
+  void Remove(Connection::ptr conn);
+
+  /**
+   * @brief 推进时间轮到now_ms，取出所有空闲超时的连接
+   * @details 按时间戳判断已经空闲的TCP连接再用TCP_INFO看内核最近一次收发数据的时间，
+   *          没有调用Touch但仍有数据往来的连接不会被回收
+   * @param[in] now_ms 当前时间(毫秒)
+   * @param[out] idle 空闲超时的连接，已从登记表中删除
+   */
+  void Reap(uint64_t now_ms, std::vector<Connection::ptr> &idle);
+
+  /**
+   * @brief 开始排空
+   * @details 之后变为空闲的连接和当前空闲的连接都被半关闭
+   */
+  void StartDrain();
+
+  /**
+   * @brief 结束排空，重新开始服务之前调用
+   */
+  void StopDrain();
+
+  /**
+   * @brief 是否正在排空
+   */
+  bool IsDraining() const { return draining_; }
+
+  /**
+   * @brief 在当前协程中等待所有连接结束
+   * @details 同一时间只允许一个协程等待
+   * @param[in] timeout_ms 超时时间(毫秒)
+   * @return 所有连接都已结束返回true，超时返回false
+   * @pre 在IOManager的协程中调用
+   */
+  bool WaitEmpty(uint64_t timeout_ms);
+
+  /**
+   * @brief shutdown所有还在登记表中的连接并删除
+   * @return 被强制关闭的连接数
+   */
+  size_t KillAll();
+
+  /**
+   * @brief 设置空闲超时(毫秒)，0表示不回收，已登记的连接按新的超时重新挂到时间轮上
+   */
+  void SetIdleTimeout(uint64_t v);
+
+  /**
+   * @brief 设置最大连接数，0表示不限制，只影响之后的Add
+   */
+  void SetMaxConnections(size_t v) { max_connections_ = v; }
+
+  uint64_t GetIdleTimeout() const { return idle_timeout_; }
+  size_t GetMaxConnections() const { return max_connections_; }
+
+  /**
+   * @brief 时间轮的tick(毫秒)，Reap的调用周期
+   */
+  uint64_t GetTick() const { return tick_; }
+
+  /**
+   * @brief 当前的连接数
+   */
+  size_t GetCount() const { return count_; }
+
+  /**
+   * @brief 所有连接已缓冲的字节数之和
+   */
+  uint64_t GetBuffered() const { return buffered_; }
+
+  /**
+   * @brief 登记过的连接数
+   */
+  uint64_t GetAcceptedCount() const { return accepted_; }
+
+  /**
+   * @brief 因连接数已满被拒绝的连接数
+   */
+  uint64_t GetRejectedCount() const { return rejected_; }
+
+  /**
+   * @brief 因空闲超时被回收的连接数
+   */
+  uint64_t GetReapedCount() const { return reaped_; }
+
+  /**
+   * @brief 排空期间自行结束的连接数
+   */
+  uint64_t GetDrainedCount() const { return drained_; }
+
+  /**
+   * @brief 排空到期时被强制关闭的连接数
+   */
+  uint64_t GetKilledCount() const { return killed_; }
+
+ private:
+  friend class Connection;
+
+  static const size_t kSlots = 64;
+  static const uint64_t kMinTick = 10;
+
+  /**
+   * @brief 等待所有连接结束的协程
+   */
+  struct Waiter {
+    Scheduler *scheduler;
+    Fiber::ptr fiber;
+    int thread;
+    // 是否已被唤醒或已超时
+    bool done = false;
+  };
+
+  /**
+   * @brief 按到期时间把连接挂到槽位上，到期tick不早于first_tick；不回收时挂到最后一个不扫描的链表上
+   */
+  void Link(Connection::ptr conn, uint64_t first_tick);
+
+  /**
+   * @brief 把连接从登记表中删除，最后一个连接删除后返回要唤醒的等待者
+   * @pre 持有mutex_
+   */
+  std::shared_ptr<Waiter> Unregister(Connection::ptr conn);
+
+  /**
+   * @brief 唤醒等待所有连接结束的协程
+   */
+  void WakeWaiter(std::shared_ptr<Waiter> waiter);
+
+  /**
+   * @brief 内核最近一次收发数据的时间(毫秒)，不是TCP连接或取不到时返回0
+   */
+  static uint64_t GetKernelActive(Socket::ptr sock, uint64_t now_ms);
+
+ private:
+  MutexType mutex_;
+  // 前kSlots个是时间轮的槽位，最后一个是不回收时的连接链表
+  std::vector<std::list<Connection::ptr>> slots_;
+  uint64_t idle_timeout_;
+  uint64_t tick_;
+  // 下一个要扫描的tick
+  uint64_t current_;
+  std::atomic<size_t> max_connections_;
+  std::atomic<uint64_t> next_id_{0};
+  std::atomic<size_t> count_{0};
+  std::atomic<uint64_t> buffered_{0};
+  std::atomic<uint64_t> accepted_{0};
+  std::atomic<uint64_t> rejected_{0};
+  std::atomic<uint64_t> reaped_{0};
+  std::atomic<bool> draining_{false};
+  std::shared_ptr<Waiter> waiter_;
+  std::atomic<uint64_t> drained_{0};
+  std::atomic<uint64_t> killed_{0};
+};
+
+}  // namespace serverframework
+
+#endif
@@ -0,0 +1,281 @@
+#include "tcp/frame_codec.h"
+
+#include <errno.h>
+#include <limits.h>
+
+#include <algorithm>
+
+#include "config/config.h"
+#include "log/log.h"
+
+namespace serverframework {
+
+static serverframework::Logger::ptr g_logger = LOG_NAME("system");
+
+static serverframework::ConfigVar<uint64_t>::ptr g_frame_max_size =
+    serverframework::Config::Lookup("frame.max_size",
+                                    (uint64_t)(16 * 1024 * 1024),
+                                    "max payload size of a decoded frame");
+
+uint64_t Frame::GetBuffers(std::vector<iovec> &buffers) const {
+  if (!data || !length) {
+    return 0;
+  }
+  return data->GetReadBuffers(buffers, length, position);
+}
+
+std::string Frame::ToString() const {
+  std::string str(length, '\0');
+  if (length) {
+    data->read(&str[0], length, position);
+  }
+  return str;
+}
+
+FrameDecoder::FrameDecoder(Frame::LengthType type, size_t max_size,
+                           size_t base_size)
+    : type_(type),
+      max_size_(max_size ? max_size : g_frame_max_size->GetValue()),
+      base_size_(base_size),
+      compact_threshold_(base_size * 16),
+      buffer_(new ByteArray(base_size)) {}
+
+void FrameDecoder::Compact() {
+  size_t size = buffer_->GetSize();
+  if (read_pos_ == size) {
+    if (!read_pos_) {
+      return;
+    }
+    // 没有帧引用时直接复用
+    if (buffer_.use_count() == 1) {
+      buffer_->Clear();
+    } else {
+      buffer_.reset(new ByteArray(base_size_));
+    }
+    read_pos_ = 0;
+    return;
+  }
+  if (read_pos_ < compact_threshold_) {
+    return;
+  }
+  // 只拷贝还没凑成完整帧的尾部
+  ByteArray::ptr buffer(new ByteArray(base_size_));
+  std::vector<iovec> iovs;
+  buffer_->GetReadBuffers(iovs, size - read_pos_, read_pos_);
+  for (auto &iov : iovs) {
+    buffer->write(iov.iov_base, iov.iov_len);
+  }
+  buffer_.swap(buffer);
+  read_pos_ = 0;
+}
+
+int FrameDecoder::ReadFrom(Socket::ptr sock, size_t length) {
+  Compact();
+  if (!length) {
+    length = std::max(base_size_, needed_);
+  }
+  std::vector<iovec> iovs;
+  buffer_->GetWriteBuffers(iovs, length);
+  int rt = sock->recv(&iovs[0], iovs.size());
+  if (rt > 0) {
+    buffer_->SetPosition(buffer_->GetPosition() + rt);
+  }
+  return rt;
+}
+
+void FrameDecoder::Append(const void *data, size_t length) {
+  Compact();
+  buffer_->write(data, length);
+}
+
+int FrameDecoder::ParseHeader(size_t &header, uint64_t &length) const {
+  size_t avail = buffer_->GetSize() - read_pos_;
+  size_t max = type_ == Frame::VARINT ? 10 : (size_t)type_;
+  uint8_t buf[10];
+  size_t n = std::min(avail, max);
+  if (n) {
+    buffer_->read(buf, n, read_pos_);
+  }
+  length = 0;
+  if (type_ == Frame::VARINT) {
+    for (size_t i = 0; i < n; ++i) {
+      length |= (uint64_t)(buf[i] & 0x7f) << (7 * i);
+      if (buf[i] < 0x80) {
+        header = i + 1;
+        return 1;
+      }
+    }
+    return n == max ? -1 : 0;
+  }
+  if (n < max) {
+    return 0;
+  }
+  for (size_t i = 0; i < n; ++i) {
+    length = (length << 8) | buf[i];
+  }
+  header = n;
+  return 1;
+}
+
+int FrameDecoder::Decode(Frame &frame) {
+  size_t header;
+  uint64_t length;
+  int rt = ParseHeader(header, length);
+  if (rt <= 0) {
+    needed_ = 0;
+    if (rt < 0) {
+      LOG_ERROR(g_logger) << "FrameDecoder invalid varint length prefix";
+      errno = EPROTO;
+    }
+    return rt;
+  }
+  if (length > max_size_) {
+    LOG_ERROR(g_logger) << "FrameDecoder frame too large length=" << length
+                        << " max=" << max_size_;
+    errno = EMSGSIZE;
+    return -1;
+  }
+  size_t avail = buffer_->GetSize() - read_pos_;
+  if (avail < header + length) {
+    needed_ = header + length - avail;
+    return 0;
+  }
+  frame.data = buffer_;
+  frame.position = read_pos_ + header;
+  frame.length = length;
+  read_pos_ += header + length;
+  needed_ = 0;
+  return 1;
+}
+
+FrameEncoder::FrameEncoder(Frame::LengthType type) : type_(type) {}
+
+size_t FrameEncoder::EncodeHeader(Frame::LengthType type, uint64_t length,
+                                  char *out) {
+  uint8_t *p = (uint8_t *)out;
+  if (type == Frame::VARINT) {
+    size_t i = 0;
+    while (length >= 0x80) {
+      p[i++] = (length & 0x7f) | 0x80;
+      length >>= 7;
+    }
+    p[i++] = length;
+    return i;
+  }
+  size_t n = type;
+  if (n < 8 && length >> (n * 8)) {
+    return 0;
+  }
+  for (size_t i = 0; i < n; ++i) {
+    p[n - 1 - i] = length & 0xff;
+    length >>= 8;
+  }
+  return n;
+}
+
+bool FrameEncoder::AddHeader(uint64_t length) {
+  char buf[10];
+  size_t n = EncodeHeader(type_, length, buf);
+  if (!n) {
+    LOG_ERROR(g_logger) << "FrameEncoder length=" << length
+                        << " does not fit in " << (int)type_ << " bytes";
+    return false;
+  }
+  Piece piece = {nullptr, headers_.size(), n};
+  headers_.insert(headers_.end(), buf, buf + n);
+  pieces_.push_back(piece);
+  pending_ += n;
+  ++frames_;
+  return true;
+}
+
+void FrameEncoder::AddPiece(const void *data, size_t length) {
+  if (!length) {
+    return;
+  }
+  Piece piece = {data, 0, length};
+  pieces_.push_back(piece);
+  pending_ += length;
+}
+
+bool FrameEncoder::Add(const void *data, size_t length) {
+  if (!AddHeader(length)) {
+    return false;
+  }
+  AddPiece(data, length);
+  return true;
+}
+
+bool FrameEncoder::Add(const std::vector<iovec> &payload) {
+  uint64_t length = 0;
+  for (auto &iov : payload) {
+    length += iov.iov_len;
+  }
+  if (!AddHeader(length)) {
+    return false;
+  }
+  for (auto &iov : payload) {
+    AddPiece(iov.iov_base, iov.iov_len);
+  }
+  return true;
+}
+
+bool FrameEncoder::Add(std::string &&payload) {
+  // deque尾部追加不移动已有元素，负载地址保持有效
+  strings_.push_back(std::move(payload));
+  const std::string &str = strings_.back();
+  return Add(str.data(), str.size());
+}
+
+bool FrameEncoder::Add(const Frame &frame) {
+  std::vector<iovec> payload;
+  frame.GetBuffers(payload);
+  if (frame.data) {
+    pins_.push_back(frame.data);
+  }
+  return Add(payload);
+}
+
+void FrameEncoder::Clear() {
+  pieces_.clear();
+  headers_.clear();
+  strings_.clear();
+  pins_.clear();
+  frames_ = 0;
+  pending_ = 0;
+}
+
+int64_t FrameEncoder::Flush(Socket::ptr sock) {
+  std::vector<iovec> iovs(pieces_.size());
+  for (size_t i = 0; i < pieces_.size(); ++i) {
+    const Piece &piece = pieces_[i];
+    iovs[i].iov_base =
+        piece.data ? (void *)piece.data : (void *)&headers_[piece.offset];
+    iovs[i].iov_len = piece.length;
+  }
+  int64_t total = 0;
+  size_t idx = 0;
+  while (idx < iovs.size()) {
+    size_t count = std::min(iovs.size() - idx, (size_t)IOV_MAX);
+    int rt = sock->send(&iovs[idx], count);
+    if (rt <= 0) {
+      Clear();
+      return rt < 0 ? rt : -1;
+    }
+    total += rt;
+    // 跳过已发出的内存块，部分发出的调整起始地址
+    size_t n = rt;
+    while (n && n >= iovs[idx].iov_len) {
+      n -= iovs[idx].iov_len;
+      ++idx;
+    }
+    if (n) {
+      iovs[idx].iov_base = (char *)iovs[idx].iov_base + n;
+      iovs[idx].iov_len -= n;
+    }
+  }
+  Clear();
+  return total;
+}
+
+}  // namespace serverframework
@@ -0,0 +1,241 @@
+/**
+ * @file frame_codec.h
+ * @brief 长度前缀分帧编解码
+ * @details 帧格式为长度前缀+负载，长度前缀是varint(与ByteArray::WriteUint64相同)或大端的16/32位定长整数。
+ *          FrameDecoder把socket数据直接读进接收ByteArray，逐步解析出完整的帧，帧只记录所在的ByteArray和位置，不拷贝负载；
+ *          FrameEncoder把长度前缀和负载的地址收集起来，一次writev发出
+ */
+#ifndef FRAME_CODEC_H
+#define FRAME_CODEC_H
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "net/socket.h"
+#include "util/bytearray.h"
+
+namespace serverframework {
+
+/**
+ * @brief 解码出的一帧，引用接收ByteArray中的负载
+ * @details 帧持有ByteArray的引用，解码器之后换用新的接收缓冲区时不影响已经解出的帧
+ */
+struct Frame {
+  /**
+   * @brief 长度前缀的类型
+   */
+  enum LengthType {
+    // varint，1~10字节
+    VARINT = 0,
+    // 大端16位
+    FIXED16 = 2,
+    // 大端32位
+    FIXED32 = 4
+  };
+
+  /**
+   * @brief 负载的内存块，追加到buffers
+   * @return 负载长度
+   */
+  uint64_t GetBuffers(std::vector<iovec> &buffers) const;
+
+  /**
+   * @brief 负载拷贝成std::string
+   */
+  std::string ToString() const;
+
+  // 负载所在的ByteArray
+  ByteArray::ptr data;
+  // 负载在data中的位置
+  size_t position = 0;
+  // 负载长度
+  size_t length = 0;
+};
+
+/**
+ * @brief 增量分帧解码器
+ * @details 接收缓冲区只在末尾追加，已解出的帧之前的数据积累到一定量后换一个新的ByteArray，
+ *          只把还没凑成完整帧的尾部拷过去；旧的ByteArray由还在使用的帧持有。
+ *          不是线程安全的，同一时间只应由一个协程使用
+ */
+class FrameDecoder {
+ public:
+  using ptr = std::shared_ptr<FrameDecoder>;
+
+  /**
+   * @brief 构造函数
+   * @param[in] type 长度前缀的类型
+   * @param[in] max_size 最大帧长，0表示使用配置项frame.max_size
+   * @param[in] base_size 接收ByteArray的内存块大小
+   */
+  FrameDecoder(Frame::LengthType type = Frame::VARINT, size_t max_size = 0,
+               size_t base_size = 4096);
+
+  /**
+   * @brief 从socket读取数据追加到接收缓冲区
+   * @param[in] length 最多读取的字节数，0表示读取一个内存块大小，不足一帧时至少读到凑够这一帧
+   * @return 同Socket::recv
+   */
+  int ReadFrom(Socket::ptr sock, size_t length = 0);
+
+  /**
+   * @brief 追加数据到接收缓冲区
+   */
+  void Append(const void *data, size_t length);
+
+  /**
+   * @brief 解出下一帧
+   * @return
+   *      @retval 1 解出一帧
+   *      @retval 0 数据还不够一帧
+   *      @retval -1 长度前缀非法或帧超过最大长度，连接应该关闭
+   */
+  int Decode(Frame &frame);
+
+  /**
+   * @brief 接收缓冲区中还没有解出的字节数
+   */
+  size_t GetPending() const { return buffer_->GetSize() - read_pos_; }
+
+  /**
+   * @brief 凑够当前这一帧还需要的字节数，长度前缀还不完整时返回0
+   */
+  size_t GetNeeded() const { return needed_; }
+
+  /**
+   * @brief 设置接收缓冲区积累多少已解出的数据后换新的ByteArray
+   */
+  void SetCompactThreshold(size_t v) { compact_threshold_ = v; }
+
+ private:
+  /**
+   * @brief 追加数据之前整理接收缓冲区
+   */
+  void Compact();
+
+  /**
+   * @brief 解析长度前缀
+   * @param[out] header 长度前缀的字节数
+   * @param[out] length 负载长度
+   * @return 同Decode
+   */
+  int ParseHeader(size_t &header, uint64_t &length) const;
+
+ private:
+  Frame::LengthType type_;
+  size_t max_size_;
+  size_t base_size_;
+  size_t compact_threshold_;
+  // 接收缓冲区，ByteArray的position固定在数据末尾用于追加
+  ByteArray::ptr buffer_;
+  // 下一帧的起始位置
+  size_t read_pos_ = 0;
+  // 凑够当前帧还需要的字节数
+  size_t needed_ = 0;
+};
+
+/**
+ * @brief 分帧编码器
+ * @details 只记录负载的地址不拷贝，Flush之前负载必须保持有效；
+ *          Add(std::string&&)和Add(const Frame&)由编码器持有数据。不是线程安全的
+ */
+class FrameEncoder {
+ public:
+  /**
+   * @brief 构造函数
+   * @param[in] type 长度前缀的类型
+   */
+  FrameEncoder(Frame::LengthType type = Frame::VARINT);
+
+  /**
+   * @brief 添加一帧
+   * @return 负载超过长度前缀能表示的范围时返回false
+   */
+  bool Add(const void *data, size_t length);
+
+  /**
+   * @brief 添加一帧，负载由多段内存组成
+   */
+  bool Add(const std::vector<iovec> &payload);
+
+  /**
+   * @brief 添加一帧，编码器持有负载
+   */
+  bool Add(std::string &&payload);
+
+  /**
+   * @brief 添加一帧，负载是解码出的帧，编码器持有它的ByteArray
+   */
+  bool Add(const Frame &frame);
+
+  /**
+   * @brief 用writev发出所有帧
+   * @return
+   *      @retval >=0 发出的字节数
+   *      @retval <0 socket错误，未发出的帧被丢弃
+   */
+  int64_t Flush(Socket::ptr sock);
+
+  /**
+   * @brief 还没有发出的帧数
+   */
+  size_t GetFrameCount() const { return frames_; }
+
+  /**
+   * @brief 还没有发出的字节数
+   */
+  size_t GetPending() const { return pending_; }
+
+  /**
+   * @brief 丢弃所有未发出的帧
+   */
+  void Clear();
+
+  /**
+   * @brief 编码长度前缀
+   * @param[out] out 至少10字节
+   * @return 长度前缀的字节数，长度超出类型能表示的范围时返回0
+   */
+  static size_t EncodeHeader(Frame::LengthType type, uint64_t length,
+                             char *out);
+
+ private:
+  /**
+   * @brief 添加长度前缀
+   */
+  bool AddHeader(uint64_t length);
+
+  /**
+   * @brief 添加一段负载
+   */
+  void AddPiece(const void *data, size_t length);
+
+ private:
+  /**
+   * @brief 一段待发送的数据，data为空时是headers_中offset处的长度前缀
+   */
+  struct Piece {
+    const void *data;
+    size_t offset;
+    size_t length;
+  };
+
+  Frame::LengthType type_;
+  std::vector<Piece> pieces_;
+  // 所有长度前缀连续存放，Flush时再转成地址，避免扩容后地址失效
+  std::vector<char> headers_;
+  // 编码器持有的负载
+  std::deque<std::string> strings_;
+  std::vector<ByteArray::ptr> pins_;
+  size_t frames_ = 0;
+  size_t pending_ = 0;
+};
+
+}  // namespace serverframework
+
+#endif
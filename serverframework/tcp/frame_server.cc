@@ -0,0 +1,48 @@
+#include "tcp/frame_server.h"
+
+#include "log/log.h"
+
+namespace serverframework {
+
+static serverframework::Logger::ptr g_logger = LOG_NAME("system");
+
+FrameServer::FrameServer(Frame::LengthType type, IOManager* io_worker,
+                         IOManager* accept_worker)
+    : TcpServer(io_worker, accept_worker), length_type_(type) {
+  type_ = "frame";
+}
+
+void FrameServer::HandleConnection(Connection::ptr conn) {
+  Socket::ptr sock = conn->GetSocket();
+  FrameDecoder decoder(length_type_);
+  FrameEncoder encoder(length_type_);
+  bool running = true;
+  while (running) {
+    conn->SetIdle(!decoder.GetPending());
+    int rt = decoder.ReadFrom(sock);
+    if (rt <= 0) {
+      break;
+    }
+    conn->SetIdle(false);
+    conn->Touch();
+    // 一次读入的所有完整请求依次处理，响应合并成一次writev。
+    // frame在每批之后释放，没有帧引用时接收缓冲区可以直接复用
+    Frame frame;
+    while (running && (rt = decoder.Decode(frame)) > 0) {
+      running = HandleRequest(conn, frame, encoder);
+    }
+    if (rt < 0) {
+      LOG_WARN(g_logger) << "FrameServer bad frame from " << *sock;
+      running = false;
+    }
+    if (encoder.GetFrameCount() && encoder.Flush(sock) < 0) {
+      break;
+    }
+    if (conn->IsDraining() && !decoder.GetPending()) {
+      break;
+    }
+  }
+  sock->close();
+}
+
+}  // namespace serverframework
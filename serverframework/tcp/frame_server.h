@@ -0,0 +1,61 @@
+/**
+ * @file frame_server.h
+ * @brief 分帧请求/响应服务器
+ * @details 客户端可以不等响应连续发送多个请求。服务器每次把socket中已到达的数据读进接收缓冲区，
+ *          依次处理其中所有完整的请求，响应按请求顺序追加，一批请求的响应用一次writev发出
+ */
+#ifndef FRAME_SERVER_H
+#define FRAME_SERVER_H
+
+#include "tcp/frame_codec.h"
+#include "tcp/tcp_server.h"
+
+namespace serverframework {
+
+/**
+ * @brief 分帧请求/响应服务器，子类实现HandleRequest
+ */
+class FrameServer : public TcpServer {
+ public:
+  using ptr = std::shared_ptr<FrameServer>;
+
+  /**
+   * @brief 构造函数
+   * @param[in] type 请求和响应的长度前缀类型
+   * @param[in] io_worker socket客户端工作的协程调度器
+   * @param[in] accept_worker 服务器socket执行接收socket连接的协程调度器
+   */
+  FrameServer(Frame::LengthType type = Frame::VARINT,
+              IOManager* io_worker = IOManager::GetThis(),
+              IOManager* accept_worker = IOManager::GetThis());
+
+  /**
+   * @brief 返回长度前缀类型
+   */
+  Frame::LengthType GetLengthType() const { return length_type_; }
+
+ protected:
+  /**
+   * @brief 处理一个请求
+   * @param[in] conn 连接
+   * @param[in] request 请求帧，负载在out发出之前一直有效，可以直接作为响应的负载
+   * @param[out] out 响应，可以不追加(单向消息)也可以追加多帧
+   * @return 返回false时发出已追加的响应后关闭连接
+   */
+  virtual bool HandleRequest(Connection::ptr conn, const Frame& request,
+                             FrameEncoder& out) = 0;
+
+  /**
+   * @brief 循环读取、解帧、分发请求并批量发出响应
+   * @details 接收缓冲区中没有未处理的数据时连接标记为空闲；排空时处理完已收到的请求后关闭连接
+   */
+  void HandleConnection(Connection::ptr conn) override;
+
+ private:
+  // 长度前缀类型
+  Frame::LengthType length_type_;
+};
+
+}  // namespace serverframework
+
+#endif
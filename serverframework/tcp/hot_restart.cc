@@ -0,0 +1,311 @@
+#include "tcp/hot_restart.h"
+
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "config/config.h"
+#include "log/log.h"
+#include "net/iomanager.h"
+#include "util/daemon.h"
+
+namespace serverframework {
+
+static serverframework::Logger::ptr g_logger = LOG_NAME("system");
+
+static serverframework::ConfigVar<std::string>::ptr g_hot_restart_path =
+    serverframework::Config::Lookup(
+        "hot_restart.path", std::string(""),
+        "unix socket path used to hand listeners to the new process");
+
+static serverframework::ConfigVar<uint32_t>::ptr g_hot_restart_timeout =
+    serverframework::Config::Lookup("hot_restart.timeout", (uint32_t)10000,
+                                    "hot restart handoff timeout in ms");
+
+// 一条消息最多携带的句柄数(SCM_MAX_FD)
+static const size_t kMaxFds = 253;
+static const char kRequest[] = "GET";
+static const char kReady[] = "READY";
+
+HotRestart::HotRestart() : path_(g_hot_restart_path->GetValue()) {}
+
+std::string HotRestart::GetPath() {
+  std::string path;
+  {
+    MutexType::Lock lock(mutex_);
+    path = path_;
+  }
+  ProcessInfo *info = ProcessInfoMgr::GetInstance();
+  if (path.empty() || info->worker_count_ <= 1) {
+    return path;
+  }
+  // 每个工作进程用自己的交接路径，新进程只和同一槽位的旧进程交接
+  return path + "." + std::to_string(info->worker_id_);
+}
+
+void HotRestart::SetPath(const std::string &v) {
+  MutexType::Lock lock(mutex_);
+  path_ = v;
+}
+
+bool HotRestart::SendFds(Socket::ptr sock, const std::vector<int> &fds,
+                         const std::string &data) {
+  if (data.empty() || fds.size() > kMaxFds) {
+    LOG_ERROR(g_logger) << "SendFds invalid fds=" << fds.size()
+                        << " data=" << data.size();
+    return false;
+  }
+  iovec iov;
+  iov.iov_base = (void *)data.data();
+  iov.iov_len = data.size();
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  std::vector<char> control;
+  if (!fds.empty()) {
+    control.resize(CMSG_SPACE(sizeof(int) * fds.size()));
+    msg.msg_control = &control[0];
+    msg.msg_controllen = control.size();
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    memcpy(CMSG_DATA(cmsg), &fds[0], sizeof(int) * fds.size());
+  }
+  ssize_t rt = sendmsg(sock->GetSocket(), &msg, 0);
+  if (rt != (ssize_t)data.size()) {
+    LOG_ERROR(g_logger) << "SendFds sendmsg rt=" << rt << " errno=" << errno
+                        << " errstr=" << strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+bool HotRestart::RecvFds(Socket::ptr sock, std::vector<int> &fds,
+                         std::string &data) {
+  std::vector<char> buf(64 * 1024);
+  std::vector<char> control(CMSG_SPACE(sizeof(int) * kMaxFds));
+  iovec iov;
+  iov.iov_base = &buf[0];
+  iov.iov_len = buf.size();
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = &control[0];
+  msg.msg_controllen = control.size();
+  ssize_t rt = recvmsg(sock->GetSocket(), &msg, MSG_CMSG_CLOEXEC);
+  if (rt <= 0) {
+    LOG_ERROR(g_logger) << "RecvFds recvmsg rt=" << rt << " errno=" << errno
+                        << " errstr=" << strerror(errno);
+    return false;
+  }
+  for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      const int *p = (const int *)CMSG_DATA(cmsg);
+      fds.insert(fds.end(), p, p + n);
+    }
+  }
+  if (msg.msg_flags & MSG_CTRUNC) {
+    LOG_ERROR(g_logger) << "RecvFds control data truncated";
+    for (int fd : fds) {
+      ::close(fd);
+    }
+    fds.clear();
+    return false;
+  }
+  data.assign(&buf[0], rt);
+  return true;
+}
+
+bool HotRestart::Inherit() {
+  std::string path = GetPath();
+  if (path.empty() || access(path.c_str(), F_OK)) {
+    return false;
+  }
+  uint32_t timeout = g_hot_restart_timeout->GetValue();
+  Socket::ptr sock = Socket::CreateUnixTCPSocket();
+  if (!sock->connect(UnixAddress::ptr(new UnixAddress(path)), timeout)) {
+    LOG_INFO(g_logger) << "HotRestart no old process on " << path;
+    return false;
+  }
+  sock->SetRecvTimeout(timeout);
+  sock->SetSendTimeout(timeout);
+  std::vector<int> fds;
+  std::string data;
+  if (sock->send(kRequest, sizeof(kRequest) - 1) != sizeof(kRequest) - 1 ||
+      !RecvFds(sock, fds, data)) {
+    LOG_ERROR(g_logger) << "HotRestart request listeners from " << path
+                        << " failed";
+    return false;
+  }
+
+  // 第一行是句柄数，之后每行是一个监听socket的本地地址，与句柄一一对应
+  std::vector<std::string> lines;
+  size_t begin = 0;
+  size_t end;
+  while ((end = data.find('\n', begin)) != std::string::npos) {
+    lines.push_back(data.substr(begin, end - begin));
+    begin = end + 1;
+  }
+  if (lines.empty() || lines.size() - 1 != fds.size() ||
+      (size_t)atoi(lines[0].c_str()) != fds.size()) {
+    LOG_ERROR(g_logger) << "HotRestart invalid handoff message, fds="
+                        << fds.size();
+    for (int fd : fds) {
+      ::close(fd);
+    }
+    return false;
+  }
+
+  MutexType::Lock lock(mutex_);
+  for (size_t i = 0; i < fds.size(); ++i) {
+    Socket::ptr listener = Socket::CreateFromFd(fds[i]);
+    if (!listener) {
+      ::close(fds[i]);
+      continue;
+    }
+    listeners_.insert(std::make_pair(lines[i + 1], listener));
+    LOG_INFO(g_logger) << "HotRestart inherit listener " << lines[i + 1]
+                       << " fd=" << fds[i];
+  }
+  parent_ = sock;
+  return true;
+}
+
+Socket::ptr HotRestart::TakeListener(Address::ptr addr) {
+  MutexType::Lock lock(mutex_);
+  if (listeners_.empty()) {
+    return nullptr;
+  }
+  auto it = listeners_.find(addr->ToString());
+  if (it == listeners_.end()) {
+    return nullptr;
+  }
+  Socket::ptr listener = it->second;
+  listeners_.erase(it);
+  return listener;
+}
+
+void HotRestart::Ready() {
+  Socket::ptr parent;
+  {
+    MutexType::Lock lock(mutex_);
+    parent.swap(parent_);
+    // 新进程没有用到的监听socket，旧进程停止后这些地址上的连接会被拒绝
+    for (auto &i : listeners_) {
+      LOG_WARN(g_logger) << "HotRestart listener " << i.first
+                         << " not adopted, closing";
+    }
+    listeners_.clear();
+  }
+  if (!parent) {
+    return;
+  }
+  if (parent->send(kReady, sizeof(kReady) - 1) != sizeof(kReady) - 1) {
+    LOG_ERROR(g_logger) << "HotRestart notify old process failed errno="
+                        << errno << " errstr=" << strerror(errno);
+  }
+  parent->close();
+}
+
+bool HotRestart::Handoff(Socket::ptr conn,
+                         const std::vector<TcpServer::ptr> &servers) {
+  uint32_t timeout = g_hot_restart_timeout->GetValue();
+  conn->SetRecvTimeout(timeout);
+  conn->SetSendTimeout(timeout);
+  char buf[16];
+  int n = conn->recv(buf, sizeof(buf));
+  if (n != sizeof(kRequest) - 1 || memcmp(buf, kRequest, n)) {
+    LOG_ERROR(g_logger) << "HotRestart invalid request rt=" << n;
+    return false;
+  }
+
+  std::vector<int> fds;
+  std::string addrs;
+  for (auto &server : servers) {
+    for (auto &sock : server->GetSocks()) {
+      fds.push_back(sock->GetSocket());
+      addrs += sock->GetLocalAddress()->ToString() + "\n";
+    }
+  }
+  if (!SendFds(conn, fds, std::to_string(fds.size()) + "\n" + addrs)) {
+    return false;
+  }
+
+  // 新进程开始接收连接之后才停止旧进程，期间两个进程同时接收连接
+  n = conn->recv(buf, sizeof(buf));
+  if (n != sizeof(kReady) - 1 || memcmp(buf, kReady, n)) {
+    LOG_ERROR(g_logger) << "HotRestart new process failed before ready rt="
+                        << n << " errno=" << errno;
+    return false;
+  }
+  LOG_INFO(g_logger) << "HotRestart handed " << fds.size()
+                     << " listeners to the new process";
+  return true;
+}
+
+bool HotRestart::Serve(const std::vector<TcpServer::ptr> &servers,
+                       std::function<void()> on_handoff) {
+  std::string path = GetPath();
+  IOManager *iom = IOManager::GetThis();
+  if (path.empty() || !iom) {
+    return false;
+  }
+  // 旧进程可能还在原路径上监听，直接删掉路径重新绑定
+  unlink(path.c_str());
+  Socket::ptr acceptor = Socket::CreateUnixTCPSocket();
+  if (!acceptor->bind(UnixAddress::ptr(new UnixAddress(path))) ||
+      !acceptor->listen()) {
+    LOG_ERROR(g_logger) << "HotRestart listen on " << path
+                        << " failed errno=" << errno
+                        << " errstr=" << strerror(errno);
+    return false;
+  }
+  {
+    MutexType::Lock lock(mutex_);
+    acceptor_ = acceptor;
+  }
+  iom->Schedule([this, acceptor, servers, on_handoff]() {
+    while (true) {
+      Socket::ptr conn = acceptor->accept();
+      if (!conn) {
+        break;
+      }
+      if (!Handoff(conn, servers)) {
+        continue;
+      }
+      {
+        MutexType::Lock lock(mutex_);
+        if (acceptor_ == acceptor) {
+          acceptor_.reset();
+        }
+      }
+      // 路径已经属于新进程，只关闭不删除
+      acceptor->close();
+      if (on_handoff) {
+        on_handoff();
+      }
+      break;
+    }
+  });
+  return true;
+}
+
+void HotRestart::StopServe() {
+  Socket::ptr acceptor;
+  {
+    MutexType::Lock lock(mutex_);
+    acceptor.swap(acceptor_);
+  }
+  if (acceptor) {
+    acceptor->CancelAll();
+    acceptor->close();
+    unlink(GetPath().c_str());
+  }
+}
+
+}  // namespace serverframework
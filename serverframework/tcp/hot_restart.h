@@ -0,0 +1,114 @@
+/**
+ * @file hot_restart.h
+ * @brief 热重启
+ * @details 新进程启动时通过Unix域socket连上旧进程，用SCM_RIGHTS取得旧进程的监听socket，
+ *          TcpServer直接使用这些socket而不再bind。新进程开始接收连接后通知旧进程，
+ *          旧进程停止接收新连接，处理完已有连接后退出。监听socket始终有进程持有，
+ *          连接队列中的连接由新进程接收，重启期间不会拒绝连接
+ */
+#ifndef HOT_RESTART_H
+#define HOT_RESTART_H
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "env/mutex.h"
+#include "net/socket.h"
+#include "tcp/tcp_server.h"
+#include "util/singleton.h"
+
+namespace serverframework {
+
+/**
+ * @brief 热重启
+ * @details 交接用的Unix域socket路径取自配置项hot_restart.path，为空时不启用热重启。
+ *          master/worker模式下有多个工作进程时，第i个工作进程使用"路径.i"，
+ *          热重启时每个新工作进程接过同一槽位旧进程的监听socket
+ */
+class HotRestart {
+ public:
+  using MutexType = Mutex;
+
+  HotRestart();
+
+  /**
+   * @brief 新进程启动时调用，从旧进程取得监听socket
+   * @details 连不上旧进程时返回false，此时按正常流程bind
+   * @return 是否从旧进程取得了监听socket
+   */
+  bool Inherit();
+
+  /**
+   * @brief 取出一个从旧进程继承的、本地地址为addr的监听socket
+   * @details 由TcpServer::bind调用，没有时返回nullptr
+   */
+  Socket::ptr TakeListener(Address::ptr addr);
+
+  /**
+   * @brief 新进程的服务都已开始接收连接后调用，通知旧进程交接完成
+   * @details 没有继承监听socket时什么也不做
+   */
+  void Ready();
+
+  /**
+   * @brief 在交接路径上等待下一个新进程，把servers的监听socket交给它
+   * @details 必须在IOManager的协程中调用，等待在新协程中进行。
+   *          新进程通知交接完成后调用on_handoff，通常在其中停止servers
+   * @return 是否开始等待
+   */
+  bool Serve(const std::vector<TcpServer::ptr> &servers,
+             std::function<void()> on_handoff);
+
+  /**
+   * @brief 停止等待新进程
+   */
+  void StopServe();
+
+  /**
+   * @brief 交接用的Unix域socket路径，多个工作进程时带上工作进程编号后缀
+   */
+  std::string GetPath();
+  void SetPath(const std::string &v);
+
+  /**
+   * @brief 通过Unix域socket发送句柄
+   * @param[in] data 随句柄一起发送的数据，不能为空
+   * @return 是否发送成功
+   */
+  static bool SendFds(Socket::ptr sock, const std::vector<int> &fds,
+                      const std::string &data);
+
+  /**
+   * @brief 通过Unix域socket接收句柄
+   * @param[out] fds 收到的句柄，带close-on-exec标志
+   * @param[out] data 随句柄一起收到的数据
+   * @return 是否收到了数据
+   */
+  static bool RecvFds(Socket::ptr sock, std::vector<int> &fds,
+                      std::string &data);
+
+ private:
+  /**
+   * @brief 处理一个新进程的交接请求
+   * @return 是否交接完成
+   */
+  bool Handoff(Socket::ptr conn, const std::vector<TcpServer::ptr> &servers);
+
+ private:
+  MutexType mutex_;
+  std::string path_;
+  // 与旧进程的连接，Ready之后关闭
+  Socket::ptr parent_;
+  // 从旧进程继承、还未被TcpServer取走的监听socket，按本地地址索引
+  std::multimap<std::string, Socket::ptr> listeners_;
+  // 等待新进程的Unix域监听socket
+  Socket::ptr acceptor_;
+};
+
+using HotRestartMgr = Singleton<HotRestart>;
+
+}  // namespace serverframework
+
+#endif
@@ -1,7 +1,12 @@
  #include "tcp/tcp_server.h"
 
+#include <algorithm>
+
 #include "config/config.h"
 #include "log/log.h"
+#include "tcp/hot_restart.h"
+#include "util/clock.h"
+#include "util/daemon.h"
 
 namespace serverframework {
 
@@ -12,14 +17,43 @@ static serverframework::ConfigVar<uint64_t>::ptr g_tcp_server_read_timeout =
                                     (uint64_t)(60 * 1000 * 2),
                                     "tcp server read timeout");
 
+static serverframework::ConfigVar<uint32_t>::ptr g_tcp_server_accept_batch =
+    serverframework::Config::Lookup("tcp_server.accept_batch", (uint32_t)64,
+                                    "max connections accepted per wakeup");
+
+static serverframework::ConfigVar<uint64_t>::ptr g_tcp_server_idle_timeout =
+    serverframework::Config::Lookup(
+        "tcp_server.idle_timeout", (uint64_t)0,
+        "close connections idle for this long in ms, 0 to disable");
+
+static serverframework::ConfigVar<uint32_t>::ptr g_tcp_server_max_connections =
+    serverframework::Config::Lookup("tcp_server.max_connections", (uint32_t)0,
+                                    "max concurrent connections, 0 unlimited");
+
+static serverframework::ConfigVar<uint64_t>::ptr g_tcp_server_connection_budget =
+    serverframework::Config::Lookup(
+        "tcp_server.connection_budget", (uint64_t)(1024 * 1024),
+        "bytes a connection may buffer before reads pause, 0 unlimited");
+
+static serverframework::ConfigVar<uint64_t>::ptr g_tcp_server_drain_timeout =
+    serverframework::Config::Lookup(
+        "tcp_server.drain_timeout", (uint64_t)30000,
+        "max ms to wait for in-flight connections when draining");
+
 TcpServer::TcpServer(serverframework::IOManager* io_worker,
                      serverframework::IOManager* accept_worker)
     : io_worker_(io_worker),
       accept_worker_(accept_worker),
+      reuse_port_(false),
+      next_worker_(0),
+      accept_batch_(std::max(g_tcp_server_accept_batch->GetValue(), 1u)),
       recv_timeout_(g_tcp_server_read_timeout->GetValue()),
       name_("1.0.0"),
       type_("tcp"),
-      is_stop_(true) {}
+      is_stop_(true),
+      connections_(g_tcp_server_idle_timeout->GetValue(),
+                   g_tcp_server_max_connections->GetValue()),
+      connection_budget_(g_tcp_server_connection_budget->GetValue()) {}
 
 TcpServer::~TcpServer() {
   for (auto& i : socks_) {
@@ -28,6 +62,12 @@ TcpServer::~TcpServer() {
   socks_.clear();
 }
 
+void TcpServer::SetWorkers(const std::vector<IOManager*>& workers,
+                           bool reuse_port) {
+  workers_ = workers;
+  reuse_port_ = reuse_port;
+}
+
 bool TcpServer::bind(serverframework::Address::ptr addr) {
   std::vector<Address::ptr> addrs;
   std::vector<Address::ptr> fails;
@@ -37,23 +77,43 @@ bool TcpServer::bind(serverframework::Address::ptr addr) {
 
 bool TcpServer::bind(const std::vector<Address::ptr>& addrs,
                      std::vector<Address::ptr>& fails) {
+  // 多接收者模式下每个地址为每个工作调度器绑定一个监听socket，第i个socket属于workers_[i % n]
+  size_t per_addr = reuse_port_ && !workers_.empty() ? workers_.size() : 1;
+  // 多个工作进程各自绑定同一个地址，由内核在进程间分发连接
+  bool reuse_port =
+      per_addr > 1 || ProcessInfoMgr::GetInstance()->worker_count_ > 1;
   for (auto& addr : addrs) {
-    Socket::ptr sock = Socket::CreateTCP(addr);
-    if (!sock->bind(addr)) {
-      LOG_ERROR(g_logger) << "bind fail errno=" << errno
-                          << " errstr=" << strerror(errno) << " addr=["
-                          << addr->ToString() << "]";
-      fails.push_back(addr);
-      continue;
+    for (size_t i = 0; i < per_addr; ++i) {
+      // 热重启时直接使用从旧进程继承的监听socket，不再bind
+      Socket::ptr sock = HotRestartMgr::GetInstance()->TakeListener(addr);
+      if (sock) {
+        socks_.push_back(sock);
+        continue;
+      }
+      sock = Socket::CreateTCP(addr);
+      if (reuse_port && !sock->SetReusePort(true)) {
+        LOG_ERROR(g_logger) << "SO_REUSEPORT fail errno=" << errno
+                            << " errstr=" << strerror(errno) << " addr=["
+                            << addr->ToString() << "]";
+        fails.push_back(addr);
+        break;
+      }
+      if (!sock->bind(addr)) {
+        LOG_ERROR(g_logger) << "bind fail errno=" << errno
+                            << " errstr=" << strerror(errno) << " addr=["
+                            << addr->ToString() << "]";
+        fails.push_back(addr);
+        break;
+      }
+      if (!sock->listen()) {
+        LOG_ERROR(g_logger) << "listen fail errno=" << errno
+                            << " errstr=" << strerror(errno) << " addr=["
+                            << addr->ToString() << "]";
+        fails.push_back(addr);
+        break;
+      }
+      socks_.push_back(sock);
     }
-    if (!sock->listen()) {
-      LOG_ERROR(g_logger) << "listen fail errno=" << errno
-                          << " errstr=" << strerror(errno) << " addr=["
-                          << addr->ToString() << "]";
-      fails.push_back(addr);
-      continue;
-    }
-    socks_.push_back(sock);
   }
 
   if (!fails.empty()) {
@@ -68,16 +128,55 @@ bool TcpServer::bind(const std::vector<Address::ptr>& addrs,
   return true;
 }
 
+IOManager* TcpServer::GetAcceptWorker(size_t i) const {
+  if (reuse_port_ && !workers_.empty()) {
+    return workers_[i % workers_.size()];
+  }
+  return accept_worker_;
+}
+
 void TcpServer::StartAccept(Socket::ptr sock) {
+  // 不轮询转交时，同一批连接都在同一个调度器上处理
+  bool round_robin = !workers_.empty() && !reuse_port_;
+  IOManager* worker = workers_.empty() ? io_worker_ : IOManager::GetThis();
+  // io_worker是亲和模式时，每个连接轮流指定一个线程，之后一直在该线程上处理
+  bool affinity = workers_.empty() && io_worker_->IsAffinity();
+  const std::vector<int>& threads = io_worker_->GetThreadIds();
+  std::vector<Socket::ptr> clients;
+  std::vector<std::function<void()>> tasks;
   while (!is_stop_) {
-    Socket::ptr client = sock->accept();
-    if (client) {
-      client->SetRecvTimeout(recv_timeout_);
-      io_worker_->Schedule(
-          std::bind(&TcpServer::HandleClient, shared_from_this(), client));
-    } else {
+    if (!sock->AcceptBatch(clients, accept_batch_)) {
+      if (is_stop_) {
+        break;
+      }
       LOG_ERROR(g_logger) << "accept errno=" << errno
                           << " errstr=" << strerror(errno);
+      continue;
+    }
+    for (auto& client : clients) {
+      Connection::ptr conn = connections_.Add(client, connection_budget_);
+      if (!conn) {
+        LOG_DEBUG(g_logger) << "too many connections, max="
+                            << connections_.GetMaxConnections() << " close "
+                            << *client;
+        client->close();
+        continue;
+      }
+      client->SetRecvTimeout(recv_timeout_);
+      std::function<void()> task =
+          std::bind(&TcpServer::ServeConnection, shared_from_this(), conn);
+      if (round_robin) {
+        workers_[next_worker_++ % workers_.size()]->Schedule(task);
+      } else if (affinity) {
+        io_worker_->Schedule(task, threads[next_worker_++ % threads.size()]);
+      } else {
+        tasks.push_back(task);
+      }
+    }
+    clients.clear();
+    if (!tasks.empty()) {
+      worker->Schedule(tasks.begin(), tasks.end());
+      tasks.clear();
     }
   }
 }
@@ -87,35 +186,95 @@ bool TcpServer::Start() {
     return true;
   }
   is_stop_ = false;
-  for (auto& sock : socks_) {
-    accept_worker_->Schedule(
-        std::bind(&TcpServer::StartAccept, shared_from_this(), sock));
+  connections_.StopDrain();
+  if (connections_.GetIdleTimeout() && io_worker_) {
+    std::weak_ptr<TcpServer> weak(shared_from_this());
+    reaper_ = io_worker_->AddTimer(
+        connections_.GetTick(),
+        [weak]() {
+          TcpServer::ptr self = weak.lock();
+          if (self) {
+            self->ReapIdle();
+          }
+        },
+        true);
+  }
+  for (size_t i = 0; i < socks_.size(); ++i) {
+    GetAcceptWorker(i)->Schedule(
+        std::bind(&TcpServer::StartAccept, shared_from_this(), socks_[i]));
   }
   return true;
 }
 
 void TcpServer::Stop() {
   is_stop_ = true;
+  if (reaper_) {
+    reaper_->Cancel();
+    reaper_.reset();
+  }
   auto self = shared_from_this();
-  accept_worker_->Schedule([this, self]() {
-    for (auto& sock : socks_) {
+  // 监听socket在接收它的调度器上注册事件，也要在那里取消
+  for (size_t i = 0; i < socks_.size(); ++i) {
+    Socket::ptr sock = socks_[i];
+    GetAcceptWorker(i)->Schedule([self, sock]() {
       sock->CancelAll();
       sock->close();
-    }
-    socks_.clear();
-  });
+    });
+  }
+  socks_.clear();
+}
+
+bool TcpServer::Drain(uint64_t timeout_ms) {
+  if (timeout_ms == (uint64_t)-1) {
+    timeout_ms = g_tcp_server_drain_timeout->GetValue();
+  }
+  Stop();
+  uint64_t drained = connections_.GetDrainedCount();
+  connections_.StartDrain();
+  bool rt = connections_.WaitEmpty(timeout_ms);
+  size_t killed = rt ? 0 : connections_.KillAll();
+  LOG_INFO(g_logger) << "type=" << type_ << " name=" << name_ << " drained "
+                     << connections_.GetDrainedCount() - drained
+                     << " connections, killed " << killed << " after "
+                     << timeout_ms << "ms";
+  return rt;
 }
 
 void TcpServer::HandleClient(Socket::ptr client) {
   LOG_INFO(g_logger) << "HandleClient: " << *client;
 }
 
+void TcpServer::HandleConnection(Connection::ptr conn) {
+  HandleClient(conn->GetSocket());
+}
+
+void TcpServer::ServeConnection(Connection::ptr conn) {
+  HandleConnection(conn);
+  connections_.Remove(conn);
+}
+
+void TcpServer::ReapIdle() {
+  std::vector<Connection::ptr> idle;
+  connections_.Reap(Clock::NowMS(), idle);
+  for (auto& conn : idle) {
+    LOG_DEBUG(g_logger) << "close idle connection " << *conn->GetSocket();
+    conn->Shutdown();
+  }
+}
+
 std::string TcpServer::ToString(const std::string& prefix) {
   std::stringstream ss;
   ss << prefix << "[type=" << type_ << " name=" << name_
      << " io_worker=" << (io_worker_ ? io_worker_->GetName() : "")
      << " accept=" << (accept_worker_ ? accept_worker_->GetName() : "")
-     << " recv_timeout=" << recv_timeout_ << "]" << std::endl;
+     << " workers=" << workers_.size() << " reuse_port=" << reuse_port_
+     << " recv_timeout=" << recv_timeout_
+     << " connections=" << connections_.GetCount()
+     << " buffered=" << connections_.GetBuffered()
+     << " rejected=" << connections_.GetRejectedCount()
+     << " reaped=" << connections_.GetReapedCount()
+     << " drained=" << connections_.GetDrainedCount()
+     << " killed=" << connections_.GetKilledCount() << "]" << std::endl;
   std::string pfx = prefix.empty() ? "    " : prefix;
   for (auto& i : socks_) {
     ss << pfx << pfx << *i << std::endl;
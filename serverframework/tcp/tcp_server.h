@@ -4,14 +4,17 @@
  */
 #ifndef TCP_SERVER_H
 #define TCP_SERVER_H
+#include <atomic>
 #include <functional>
 #include <memory>
+#include <vector>
 
 #include "net/address.h"
 #include "config/config.h"
 #include "net/iomanager.h"
 
 #include "net/socket.h"
+#include "tcp/connection.h"
 
 namespace serverframework {
 /**
@@ -39,6 +42,19 @@ class TcpServer : public std::enable_shared_from_this<TcpServer> {
    */
   virtual ~TcpServer();
 
+  /**
+   * @brief 设置多接收者模式的工作调度器
+   * @details 工作调度器应该都是单线程的IOManager。reuse_port为true时bind为每个工作调度器创建一个
+   *          SO_REUSEPORT监听socket，由内核分发连接，连接在接收它的调度器上处理，不跨线程转交；
+   *          为false时只有一个监听socket，由accept_worker批量接收后轮询转交给各工作调度器，
+   *          用于不支持SO_REUSEPORT或者内核按四元组哈希分发不均衡、又不想挂BPF程序的场景
+   * @param[in] workers 工作调度器
+   * @param[in] reuse_port 是否每个工作调度器一个SO_REUSEPORT监听socket
+   * @pre 在bind之前调用
+   */
+  void SetWorkers(const std::vector<IOManager*>& workers,
+                  bool reuse_port = true);
+
   /**
    * @brief 绑定地址
    * @return 返回是否绑定成功
@@ -65,6 +81,17 @@ class TcpServer : public std::enable_shared_from_this<TcpServer> {
    */
   virtual void Stop();
 
+  /**
+   * @brief 排空后停止服务
+   * @details 先Stop不再接收新连接，半关闭空闲的长连接(见Connection::SetIdle)，
+   *          等正在处理请求的连接结束；到期时shutdown剩下的连接，阻塞在读写上的协程随即返回，
+   *          之后IOManager可以正常停止。排空和强制关闭的连接数见GetConnections()
+   * @param[in] timeout_ms 最长等待时间(毫秒)，-1表示使用配置项tcp_server.drain_timeout
+   * @return 所有连接都在到期前结束返回true
+   * @pre 在IOManager的协程中调用
+   */
+  virtual bool Drain(uint64_t timeout_ms = -1);
+
   /**
    * @brief 返回读取超时时间(毫秒)
    */
@@ -90,6 +117,32 @@ class TcpServer : public std::enable_shared_from_this<TcpServer> {
    */
   bool IsStop() const { return is_stop_; }
 
+  /**
+   * @brief 设置空闲超时(毫秒)，0表示不回收空闲连接
+   * @pre 在Start之前调用
+   */
+  void SetIdleTimeout(uint64_t v) { connections_.SetIdleTimeout(v); }
+
+  /**
+   * @brief 设置最大连接数，0表示不限制，超过时新连接被直接关闭
+   */
+  void SetMaxConnections(size_t v) { connections_.SetMaxConnections(v); }
+
+  /**
+   * @brief 设置之后新连接的缓冲预算(字节)，0表示不限制
+   */
+  void SetConnectionBudget(size_t v) { connection_budget_ = v; }
+
+  /**
+   * @brief 返回连接登记表，用于读取连接数、缓冲字节数、拒绝和回收次数等指标
+   */
+  const ConnectionRegistry& GetConnections() const { return connections_; }
+
+  /**
+   * @brief 返回监听Socket数组
+   */
+  std::vector<Socket::ptr> GetSocks() const { return socks_; }
+
   /**
    * @brief 以字符串形式dump server信息
    */
@@ -101,11 +154,37 @@ class TcpServer : public std::enable_shared_from_this<TcpServer> {
    */
   virtual void HandleClient(Socket::ptr client);
 
+  /**
+   * @brief 处理新连接
+   * @details 默认调用HandleClient。需要Touch或缓冲预算的服务重写这个函数，
+   *          返回后连接从登记表中删除
+   */
+  virtual void HandleConnection(Connection::ptr conn);
+
   /**
    * @brief 开始接受连接
+   * @details 每次批量接收排队的连接，同一个调度器上的新连接一次加入调度队列。
+   *          io_worker是亲和模式的IOManager时，新连接轮流指定io_worker的一个线程处理，
+   *          连接的协程和fd之后一直留在该线程上
    */
   virtual void StartAccept(Socket::ptr sock);
 
+  /**
+   * @brief 第i个监听socket接收连接的调度器
+   */
+  IOManager* GetAcceptWorker(size_t i) const;
+
+ private:
+  /**
+   * @brief 处理连接并在结束后从登记表中删除
+   */
+  void ServeConnection(Connection::ptr conn);
+
+  /**
+   * @brief 回收定时器，shutdown空闲超时的连接
+   */
+  void ReapIdle();
+
  protected:
   // 监听Socket数组
   std::vector<Socket::ptr> socks_;
@@ -113,6 +192,14 @@ class TcpServer : public std::enable_shared_from_this<TcpServer> {
   IOManager* io_worker_;
   // 服务器Socket接收连接的调度器
   IOManager* accept_worker_;
+  // 多接收者模式的工作调度器，为空时不启用
+  std::vector<IOManager*> workers_;
+  // 多接收者模式下是否每个工作调度器一个SO_REUSEPORT监听socket
+  bool reuse_port_;
+  // 轮询转交时下一个工作调度器的序号
+  std::atomic<size_t> next_worker_;
+  // 每次最多批量接收的连接数
+  uint32_t accept_batch_;
   // 接收超时时间(毫秒)
   uint64_t recv_timeout_;
   // 服务器名称
@@ -121,6 +208,12 @@ class TcpServer : public std::enable_shared_from_this<TcpServer> {
   std::string type_;
   // 服务是否停止
   bool is_stop_;
+  // 连接登记表
+  ConnectionRegistry connections_;
+  // 新连接的缓冲预算(字节)
+  size_t connection_budget_;
+  // 空闲连接回收定时器
+  Timer::ptr reaper_;
 };
 
 }  // namespace serverframework
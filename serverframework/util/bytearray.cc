@@ -380,9 +380,14 @@ void ByteArray::read(void* buf, size_t size, size_t position) const {
   }
 
   size_t npos = position % base_size_;
-  size_t ncap = cur_->size - npos;
+  size_t count = position / base_size_;
+  Node* cur = root_;
+  while (count > 0) {
+    cur = cur->next;
+    --count;
+  }
+  size_t ncap = cur->size - npos;
   size_t bpos = 0;
-  Node* cur = cur_;
   while (size > 0) {
     if (ncap >= size) {
       memcpy((char*)buf + bpos, cur->ptr + npos, size);
@@ -558,7 +563,10 @@ uint64_t ByteArray::GetReadBuffers(std::vector<iovec>& buffers,
 
 uint64_t ByteArray::GetReadBuffers(std::vector<iovec>& buffers, uint64_t len,
                                    uint64_t position) const {
-  len = len > GetReadSize() ? GetReadSize() : len;
+  if (position >= size_) {
+    return 0;
+  }
+  len = len > size_ - position ? size_ - position : len;
   if (len == 0) {
     return 0;
   }
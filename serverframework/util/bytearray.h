@@ -442,8 +442,8 @@ class ByteArray {
   /**
    * @brief 获取可读取的缓存,保存成iovec数组,从position位置开始
    * @param[out] buffers 保存可读取数据的iovec数组
-   * @param[in] len 读取数据的长度,如果len > GetReadSize() 则 len =
-   * GetReadSize()
+   * @param[in] len 读取数据的长度,如果len > GetSize() - position 则 len =
+   * GetSize() - position
    * @param[in] position 读取数据的位置
    * @return 返回实际数据的长度
    */
@@ -0,0 +1,315 @@
+/**
+ * @file clock.cc
+ * @brief 时钟实现
+ */
+#include "util/clock.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+#include <atomic>
+#include <mutex>
+
+#include "config/config.h"
+#include "log/log.h"
+#include "util/macro.h"
+
+namespace serverframework {
+
+static serverframework::Logger::ptr g_logger = LOG_NAME("system");
+
+static serverframework::ConfigVar<std::string>::ptr g_clock_source =
+    serverframework::Config::Lookup("clock.source", std::string("monotonic"),
+                                    "clock source: monotonic, coarse or tsc");
+
+// 当前时钟源
+static std::atomic<int> s_source = {Clock::MONOTONIC};
+
+// TSC时钟与CLOCK_MONOTONIC重新对齐的间隔(微秒)
+static const uint64_t kTscResyncUS = 1000 * 1000;
+
+/**
+ * @brief TSC换算参数
+ * @details 读时钟的线程不加锁，按seqlock读取：seq为奇数表示正在更新，前后两次读到的seq不同时重读。
+ *          重新对齐时只改变之后的速率，不让读数跳变
+ */
+struct TscParams {
+  std::atomic<uint64_t> seq{0};
+  // 换算起点的TSC
+  std::atomic<uint64_t> base_tsc{0};
+  // 换算起点的时间(微秒)
+  std::atomic<uint64_t> base_us{0};
+  // 每个TSC周期的微秒数，32位定点小数
+  std::atomic<uint64_t> mult{0};
+  // TSC超过这个值时重新对齐
+  std::atomic<uint64_t> resync_tsc{0};
+  // TSC频率
+  std::atomic<uint64_t> hz{0};
+
+  // 以下只在持有mutex时访问
+  std::mutex mutex;
+  // 上一次对齐时读到的CLOCK_MONOTONIC(微秒)和TSC
+  uint64_t last_us = 0;
+  uint64_t last_tsc = 0;
+};
+static TscParams s_tsc;
+static std::once_flag s_tsc_once;
+
+// 库以共享库链接时，默认的TLS模型每次访问都要调用__tls_get_addr，热路径上的变量使用initial-exec模型
+#define CLOCK_TLS __attribute__((tls_model("initial-exec")))
+
+// 当前线程缓存的时间戳，0表示没有缓存
+static thread_local uint64_t t_cached_us CLOCK_TLS = 0;
+// 当前线程缓存的墙上时间(秒)
+static thread_local time_t t_wall_sec CLOCK_TLS = 0;
+// 当前线程缓存的墙上时间在单调时钟的这个时间点失效
+static thread_local uint64_t t_wall_expire_us CLOCK_TLS = 0;
+
+static uint64_t ReadClock(clockid_t id) {
+  struct timespec ts;
+  clock_gettime(id, &ts);
+  return ts.tv_sec * 1000 * 1000ul + ts.tv_nsec / 1000;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * @brief CPU是否支持不变TSC(频率恒定，且各核同步)
+ */
+static bool HasInvariantTsc() {
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) {
+    return false;
+  }
+  return edx & (1u << 8);
+}
+
+/**
+ * @brief 发布新的换算参数
+ */
+static void PublishTsc(uint64_t base_tsc, uint64_t base_us, uint64_t mult,
+                       uint64_t resync_tsc) {
+  uint64_t seq = s_tsc.seq.load(std::memory_order_relaxed);
+  s_tsc.seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  s_tsc.base_tsc.store(base_tsc, std::memory_order_relaxed);
+  s_tsc.base_us.store(base_us, std::memory_order_relaxed);
+  s_tsc.mult.store(mult, std::memory_order_relaxed);
+  s_tsc.resync_tsc.store(resync_tsc, std::memory_order_relaxed);
+  s_tsc.seq.store(seq + 2, std::memory_order_release);
+}
+
+/**
+ * @brief 以CLOCK_MONOTONIC为基准忙等10毫秒校准TSC频率
+ */
+static void CalibrateTsc() {
+  if (!HasInvariantTsc()) {
+    return;
+  }
+  uint64_t t0 = ReadClock(CLOCK_MONOTONIC);
+  uint64_t c0 = __rdtsc();
+  uint64_t t1 = t0;
+  while (t1 - t0 < 10 * 1000) {
+    t1 = ReadClock(CLOCK_MONOTONIC);
+  }
+  uint64_t c1 = __rdtsc();
+  if (c1 <= c0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(s_tsc.mutex);
+  uint64_t hz = (c1 - c0) * 1000 * 1000 / (t1 - t0);
+  s_tsc.last_us = t1;
+  s_tsc.last_tsc = c1;
+  PublishTsc(c1, t1,
+             (uint64_t)((((unsigned __int128)(t1 - t0)) << 32) / (c1 - c0)),
+             c1 + hz);
+  s_tsc.hz.store(hz, std::memory_order_release);
+}
+
+/**
+ * @brief 按换算参数把TSC转换成微秒
+ */
+static uint64_t TscToUS(uint64_t tsc, uint64_t base_tsc, uint64_t base_us,
+                        uint64_t mult) {
+  if (UNLIKELY(tsc < base_tsc)) {
+    return base_us;
+  }
+  return base_us +
+         (uint64_t)(((unsigned __int128)(tsc - base_tsc) * mult) >> 32);
+}
+
+/**
+ * @brief 把TSC时钟重新对齐到CLOCK_MONOTONIC
+ * @details 10毫秒的校准误差和TSC与CLOCK_MONOTONIC(受NTP调整)之间的漂移会不断累积。
+ *          每隔kTscResyncUS用这段时间内实测的频率更新速率，并把与CLOCK_MONOTONIC的偏差
+ *          分摊到下一个间隔里：TSC时钟落后时走快一点，超前时走慢一点，读数保持连续、不回退。
+ *          偏差超过半个间隔时，落后则直接追上，超前则按最慢的速率追赶。
+ *          其他线程正在对齐时直接返回，继续使用旧参数
+ */
+static void ResyncTsc() {
+  std::unique_lock<std::mutex> lock(s_tsc.mutex, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    return;
+  }
+  uint64_t tsc = __rdtsc();
+  if (tsc < s_tsc.resync_tsc.load(std::memory_order_relaxed)) {
+    // 其他线程刚对齐过
+    return;
+  }
+  uint64_t now = ReadClock(CLOCK_MONOTONIC);
+  if (tsc <= s_tsc.last_tsc || now <= s_tsc.last_us) {
+    return;
+  }
+  // 当前的读数，新参数从这里接着走
+  uint64_t cur = TscToUS(tsc, s_tsc.base_tsc.load(std::memory_order_relaxed),
+                         s_tsc.base_us.load(std::memory_order_relaxed),
+                         s_tsc.mult.load(std::memory_order_relaxed));
+  // 上一个间隔实测的速率
+  unsigned __int128 mult = (((unsigned __int128)(now - s_tsc.last_us)) << 32) /
+                           (tsc - s_tsc.last_tsc);
+  uint64_t hz = (tsc - s_tsc.last_tsc) * 1000 * 1000 / (now - s_tsc.last_us);
+  s_tsc.last_us = now;
+  s_tsc.last_tsc = tsc;
+
+  int64_t offset = (int64_t)now - (int64_t)cur;
+  int64_t limit = kTscResyncUS / 2;
+  if (offset > limit) {
+    cur = now;
+    offset = 0;
+  } else if (offset < -limit) {
+    offset = -limit;
+  }
+  // 下一个间隔走kTscResyncUS + offset微秒
+  mult = mult * (uint64_t)((int64_t)kTscResyncUS + offset) / kTscResyncUS;
+  PublishTsc(tsc, cur, (uint64_t)mult, tsc + hz * kTscResyncUS / 1000000);
+  s_tsc.hz.store(hz, std::memory_order_release);
+}
+
+/**
+ * @brief 读取TSC时钟
+ */
+static uint64_t TscNowUS() {
+  bool resynced = false;
+  while (true) {
+    uint64_t tsc = __rdtsc();
+    uint64_t seq = s_tsc.seq.load(std::memory_order_acquire);
+    uint64_t base_tsc = s_tsc.base_tsc.load(std::memory_order_relaxed);
+    uint64_t base_us = s_tsc.base_us.load(std::memory_order_relaxed);
+    uint64_t mult = s_tsc.mult.load(std::memory_order_relaxed);
+    uint64_t resync_tsc = s_tsc.resync_tsc.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (UNLIKELY((seq & 1) ||
+                 seq != s_tsc.seq.load(std::memory_order_relaxed))) {
+      continue;
+    }
+    if (UNLIKELY(tsc >= resync_tsc) && !resynced) {
+      // 对齐失败或者其他线程正在对齐时，旧参数仍然可用
+      ResyncTsc();
+      resynced = true;
+      continue;
+    }
+    return TscToUS(tsc, base_tsc, base_us, mult);
+  }
+}
+#endif
+
+uint64_t Clock::NowUS() {
+  switch (s_source.load(std::memory_order_acquire)) {
+#if defined(__x86_64__) || defined(__i386__)
+    case TSC:
+      return TscNowUS();
+#endif
+    case COARSE:
+      return ReadClock(CLOCK_MONOTONIC_COARSE);
+    default:
+      return ReadClock(CLOCK_MONOTONIC);
+  }
+}
+
+uint64_t Clock::Update() {
+  t_cached_us = NowUS();
+  return t_cached_us;
+}
+
+void Clock::Invalidate() { t_cached_us = 0; }
+
+uint64_t Clock::CachedUS() {
+  return LIKELY(t_cached_us) ? t_cached_us : NowUS();
+}
+
+time_t Clock::WallSeconds() {
+  // 没有缓存的时间戳时直接取墙上时间，time(0)由vDSO提供，比读单调时钟再比较更快
+  uint64_t now_us = t_cached_us;
+  if (!now_us) {
+    return time(0);
+  }
+  if (now_us >= t_wall_expire_us) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    t_wall_sec = ts.tv_sec;
+    t_wall_expire_us = now_us + (1000 * 1000 - ts.tv_nsec / 1000);
+  }
+  return t_wall_sec;
+}
+
+bool Clock::SetSource(Source source) {
+  if (source == TSC) {
+#if defined(__x86_64__) || defined(__i386__)
+    std::call_once(s_tsc_once, &CalibrateTsc);
+#endif
+    if (!s_tsc.hz.load(std::memory_order_acquire)) {
+      return false;
+    }
+  }
+  s_source.store(source, std::memory_order_release);
+  return true;
+}
+
+Clock::Source Clock::GetSource() { return (Source)s_source.load(); }
+
+std::string Clock::ToString(Source source) {
+  switch (source) {
+    case MONOTONIC:
+      return "monotonic";
+    case COARSE:
+      return "coarse";
+    case TSC:
+      return "tsc";
+    default:
+      return "unknown";
+  }
+}
+
+uint64_t Clock::GetTscHz() {
+  return s_tsc.hz.load(std::memory_order_acquire);
+}
+
+struct ClockIniter {
+  ClockIniter() {
+    g_clock_source->AddListener(
+        [](const std::string &old_value, const std::string &new_value) {
+          Clock::Source source = Clock::MONOTONIC;
+          if (new_value == "coarse") {
+            source = Clock::COARSE;
+          } else if (new_value == "tsc") {
+            source = Clock::TSC;
+          } else if (new_value != "monotonic") {
+            LOG_ERROR(g_logger) << "unknown clock.source " << new_value
+                                << ", use monotonic";
+          }
+          if (!Clock::SetSource(source)) {
+            LOG_WARN(g_logger) << "clock source " << new_value
+                               << " not supported, use monotonic";
+            Clock::SetSource(Clock::MONOTONIC);
+          }
+          LOG_INFO(g_logger) << "clock source: "
+                             << Clock::ToString(Clock::GetSource());
+        });
+  }
+};
+
+// 在main函数之前注册配置更改的回调函数
+static ClockIniter __clock_init;
+
+}  // namespace serverframework
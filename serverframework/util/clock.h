@@ -0,0 +1,103 @@
+/**
+ * @file clock.h
+ * @brief 时钟封装
+ * @details 提供热路径使用的单调时钟和按线程缓存的时间戳。
+ *          时钟源由配置项clock.source选择：monotonic使用vDSO提供的CLOCK_MONOTONIC；
+ *          coarse使用CLOCK_MONOTONIC_COARSE，开销最小但精度只有一个jiffy(1~4毫秒)，只适合毫秒级超时；
+ *          tsc直接读取时间戳计数器，按CLOCK_MONOTONIC校准，之后每秒重新对齐一次，只调整速率、读数不跳变，
+ *          与CLOCK_MONOTONIC的偏差不会累积；CPU不支持不变TSC时退化为monotonic。
+ *          所有时钟源的起点一致，切换时钟源不影响已有定时器
+ */
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include <string>
+
+namespace serverframework {
+
+/**
+ * @brief 时钟
+ */
+class Clock {
+ public:
+  /**
+   * @brief 时钟源
+   */
+  enum Source {
+    // CLOCK_MONOTONIC
+    MONOTONIC = 0,
+    // CLOCK_MONOTONIC_COARSE
+    COARSE = 1,
+    // 校准后的TSC
+    TSC = 2,
+  };
+
+  /**
+   * @brief 当前单调时间(微秒)，从当前时钟源读取
+   */
+  static uint64_t NowUS();
+
+  /**
+   * @brief 当前单调时间(毫秒)
+   */
+  static uint64_t NowMS() { return NowUS() / 1000; }
+
+  /**
+   * @brief 刷新当前线程缓存的时间戳
+   * @details IO调度线程每轮idle循环都会刷新
+   * @return 刷新后的时间戳(微秒)
+   */
+  static uint64_t Update();
+
+  /**
+   * @brief 清除当前线程缓存的时间戳，之后CachedUS()直接读取时钟
+   * @details IO调度线程退出idle循环时清除，避免线程离开调度器后继续使用过期的时间戳
+   */
+  static void Invalidate();
+
+  /**
+   * @brief 当前线程缓存的时间戳(微秒)
+   * @details 不读时钟，比NowUS()慢最多一轮任务的执行时间；当前线程没有缓存时读取时钟
+   */
+  static uint64_t CachedUS();
+
+  /**
+   * @brief 当前线程缓存的时间戳(毫秒)
+   */
+  static uint64_t CachedMS() { return CachedUS() / 1000; }
+
+  /**
+   * @brief 当前的墙上时间(秒)，与time(0)相同
+   * @details 当前线程有缓存的时间戳时，用它判断是否跨过秒边界，只在跨过时重新读取墙上时间，
+   *          和缓存的时间戳一样最多慢一轮任务的执行时间
+   */
+  static time_t WallSeconds();
+
+  /**
+   * @brief 切换时钟源
+   * @return 当前机器不支持该时钟源时返回false，时钟源不变
+   */
+  static bool SetSource(Source source);
+
+  /**
+   * @brief 当前时钟源
+   */
+  static Source GetSource();
+
+  /**
+   * @brief 时钟源名称
+   */
+  static std::string ToString(Source source);
+
+  /**
+   * @brief 最近一次校准得到的TSC频率(Hz)，未使用过TSC时返回0
+   */
+  static uint64_t GetTscHz();
+};
+
+}  // namespace serverframework
+
+#endif
@@ -4,12 +4,18 @@
  */
 #include "util/daemon.h"
 
+#include <poll.h>
+#include <signal.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <set>
+#include <vector>
+
 #include "config/config.h"
 #include "log/log.h"
 
@@ -20,6 +26,20 @@ static serverframework::ConfigVar<uint32_t>::ptr g_daemon_restart_interval =
     serverframework::Config::Lookup("daemon.restart_interval", (uint32_t)5,
                                     "daemon restart interval");
 
+static serverframework::ConfigVar<uint32_t>::ptr g_daemon_max_restart_interval =
+    serverframework::Config::Lookup(
+        "daemon.max_restart_interval", (uint32_t)60,
+        "max restart interval of a crashing worker in seconds");
+
+static serverframework::ConfigVar<uint32_t>::ptr g_daemon_workers =
+    serverframework::Config::Lookup("daemon.workers", (uint32_t)1,
+                                    "worker process count");
+
+static serverframework::ConfigVar<uint32_t>::ptr g_daemon_ready_timeout =
+    serverframework::Config::Lookup(
+        "daemon.ready_timeout", (uint32_t)10000,
+        "max time to wait for a new worker during rolling reload in ms");
+
 std::string ProcessInfo::ToString() const {
   std::stringstream ss;
   ss << "[ProcessInfo parent_id_=" << parent_id_ << " main_id_=" << main_id_
@@ -34,48 +54,378 @@ static int RealStart(int argc, char** argv,
   return main_cb(argc, argv);
 }
 
+// 主进程收到的信号，由主循环处理
+static volatile sig_atomic_t s_hot_restart = 0;
+static volatile sig_atomic_t s_reload = 0;
+static volatile sig_atomic_t s_terminate = 0;
+
+static void OnMasterSignal(int sig) {
+  if (sig == SIGUSR2) {
+    s_hot_restart = 1;
+  } else if (sig == SIGHUP) {
+    s_reload = 1;
+  } else {
+    s_terminate = 1;
+  }
+}
+
+// 工作进程通知主进程已就绪的管道写端
+static int s_ready_fd = -1;
+
+void NotifyReady() {
+  if (s_ready_fd < 0) {
+    return;
+  }
+  char c = 1;
+  if (write(s_ready_fd, &c, 1) != 1) {
+    LOG_ERROR(g_logger) << "NotifyReady write fail errno=" << errno
+                        << " errstr=" << strerror(errno);
+  }
+  close(s_ready_fd);
+  s_ready_fd = -1;
+}
+
+namespace {
+
+/**
+ * @brief 主进程中的一个工作进程槽位
+ */
+struct Worker {
+  // 当前的工作进程，0表示没有
+  pid_t pid = 0;
+  // 启动时间(毫秒)
+  uint64_t start_ms = 0;
+  // 就绪管道的读端，收到通知或进程退出后关闭
+  int ready_fd = -1;
+  // 是否已通知就绪
+  bool ready = false;
+  // 下一次崩溃后的重启间隔(秒)，0表示从daemon.restart_interval开始
+  uint32_t backoff = 0;
+  // 等待重启的时间点(毫秒)，0表示不需要重启
+  uint64_t restart_at = 0;
+  // 滚动重载中被替换、新进程就绪后要停止的旧进程
+  pid_t replaced = 0;
+  // 是否已经正常退出
+  bool finished = false;
+};
+
+}  // namespace
+
+static uint64_t NowMS() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
+static void CloseReadyFd(Worker& w) {
+  if (w.ready_fd >= 0) {
+    close(w.ready_fd);
+    w.ready_fd = -1;
+  }
+}
+
+/**
+ * @brief 为第id个槽位fork一个工作进程
+ * @return 主进程中返回子进程pid，失败返回-1；工作进程中返回0
+ */
+static pid_t SpawnWorker(std::vector<Worker>& workers, uint32_t id) {
+  int fds[2];
+  if (pipe(fds)) {
+    LOG_ERROR(g_logger) << "pipe fail errno=" << errno
+                        << " errstr=" << strerror(errno);
+    return -1;
+  }
+  pid_t pid = fork();
+  if (pid == 0) {
+    //子进程返回
+    close(fds[0]);
+    for (auto& w : workers) {
+      CloseReadyFd(w);
+    }
+    s_ready_fd = fds[1];
+    signal(SIGUSR2, SIG_DFL);
+    signal(SIGHUP, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    ProcessInfo* info = ProcessInfoMgr::GetInstance();
+    info->main_id_ = getpid();
+    info->main_start_time = time(0);
+    info->worker_id_ = id;
+    info->worker_count_ = workers.size();
+    LOG_INFO(g_logger) << "process Start pid=" << getpid()
+                       << " worker=" << id;
+    return 0;
+  }
+  close(fds[1]);
+  if (pid < 0) {
+    close(fds[0]);
+    LOG_ERROR(g_logger) << "fork fail return=" << pid << " errno=" << errno
+                        << " errstr=" << strerror(errno);
+    return -1;
+  }
+  Worker& w = workers[id];
+  CloseReadyFd(w);
+  w.pid = pid;
+  w.start_ms = NowMS();
+  w.ready_fd = fds[0];
+  w.ready = false;
+  w.restart_at = 0;
+  return pid;
+}
+
+/**
+ * @brief 滚动重载中第id个槽位的新进程已就绪，停止被替换的旧进程
+ */
+static void RetireReplaced(Worker& w, uint32_t id) {
+  if (w.replaced > 0) {
+    LOG_INFO(g_logger) << "reload worker=" << id << " stop old pid="
+                       << w.replaced << " new pid=" << w.pid;
+    kill(w.replaced, SIGTERM);
+    w.replaced = 0;
+  }
+}
+
 static int RealDaemon(int argc, char** argv,
-                      std::function<int(int argc, char** argv)> main_cb) {
-  daemon(1, 0);
+                      std::function<int(int argc, char** argv)> main_cb,
+                      uint32_t count, bool is_daemon) {
+  if (is_daemon) {
+    daemon(1, 0);
+  }
   ProcessInfoMgr::GetInstance()->parent_id_ = getpid();
   ProcessInfoMgr::GetInstance()->parent_start_time_ = time(0);
-  while (true) {
-    pid_t pid = fork();
+
+  // 不设SA_RESTART，让主循环的poll被信号打断后立即处理
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = OnMasterSignal;
+  sigemptyset(&sa.sa_mask);
+  for (int sig : {SIGUSR2, SIGHUP, SIGTERM, SIGINT}) {
+    sigaction(sig, &sa, nullptr);
+  }
+
+  std::vector<Worker> workers(std::max(count, 1u));
+  for (uint32_t i = 0; i < workers.size(); ++i) {
+    pid_t pid = SpawnWorker(workers, i);
     if (pid == 0) {
-      //子进程返回
-      ProcessInfoMgr::GetInstance()->main_id_ = getpid();
-      ProcessInfoMgr::GetInstance()->main_start_time = time(0);
-      LOG_INFO(g_logger) << "process Start pid=" << getpid();
       return RealStart(argc, argv, main_cb);
     } else if (pid < 0) {
-      LOG_ERROR(g_logger) << "fork fail return=" << pid << " errno=" << errno
-                          << " errstr=" << strerror(errno);
       return -1;
-    } else {
-      //父进程返回
-      int status = 0;
-      waitpid(pid, &status, 0);
-      if (status) {
-        LOG_ERROR(g_logger)
-            << "child crash pid=" << pid << " status=" << status;
-      } else {
-        LOG_INFO(g_logger) << "child finished pid=" << pid;
+    }
+  }
+
+  // 滚动重载当前处理到的槽位，-1表示不在重载中
+  int reloading = -1;
+  uint64_t ready_deadline = 0;
+  // 热重启、滚动重载后还没有退出的旧进程
+  std::set<pid_t> retiring;
+  bool terminating = false;
+  while (true) {
+    uint64_t now = NowMS();
+    if (s_terminate && !terminating) {
+      terminating = true;
+      LOG_INFO(g_logger) << "master terminating, stop all workers";
+      for (auto& w : workers) {
+        if (w.pid > 0) {
+          kill(w.pid, SIGTERM);
+        }
+        w.restart_at = 0;
+      }
+      for (pid_t pid : retiring) {
+        kill(pid, SIGTERM);
+      }
+    }
+    if (s_hot_restart && !terminating) {
+      s_hot_restart = 0;
+      // 旧进程自己退出，新进程通过hot_restart.path从旧进程接过监听socket
+      for (uint32_t i = 0; i < workers.size(); ++i) {
+        Worker& w = workers[i];
+        if (w.finished || w.pid <= 0) {
+          continue;
+        }
+        LOG_INFO(g_logger) << "hot restart worker=" << i
+                           << " old pid=" << w.pid;
+        pid_t old_pid = w.pid;
+        retiring.insert(old_pid);
+        pid_t pid = SpawnWorker(workers, i);
+        if (pid == 0) {
+          return RealStart(argc, argv, main_cb);
+        } else if (pid < 0) {
+          // 没有新进程接手，旧进程继续作为这个槽位的工作进程
+          LOG_ERROR(g_logger) << "hot restart worker=" << i
+                              << " spawn fail, keep old pid=" << old_pid;
+          retiring.erase(old_pid);
+        }
+      }
+    }
+    if (s_reload && reloading < 0 && !terminating) {
+      s_reload = 0;
+      reloading = 0;
+      ready_deadline = 0;
+      LOG_INFO(g_logger) << "rolling reload " << workers.size() << " workers";
+    }
+
+    // 滚动重载：一次只替换一个工作进程，新进程就绪后才停止旧进程
+    while (reloading >= 0 && !terminating) {
+      if ((size_t)reloading >= workers.size()) {
+        reloading = -1;
+        LOG_INFO(g_logger) << "rolling reload finished";
         break;
       }
+      Worker& w = workers[reloading];
+      if (!ready_deadline) {
+        if (w.finished || w.pid <= 0) {
+          ++reloading;
+          continue;
+        }
+        w.replaced = w.pid;
+        retiring.insert(w.pid);
+        pid_t pid = SpawnWorker(workers, reloading);
+        if (pid == 0) {
+          return RealStart(argc, argv, main_cb);
+        } else if (pid < 0) {
+          // w.pid仍然是旧进程，不能当作被替换的进程停止
+          LOG_ERROR(g_logger) << "reload worker=" << reloading
+                              << " spawn fail, keep old pid=" << w.replaced;
+          retiring.erase(w.replaced);
+          w.replaced = 0;
+          ++reloading;
+          continue;
+        }
+        ready_deadline = now + g_daemon_ready_timeout->GetValue();
+      }
+      if (w.pid <= 0) {
+        // 新进程没有就绪就退出了，旧进程还在时继续使用旧进程，否则按崩溃重启
+        if (w.replaced > 0) {
+          LOG_ERROR(g_logger) << "reload worker=" << reloading
+                              << " new process exited, keep old pid="
+                              << w.replaced;
+          retiring.erase(w.replaced);
+          w.pid = w.replaced;
+          w.replaced = 0;
+          w.restart_at = 0;
+          w.finished = false;
+        }
+      } else if (!w.ready && now < ready_deadline) {
+        break;
+      } else {
+        if (!w.ready) {
+          LOG_WARN(g_logger) << "reload worker=" << reloading
+                             << " not ready in time pid=" << w.pid;
+        }
+        RetireReplaced(w, reloading);
+      }
+      ++reloading;
+      ready_deadline = 0;
+    }
+
+    // 回收退出的子进程
+    int status = 0;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+      auto it = std::find_if(workers.begin(), workers.end(),
+                             [pid](const Worker& w) { return w.pid == pid; });
+      if (it == workers.end()) {
+        for (auto& w : workers) {
+          if (w.replaced == pid) {
+            w.replaced = 0;
+          }
+        }
+        retiring.erase(pid);
+        LOG_INFO(g_logger) << "old worker exited pid=" << pid
+                           << " status=" << status;
+        continue;
+      }
+      Worker& w = *it;
+      uint32_t id = it - workers.begin();
+      CloseReadyFd(w);
+      w.pid = 0;
+      if (!status || terminating) {
+        LOG_INFO(g_logger) << "worker=" << id << " finished pid=" << pid
+                           << " status=" << status;
+        w.finished = true;
+        continue;
+      }
+      // 运行够久的进程再崩溃说明不是启动即崩溃，退避从头开始
+      uint32_t max_interval = g_daemon_max_restart_interval->GetValue();
+      uint32_t base = std::max(g_daemon_restart_interval->GetValue(), 1u);
+      if (!w.backoff || NowMS() - w.start_ms >= max_interval * 1000ull) {
+        w.backoff = base;
+      }
+      LOG_ERROR(g_logger) << "worker=" << id << " crash pid=" << pid
+                          << " status=" << status << " restart in "
+                          << w.backoff << "s";
+      w.restart_at = NowMS() + w.backoff * 1000ull;
+      w.backoff = std::max(std::min(w.backoff * 2, max_interval), base);
       ProcessInfoMgr::GetInstance()->restart_count_ += 1;
-      sleep(g_daemon_restart_interval->GetValue());
+    }
+    if (pid < 0 && errno != ECHILD && errno != EINTR) {
+      LOG_ERROR(g_logger) << "waitpid fail errno=" << errno
+                          << " errstr=" << strerror(errno);
+      return -1;
+    }
+
+    now = NowMS();
+    bool alive = !retiring.empty();
+    std::vector<pollfd> pfds;
+    for (uint32_t i = 0; i < workers.size(); ++i) {
+      Worker& w = workers[i];
+      if (w.restart_at && now >= w.restart_at && !terminating) {
+        pid_t pid = SpawnWorker(workers, i);
+        if (pid == 0) {
+          return RealStart(argc, argv, main_cb);
+        } else if (pid < 0) {
+          w.restart_at = now + std::max(w.backoff, 1u) * 1000ull;
+        }
+      }
+      if (w.pid > 0 || w.restart_at) {
+        alive = true;
+      }
+      if (w.ready_fd >= 0) {
+        pfds.push_back(pollfd{w.ready_fd, POLLIN, 0});
+      }
+    }
+    if (!alive) {
+      break;
+    }
+
+    // 等待就绪通知，同时定期回收子进程、检查重启时间
+    if (poll(pfds.empty() ? nullptr : &pfds[0], pfds.size(), 100) > 0) {
+      for (auto& pfd : pfds) {
+        if (!pfd.revents) {
+          continue;
+        }
+        for (uint32_t i = 0; i < workers.size(); ++i) {
+          Worker& w = workers[i];
+          if (w.ready_fd != pfd.fd) {
+            continue;
+          }
+          // 读到0说明进程没有通知就绪就退出了，由回收子进程处理
+          char c;
+          if (read(w.ready_fd, &c, 1) == 1) {
+            LOG_INFO(g_logger) << "worker=" << i << " ready pid=" << w.pid;
+            w.ready = true;
+          }
+          CloseReadyFd(w);
+        }
+      }
     }
   }
   return 0;
 }
 
+int StartWorkers(int argc, char** argv,
+                 std::function<int(int argc, char** argv)> main_cb,
+                 uint32_t workers, bool is_daemon) {
+  return RealDaemon(argc, argv, main_cb, workers, is_daemon);
+}
+
 int StartDaemon(int argc, char** argv,
                 std::function<int(int argc, char** argv)> main_cb,
                 bool is_daemon) {
   if (!is_daemon) {
     return RealStart(argc, argv, main_cb);
   }
-  return RealDaemon(argc, argv, main_cb);
+  return RealDaemon(argc, argv, main_cb, g_daemon_workers->GetValue(), true);
 }
 
 }  // namespace serverframework
@@ -25,6 +25,10 @@ struct ProcessInfo {
   uint64_t main_start_time = 0;
   // 主进程重启的次数
   uint32_t restart_count_ = 0;
+  // 工作进程的序号，从0开始，重启和滚动重载后不变
+  uint32_t worker_id_ = 0;
+  // 工作进程数，大于1时TcpServer给监听socket设置SO_REUSEPORT
+  uint32_t worker_count_ = 1;
 
   std::string ToString() const;
 };
@@ -33,6 +37,7 @@ using ProcessInfoMgr = serverframework::Singleton<ProcessInfo>;
 
 /**
  * @brief 启动程序可以选择用守护进程的方式
+ * @details 守护进程方式等同于StartWorkers(argc, argv, main_cb, daemon.workers, true)
  * @param[in] argc 参数个数
  * @param[in] argv 参数值数组
  * @param[in] main_cb 启动函数
@@ -43,6 +48,32 @@ int StartDaemon(int argc, char** argv,
                 std::function<int(int argc, char** argv)> main_cb,
                 bool is_daemon);
 
+/**
+ * @brief 以主进程/工作进程模式启动程序
+ * @details 主进程fork出workers个工作进程，每个工作进程执行main_cb，各自bind同一个地址的
+ *          SO_REUSEPORT监听socket、运行自己的IOManager，由内核在进程间分发连接。
+ *          主进程只负责管理工作进程：
+ *          - 工作进程异常退出时只重启这一个，重启间隔从daemon.restart_interval开始按指数退避，
+ *            最长daemon.max_restart_interval，运行超过最长间隔后退避重置
+ *          - 收到SIGHUP时滚动重载：逐个启动新的工作进程，新进程调用NotifyReady
+ *            (或者超过daemon.ready_timeout)之后向对应的旧进程发送SIGTERM，再处理下一个
+ *          - 收到SIGUSR2时热重启：为每个工作进程启动新进程，旧进程由程序自己决定何时退出
+ *          - 收到SIGTERM/SIGINT时向所有工作进程发送SIGTERM，等它们退出后返回
+ *          工作进程正常退出时不再重启，所有工作进程都正常退出后主进程返回
+ * @param[in] workers 工作进程数
+ * @param[in] is_daemon 主进程是否先转为守护进程
+ * @return 主进程返回0，工作进程返回main_cb的结果
+ */
+int StartWorkers(int argc, char** argv,
+                 std::function<int(int argc, char** argv)> main_cb,
+                 uint32_t workers, bool is_daemon);
+
+/**
+ * @brief 工作进程开始服务后调用，通知主进程滚动重载可以继续
+ * @details 不是由StartWorkers启动的进程调用时什么也不做
+ */
+void NotifyReady();
+
 }  // namespace serverframework
 
 #endif
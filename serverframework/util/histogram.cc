@@ -0,0 +1,128 @@
+#include "util/histogram.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <sstream>
+
+#include "util/macro.h"
+
+namespace serverframework {
+
+Histogram::Histogram(uint64_t highest, int significant_digits)
+    : highest_(std::max(highest, (uint64_t)2)),
+      significant_digits_(std::min(std::max(significant_digits, 1), 5)) {
+  // 子桶数取能区分2*10^d个值的最小的2的幂，每个桶的后一半子桶和前一个桶不重叠
+  uint64_t largest = 2;
+  for (int i = 0; i < significant_digits_; ++i) {
+    largest *= 10;
+  }
+  int magnitude = 64 - __builtin_clzll(largest - 1);
+  sub_bucket_half_magnitude_ = magnitude - 1;
+  sub_bucket_half_count_ = 1ull << sub_bucket_half_magnitude_;
+  sub_bucket_mask_ = (1ull << magnitude) - 1;
+
+  size_t buckets = 1;
+  uint64_t smallest_untrackable = 1ull << magnitude;
+  while (smallest_untrackable <= highest_) {
+    if (smallest_untrackable > (UINT64_MAX >> 1)) {
+      ++buckets;
+      break;
+    }
+    smallest_untrackable <<= 1;
+    ++buckets;
+  }
+  counts_.resize((buckets + 1) * sub_bucket_half_count_);
+}
+
+size_t Histogram::IndexOf(uint64_t value) const {
+  int pow2ceiling = 64 - __builtin_clzll(value | sub_bucket_mask_);
+  int bucket = pow2ceiling - (sub_bucket_half_magnitude_ + 1);
+  uint64_t sub_bucket = value >> bucket;
+  return ((size_t)(bucket + 1) << sub_bucket_half_magnitude_) +
+         (sub_bucket - sub_bucket_half_count_);
+}
+
+uint64_t Histogram::ValueAt(size_t index) const {
+  int bucket = (int)(index >> sub_bucket_half_magnitude_) - 1;
+  uint64_t sub_bucket =
+      (index & (sub_bucket_half_count_ - 1)) + sub_bucket_half_count_;
+  if (bucket < 0) {
+    sub_bucket -= sub_bucket_half_count_;
+    bucket = 0;
+  }
+  return sub_bucket << bucket;
+}
+
+uint64_t Histogram::HighestEquivalent(uint64_t value) const {
+  int pow2ceiling = 64 - __builtin_clzll(value | sub_bucket_mask_);
+  int bucket = pow2ceiling - (sub_bucket_half_magnitude_ + 1);
+  uint64_t lowest = (value >> bucket) << bucket;
+  return lowest + (1ull << bucket) - 1;
+}
+
+void Histogram::Record(uint64_t value, uint64_t count) {
+  if (value > highest_) {
+    value = highest_;
+  }
+  counts_[IndexOf(value)] += count;
+  total_ += count;
+  min_ = std::min(min_, value);
+  max_ = std::max(max_, value);
+  sum_ += (double)value * count;
+}
+
+void Histogram::Merge(const Histogram &other) {
+  ASSERT(counts_.size() == other.counts_.size() &&
+         significant_digits_ == other.significant_digits_);
+  for (size_t i = 0; i < counts_.size(); ++i) {
+    counts_[i] += other.counts_[i];
+  }
+  total_ += other.total_;
+  min_ = std::min(min_, other.min_);
+  max_ = std::max(max_, other.max_);
+  sum_ += other.sum_;
+}
+
+void Histogram::Reset() {
+  std::fill(counts_.begin(), counts_.end(), 0);
+  total_ = 0;
+  min_ = UINT64_MAX;
+  max_ = 0;
+  sum_ = 0;
+}
+
+uint64_t Histogram::GetPercentile(double p) const {
+  if (!total_) {
+    return 0;
+  }
+  if (p <= 0) {
+    return min_;
+  }
+  p = std::min(p, 100.0);
+  uint64_t target = std::max((uint64_t)1, (uint64_t)ceil(p / 100 * total_));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < counts_.size(); ++i) {
+    seen += counts_[i];
+    if (seen >= target) {
+      return std::min(HighestEquivalent(ValueAt(i)), max_);
+    }
+  }
+  return max_;
+}
+
+double Histogram::GetMean() const { return total_ ? sum_ / total_ : 0; }
+
+std::string Histogram::ToString(const std::string &unit) const {
+  static const double kPercentiles[] = {50, 75, 90, 99, 99.9, 99.99};
+  std::stringstream ss;
+  ss << "count=" << total_ << " min=" << GetMin() << unit
+     << " mean=" << (uint64_t)GetMean() << unit;
+  for (double p : kPercentiles) {
+    ss << " p" << p << "=" << GetPercentile(p) << unit;
+  }
+  ss << " max=" << max_ << unit;
+  return ss.str();
+}
+
+}  // namespace serverframework
@@ -0,0 +1,98 @@
+/**
+ * @file histogram.h
+ * @brief HDR直方图
+ * @details 按HdrHistogram的分桶方式记录整数值：每个2的幂区间分成相同数量的子桶，
+ *          保证任意值的相对误差不超过设定的有效数字位数，内存只和数值范围的对数成正比。
+ *          Record是O(1)的几次位运算，适合在压测的热路径上记录每个请求的延迟。不是线程安全的，
+ *          多个线程各自记录后用Merge合并
+ */
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+namespace serverframework {
+
+class Histogram {
+ public:
+  /**
+   * @brief 构造函数
+   * @param[in] highest 能够精确记录的最大值，更大的值按highest记录
+   * @param[in] significant_digits 有效数字位数，1~5
+   */
+  Histogram(uint64_t highest = 3600ull * 1000 * 1000,
+            int significant_digits = 3);
+
+  /**
+   * @brief 记录count次value
+   */
+  void Record(uint64_t value, uint64_t count = 1);
+
+  /**
+   * @brief 合并另一个直方图，两者的参数必须相同
+   */
+  void Merge(const Histogram &other);
+
+  /**
+   * @brief 清空所有记录
+   */
+  void Reset();
+
+  /**
+   * @brief 第p百分位的值
+   * @param[in] p 0~100
+   * @return 所在子桶能表示的最大值，不超过记录过的最大值；没有记录时返回0
+   */
+  uint64_t GetPercentile(double p) const;
+
+  uint64_t GetCount() const { return total_; }
+
+  uint64_t GetMin() const { return total_ ? min_ : 0; }
+
+  uint64_t GetMax() const { return max_; }
+
+  double GetMean() const;
+
+  /**
+   * @brief 按常用百分位输出一行
+   * @param[in] unit 值的单位，附在每个值后面
+   */
+  std::string ToString(const std::string &unit = "") const;
+
+ private:
+  /**
+   * @brief 值所在的计数下标
+   */
+  size_t IndexOf(uint64_t value) const;
+
+  /**
+   * @brief 计数下标对应的最小值
+   */
+  uint64_t ValueAt(size_t index) const;
+
+  /**
+   * @brief 和value落在同一子桶的最大值
+   */
+  uint64_t HighestEquivalent(uint64_t value) const;
+
+ private:
+  uint64_t highest_;
+  int significant_digits_;
+  // 每个桶子桶数一半的log2
+  int sub_bucket_half_magnitude_;
+  uint64_t sub_bucket_half_count_;
+  uint64_t sub_bucket_mask_;
+  std::vector<uint64_t> counts_;
+  uint64_t total_ = 0;
+  uint64_t min_ = UINT64_MAX;
+  uint64_t max_ = 0;
+  // 所有值的和，用于计算均值
+  double sum_ = 0;
+};
+
+}  // namespace serverframework
+
+#endif
@@ -1,100 +1,357 @@
 #include "util/timer.h"
 
+#include <algorithm>
+
+#include "config/config.h"
+#include "util/clock.h"
 #include "util/macro.h"
+#include "util/timer_wheel.h"
 #include "util/util.h"
 
 namespace serverframework {
 
-bool Timer::Comparator::operator()(const Timer::ptr& lhs,
-                                   const Timer::ptr& rhs) const {
-  if (!lhs && !rhs) {
-    return false;
+static serverframework::ConfigVar<bool>::ptr g_timer_wheel =
+    serverframework::Config::Lookup("timer.wheel", false,
+                                    "use hierarchical timing wheel for timers");
+
+// TimerManager的id生成器
+static std::atomic<uint64_t> s_timer_manager_id = {0};
+// 当前线程绑定的TimerManager的id
+static thread_local uint64_t t_timer_manager_id = 0;
+// 当前线程绑定的分片
+static thread_local TimerShard *t_timer_shard = nullptr;
+
+/**
+ * @brief 投递到分片收件箱的定时器操作
+ */
+struct TimerOp {
+  // 操作类型
+  TimerManager::OpType type = TimerManager::OP_ADD;
+  // 操作的定时器
+  Timer::ptr timer;
+  // OP_RESET的执行间隔(微秒)
+  uint64_t us = 0;
+  // OP_RESET是否从当前时间开始计算
+  bool from_now = false;
+  // 收件箱中的下一条消息
+  TimerOp *next = nullptr;
+};
+
+/**
+ * @brief 定时器分片
+ * @details 除收件箱和next_wakeup外，所有成员只由所属线程访问
+ */
+struct TimerShard {
+  TimerShard(uint64_t now, bool use_wheel) : previous_use_time(now) {
+    if (use_wheel) {
+      wheel.reset(new TimerWheel(now));
+    }
   }
-  if (!lhs) {
-    return true;
+
+  ~TimerShard() {
+    TimerOp *op = inbox.exchange(nullptr);
+    while (op) {
+      TimerOp *next = op->next;
+      delete op;
+      op = next;
+    }
   }
-  if (!rhs) {
-    return false;
+
+  static bool Less(const Timer::ptr &lhs, const Timer::ptr &rhs) {
+    return lhs->next_ < rhs->next_;
   }
-  if (lhs->next_ < rhs->next_) {
-    return true;
+
+  void SiftUp(size_t idx) {
+    while (idx > 0) {
+      size_t parent = (idx - 1) / 2;
+      if (!Less(heap[idx], heap[parent])) {
+        break;
+      }
+      std::swap(heap[idx], heap[parent]);
+      heap[idx]->heap_index_ = (int)idx;
+      heap[parent]->heap_index_ = (int)parent;
+      idx = parent;
+    }
   }
-  if (rhs->next_ < lhs->next_) {
-    return false;
+
+  void SiftDown(size_t idx) {
+    size_t size = heap.size();
+    while (true) {
+      size_t min = idx;
+      size_t left = idx * 2 + 1;
+      size_t right = left + 1;
+      if (left < size && Less(heap[left], heap[min])) {
+        min = left;
+      }
+      if (right < size && Less(heap[right], heap[min])) {
+        min = right;
+      }
+      if (min == idx) {
+        break;
+      }
+      std::swap(heap[idx], heap[min]);
+      heap[idx]->heap_index_ = (int)idx;
+      heap[min]->heap_index_ = (int)min;
+      idx = min;
+    }
   }
-  return lhs.get() < rhs.get();
-}
 
-Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring,
-             TimerManager* manager)
-    : recurring_(recurring), ms_(ms), cb_(cb), manager_(manager) {
-  next_ = serverframework::GetElapsedMS() + ms_;
-}
+  /**
+   * @brief 把定时器加入堆或时间轮
+   */
+  void Insert(Timer::ptr timer) {
+    if (wheel) {
+      wheel->Add(std::move(timer));
+      return;
+    }
+    timer->heap_index_ = (int)heap.size();
+    heap.push_back(std::move(timer));
+    SiftUp(heap.size() - 1);
+  }
 
-Timer::Timer(uint64_t next) : next_(next) {}
+  /**
+   * @brief 把定时器从堆或时间轮中删除
+   * @return 定时器不在分片中时返回nullptr
+   */
+  Timer::ptr Erase(Timer *timer) {
+    if (wheel) {
+      return wheel->Remove(timer);
+    }
+    if (timer->heap_index_ < 0) {
+      return nullptr;
+    }
+    size_t idx = (size_t)timer->heap_index_;
+    Timer::ptr self = std::move(heap[idx]);
+    self->heap_index_ = -1;
+    size_t last = heap.size() - 1;
+    if (idx != last) {
+      heap[idx] = std::move(heap[last]);
+      heap[idx]->heap_index_ = (int)idx;
+      heap.pop_back();
+      if (idx > 0 && Less(heap[idx], heap[(idx - 1) / 2])) {
+        SiftUp(idx);
+      } else {
+        SiftDown(idx);
+      }
+    } else {
+      heap.pop_back();
+    }
+    return self;
+  }
 
-bool Timer::Cancel() {
-  TimerManager::RWMutexType::WriteLock lock(manager_->mutex_);
-  if (cb_) {
-    cb_ = nullptr;
-    auto it = manager_->timers_.find(shared_from_this());
-    manager_->timers_.erase(it);
-    return true;
+  /**
+   * @brief 修改定时器的执行时间
+   * @details 定时器还在收件箱中(其他线程添加、尚未处理)时只修改时间，加入分片时自然按新时间排序
+   */
+  void Reschedule(Timer *timer, uint64_t next) {
+    Timer::ptr self = Erase(timer);
+    timer->next_ = next;
+    if (self) {
+      Insert(std::move(self));
+    }
+  }
+
+  /**
+   * @brief 在所属线程上执行取消、刷新、重置操作
+   */
+  void Apply(TimerManager::OpType type, Timer *timer, uint64_t us,
+             bool from_now) {
+    switch (type) {
+      case TimerManager::OP_CANCEL:
+        Erase(timer);
+        timer->cb_ = nullptr;
+        break;
+      case TimerManager::OP_REFRESH:
+        if (timer->armed_) {
+          Reschedule(timer, Clock::NowUS() + timer->us_);
+        }
+        break;
+      case TimerManager::OP_RESET: {
+        if (!timer->armed_ || (us == timer->us_ && !from_now)) {
+          break;
+        }
+        uint64_t start = from_now ? Clock::NowUS() : timer->next_ - timer->us_;
+        timer->us_ = us;
+        Reschedule(timer, start + us);
+        break;
+      }
+      default:
+        break;
+    }
   }
-  return false;
+
+  /**
+   * @brief 处理收件箱中的所有消息
+   */
+  void Drain() {
+    TimerOp *op = inbox.exchange(nullptr);
+    // 收件箱是后进先出的栈，反转后按投递顺序处理
+    TimerOp *head = nullptr;
+    while (op) {
+      TimerOp *next = op->next;
+      op->next = head;
+      head = op;
+      op = next;
+    }
+    while (head) {
+      TimerOp *next = head->next;
+      if (head->type == TimerManager::OP_ADD) {
+        if (head->timer->armed_) {
+          Insert(std::move(head->timer));
+        } else {
+          head->timer->cb_ = nullptr;
+        }
+      } else {
+        Apply(head->type, head->timer.get(), head->us, head->from_now);
+      }
+      delete head;
+      head = next;
+    }
+  }
+
+  /**
+   * @brief 到最近一个定时器执行的时间间隔(微秒)，没有定时器时返回~0ull
+   */
+  uint64_t GetNextExpire(uint64_t now_us) const {
+    if (wheel) {
+      return wheel->GetNextExpire(now_us);
+    }
+    if (heap.empty()) {
+      return ~0ull;
+    }
+    uint64_t next = heap.front()->next_;
+    return now_us >= next ? 0 : next - now_us;
+  }
+
+  /**
+   * @brief 取出所有已到期的定时器
+   */
+  void PopExpired(uint64_t now_us, std::vector<Timer::ptr> &expired) {
+    if (wheel) {
+      wheel->PopExpired(now_us, expired);
+      return;
+    }
+    // 时间取自Clock::NowUS，各个时钟源都是单调的，正常不会出现时间回退
+    bool rollover = DetectClockRollover(now_us);
+    while (!heap.empty() && (rollover || heap.front()->next_ <= now_us)) {
+      expired.push_back(Erase(heap.front().get()));
+    }
+  }
+
+  /**
+   * @brief 检测服务器时间是否被调后了
+   */
+  bool DetectClockRollover(uint64_t now_us) {
+    bool rollover = false;
+    if (now_us < previous_use_time &&
+        now_us < (previous_use_time - 60 * 60 * 1000 * 1000ull)) {
+      rollover = true;
+    }
+    previous_use_time = now_us;
+    return rollover;
+  }
+
+  // 按执行时间排序的最小堆
+  std::vector<Timer::ptr> heap;
+  // 时间轮，使用时间轮时不为空，此时不使用heap
+  std::unique_ptr<TimerWheel> wheel;
+  // 其他线程投递的消息，无锁栈
+  std::atomic<TimerOp *> inbox = {nullptr};
+  // 所属线程阻塞等待到的时间点，0表示所属线程未阻塞(会在阻塞前处理收件箱)，~0ull表示无限等待
+  std::atomic<uint64_t> next_wakeup = {0};
+  // 所属线程id
+  std::atomic<int> thread = {-1};
+  // 上次执行时间
+  uint64_t previous_use_time = 0;
+};
+
+Timer::Timer(uint64_t us, std::function<void()> cb, bool recurring,
+             TimerManager *manager)
+    : recurring_(recurring), us_(us), cb_(cb), manager_(manager) {
+  next_ = Clock::NowUS() + us_;
 }
 
-bool Timer::Refresh() {
-  TimerManager::RWMutexType::WriteLock lock(manager_->mutex_);
-  if (!cb_) {
+bool Timer::Cancel() {
+  bool armed = true;
+  if (!armed_.compare_exchange_strong(armed, false)) {
     return false;
   }
-  auto it = manager_->timers_.find(shared_from_this());
-  if (it == manager_->timers_.end()) {
+  --manager_->timer_count_;
+  manager_->Dispatch(this, TimerManager::OP_CANCEL, 0, false);
+  return true;
+}
+
+bool Timer::Refresh() {
+  if (!armed_) {
     return false;
   }
-  manager_->timers_.erase(it);
-  next_ = serverframework::GetElapsedMS() + ms_;
-  manager_->timers_.insert(shared_from_this());
+  manager_->Dispatch(this, TimerManager::OP_REFRESH, 0, false);
   return true;
 }
 
 bool Timer::reset(uint64_t ms, bool from_now) {
-  if (ms == ms_ && !from_now) {
-    return true;
-  }
-  TimerManager::RWMutexType::WriteLock lock(manager_->mutex_);
-  if (!cb_) {
+  if (!armed_) {
     return false;
   }
-  auto it = manager_->timers_.find(shared_from_this());
-  if (it == manager_->timers_.end()) {
-    return false;
-  }
-  manager_->timers_.erase(it);
-  uint64_t Start = 0;
-  if (from_now) {
-    Start = serverframework::GetElapsedMS();
-  } else {
-    Start = next_ - ms_;
-  }
-  ms_ = ms;
-  next_ = Start + ms_;
-  manager_->AddTimer(shared_from_this(), lock);
+  manager_->Dispatch(this, TimerManager::OP_RESET, ms * 1000, from_now);
   return true;
 }
 
-TimerManager::TimerManager() {
-  previous_use_time_ = serverframework::GetElapsedMS();
+TimerManager::TimerManager(size_t shards) {
+  id_ = ++s_timer_manager_id;
+  use_wheel_ = g_timer_wheel->GetValue();
+  uint64_t now_us = Clock::NowUS();
+  shards = std::max(shards, (size_t)1);
+  shards_.reserve(shards);
+  for (size_t i = 0; i < shards; ++i) {
+    shards_.emplace_back(new TimerShard(now_us, use_wheel_));
+  }
 }
 
 TimerManager::~TimerManager() {}
 
+TimerShard *TimerManager::GetLocalShard() const {
+  return t_timer_manager_id == id_ ? t_timer_shard : nullptr;
+}
+
+TimerShard *TimerManager::BindShard() {
+  if (t_timer_manager_id == id_) {
+    return t_timer_shard;
+  }
+  size_t idx = next_bind_++;
+  ASSERT2(idx < shards_.size(), "timer shards exhausted");
+  TimerShard *shard = shards_[idx].get();
+  shard->thread = serverframework::GetThreadId();
+  t_timer_manager_id = id_;
+  t_timer_shard = shard;
+  return shard;
+}
+
 Timer::ptr TimerManager::AddTimer(uint64_t ms, std::function<void()> cb,
                                   bool recurring) {
-  Timer::ptr timer(new Timer(ms, cb, recurring, this));
-  RWMutexType::WriteLock lock(mutex_);
-  AddTimer(timer, lock);
+  return AddTimerUS(ms * 1000, cb, recurring);
+}
+
+Timer::ptr TimerManager::AddTimerUS(uint64_t us, std::function<void()> cb,
+                                    bool recurring) {
+  Timer::ptr timer(new Timer(us, cb, recurring, this));
+  ++timer_count_;
+  TimerShard *shard = GetLocalShard();
+  if (shard) {
+    timer->shard_ = shard;
+    shard->Insert(timer);
+    return timer;
+  }
+
+  // 非分片线程添加的定时器轮流分配给已绑定的分片
+  size_t bound = std::min(next_bind_.load(), shards_.size());
+  shard = shards_[bound ? next_foreign_++ % bound : 0].get();
+  timer->shard_ = shard;
+  uint64_t deadline = timer->next_;
+  TimerOp *op = new TimerOp;
+  op->type = OP_ADD;
+  op->timer = timer;
+  Post(shard, op, deadline);
   return timer;
 }
 
@@ -112,90 +369,121 @@ Timer::ptr TimerManager::AddConditionTimer(uint64_t ms,
   return AddTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring);
 }
 
-uint64_t TimerManager::GetNextTimer() {
-  RWMutexType::ReadLock lock(mutex_);
-  tickled_ = false;
-  if (timers_.empty()) {
-    return ~0ull;
-  }
-
-  const Timer::ptr& next = *timers_.begin();
-  uint64_t now_ms = serverframework::GetElapsedMS();
-  if (now_ms >= next->next_) {
-    return 0;
-  } else {
-    return next->next_ - now_ms;
+bool TimerManager::RearmTimer(const Timer::ptr &timer, uint64_t ms,
+                              std::function<void()> cb) {
+  TimerShard *shard = GetLocalShard();
+  // 唯一引用说明定时器不在分片中，也没有未处理的跨线程操作
+  if (!shard || timer->manager_ != this || timer->shard_ != shard ||
+      timer->armed_ || timer.use_count() != 1) {
+    return false;
   }
+  timer->recurring_ = false;
+  timer->us_ = ms * 1000;
+  timer->next_ = Clock::NowUS() + timer->us_;
+  timer->cb_ = std::move(cb);
+  timer->armed_ = true;
+  ++timer_count_;
+  shard->Insert(timer);
+  return true;
 }
 
-void TimerManager::ListExpiredCb(std::vector<std::function<void()> >& cbs) {
-  uint64_t now_ms = serverframework::GetElapsedMS();
-  std::vector<Timer::ptr> expired;
-  {
-    RWMutexType::ReadLock lock(mutex_);
-    if (timers_.empty()) {
-      return;
-    }
-  }
-  RWMutexType::WriteLock lock(mutex_);
-  if (timers_.empty()) {
-    return;
-  }
-  bool rollover = false;
-  if (UNLIKELY(DetectClockRollover(now_ms))) {
-    // 使用clock_gettime(CLOCK_MONOTONIC_RAW)，应该不可能出现时间回退的问题
-    rollover = true;
-  }
-  if (!rollover && ((*timers_.begin())->next_ > now_ms)) {
+void TimerManager::Dispatch(Timer *timer, OpType type, uint64_t us,
+                            bool from_now) {
+  TimerShard *shard = timer->shard_;
+  if (GetLocalShard() == shard) {
+    shard->Apply(type, timer, us, from_now);
     return;
   }
 
-  Timer::ptr now_timer(new Timer(now_ms));
-  auto it = rollover ? timers_.end() : timers_.lower_bound(now_timer);
-  while (it != timers_.end() && (*it)->next_ == now_ms) {
-    ++it;
+  TimerOp *op = new TimerOp;
+  op->type = type;
+  op->timer = timer->shared_from_this();
+  op->us = us;
+  op->from_now = from_now;
+  // 取消和刷新不会让定时器提前，不需要唤醒所属线程；不从当前时间开始的重置无法在本线程算出新时间，总是唤醒
+  uint64_t deadline = ~0ull;
+  if (type == OP_RESET) {
+    deadline = from_now ? Clock::NowUS() + us : 0;
   }
-  expired.insert(expired.begin(), timers_.begin(), it);
-  timers_.erase(timers_.begin(), it);
-  cbs.reserve(expired.size());
+  Post(shard, op, deadline);
+}
 
-  for (auto& timer : expired) {
-    cbs.push_back(timer->cb_);
-    if (timer->recurring_) {
-      timer->next_ = now_ms + timer->ms_;
-      timers_.insert(timer);
-    } else {
-      timer->cb_ = nullptr;
+void TimerManager::Post(TimerShard *shard, TimerOp *op, uint64_t deadline) {
+  TimerOp *head = shard->inbox.load();
+  do {
+    op->next = head;
+  } while (!shard->inbox.compare_exchange_weak(head, op));
+
+  // 所属线程正阻塞等待一个更晚的时间点，把next_wakeup置0成功的线程负责唤醒它
+  uint64_t wakeup = shard->next_wakeup.load();
+  while (deadline < wakeup) {
+    if (shard->next_wakeup.compare_exchange_weak(wakeup, 0)) {
+      OnTimerInsertedAtFront(shard->thread);
+      break;
     }
   }
 }
 
-void TimerManager::AddTimer(Timer::ptr val, RWMutexType::WriteLock& lock) {
-  auto it = timers_.insert(val).first;
-  bool at_front = (it == timers_.begin()) && !tickled_;
-  if (at_front) {
-    tickled_ = true;
-  }
-  lock.unlock();
+uint64_t TimerManager::GetNextTimer() {
+  TimerShard *shard = BindShard();
+  shard->next_wakeup = 0;
+  shard->Drain();
 
-  if (at_front) {
-    OnTimerInsertedAtFront();
+  uint64_t now_us = Clock::NowUS();
+  uint64_t next = shard->GetNextExpire(now_us);
+  if (next == 0) {
+    return 0;
   }
+  shard->next_wakeup = next == ~0ull ? ~0ull : now_us + next;
+  // 公布等待时间后再检查一次收件箱，其他线程要么看到新的等待时间，要么它的消息在这里被发现
+  if (shard->inbox.load()) {
+    shard->next_wakeup = 0;
+    return 0;
+  }
+  return next;
 }
 
-bool TimerManager::DetectClockRollover(uint64_t now_ms) {
-  bool rollover = false;
-  if (now_ms < previous_use_time_ &&
-      now_ms < (previous_use_time_ - 60 * 60 * 1000)) {
-    rollover = true;
+void TimerManager::ListExpiredCb(std::vector<std::function<void()> > &cbs) {
+  TimerShard *shard = BindShard();
+  shard->next_wakeup = 0;
+  shard->Drain();
+
+  // IO调度线程在每轮idle循环中刷新缓存的时间戳，这里不再读时钟。
+  // 缓存的时间只会比实际时间早，定时器只可能晚触发；起始时间则总是读时钟，否则会提前触发
+  uint64_t now_us = Clock::CachedUS();
+  std::vector<Timer::ptr> expired;
+  shard->PopExpired(now_us, expired);
+  if (expired.empty()) {
+    return;
   }
-  previous_use_time_ = now_ms;
-  return rollover;
-}
+  cbs.reserve(expired.size());
 
-bool TimerManager::HasTimer() {
-  RWMutexType::ReadLock lock(mutex_);
-  return !timers_.empty();
+  // 循环定时器重新计时的起点
+  uint64_t start_us = 0;
+  for (auto &timer : expired) {
+    if (timer->recurring_) {
+      if (timer->armed_) {
+        cbs.push_back(timer->cb_);
+        if (!start_us) {
+          start_us = Clock::NowUS();
+        }
+        timer->next_ = start_us + timer->us_;
+        shard->Insert(timer);
+      } else {
+        timer->cb_ = nullptr;
+      }
+      continue;
+    }
+    // 与其他线程的Cancel竞争，只有一方成功
+    bool armed = true;
+    if (timer->armed_.compare_exchange_strong(armed, false)) {
+      --timer_count_;
+      cbs.push_back(timer->cb_);
+    }
+    timer->cb_ = nullptr;
+  }
 }
 
+bool TimerManager::HasTimer() { return timer_count_ > 0; }
+
 }  // namespace serverframework
@@ -5,20 +5,24 @@
 #ifndef TIMER_H
 #define TIMER_H
 
+#include <atomic>
+#include <functional>
 #include <memory>
-#include <set>
 #include <vector>
 
-#include "env/mutex.h"
-
 namespace serverframework {
 
 class TimerManager;
+class TimerWheel;
+struct TimerShard;
+struct TimerOp;
 /**
  * @brief 定时器
  */
 class Timer : public std::enable_shared_from_this<Timer> {
   friend class TimerManager;
+  friend class TimerWheel;
+  friend struct TimerShard;
 
  public:
   // 定时器的智能指针类型
@@ -26,6 +30,7 @@ class Timer : public std::enable_shared_from_this<Timer> {
 
   /**
    * @brief 取消定时器
+   * @details 可以在任意线程调用，不加锁，非所属线程调用时向所属分片投递一条取消消息
    */
   bool Cancel();
 
@@ -44,59 +49,76 @@ class Timer : public std::enable_shared_from_this<Timer> {
  private:
   /**
    * @brief 构造函数
-   * @param[in] ms 定时器执行间隔时间
+   * @param[in] us 定时器执行间隔时间(微秒)
    * @param[in] cb 回调函数
    * @param[in] recurring 是否循环
    * @param[in] manager 定时器管理器
    */
-  Timer(uint64_t ms, std::function<void()> cb, bool recurring,
+  Timer(uint64_t us, std::function<void()> cb, bool recurring,
         TimerManager* manager);
-  /**
-   * @brief 构造函数
-   * @param[in] next 执行的时间戳(毫秒)
-   */
-  Timer(uint64_t next);
 
  private:
   // 是否循环定时器
   bool recurring_ = false;
-  // 执行周期
-  uint64_t ms_ = 0;
-  // 精确的执行时间
+  // 执行周期(微秒)
+  uint64_t us_ = 0;
+  // 精确的执行时间(微秒)
   uint64_t next_ = 0;
-  // 回调函数
+  // 回调函数，只由所属分片的线程访问
   std::function<void()> cb_;
   // 定时器管理器
   TimerManager* manager_ = nullptr;
-
- private:
-  /**
-   * @brief 定时器比较仿函数
-   */
-  struct Comparator {
-    /**
-     * @brief 比较定时器的智能指针的大小(按执行时间排序)
-     * @param[in] lhs 定时器智能指针
-     * @param[in] rhs 定时器智能指针
-     */
-    bool operator()(const Timer::ptr& lhs, const Timer::ptr& rhs) const;
-  };
+  // 所属的分片
+  TimerShard* shard_ = nullptr;
+  // 是否有效，取消或执行完(非循环)后失效，通过CAS保证只有一方成功
+  std::atomic<bool> armed_ = {true};
+  // 在分片最小堆中的下标，不在堆中时为-1
+  int heap_index_ = -1;
+  // 时间轮中所在槽位的链表头，不在时间轮中时为nullptr
+  Timer** wheel_slot_ = nullptr;
+  // 时间轮中所在的层
+  int wheel_level_ = 0;
+  // 时间轮槽位链表的前一个节点
+  Timer* wheel_prev_ = nullptr;
+  // 时间轮槽位链表的后一个节点
+  Timer* wheel_next_ = nullptr;
+  // 在时间轮中时持有自身的引用，保证定时器不被提前释放
+  Timer::ptr wheel_self_;
 };
 
 /**
  * @brief 定时器管理器
+ * @details 定时器按线程分片，每个分片只由所属线程访问，不加锁。
+ *          调用GetNextTimer/ListExpiredCb的线程绑定一个分片(一个线程只能绑定一个TimerManager)，
+ *          在所属线程上添加、取消、刷新定时器直接操作本线程的分片；
+ *          在其他线程上的操作封装成消息投递到目标分片的无锁收件箱，由所属线程在下一次
+ *          GetNextTimer/ListExpiredCb时处理，必要时通过OnTimerInsertedAtFront唤醒所属线程。
+ *          分片默认使用最小堆管理定时器，精度为微秒；配置项timer.wheel为true时改用分层时间轮，
+ *          时间轮的tick为1毫秒，定时器按毫秒向上取整触发
  */
 class TimerManager {
   friend class Timer;
 
  public:
-  // 读写锁类型
-  typedef RWMutex RWMutexType;
+  /**
+   * @brief 定时器操作类型
+   */
+  enum OpType {
+    // 添加
+    OP_ADD,
+    // 取消
+    OP_CANCEL,
+    // 刷新
+    OP_REFRESH,
+    // 重置
+    OP_RESET,
+  };
 
   /**
    * @brief 构造函数
+   * @param[in] shards 分片数量，应等于调用GetNextTimer/ListExpiredCb的线程数
    */
-  TimerManager();
+  TimerManager(size_t shards = 1);
 
   /**
    * @brief 析构函数
@@ -112,6 +134,15 @@ class TimerManager {
   Timer::ptr AddTimer(uint64_t ms, std::function<void()> cb,
                       bool recurring = false);
 
+  /**
+   * @brief 添加微秒精度的定时器
+   * @param[in] us 定时器执行间隔时间(微秒)
+   * @param[in] cb 定时器回调函数
+   * @param[in] recurring 是否循环定时器
+   */
+  Timer::ptr AddTimerUS(uint64_t us, std::function<void()> cb,
+                        bool recurring = false);
+
   /**
    * @brief 添加条件定时器
    * @param[in] ms 定时器执行间隔时间
@@ -124,47 +155,80 @@ class TimerManager {
                                bool recurring = false);
 
   /**
-   * @brief 到最近一个定时器执行的时间间隔(毫秒)
+   * @brief 复用已经触发或取消的一次性定时器，重新设置间隔和回调后加入当前线程的分片
+   * @details 只有定时器属于当前线程的分片，已经不在分片中，且调用方持有唯一的引用时才能复用，
+   *          用于IO超时这类频繁添加又大多被取消的定时器，避免每次都分配Timer对象
+   * @param[in] timer 待复用的定时器
+   * @param[in] ms 定时器执行间隔时间
+   * @param[in] cb 定时器回调函数
+   * @return 不满足复用条件时返回false，定时器保持不变
+   */
+  bool RearmTimer(const Timer::ptr& timer, uint64_t ms,
+                  std::function<void()> cb);
+
+  /**
+   * @brief 到当前线程分片中最近一个定时器执行的时间间隔(微秒)
+   * @details 当前线程未绑定分片时先绑定一个分片
    */
   uint64_t GetNextTimer();
 
   /**
-   * @brief 获取需要执行的定时器的回调函数列表
+   * @brief 获取当前线程分片中需要执行的定时器的回调函数列表
    * @param[out] cbs 回调函数数组
    */
   void ListExpiredCb(std::vector<std::function<void()> >& cbs);
 
   /**
-   * @brief 是否有定时器
+   * @brief 是否有定时器(所有分片)
    */
   bool HasTimer();
 
- protected:
   /**
-   * @brief 当有新的定时器插入到定时器的首部,执行该函数
+   * @brief 是否使用时间轮管理定时器
    */
-  virtual void OnTimerInsertedAtFront() = 0;
+  bool IsUseWheel() const { return use_wheel_; }
 
+ protected:
   /**
-   * @brief 将定时器添加到管理器中
+   * @brief 其他线程投递的定时器可能早于分片所属线程当前的等待时间时，执行该函数
+   * @param[in] thread 分片所属的线程id，需要唤醒该线程以更新epoll_wait的超时时间
    */
-  void AddTimer(Timer::ptr val, RWMutexType::WriteLock& lock);
+  virtual void OnTimerInsertedAtFront(int thread) = 0;
 
  private:
   /**
-   * @brief 检测服务器时间是否被调后了
+   * @brief 当前线程绑定的本管理器分片，未绑定时返回nullptr
+   */
+  TimerShard* GetLocalShard() const;
+
+  /**
+   * @brief 获取当前线程绑定的分片，未绑定时绑定一个分片
+   */
+  TimerShard* BindShard();
+
+  /**
+   * @brief 在所属线程上直接修改定时器，在其他线程上投递消息
+   */
+  void Dispatch(Timer* timer, OpType type, uint64_t us, bool from_now);
+
+  /**
+   * @brief 向分片投递消息，deadline早于分片所属线程的等待时间时唤醒该线程
    */
-  bool DetectClockRollover(uint64_t now_ms);
+  void Post(TimerShard* shard, TimerOp* op, uint64_t deadline);
 
  private:
-  // Mutex
-  RWMutexType mutex_;
-  // 定时器集合
-  std::set<Timer::ptr, Timer::Comparator> timers_;
-  // 是否触发onTimerInsertedAtFront
-  bool tickled_ = false;
-  // 上次执行时间
-  uint64_t previous_use_time_ = 0;
+  // 分片
+  std::vector<std::unique_ptr<TimerShard> > shards_;
+  // 已分配给线程的分片数
+  std::atomic<size_t> next_bind_ = {0};
+  // 非分片线程添加定时器时轮流选择分片
+  std::atomic<size_t> next_foreign_ = {0};
+  // 所有分片中有效的定时器数量
+  std::atomic<size_t> timer_count_ = {0};
+  // 管理器的唯一id，线程通过id判断绑定关系，避免管理器析构后地址被复用
+  uint64_t id_ = 0;
+  // 是否使用时间轮
+  bool use_wheel_ = false;
 };
 
 }  // namespace serverframework
@@ -0,0 +1,204 @@
+/**
+ * @file timer_wheel.cc
+ * @brief 分层时间轮实现
+ */
+#include "util/timer_wheel.h"
+
+#include <string.h>
+
+#include "util/macro.h"
+
+namespace serverframework {
+
+TimerWheel::TimerWheel(uint64_t now_us) : current_(now_us / kTickUS) {
+  memset(root_, 0, sizeof(root_));
+  memset(levels_, 0, sizeof(levels_));
+}
+
+TimerWheel::~TimerWheel() {
+  std::vector<Timer::ptr> all;
+  all.reserve(size_);
+  for (uint64_t i = 0; i < kRootSize; ++i) {
+    while (root_[i]) {
+      Timer* t = root_[i];
+      Unlink(t);
+      all.push_back(std::move(t->wheel_self_));
+    }
+  }
+  for (int l = 1; l < kLevels; ++l) {
+    for (uint64_t i = 0; i < kLevelSize; ++i) {
+      while (levels_[l - 1][i]) {
+        Timer* t = levels_[l - 1][i];
+        Unlink(t);
+        all.push_back(std::move(t->wheel_self_));
+      }
+    }
+  }
+}
+
+Timer** TimerWheel::Slot(int level, uint64_t idx) {
+  if (level == 0) {
+    return &root_[idx & kRootMask];
+  }
+  return &levels_[level - 1][idx & kLevelMask];
+}
+
+void TimerWheel::Link(Timer* timer) {
+  // 到期时间向上取整到tick，保证定时器不会提前触发
+  uint64_t expires = (timer->next_ + kTickUS - 1) / kTickUS;
+  int level = 0;
+  uint64_t idx = 0;
+  if (expires < current_) {
+    // 已经过期的定时器挂到当前槽位，下一次推进时间轮就会被取出
+    idx = current_;
+  } else {
+    uint64_t delta = expires - current_;
+    if (delta > kMaxInterval) {
+      delta = kMaxInterval;
+      expires = current_ + delta;
+    }
+    if (delta < kRootSize) {
+      idx = expires;
+    } else {
+      level = 1;
+      while (level < kLevels - 1 &&
+             delta >= (1ull << (Shift(level) + kLevelBits))) {
+        ++level;
+      }
+      idx = expires >> Shift(level);
+    }
+  }
+
+  Timer** slot = Slot(level, idx);
+  timer->wheel_slot_ = slot;
+  timer->wheel_level_ = level;
+  timer->wheel_prev_ = nullptr;
+  timer->wheel_next_ = *slot;
+  if (*slot) {
+    (*slot)->wheel_prev_ = timer;
+  }
+  *slot = timer;
+  ++level_size_[level];
+}
+
+void TimerWheel::Unlink(Timer* timer) {
+  if (timer->wheel_prev_) {
+    timer->wheel_prev_->wheel_next_ = timer->wheel_next_;
+  } else {
+    *timer->wheel_slot_ = timer->wheel_next_;
+  }
+  if (timer->wheel_next_) {
+    timer->wheel_next_->wheel_prev_ = timer->wheel_prev_;
+  }
+  --level_size_[timer->wheel_level_];
+  timer->wheel_slot_ = nullptr;
+  timer->wheel_prev_ = nullptr;
+  timer->wheel_next_ = nullptr;
+}
+
+void TimerWheel::Add(Timer::ptr timer) {
+  ASSERT(!timer->wheel_slot_);
+  Timer* raw = timer.get();
+  raw->wheel_self_ = std::move(timer);
+  Link(raw);
+  ++size_;
+}
+
+Timer::ptr TimerWheel::Remove(Timer* timer) {
+  if (!timer->wheel_slot_) {
+    return nullptr;
+  }
+  Unlink(timer);
+  --size_;
+  return std::move(timer->wheel_self_);
+}
+
+void TimerWheel::Cascade(int level, uint64_t idx) {
+  Timer** slot = Slot(level, idx);
+  Timer* t = *slot;
+  *slot = nullptr;
+  while (t) {
+    Timer* next = t->wheel_next_;
+    --level_size_[level];
+    Link(t);
+    t = next;
+  }
+}
+
+uint64_t TimerWheel::GetNextExpire(uint64_t now_us) const {
+  if (size_ == 0) {
+    return ~0ull;
+  }
+  uint64_t next = ~0ull;
+  if (level_size_[0]) {
+    for (uint64_t k = 0; k < kRootSize; ++k) {
+      if (root_[(current_ + k) & kRootMask]) {
+        next = current_ + k;
+        break;
+      }
+    }
+  }
+  // 高层槽位中的定时器最早在该槽位cascade时到期
+  for (int l = 1; l < kLevels; ++l) {
+    if (!level_size_[l]) {
+      continue;
+    }
+    uint64_t base = current_ >> Shift(l);
+    for (uint64_t k = 1; k <= kLevelSize; ++k) {
+      if (levels_[l - 1][(base + k) & kLevelMask]) {
+        uint64_t at = (base + k) << Shift(l);
+        if (at < next) {
+          next = at;
+        }
+        break;
+      }
+    }
+  }
+  if (next == ~0ull) {
+    return ~0ull;
+  }
+  return next * kTickUS > now_us ? next * kTickUS - now_us : 0;
+}
+
+void TimerWheel::PopExpired(uint64_t now_us,
+                            std::vector<Timer::ptr>& expired) {
+  uint64_t now = now_us / kTickUS;
+  while (current_ <= now) {
+    if (size_ == 0) {
+      current_ = now + 1;
+      break;
+    }
+    uint64_t idx = current_ & kRootMask;
+    if (idx == 0) {
+      // 第0层转完一圈，逐层cascade
+      for (int l = 1; l < kLevels; ++l) {
+        uint64_t lidx = (current_ >> Shift(l)) & kLevelMask;
+        Cascade(l, lidx);
+        if (lidx != 0) {
+          break;
+        }
+      }
+    }
+    if (level_size_[0] == 0) {
+      // 第0层为空时直接跳到下一次cascade的位置
+      uint64_t boundary = (current_ | kRootMask) + 1;
+      current_ = boundary <= now ? boundary : now + 1;
+      continue;
+    }
+    Timer* t = root_[idx];
+    root_[idx] = nullptr;
+    while (t) {
+      Timer* next = t->wheel_next_;
+      --level_size_[0];
+      --size_;
+      t->wheel_slot_ = nullptr;
+      t->wheel_prev_ = nullptr;
+      t->wheel_next_ = nullptr;
+      expired.push_back(std::move(t->wheel_self_));
+      t = next;
+    }
+    ++current_;
+  }
+}
+
+}  // namespace serverframework
@@ -0,0 +1,133 @@
+/**
+ * @file timer_wheel.h
+ * @brief 分层时间轮
+ * @details 定时器按到期时间挂到不同层的槽位链表上，插入和删除都是O(1)。
+ *          tick为1毫秒，定时器的到期时间(微秒)向上取整到tick。第0层256个槽，每槽1个tick；第1~4层各64个槽，每层每槽的跨度是下一层一整圈，
+ *          低层转完一圈时把高层对应槽位的定时器重新分配(cascade)到低层。
+ *          时间轮本身不加锁，只由所属定时器分片的线程访问
+ */
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "util/timer.h"
+
+namespace serverframework {
+
+/**
+ * @brief 分层时间轮
+ */
+class TimerWheel {
+ public:
+  /**
+   * @brief 构造函数
+   * @param[in] now_us 当前时间(微秒)，作为时间轮的起始tick
+   */
+  TimerWheel(uint64_t now_us);
+
+  TimerWheel(const TimerWheel&) = delete;
+  TimerWheel& operator=(const TimerWheel&) = delete;
+
+  /**
+   * @brief 析构函数，释放轮中所有定时器对自身的引用
+   */
+  ~TimerWheel();
+
+  /**
+   * @brief 按定时器的到期时间插入时间轮
+   * @pre 定时器不在时间轮中
+   */
+  void Add(Timer::ptr timer);
+
+  /**
+   * @brief 从时间轮中删除定时器
+   * @return 时间轮持有的定时器引用，定时器不在时间轮中时返回nullptr
+   */
+  Timer::ptr Remove(Timer* timer);
+
+  /**
+   * @brief 到下一次可能有定时器到期的时间间隔(微秒)
+   * @details 第0层没有定时器时返回的是高层下一次cascade的时间，是到期时间的下界
+   * @param[in] now_us 当前时间(微秒)
+   * @return 没有定时器时返回~0ull
+   */
+  uint64_t GetNextExpire(uint64_t now_us) const;
+
+  /**
+   * @brief 推进时间轮到now_us，取出所有已到期的定时器
+   * @param[in] now_us 当前时间(微秒)
+   * @param[out] expired 已到期的定时器，按到期tick排序
+   */
+  void PopExpired(uint64_t now_us, std::vector<Timer::ptr>& expired);
+
+  /**
+   * @brief 定时器数量
+   */
+  size_t GetSize() const { return size_; }
+
+  /**
+   * @brief 是否没有定时器
+   */
+  bool IsEmpty() const { return size_ == 0; }
+
+ private:
+  // 每个tick的微秒数
+  static const uint64_t kTickUS = 1000;
+  // 第0层槽位数的位数
+  static const int kRootBits = 8;
+  // 第1~4层槽位数的位数
+  static const int kLevelBits = 6;
+  // 层数
+  static const int kLevels = 5;
+  static const uint64_t kRootSize = 1ull << kRootBits;
+  static const uint64_t kLevelSize = 1ull << kLevelBits;
+  static const uint64_t kRootMask = kRootSize - 1;
+  static const uint64_t kLevelMask = kLevelSize - 1;
+  // 时间轮能表示的最大间隔，超过的按最大间隔挂到最高层，cascade时重新计算
+  static const uint64_t kMaxInterval =
+      (1ull << (kRootBits + (kLevels - 1) * kLevelBits)) - 1;
+
+  /**
+   * @brief 第level层第idx个槽位的链表头
+   */
+  Timer** Slot(int level, uint64_t idx);
+
+  /**
+   * @brief 第level(>=1)层的槽位对应的时间位移
+   */
+  static int Shift(int level) { return kRootBits + (level - 1) * kLevelBits; }
+
+  /**
+   * @brief 把定时器挂到对应的槽位上，不修改引用
+   */
+  void Link(Timer* timer);
+
+  /**
+   * @brief 把定时器从所在的槽位上摘下，不修改引用
+   */
+  void Unlink(Timer* timer);
+
+  /**
+   * @brief 把第level层第idx个槽位的定时器重新分配到低层
+   */
+  void Cascade(int level, uint64_t idx);
+
+ private:
+  // 当前tick，小于current_的tick都已经处理过
+  uint64_t current_;
+  // 定时器数量
+  size_t size_ = 0;
+  // 每层的定时器数量
+  size_t level_size_[kLevels] = {0};
+  // 第0层槽位
+  Timer* root_[kRootSize];
+  // 第1~4层槽位
+  Timer* levels_[kLevels - 1][kLevelSize];
+};
+
+}  // namespace serverframework
+
+#endif
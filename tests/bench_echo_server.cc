@@ -0,0 +1,80 @@
+/**
+ * @file bench_echo_server.cc
+ * @brief 压测用的回显服务器
+ * @details 协议是varint长度前缀的帧(见frame_codec.h)，每个请求帧原样返回，不拷贝负载。
+ *          与bench_loadgen配合在同一台机器上测量框架的吞吐和延迟。
+ *          用法：bench_echo_server -a 监听地址 -t 线程数 [-w]
+ */
+#include "serverframework.h"
+
+static serverframework::Logger::ptr g_logger = LOG_ROOT();
+
+static serverframework::Env *g_env = serverframework::EnvMgr::GetInstance();
+
+class EchoServer : public serverframework::FrameServer {
+ public:
+  EchoServer(serverframework::IOManager *io_worker,
+             serverframework::IOManager *accept_worker)
+      : FrameServer(serverframework::Frame::VARINT, io_worker,
+                    accept_worker) {}
+
+ protected:
+  bool HandleRequest(serverframework::Connection::ptr conn,
+                     const serverframework::Frame &request,
+                     serverframework::FrameEncoder &out) override {
+    return out.Add(request);
+  }
+};
+
+static serverframework::Address::ptr s_addr;
+static int s_threads = 1;
+static std::vector<std::shared_ptr<serverframework::IOManager>> s_workers;
+
+static void Run() {
+  serverframework::IOManager *iom = serverframework::IOManager::GetThis();
+  std::shared_ptr<EchoServer> server(new EchoServer(iom, iom));
+  if (!s_workers.empty()) {
+    std::vector<serverframework::IOManager *> workers;
+    for (auto &i : s_workers) {
+      workers.push_back(i.get());
+    }
+    server->SetWorkers(workers);
+  }
+  if (!server->bind(s_addr)) {
+    LOG_ERROR(g_logger) << "bind " << s_addr->ToString() << " fail";
+    exit(1);
+  }
+  server->Start();
+  std::cout << "echo server listening on " << s_addr->ToString() << std::endl;
+  // 服务器由这个协程持有，直到进程被杀死
+  while (true) {
+    sleep(3600);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  g_env->AddHelp("a", "listen ip:port, default 127.0.0.1:12052");
+  g_env->AddHelp("t", "threads, default 1");
+  g_env->AddHelp("w", "one SO_REUSEPORT acceptor per thread");
+  if (!g_env->Init(argc, argv) || g_env->Has("h")) {
+    g_env->PrintHelp();
+    return 0;
+  }
+  serverframework::Config::LoadFromConfDir(g_env->GetConfigPath());
+  s_addr = serverframework::Address::LookupAnyIPAddress(
+      g_env->Get("a", "127.0.0.1:12052"));
+  ASSERT(s_addr);
+  s_threads = std::max(1, atoi(g_env->Get("t", "1").c_str()));
+  g_logger->SetLevel(serverframework::LogLevel::WARN);
+
+  if (g_env->Has("w")) {
+    for (int i = 0; i < s_threads; ++i) {
+      s_workers.emplace_back(new serverframework::IOManager(
+          1, false, "echo_" + std::to_string(i)));
+    }
+    s_threads = 1;
+  }
+  serverframework::IOManager iom(s_threads, true, "echo");
+  iom.Schedule(&Run);
+  return 0;
+}
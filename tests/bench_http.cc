@@ -0,0 +1,191 @@
+/**
+ * @file bench_http.cc
+ * @brief HTTP服务器压测
+ * @details 类似wrk：每个连接一个协程，在长连接上循环发送请求(可以流水线发送多个)并等待响应，
+ *          持续指定的时间后输出吞吐量和延迟分布。默认在进程内启动HttpServer，指定-a时压测外部服务器。
+ *          用法：bench_http -c 连接数 -d 秒数 -p 流水线深度 -t 线程数 [-a ip:port] [-path /plaintext]
+ */
+#include <algorithm>
+
+#include "serverframework.h"
+
+static serverframework::Logger::ptr g_logger = LOG_ROOT();
+
+static serverframework::Env *g_env = serverframework::EnvMgr::GetInstance();
+
+static serverframework::Address::ptr s_addr;
+static serverframework::HttpServer::ptr s_server;
+static std::string s_request;
+static int s_connections = 64;
+static int s_duration = 3;
+static int s_pipeline = 1;
+static uint64_t s_deadline = 0;
+static uint64_t s_start = 0;
+
+static serverframework::Mutex s_mutex;
+static std::vector<uint64_t> s_latencies;
+static uint64_t s_bytes = 0;
+static uint64_t s_errors = 0;
+static int s_running = 0;
+
+/**
+ * @brief 从buffer中取出一个完整的响应
+ * @return 响应的长度，不完整返回0，格式错误返回-1
+ */
+static int64_t TakeResponse(const std::string &buffer, size_t pos) {
+  size_t end = buffer.find("\r\n\r\n", pos);
+  if (end == std::string::npos) {
+    return 0;
+  }
+  size_t length = 0;
+  size_t p = buffer.find("Content-Length: ", pos);
+  if (p == std::string::npos || p > end) {
+    return -1;
+  }
+  length = strtoull(buffer.c_str() + p + 16, nullptr, 10);
+  if (buffer.size() < end + 4 + length) {
+    return 0;
+  }
+  return end + 4 + length - pos;
+}
+
+static void Report() {
+  double seconds = (serverframework::Clock::NowMS() - s_start) / 1000.0;
+  std::sort(s_latencies.begin(), s_latencies.end());
+  size_t n = s_latencies.size();
+  uint64_t sum = 0;
+  for (auto v : s_latencies) {
+    sum += v;
+  }
+  auto pct = [n](double p) {
+    return s_latencies[std::min(n - 1, (size_t)(n * p))];
+  };
+  std::cout << "Running " << s_duration << "s test @ " << s_addr->ToString()
+            << s_request.substr(4, s_request.find(' ', 4) - 4) << std::endl
+            << "  " << s_connections << " connections, pipeline "
+            << s_pipeline << std::endl;
+  if (!n) {
+    std::cout << "  no response, errors=" << s_errors << std::endl;
+    return;
+  }
+  std::cout << "  Latency(us) avg=" << sum / n << " p50=" << pct(0.5)
+            << " p90=" << pct(0.9) << " p99=" << pct(0.99)
+            << " max=" << s_latencies[n - 1] << std::endl
+            << "  " << n << " requests in " << seconds << "s, "
+            << s_bytes / 1024.0 / 1024.0 << "MB read, errors=" << s_errors
+            << std::endl
+            << "Requests/sec: " << (uint64_t)(n / seconds) << std::endl
+            << "Transfer/sec: " << s_bytes / 1024.0 / 1024.0 / seconds << "MB"
+            << std::endl;
+}
+
+static void Client() {
+  std::vector<uint64_t> latencies;
+  uint64_t bytes = 0;
+  uint64_t errors = 0;
+  std::string batch;
+  for (int i = 0; i < s_pipeline; ++i) {
+    batch += s_request;
+  }
+  serverframework::Socket::ptr sock =
+      serverframework::Socket::CreateTCP(s_addr);
+  sock->SetRecvTimeout(3000);
+  if (!sock->connect(s_addr, 3000)) {
+    ++errors;
+  } else {
+    std::string buffer;
+    char buf[16 * 1024];
+    while (serverframework::Clock::NowMS() < s_deadline) {
+      uint64_t begin = serverframework::Clock::NowUS();
+      if (sock->send(batch.data(), batch.size()) != (int)batch.size()) {
+        ++errors;
+        break;
+      }
+      int got = 0;
+      size_t pos = 0;
+      while (got < s_pipeline) {
+        int64_t len = TakeResponse(buffer, pos);
+        if (len > 0) {
+          pos += len;
+          ++got;
+          latencies.push_back(serverframework::Clock::NowUS() - begin);
+          continue;
+        }
+        int rt = len < 0 ? -1 : sock->recv(buf, sizeof(buf));
+        if (rt <= 0) {
+          break;
+        }
+        buffer.append(buf, rt);
+        bytes += rt;
+      }
+      if (got < s_pipeline) {
+        ++errors;
+        break;
+      }
+      buffer.erase(0, pos);
+    }
+    sock->close();
+  }
+
+  serverframework::Mutex::Lock lock(s_mutex);
+  s_latencies.insert(s_latencies.end(), latencies.begin(), latencies.end());
+  s_bytes += bytes;
+  s_errors += errors;
+  if (--s_running == 0) {
+    Report();
+    if (s_server) {
+      s_server->Stop();
+    }
+  }
+}
+
+static void Run() {
+  if (!s_addr) {
+    s_addr = serverframework::Address::LookupAnyIPAddress("127.0.0.1:12047");
+    s_server.reset(new serverframework::HttpServer);
+    s_server->GetRouter().Add(
+        serverframework::HttpMethod::GET, "/plaintext",
+        [](serverframework::HttpRequest &req,
+           serverframework::HttpResponse &rsp) {
+          rsp.SetHeader("Content-Type", "text/plain");
+          rsp.SetBody("Hello, World!");
+        });
+    bool ok = s_server->bind(s_addr) && s_server->Start();
+    ASSERT(ok);
+  }
+  s_start = serverframework::Clock::NowMS();
+  s_deadline = s_start + s_duration * 1000;
+  s_running = s_connections;
+  for (int i = 0; i < s_connections; ++i) {
+    serverframework::IOManager::GetThis()->Schedule(&Client);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  g_env->AddHelp("c", "connections, default 64");
+  g_env->AddHelp("d", "duration in seconds, default 3");
+  g_env->AddHelp("p", "pipelined requests per round trip, default 1");
+  g_env->AddHelp("t", "threads, default 1");
+  g_env->AddHelp("a", "target ip:port, default an in-process server");
+  g_env->AddHelp("path", "request path, default /plaintext");
+  if (!g_env->Init(argc, argv) || g_env->Has("h")) {
+    g_env->PrintHelp();
+    return 0;
+  }
+  serverframework::Config::LoadFromConfDir(g_env->GetConfigPath());
+  s_connections = std::max(1, atoi(g_env->Get("c", "64").c_str()));
+  s_duration = std::max(1, atoi(g_env->Get("d", "3").c_str()));
+  s_pipeline = std::max(1, atoi(g_env->Get("p", "1").c_str()));
+  int threads = std::max(1, atoi(g_env->Get("t", "1").c_str()));
+  if (g_env->Has("a")) {
+    s_addr = serverframework::Address::LookupAnyIPAddress(g_env->Get("a"));
+    ASSERT(s_addr);
+  }
+  s_request = "GET " + g_env->Get("path", "/plaintext") +
+              " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  g_logger->SetLevel(serverframework::LogLevel::WARN);
+
+  serverframework::IOManager iom(threads, true, "bench");
+  iom.Schedule(&Run);
+  return 0;
+}
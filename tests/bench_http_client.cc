@@ -0,0 +1,149 @@
+/**
+ * @file bench_http_client.cc
+ * @brief HTTP客户端压测
+ * @details 多个协程共用一个HttpClient，循环发送请求直到指定的时间，连接从连接池借还；
+ *          -p大于1时每次用Pipeline在一个连接上流水线发送p个请求。默认压测进程内的HttpServer，
+ *          指定-a时压测外部服务器。
+ *          用法：bench_http_client -c 协程数 -d 秒数 -p 流水线深度 -t 线程数 [-a ip:port] [-path /plaintext]
+ */
+#include <algorithm>
+
+#include "serverframework.h"
+
+static serverframework::Logger::ptr g_logger = LOG_ROOT();
+
+static serverframework::Env *g_env = serverframework::EnvMgr::GetInstance();
+
+static serverframework::Address::ptr s_addr;
+static serverframework::HttpServer::ptr s_server;
+static serverframework::HttpClient::ptr s_client;
+static std::string s_path;
+static int s_concurrency = 64;
+static int s_duration = 3;
+static int s_pipeline = 1;
+static uint64_t s_deadline = 0;
+static uint64_t s_start = 0;
+
+static serverframework::Mutex s_mutex;
+static std::vector<uint64_t> s_latencies;
+static uint64_t s_errors = 0;
+static int s_running = 0;
+
+static void Report() {
+  double seconds = (serverframework::Clock::NowMS() - s_start) / 1000.0;
+  std::sort(s_latencies.begin(), s_latencies.end());
+  size_t n = s_latencies.size();
+  std::cout << "Running " << s_duration << "s client test @ "
+            << s_addr->ToString() << s_path << std::endl
+            << "  " << s_concurrency << " fibers, pipeline " << s_pipeline
+            << std::endl;
+  if (!n) {
+    std::cout << "  no response, errors=" << s_errors << std::endl;
+    return;
+  }
+  uint64_t sum = 0;
+  for (auto v : s_latencies) {
+    sum += v;
+  }
+  auto pct = [n](double p) {
+    return s_latencies[std::min(n - 1, (size_t)(n * p))];
+  };
+  serverframework::SocketPool *pool = s_client->GetPool();
+  std::cout << "  Latency(us) avg=" << sum / n << " p50=" << pct(0.5)
+            << " p90=" << pct(0.9) << " p99=" << pct(0.99)
+            << " max=" << s_latencies[n - 1] << std::endl
+            << "  " << n << " requests in " << seconds
+            << "s, errors=" << s_errors
+            << " connects=" << pool->GetConnectCount()
+            << " reuses=" << pool->GetReuseCount() << std::endl
+            << "Requests/sec: " << (uint64_t)(n / seconds) << std::endl;
+}
+
+static void Worker() {
+  std::vector<uint64_t> latencies;
+  uint64_t errors = 0;
+  std::vector<serverframework::HttpClientRequest> reqs(
+      s_pipeline, serverframework::HttpClientRequest(
+                      serverframework::HttpMethod::GET, s_path));
+  while (serverframework::Clock::NowMS() < s_deadline) {
+    uint64_t begin = serverframework::Clock::NowUS();
+    std::vector<serverframework::HttpResult> results;
+    if (s_pipeline == 1) {
+      results.push_back(s_client->Do(reqs[0]));
+    } else {
+      results = s_client->Pipeline(reqs);
+    }
+    uint64_t latency = serverframework::Clock::NowUS() - begin;
+    for (auto &result : results) {
+      if (result.ok()) {
+        latencies.push_back(latency);
+      } else {
+        ++errors;
+      }
+    }
+  }
+
+  serverframework::Mutex::Lock lock(s_mutex);
+  s_latencies.insert(s_latencies.end(), latencies.begin(), latencies.end());
+  s_errors += errors;
+  if (--s_running == 0) {
+    Report();
+    s_client.reset();
+    if (s_server) {
+      s_server->Stop();
+    }
+  }
+}
+
+static void Run() {
+  if (!s_addr) {
+    s_addr = serverframework::Address::LookupAnyIPAddress("127.0.0.1:12049");
+    s_server.reset(new serverframework::HttpServer);
+    s_server->GetRouter().Add(
+        serverframework::HttpMethod::GET, "/plaintext",
+        [](serverframework::HttpRequest &req,
+           serverframework::HttpResponse &rsp) {
+          rsp.SetHeader("Content-Type", "text/plain");
+          rsp.SetBody("Hello, World!");
+        });
+    bool ok = s_server->bind(s_addr) && s_server->Start();
+    ASSERT(ok);
+  }
+  s_client.reset(new serverframework::HttpClient(s_addr));
+  s_client->GetPool()->SetMaxIdle(s_concurrency);
+  s_client->GetPool()->SetMaxTotal(s_concurrency);
+  s_start = serverframework::Clock::NowMS();
+  s_deadline = s_start + s_duration * 1000;
+  s_running = s_concurrency;
+  for (int i = 0; i < s_concurrency; ++i) {
+    serverframework::IOManager::GetThis()->Schedule(&Worker);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  g_env->AddHelp("c", "concurrent fibers, default 64");
+  g_env->AddHelp("d", "duration in seconds, default 3");
+  g_env->AddHelp("p", "pipelined requests per call, default 1");
+  g_env->AddHelp("t", "threads, default 1");
+  g_env->AddHelp("a", "target ip:port, default an in-process server");
+  g_env->AddHelp("path", "request path, default /plaintext");
+  if (!g_env->Init(argc, argv) || g_env->Has("h")) {
+    g_env->PrintHelp();
+    return 0;
+  }
+  serverframework::Config::LoadFromConfDir(g_env->GetConfigPath());
+  s_concurrency = std::max(1, atoi(g_env->Get("c", "64").c_str()));
+  s_duration = std::max(1, atoi(g_env->Get("d", "3").c_str()));
+  s_pipeline = std::max(1, atoi(g_env->Get("p", "1").c_str()));
+  int threads = std::max(1, atoi(g_env->Get("t", "1").c_str()));
+  if (g_env->Has("a")) {
+    s_addr = serverframework::Address::LookupAnyIPAddress(g_env->Get("a"));
+    ASSERT(s_addr);
+  }
+  s_path = g_env->Get("path", "/plaintext");
+  g_logger->SetLevel(serverframework::LogLevel::WARN);
+
+  serverframework::IOManager iom(threads, true, "bench");
+  iom.Schedule(&Run);
+  return 0;
+}
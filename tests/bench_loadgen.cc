@@ -0,0 +1,363 @@
+/**
+ * @file bench_loadgen.cc
+ * @brief 回显协议的负载生成器
+ * @details 每个连接一个或两个协程，请求是指定长度的varint长度前缀帧，服务器按顺序原样返回。
+ *          - 闭环(-r 0)：每个连接保持-p个未完成的请求，收到一个响应就补发一个，测量服务器能承受的最大吞吐；
+ *            延迟从实际发出算起
+ *          - 开环(-r 每秒请求数)：请求按固定的时间表均匀分布到各连接上发出，不受响应快慢的影响，
+ *            落后于时间表时一次补发所有到期的请求；延迟从时间表上应当发出的时刻算起，
+ *            服务器变慢时排队的时间也计入延迟，避免协调遗漏(coordinated omission)
+ *          延迟记录在每个线程的HDR直方图中，结束后合并输出各百分位。默认压测进程内的回显服务器，
+ *          指定-a时压测外部服务器(如bench_echo_server)。
+ *          用法：bench_loadgen -c 连接数 -d 秒数 -s 请求字节数 [-r 每秒请求数 | -p 每连接未完成请求数] -t 线程数 [-a ip:port]
+ */
+#include <algorithm>
+#include <deque>
+#include <iomanip>
+
+#include "serverframework.h"
+
+static serverframework::Logger::ptr g_logger = LOG_ROOT();
+
+static serverframework::Env *g_env = serverframework::EnvMgr::GetInstance();
+
+// 延迟直方图能记录的最大值(微秒)
+static const uint64_t kHighestUS = 60ull * 1000 * 1000;
+// 结束后等待剩余响应的最长时间(毫秒)
+static const uint64_t kDrainMS = 5000;
+
+class EchoServer : public serverframework::FrameServer {
+ protected:
+  bool HandleRequest(serverframework::Connection::ptr conn,
+                     const serverframework::Frame &request,
+                     serverframework::FrameEncoder &out) override {
+    return out.Add(request);
+  }
+};
+
+static serverframework::Address::ptr s_addr;
+static std::shared_ptr<EchoServer> s_server;
+static std::string s_payload;
+static int s_connections = 64;
+static int s_duration = 3;
+static int s_pipeline = 1;
+static uint64_t s_rate = 0;
+static uint64_t s_deadline = 0;
+static uint64_t s_start = 0;
+
+static serverframework::Mutex s_mutex;
+static std::vector<serverframework::Histogram *> s_histograms;
+static uint64_t s_requests = 0;
+static uint64_t s_errors = 0;
+static int s_running = 0;
+
+/**
+ * @brief 当前线程的延迟直方图
+ * @details 协程可能在不同的线程上恢复，每次记录前重新获取
+ */
+static serverframework::Histogram *GetHistogram() {
+  static thread_local serverframework::Histogram *t_histogram = nullptr;
+  if (!t_histogram) {
+    t_histogram = new serverframework::Histogram(kHighestUS);
+    serverframework::Mutex::Lock lock(s_mutex);
+    s_histograms.push_back(t_histogram);
+  }
+  return t_histogram;
+}
+
+/**
+ * @brief 让出当前协程us微秒
+ */
+static void SleepUS(uint64_t us) {
+  serverframework::IOManager *iom = serverframework::IOManager::GetThis();
+  serverframework::Fiber::ptr fiber = serverframework::Fiber::GetThis();
+  int thread = iom->GetAffinityThread();
+  iom->AddTimerUS(us, [iom, fiber, thread]() { iom->Schedule(fiber, thread); });
+  serverframework::Fiber::GetThis()->Yield();
+}
+
+static void Report() {
+  double seconds = (serverframework::Clock::NowMS() - s_start) / 1000.0;
+  serverframework::Histogram latency(kHighestUS);
+  for (auto i : s_histograms) {
+    latency.Merge(*i);
+  }
+  std::cout << "Running " << s_duration << "s "
+            << (s_rate ? "open-loop" : "closed-loop") << " test @ "
+            << s_addr->ToString() << std::endl
+            << "  " << s_connections << " connections, " << s_payload.size()
+            << " bytes payload, ";
+  if (s_rate) {
+    std::cout << "target " << s_rate << " req/s" << std::endl;
+  } else {
+    std::cout << s_pipeline << " outstanding per connection" << std::endl;
+  }
+  uint64_t n = latency.GetCount();
+  if (!n) {
+    std::cout << "  no response, errors=" << s_errors << std::endl;
+    return;
+  }
+  std::cout << "  Latency(us) mean=" << (uint64_t)latency.GetMean()
+            << " max=" << latency.GetMax() << std::endl
+            << "  Latency Distribution (HdrHistogram)" << std::endl;
+  static const double kPercentiles[] = {50,   75,    90,     99,
+                                        99.9, 99.99, 99.999, 100};
+  for (double p : kPercentiles) {
+    std::cout << "  " << std::setw(8) << std::right << p << "% "
+              << std::setw(10) << latency.GetPercentile(p) << "us"
+              << std::endl;
+  }
+  std::cout << "  " << n << " responses of " << s_requests << " requests in "
+            << seconds << "s, errors=" << s_errors << std::endl
+            << "Requests/sec: " << (uint64_t)(n / seconds) << std::endl
+            << "Transfer/sec: "
+            << n * s_payload.size() * 2 / seconds / 1024 / 1024 << "MB"
+            << std::endl;
+}
+
+static void Finish(uint64_t requests, uint64_t errors) {
+  serverframework::Mutex::Lock lock(s_mutex);
+  s_requests += requests;
+  s_errors += errors;
+  if (--s_running == 0) {
+    Report();
+    if (s_server) {
+      s_server->Stop();
+    }
+  }
+}
+
+static serverframework::Socket::ptr Connect() {
+  serverframework::Socket::ptr sock =
+      serverframework::Socket::CreateTCP(s_addr);
+  if (!sock->connect(s_addr, 3000)) {
+    LOG_ERROR(g_logger) << "connect " << s_addr->ToString()
+                        << " fail errno=" << errno;
+    return nullptr;
+  }
+  sock->SetRecvTimeout(kDrainMS);
+  return sock;
+}
+
+/**
+ * @brief 闭环：保持s_pipeline个未完成的请求
+ */
+static void ClosedLoop() {
+  serverframework::Socket::ptr sock = Connect();
+  if (!sock) {
+    Finish(0, 1);
+    return;
+  }
+  serverframework::FrameEncoder encoder;
+  serverframework::FrameDecoder decoder;
+  // 未完成请求的发出时间，响应按顺序返回
+  std::deque<uint64_t> sent;
+  uint64_t requests = 0;
+  uint64_t errors = 0;
+  uint64_t now = serverframework::Clock::NowUS();
+  for (int i = 0; i < s_pipeline; ++i) {
+    encoder.Add(s_payload.data(), s_payload.size());
+    sent.push_back(now);
+  }
+  while (!sent.empty()) {
+    if (encoder.GetFrameCount()) {
+      requests += encoder.GetFrameCount();
+      if (encoder.Flush(sock) < 0) {
+        break;
+      }
+    }
+    int rt = decoder.ReadFrom(sock);
+    if (rt <= 0) {
+      break;
+    }
+    serverframework::Histogram *histogram = GetHistogram();
+    serverframework::Frame frame;
+    now = serverframework::Clock::NowUS();
+    bool running = now / 1000 < s_deadline;
+    while ((rt = decoder.Decode(frame)) > 0) {
+      if (frame.length != s_payload.size() || sent.empty()) {
+        ++errors;
+        continue;
+      }
+      histogram->Record(now - sent.front());
+      sent.pop_front();
+      if (running) {
+        encoder.Add(s_payload.data(), s_payload.size());
+        sent.push_back(now);
+      }
+    }
+    if (rt < 0) {
+      break;
+    }
+  }
+  sock->close();
+  Finish(requests, errors + sent.size());
+}
+
+/**
+ * @brief 开环连接的共享状态
+ */
+struct OpenLoopState {
+  serverframework::Mutex mutex;
+  // 未完成请求按时间表应当发出的时间
+  std::deque<uint64_t> intended;
+  // 发送协程是否已经结束
+  bool done = false;
+};
+
+/**
+ * @brief 开环的接收协程
+ */
+static void OpenLoopReceiver(serverframework::Socket::ptr sock,
+                             std::shared_ptr<OpenLoopState> state) {
+  serverframework::FrameDecoder decoder;
+  uint64_t errors = 0;
+  std::vector<uint64_t> intended;
+  while (true) {
+    {
+      serverframework::Mutex::Lock lock(state->mutex);
+      if (state->done && state->intended.empty()) {
+        break;
+      }
+    }
+    int rt = decoder.ReadFrom(sock);
+    if (rt <= 0) {
+      break;
+    }
+    uint64_t now = serverframework::Clock::NowUS();
+    size_t count = 0;
+    serverframework::Frame frame;
+    while ((rt = decoder.Decode(frame)) > 0) {
+      if (frame.length != s_payload.size()) {
+        ++errors;
+      }
+      ++count;
+    }
+    {
+      serverframework::Mutex::Lock lock(state->mutex);
+      count = std::min(count, state->intended.size());
+      intended.assign(state->intended.begin(),
+                      state->intended.begin() + count);
+      state->intended.erase(state->intended.begin(),
+                            state->intended.begin() + count);
+    }
+    serverframework::Histogram *histogram = GetHistogram();
+    for (auto t : intended) {
+      histogram->Record(now > t ? now - t : 0);
+    }
+    if (rt < 0) {
+      break;
+    }
+  }
+  // 没有收到响应的请求记为错误
+  serverframework::Mutex::Lock lock(state->mutex);
+  errors += state->intended.size();
+  lock.unlock();
+  sock->close();
+  Finish(0, errors);
+}
+
+/**
+ * @brief 开环的发送协程，按时间表发出请求
+ * @param[in] offset_ns 本连接第一个请求相对开始时刻的偏移，使各连接的请求均匀错开
+ */
+static void OpenLoop(uint64_t offset_ns) {
+  serverframework::Socket::ptr sock = Connect();
+  if (!sock) {
+    // 发送和接收协程各计一次
+    Finish(0, 1);
+    Finish(0, 0);
+    return;
+  }
+  std::shared_ptr<OpenLoopState> state(new OpenLoopState);
+  serverframework::IOManager::GetThis()->Schedule(
+      std::bind(&OpenLoopReceiver, sock, state));
+
+  serverframework::FrameEncoder encoder;
+  uint64_t interval_ns = 1000000000ull * s_connections / s_rate;
+  uint64_t next_ns = s_start * 1000000 + offset_ns;
+  uint64_t end_ns = s_deadline * 1000000;
+  uint64_t requests = 0;
+  while (next_ns < end_ns) {
+    uint64_t now = serverframework::Clock::NowUS();
+    {
+      serverframework::Mutex::Lock lock(state->mutex);
+      while (next_ns / 1000 <= now && next_ns < end_ns) {
+        encoder.Add(s_payload.data(), s_payload.size());
+        state->intended.push_back(next_ns / 1000);
+        next_ns += interval_ns;
+      }
+    }
+    if (encoder.GetFrameCount()) {
+      requests += encoder.GetFrameCount();
+      if (encoder.Flush(sock) < 0) {
+        break;
+      }
+    }
+    if (next_ns < end_ns) {
+      SleepUS(next_ns / 1000 - std::min(now, next_ns / 1000));
+    }
+  }
+  {
+    serverframework::Mutex::Lock lock(state->mutex);
+    state->done = true;
+    // 响应都已收到时接收协程可能还在等待读取，唤醒它
+    if (state->intended.empty()) {
+      ::shutdown(sock->GetSocket(), SHUT_RDWR);
+    }
+  }
+  Finish(requests, 0);
+}
+
+static void Run() {
+  if (!s_addr) {
+    s_addr = serverframework::Address::LookupAnyIPAddress("127.0.0.1:12053");
+    s_server.reset(new EchoServer);
+    bool ok = s_server->bind(s_addr) && s_server->Start();
+    ASSERT(ok);
+  }
+  serverframework::IOManager *iom = serverframework::IOManager::GetThis();
+  s_start = serverframework::Clock::NowMS();
+  s_deadline = s_start + s_duration * 1000;
+  // 开环每个连接有发送和接收两个协程
+  s_running = s_rate ? s_connections * 2 : s_connections;
+  uint64_t interval_ns = s_rate ? 1000000000ull * s_connections / s_rate : 0;
+  for (int i = 0; i < s_connections; ++i) {
+    if (s_rate) {
+      iom->Schedule(std::bind(&OpenLoop, interval_ns * i / s_connections));
+    } else {
+      iom->Schedule(&ClosedLoop);
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  g_env->AddHelp("c", "connections, default 64");
+  g_env->AddHelp("d", "duration in seconds, default 3");
+  g_env->AddHelp("s", "request payload bytes, default 16");
+  g_env->AddHelp("r", "open-loop total requests per second, 0 for closed-loop");
+  g_env->AddHelp("p", "closed-loop outstanding requests per connection, "
+                      "default 1");
+  g_env->AddHelp("t", "threads, default 1");
+  g_env->AddHelp("a", "target ip:port, default an in-process echo server");
+  if (!g_env->Init(argc, argv) || g_env->Has("h")) {
+    g_env->PrintHelp();
+    return 0;
+  }
+  serverframework::Config::LoadFromConfDir(g_env->GetConfigPath());
+  s_connections = std::max(1, atoi(g_env->Get("c", "64").c_str()));
+  s_duration = std::max(1, atoi(g_env->Get("d", "3").c_str()));
+  s_payload.assign(std::max(0, atoi(g_env->Get("s", "16").c_str())), 'x');
+  s_rate = strtoull(g_env->Get("r", "0").c_str(), nullptr, 10);
+  s_pipeline = std::max(1, atoi(g_env->Get("p", "1").c_str()));
+  int threads = std::max(1, atoi(g_env->Get("t", "1").c_str()));
+  if (g_env->Has("a")) {
+    s_addr = serverframework::Address::LookupAnyIPAddress(g_env->Get("a"));
+    ASSERT(s_addr);
+  }
+  g_logger->SetLevel(serverframework::LogLevel::WARN);
+
+  serverframework::IOManager iom(threads, true, "loadgen");
+  iom.Schedule(&Run);
+  return 0;
+}
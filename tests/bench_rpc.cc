@@ -0,0 +1,153 @@
+/**
+ * @file bench_rpc.cc
+ * @brief RPC压测
+ * @details 每个连接上多个协程循环调用进程内RpcServer的内联echo方法直到指定的时间，
+ *          同一连接上的请求和响应分别在发送缓冲区中合并后批量发出。指定-a时压测外部服务器。
+ *          用法：bench_rpc -c 连接数 -f 每个连接的协程数 -d 秒数 -s 请求字节数 -t 线程数 [-w 超时毫秒] [-a ip:port]
+ */
+#include <algorithm>
+
+#include "serverframework.h"
+
+static serverframework::Logger::ptr g_logger = LOG_ROOT();
+
+static serverframework::Env *g_env = serverframework::EnvMgr::GetInstance();
+
+static serverframework::Address::ptr s_addr;
+static serverframework::RpcServer::ptr s_server;
+static std::vector<serverframework::RpcClient::ptr> s_clients;
+static std::string s_payload;
+static int s_connections = 1;
+static int s_fibers = 64;
+static int s_duration = 3;
+static uint64_t s_timeout = -1;
+static uint64_t s_deadline = 0;
+static uint64_t s_start = 0;
+
+static serverframework::Mutex s_mutex;
+static std::vector<uint64_t> s_latencies;
+static uint64_t s_errors = 0;
+static int s_running = 0;
+
+static void Report() {
+  double seconds = (serverframework::Clock::NowMS() - s_start) / 1000.0;
+  std::sort(s_latencies.begin(), s_latencies.end());
+  size_t n = s_latencies.size();
+  std::cout << "Running " << s_duration << "s rpc test @ " << s_addr->ToString()
+            << std::endl
+            << "  " << s_connections << " connections, " << s_fibers
+            << " fibers per connection, " << s_payload.size()
+            << " bytes payload" << std::endl;
+  if (!n) {
+    std::cout << "  no response, errors=" << s_errors << std::endl;
+    return;
+  }
+  uint64_t sum = 0;
+  for (auto v : s_latencies) {
+    sum += v;
+  }
+  auto pct = [n](double p) {
+    return s_latencies[std::min(n - 1, (size_t)(n * p))];
+  };
+  std::cout << "  Latency(us) avg=" << sum / n << " p50=" << pct(0.5)
+            << " p90=" << pct(0.9) << " p99=" << pct(0.99)
+            << " max=" << s_latencies[n - 1] << std::endl
+            << "  " << n << " calls in " << seconds << "s, errors=" << s_errors
+            << std::endl
+            << "Calls/sec: " << (uint64_t)(n / seconds) << std::endl;
+}
+
+static void Worker(serverframework::RpcClient::ptr client) {
+  std::vector<uint64_t> latencies;
+  uint64_t errors = 0;
+  while (serverframework::Clock::NowMS() < s_deadline) {
+    uint64_t begin = serverframework::Clock::NowUS();
+    serverframework::RpcResult result = client->Call("echo", s_payload, s_timeout);
+    if (result.ok()) {
+      latencies.push_back(serverframework::Clock::NowUS() - begin);
+    } else {
+      ++errors;
+      if (result.status == serverframework::RPC_CLOSED) {
+        break;
+      }
+    }
+  }
+
+  serverframework::Mutex::Lock lock(s_mutex);
+  s_latencies.insert(s_latencies.end(), latencies.begin(), latencies.end());
+  s_errors += errors;
+  if (--s_running == 0) {
+    Report();
+    for (auto &i : s_clients) {
+      i->Close();
+    }
+    s_clients.clear();
+    if (s_server) {
+      s_server->Stop();
+    }
+  }
+}
+
+static void Run() {
+  if (!s_addr) {
+    s_addr = serverframework::Address::LookupAnyIPAddress("127.0.0.1:12051");
+    s_server.reset(new serverframework::RpcServer);
+    s_server->Register(
+        "echo",
+        [](serverframework::RpcContext::ptr ctx, const std::string &request,
+           std::string &response) {
+          response = request;
+          return 0;
+        },
+        true);
+    bool ok = s_server->bind(s_addr) && s_server->Start();
+    ASSERT(ok);
+  }
+  for (int i = 0; i < s_connections; ++i) {
+    serverframework::RpcClient::ptr client(new serverframework::RpcClient);
+    bool connected = client->Connect(s_addr);
+    ASSERT(connected);
+    s_clients.push_back(client);
+  }
+  s_start = serverframework::Clock::NowMS();
+  s_deadline = s_start + s_duration * 1000;
+  s_running = s_connections * s_fibers;
+  for (auto &client : s_clients) {
+    for (int i = 0; i < s_fibers; ++i) {
+      serverframework::IOManager::GetThis()->Schedule(
+          std::bind(&Worker, client));
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  g_env->AddHelp("c", "connections, default 1");
+  g_env->AddHelp("f", "concurrent fibers per connection, default 64");
+  g_env->AddHelp("d", "duration in seconds, default 3");
+  g_env->AddHelp("s", "request payload bytes, default 16");
+  g_env->AddHelp("t", "threads, default 1");
+  g_env->AddHelp("w", "call timeout in ms, 0 means none, default rpc.timeout");
+  g_env->AddHelp("a", "target ip:port, default an in-process server");
+  if (!g_env->Init(argc, argv) || g_env->Has("h")) {
+    g_env->PrintHelp();
+    return 0;
+  }
+  serverframework::Config::LoadFromConfDir(g_env->GetConfigPath());
+  s_connections = std::max(1, atoi(g_env->Get("c", "1").c_str()));
+  s_fibers = std::max(1, atoi(g_env->Get("f", "64").c_str()));
+  s_duration = std::max(1, atoi(g_env->Get("d", "3").c_str()));
+  s_payload.assign(std::max(0, atoi(g_env->Get("s", "16").c_str())), 'x');
+  int threads = std::max(1, atoi(g_env->Get("t", "1").c_str()));
+  if (g_env->Has("w")) {
+    s_timeout = strtoull(g_env->Get("w").c_str(), nullptr, 10);
+  }
+  if (g_env->Has("a")) {
+    s_addr = serverframework::Address::LookupAnyIPAddress(g_env->Get("a"));
+    ASSERT(s_addr);
+  }
+  g_logger->SetLevel(serverframework::LogLevel::WARN);
+
+  serverframework::IOManager iom(threads, true, "bench");
+  iom.Schedule(&Run);
+  return 0;
+}
@@ -0,0 +1,110 @@
+/**
+ * @file test_accept.cc
+ * @brief Socket::accept建连速率测试
+ * @details 先校验accept得到的socket：对端地址与客户端的本地地址一致，fd为非阻塞、close-on-exec，
+ *          并且从监听socket继承了TCP_NODELAY。
+ *          然后在回环地址上测每秒建立的连接数，对比accept之后立即获取本地和远端地址(旧的行为)
+ *          与不获取地址两种情况。客户端用SO_LINGER为0的方式关闭连接，避免TIME_WAIT耗尽端口
+ */
+#include <fcntl.h>
+
+#include "serverframework.h"
+
+static serverframework::Logger::ptr g_logger = LOG_ROOT();
+
+static const int kConnections = 20000;
+static const int kClients = 8;
+
+static serverframework::Address::ptr s_addr;
+
+static void Client(int count) {
+  struct linger lg;
+  lg.l_onoff = 1;
+  lg.l_linger = 0;
+  for (int i = 0; i < count; ++i) {
+    serverframework::Socket::ptr sock =
+        serverframework::Socket::CreateTCP(s_addr);
+    bool connected = sock->connect(s_addr);
+    ASSERT(connected);
+    sock->SetOption(SOL_SOCKET, SO_LINGER, lg);
+    sock->close();
+  }
+}
+
+static void test_accept() {
+  serverframework::Socket::ptr listener =
+      serverframework::Socket::CreateTCP(s_addr);
+  bool ok = listener->bind(s_addr) && listener->listen();
+  ASSERT(ok);
+
+  serverframework::Socket::ptr client =
+      serverframework::Socket::CreateTCP(s_addr);
+  ok = client->connect(s_addr);
+  ASSERT(ok);
+  serverframework::Socket::ptr conn = listener->accept();
+  ASSERT(conn);
+  ASSERT(conn->GetRemoteAddress()->ToString() ==
+         client->GetLocalAddress()->ToString());
+  ASSERT(conn->GetLocalAddress()->ToString() == s_addr->ToString());
+
+  int fd = conn->GetSocket();
+  // hook的fcntl对用户隐藏了O_NONBLOCK，这里看真实的标志
+  ASSERT(fcntl_f(fd, F_GETFL) & O_NONBLOCK);
+  ASSERT(fcntl(fd, F_GETFD) & FD_CLOEXEC);
+  int nodelay = 0;
+  ASSERT(conn->GetOption(IPPROTO_TCP, TCP_NODELAY, nodelay) && nodelay);
+
+  client->close();
+  listener->close();
+  conn->close();
+  // 对端地址取自accept4，关闭之后依然可以取到
+  LOG_INFO(g_logger) << "accept semantics ok, peer="
+                     << conn->GetRemoteAddress()->ToString();
+}
+
+static void bench(bool eager) {
+  serverframework::Socket::ptr listener =
+      serverframework::Socket::CreateTCP(s_addr);
+  bool ok = listener->bind(s_addr) && listener->listen(1024);
+  ASSERT(ok);
+
+  for (int i = 0; i < kClients; ++i) {
+    serverframework::IOManager::GetThis()->Schedule(
+        std::bind(&Client, kConnections / kClients));
+  }
+
+  uint64_t begin = serverframework::GetCurrentUS();
+  for (int i = 0; i < kConnections; ++i) {
+    serverframework::Socket::ptr conn = listener->accept();
+    ASSERT(conn);
+    if (eager) {
+      conn->GetLocalAddress();
+      conn->GetRemoteAddress();
+    }
+    conn->close();
+  }
+  uint64_t cost = serverframework::GetCurrentUS() - begin;
+  std::cout << (eager ? "eager addresses: " : "lazy addresses : ")
+            << kConnections << " connections in " << cost / 1000 << "ms, "
+            << (uint64_t)kConnections * 1000000 / (cost + 1) << " conn/s"
+            << std::endl;
+  listener->close();
+}
+
+int main(int argc, char *argv[]) {
+  serverframework::EnvMgr::GetInstance()->Init(argc, argv);
+  serverframework::Config::LoadFromConfDir(
+      serverframework::EnvMgr::GetInstance()->GetConfigPath());
+
+  s_addr = serverframework::Address::LookupAnyIPAddress("127.0.0.1:12036");
+  ASSERT(s_addr);
+  {
+    serverframework::IOManager iom(1, true, "accept");
+    iom.Schedule(&test_accept);
+  }
+  for (bool eager : {true, false}) {
+    serverframework::IOManager iom(1, true, "accept");
+    iom.Schedule(std::bind(&bench, eager));
+  }
+  return 0;
+}
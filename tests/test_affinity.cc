@@ -0,0 +1,133 @@
+/**
+ * @file test_affinity.cc
+ * @brief 连接亲和模式测试
+ * @details 4线程的IOManager上运行echo服务器，客户端用长连接反复收发，中途sleep一次。
+ *          服务端记录每个连接的协程在收发之间换了几次线程。亲和模式下校验连接不会迁移、
+ *          连接分散到所有线程，并和默认模式对比迁移次数与每秒完成的请求数
+ */
+#include <set>
+
+#include "serverframework.h"
+
+static serverframework::Logger::ptr g_logger = LOG_ROOT();
+
+static const int kThreads = 4;
+static const int kClients = 32;
+static const int kRounds = 2000;
+
+static serverframework::Address::ptr s_addr;
+
+class EchoServer : public serverframework::TcpServer {
+ public:
+  EchoServer(serverframework::IOManager *iom) : TcpServer(iom, iom) {}
+
+  uint64_t GetMigrations() const { return migrations_; }
+
+  size_t GetThreadCount() {
+    serverframework::Mutex::Lock lock(mutex_);
+    return threads_.size();
+  }
+
+ protected:
+  void HandleClient(serverframework::Socket::ptr client) override {
+    int thread = serverframework::GetThreadId();
+    {
+      serverframework::Mutex::Lock lock(mutex_);
+      threads_.insert(thread);
+    }
+    char buf[64];
+    int n;
+    while ((n = client->recv(buf, sizeof(buf))) > 0) {
+      if (std::string(buf, n) == "sleep") {
+        usleep(1000);
+      }
+      if (serverframework::GetThreadId() != thread) {
+        ++migrations_;
+        thread = serverframework::GetThreadId();
+      }
+      if (client->send(buf, n) != n) {
+        break;
+      }
+    }
+    client->close();
+  }
+
+ private:
+  serverframework::Mutex mutex_;
+  std::set<int> threads_;
+  std::atomic<uint64_t> migrations_ = {0};
+};
+
+static void Client(std::shared_ptr<int> done) {
+  serverframework::Socket::ptr sock =
+      serverframework::Socket::CreateTCP(s_addr);
+  bool connected = sock->connect(s_addr, 3000);
+  ASSERT(connected);
+  char buf[64];
+  for (int i = 0; i < kRounds; ++i) {
+    std::string msg = i == kRounds / 2 ? "sleep" : "ping";
+    int rt = sock->send(msg.data(), msg.size());
+    ASSERT(rt == (int)msg.size());
+    rt = sock->recv(buf, sizeof(buf));
+    ASSERT(rt == (int)msg.size());
+  }
+  sock->close();
+  ++*done;
+}
+
+static void Run(bool affinity) {
+  serverframework::Config::Lookup<bool>("iomanager.affinity")
+      ->SetValue(affinity);
+  serverframework::IOManager server_iom(kThreads, false, "server");
+  ASSERT(server_iom.IsAffinity() == affinity);
+  std::shared_ptr<EchoServer> server(new EchoServer(&server_iom));
+  // 在调度器的协程中bind，监听socket才是hook过的非阻塞socket；
+  // 等服务器开始监听后再启动客户端
+  serverframework::Semaphore started;
+  bool ok = false;
+  server_iom.Schedule([server, &started, &ok]() {
+    ok = server->bind(s_addr) && server->Start();
+    started.notify();
+  });
+  started.wait();
+  ASSERT(ok);
+
+  uint64_t begin = serverframework::GetCurrentUS();
+  {
+    serverframework::IOManager client_iom(1, true, "client");
+    client_iom.Schedule([]() {
+      std::shared_ptr<int> done(new int(0));
+      for (int i = 0; i < kClients; ++i) {
+        serverframework::IOManager::GetThis()->Schedule(
+            std::bind(&Client, done));
+      }
+      while (*done < kClients) {
+        usleep(10 * 1000);
+      }
+    });
+  }
+  uint64_t cost = serverframework::GetCurrentUS() - begin;
+  server->Stop();
+
+  std::cout << (affinity ? "affinity: " : "default : ")
+            << (uint64_t)kClients * kRounds * 1000000 / (cost + 1)
+            << " req/s, " << server->GetMigrations()
+            << " migrations, connections on " << server->GetThreadCount()
+            << " threads" << std::endl;
+  if (affinity) {
+    ASSERT(server->GetMigrations() == 0);
+    ASSERT(server->GetThreadCount() == kThreads);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  serverframework::EnvMgr::GetInstance()->Init(argc, argv);
+  serverframework::Config::LoadFromConfDir(
+      serverframework::EnvMgr::GetInstance()->GetConfigPath());
+
+  s_addr = serverframework::Address::LookupAnyIPAddress("127.0.0.1:12042");
+  ASSERT(s_addr);
+  Run(false);
+  Run(true);
+  return 0;
+}
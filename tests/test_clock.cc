@@ -0,0 +1,149 @@
+/**
+ * @file test_clock.cc
+ * @brief 时钟测试
+ * @details 统计各种取时间方式每秒可以调用的次数，并检查各时钟源之间的一致性，
+ *          以及TSC时钟跨过几次重新对齐后仍然单调、与CLOCK_MONOTONIC的偏差没有累积
+ */
+#include <iomanip>
+
+#include "serverframework.h"
+
+static serverframework::Logger::ptr g_logger = LOG_ROOT();
+
+static const int kCalls = 5 * 1000 * 1000;
+
+// 防止编译器优化掉取时间的调用
+static volatile uint64_t s_sink = 0;
+
+template <class Func>
+static void bench(const std::string &name, Func func) {
+  uint64_t begin = serverframework::GetCurrentUS();
+  uint64_t sum = 0;
+  for (int i = 0; i < kCalls; ++i) {
+    sum += func();
+  }
+  s_sink = sum;
+  uint64_t cost = serverframework::GetCurrentUS() - begin;
+  std::cout << std::setw(36) << std::left << name << std::setw(12)
+            << std::right << (uint64_t)kCalls * 1000000 / (cost + 1)
+            << " calls/s" << std::setw(10) << std::fixed
+            << std::setprecision(1) << cost * 1000.0 / kCalls << " ns/call"
+            << std::endl;
+}
+
+static void check_source(serverframework::Clock::Source source) {
+  if (!serverframework::Clock::SetSource(source)) {
+    std::cout << serverframework::Clock::ToString(source)
+              << " not supported on this machine" << std::endl;
+    return;
+  }
+  // 与CLOCK_MONOTONIC比较，coarse最多慢一个jiffy
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  uint64_t mono = ts.tv_sec * 1000000ul + ts.tv_nsec / 1000;
+  uint64_t now = serverframework::Clock::NowUS();
+  int64_t diff = (int64_t)now - (int64_t)mono;
+  LOG_INFO(g_logger) << serverframework::Clock::ToString(source)
+                     << " - CLOCK_MONOTONIC = " << diff << "us";
+  ASSERT(diff > -20 * 1000 && diff < 20 * 1000);
+
+  uint64_t last = 0;
+  for (int i = 0; i < 100000; ++i) {
+    uint64_t t = serverframework::Clock::NowUS();
+    ASSERT(t >= last);
+    last = t;
+  }
+  bench("Clock::NowUS() " + serverframework::Clock::ToString(source),
+        []() { return serverframework::Clock::NowUS(); });
+}
+
+static int64_t DiffToMonotonic() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  uint64_t mono = ts.tv_sec * 1000000ul + ts.tv_nsec / 1000;
+  return (int64_t)serverframework::Clock::NowUS() - (int64_t)mono;
+}
+
+/**
+ * @brief TSC时钟每秒重新对齐一次，对齐前后读数连续
+ */
+static void check_tsc_resync() {
+  if (!serverframework::Clock::SetSource(serverframework::Clock::TSC)) {
+    return;
+  }
+  uint64_t last = 0;
+  int64_t max_diff = 0;
+  for (int i = 0; i < 250; ++i) {
+    uint64_t t = serverframework::Clock::NowUS();
+    ASSERT(t >= last);
+    last = t;
+    int64_t diff = DiffToMonotonic();
+    max_diff = std::max(max_diff, diff < 0 ? -diff : diff);
+    usleep(10 * 1000);
+  }
+  int64_t diff = DiffToMonotonic();
+  LOG_INFO(g_logger) << "tsc after resync - CLOCK_MONOTONIC = " << diff
+                     << "us, max " << max_diff << "us, hz="
+                     << serverframework::Clock::GetTscHz();
+  ASSERT(diff > -1000 && diff < 1000);
+}
+
+/**
+ * @brief 长任务之后添加的定时器不能提前触发
+ * @details 缓存的时间戳停在本轮任务开始时，定时器的起始时间必须读时钟
+ */
+static void check_late_timer() {
+  static const uint64_t kBusyUS = 80 * 1000;
+  static const uint64_t kTimerMS = 100;
+  uint64_t armed_at = 0;
+  uint64_t fired_at = 0;
+  {
+    serverframework::IOManager iom(1, false, "late_timer");
+    iom.Schedule([&armed_at, &fired_at]() {
+      uint64_t begin = serverframework::Clock::NowUS();
+      while (serverframework::Clock::NowUS() - begin < kBusyUS) {
+      }
+      armed_at = serverframework::Clock::NowUS();
+      serverframework::IOManager::GetThis()->AddTimer(kTimerMS, [&fired_at]() {
+        fired_at = serverframework::Clock::NowUS();
+      });
+    });
+    iom.Stop();
+  }
+  uint64_t elapsed = fired_at - armed_at;
+  LOG_INFO(g_logger) << kTimerMS << "ms timer armed after " << kBusyUS
+                     << "us busy task fired after " << elapsed << "us";
+  ASSERT(fired_at && elapsed >= kTimerMS * 1000);
+}
+
+int main(int argc, char *argv[]) {
+  serverframework::EnvMgr::GetInstance()->Init(argc, argv);
+  serverframework::Config::LoadFromConfDir(
+      serverframework::EnvMgr::GetInstance()->GetConfigPath());
+
+  bench("clock_gettime(CLOCK_MONOTONIC_RAW)", []() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return ts.tv_sec * 1000000ul + ts.tv_nsec / 1000;
+  });
+  bench("time(0)", []() { return (uint64_t)time(0); });
+
+  check_source(serverframework::Clock::MONOTONIC);
+  check_source(serverframework::Clock::COARSE);
+  check_source(serverframework::Clock::TSC);
+  if (serverframework::Clock::GetTscHz()) {
+    LOG_INFO(g_logger) << "tsc hz=" << serverframework::Clock::GetTscHz();
+  }
+  check_tsc_resync();
+
+  serverframework::Clock::Update();
+  bench("Clock::CachedUS()", []() { return serverframework::Clock::CachedUS(); });
+  bench("Clock::WallSeconds()",
+        []() { return (uint64_t)serverframework::Clock::WallSeconds(); });
+  ASSERT(serverframework::Clock::WallSeconds() - time(0) <= 1);
+  serverframework::Clock::Invalidate();
+
+  serverframework::Clock::SetSource(serverframework::Clock::MONOTONIC);
+  check_late_timer();
+  return 0;
+}
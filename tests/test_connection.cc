@@ -0,0 +1,211 @@
+/**
+ * @file test_connection.cc
+ * @brief TcpServer连接登记测试
+ * @details 最大连接数为4时第5个连接被直接关闭；空闲超时后没有数据往来的连接被回收，
+ *          持续收发的连接保留；服务端缓冲超过预算时停止读取，缓冲的峰值不超过预算加一次读取的长度；
+ *          多个线程同时登记连接时不会超过最大连接数
+ */
+#include <algorithm>
+
+#include "serverframework.h"
+
+static serverframework::Logger::ptr g_logger = LOG_ROOT();
+
+static const size_t kBudget = 256 * 1024;
+static const size_t kChunk = 64 * 1024;
+static const size_t kFlood = 4 * 1024 * 1024;
+
+static serverframework::Address::ptr s_addr;
+
+class TestServer : public serverframework::TcpServer {
+ public:
+  size_t GetMaxBuffered() const { return max_buffered_; }
+  size_t GetConsumed() const { return consumed_; }
+
+ protected:
+  void HandleConnection(serverframework::Connection::ptr conn) override {
+    serverframework::Socket::ptr client = conn->GetSocket();
+    std::vector<char> buf(kChunk);
+    if (client->recv(&buf[0], 1, MSG_PEEK) == 1 && buf[0] == 'F') {
+      Flood(conn);
+    } else {
+      int n;
+      while ((n = client->recv(&buf[0], buf.size())) > 0 &&
+             client->send(&buf[0], n) == n) {
+      }
+    }
+    client->close();
+  }
+
+ private:
+  /**
+   * @brief 读入的数据记入缓冲，由另一个协程慢慢消费
+   */
+  void Flood(serverframework::Connection::ptr conn) {
+    std::shared_ptr<bool> eof(new bool(false));
+    serverframework::IOManager::GetThis()->Schedule([this, conn, eof]() {
+      while (!*eof || conn->GetBuffered()) {
+        usleep(2000);
+        size_t n = std::min(conn->GetBuffered(), kChunk / 2);
+        conn->Release(n);
+        consumed_ += n;
+      }
+    });
+    std::vector<char> buf(kChunk);
+    while (conn->WaitBudget()) {
+      int n = conn->GetSocket()->recv(&buf[0], buf.size());
+      if (n <= 0) {
+        break;
+      }
+      conn->Reserve(n);
+      max_buffered_ = std::max(max_buffered_.load(), conn->GetBuffered());
+    }
+    *eof = true;
+    while (conn->GetBuffered()) {
+      usleep(1000);
+    }
+  }
+
+ private:
+  std::atomic<size_t> max_buffered_{0};
+  std::atomic<size_t> consumed_{0};
+};
+
+static serverframework::Socket::ptr Connect() {
+  serverframework::Socket::ptr sock =
+      serverframework::Socket::CreateTCP(s_addr);
+  sock->SetRecvTimeout(3000);
+  bool connected = sock->connect(s_addr, 3000);
+  ASSERT(connected);
+  return sock;
+}
+
+static bool Ping(serverframework::Socket::ptr sock) {
+  char c;
+  return sock->send("p", 1) == 1 && sock->recv(&c, 1) == 1 && c == 'p';
+}
+
+template <class F>
+static bool WaitFor(F cond, int timeout_ms = 3000) {
+  for (int i = 0; i < timeout_ms / 10 && !cond(); ++i) {
+    usleep(10 * 1000);
+  }
+  return cond();
+}
+
+static void TestConcurrentAdd() {
+  static const int kMax = 8;
+  static const int kThreads = 4;
+  static const int kAdds = 1000;
+  serverframework::ConnectionRegistry registry(0, kMax);
+  serverframework::Socket::ptr sock =
+      serverframework::Socket::CreateTCPSocket();
+  serverframework::Mutex mutex;
+  std::vector<serverframework::Connection::ptr> added;
+  std::vector<serverframework::Thread::ptr> threads;
+  for (int i = 0; i < kThreads; ++i) {
+    threads.emplace_back(new serverframework::Thread(
+        [&]() {
+          for (int j = 0; j < kAdds; ++j) {
+            serverframework::Connection::ptr conn = registry.Add(sock, 0);
+            if (conn) {
+              serverframework::Mutex::Lock lock(mutex);
+              added.push_back(conn);
+            }
+          }
+        },
+        "add_" + std::to_string(i)));
+  }
+  for (auto &i : threads) {
+    i->Join();
+  }
+  std::cout << "concurrent add: " << added.size() << " added, "
+            << registry.GetRejectedCount() << " rejected" << std::endl;
+  ASSERT(added.size() == kMax && registry.GetCount() == kMax);
+  ASSERT(registry.GetRejectedCount() == kThreads * kAdds - kMax);
+  for (auto &conn : added) {
+    registry.Remove(conn);
+  }
+  ASSERT(registry.GetCount() == 0);
+}
+
+static void Run() {
+  std::shared_ptr<TestServer> server(new TestServer);
+  server->SetMaxConnections(4);
+  server->SetIdleTimeout(300);
+  server->SetConnectionBudget(kBudget);
+  bool ok = server->bind(s_addr) && server->Start();
+  ASSERT(ok);
+  const serverframework::ConnectionRegistry &conns = server->GetConnections();
+
+  // 超过最大连接数的连接被直接关闭
+  std::vector<serverframework::Socket::ptr> socks;
+  for (int i = 0; i < 4; ++i) {
+    socks.push_back(Connect());
+    ok = Ping(socks.back());
+    ASSERT(ok);
+  }
+  serverframework::Socket::ptr extra = Connect();
+  char c;
+  bool served = extra->send("p", 1) == 1 && extra->recv(&c, 1) > 0;
+  ASSERT(!served);
+  ASSERT(conns.GetCount() == 4 && conns.GetRejectedCount() == 1);
+  socks[2]->close();
+  socks[3]->close();
+  ok = WaitFor([&conns]() { return conns.GetCount() == 2; });
+  ASSERT(ok);
+  std::cout << "max connections: 4 served, " << conns.GetRejectedCount()
+            << " rejected" << std::endl;
+
+  // 持续收发的连接保留，没有数据往来的连接被回收
+  for (int i = 0; i < 16; ++i) {
+    ok = Ping(socks[0]);
+    ASSERT(ok);
+    usleep(50 * 1000);
+  }
+  int rt = socks[1]->recv(&c, 1);
+  ASSERT(rt == 0);
+  ok = Ping(socks[0]);
+  ASSERT(ok);
+  ASSERT(conns.GetReapedCount() == 1);
+  std::cout << "idle timeout: " << conns.GetReapedCount()
+            << " reaped, active connection kept" << std::endl;
+
+  // 超过缓冲预算时服务端停止读取
+  serverframework::Socket::ptr flood = Connect();
+  std::vector<char> data(kChunk, 'F');
+  size_t buffered = 0;
+  for (size_t sent = 0; sent < kFlood;) {
+    int n = flood->send(&data[0], std::min(data.size(), kFlood - sent));
+    ASSERT(n > 0);
+    sent += n;
+    buffered = std::max(buffered, (size_t)conns.GetBuffered());
+  }
+  flood->close();
+  ok = WaitFor([&server]() { return server->GetConsumed() == kFlood; }) &&
+       WaitFor([&conns]() { return conns.GetBuffered() == 0; });
+  ASSERT(ok);
+  std::cout << "budget: max buffered " << server->GetMaxBuffered()
+            << " bytes, registry saw " << buffered << " bytes" << std::endl;
+  ASSERT(buffered > 0);
+  ASSERT(server->GetMaxBuffered() <= kBudget + kChunk);
+
+  socks[0]->close();
+  ok = WaitFor([&conns]() { return conns.GetCount() == 0; });
+  ASSERT(ok);
+  std::cout << server->ToString();
+  server->Stop();
+}
+
+int main(int argc, char *argv[]) {
+  serverframework::EnvMgr::GetInstance()->Init(argc, argv);
+  serverframework::Config::LoadFromConfDir(
+      serverframework::EnvMgr::GetInstance()->GetConfigPath());
+
+  s_addr = serverframework::Address::LookupAnyIPAddress("127.0.0.1:12043");
+  ASSERT(s_addr);
+  TestConcurrentAdd();
+  serverframework::IOManager iom(2, true, "main");
+  iom.Schedule(&Run);
+  return 0;
+}
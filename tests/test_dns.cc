@@ -0,0 +1,296 @@
+/**
+ * @file test_dns.cc
+ * @brief 异步DNS解析测试
+ * @details 在回环地址上起一个简单的DNS服务器，记录每个名字收到的查询数，校验：
+ *          1. 解析结果和CNAME跟随，A/AAAA/AF_UNSPEC
+ *          2. 按TTL缓存，过期后重新查询
+ *          3. NXDOMAIN按SOA的TTL做否定缓存
+ *          4. 多个协程同时解析同一个名字时只发出一个查询
+ *          5. 第一个服务器不可用时换下一个服务器
+ *          6. Address::Lookup在协程中走异步解析
+ *          7. UDP应答被截断时改用TCP重查，截断的应答不缓存
+ */
+#include <arpa/inet.h>
+
+#include <map>
+
+#include "serverframework.h"
+
+static serverframework::Logger::ptr g_logger = LOG_ROOT();
+
+static serverframework::IPAddress::ptr s_server_addr;
+static serverframework::IPAddress::ptr s_dead_addr;
+static std::map<std::string, int> s_queries;
+static std::map<std::string, int> s_tcp_queries;
+
+static void WriteU16(std::string &buf, uint16_t v) {
+  buf.push_back(v >> 8);
+  buf.push_back(v & 0xff);
+}
+
+static void WriteU32(std::string &buf, uint32_t v) {
+  WriteU16(buf, v >> 16);
+  WriteU16(buf, v & 0xffff);
+}
+
+/**
+ * @brief 追加一条资源记录，名字用指向问题部分的压缩指针
+ */
+static void AddRecord(std::string &buf, uint16_t type, uint32_t ttl,
+                      const std::string &rdata) {
+  WriteU16(buf, 0xc00c);
+  WriteU16(buf, type);
+  WriteU16(buf, 1);
+  WriteU32(buf, ttl);
+  WriteU16(buf, rdata.size());
+  buf += rdata;
+}
+
+static std::string Ipv4(const char *ip) {
+  in_addr addr;
+  inet_pton(AF_INET, ip, &addr);
+  return std::string((const char *)&addr, 4);
+}
+
+static std::string Ipv6(const char *ip) {
+  in6_addr addr;
+  inet_pton(AF_INET6, ip, &addr);
+  return std::string((const char *)&addr, 16);
+}
+
+/**
+ * @brief 按问题构造应答
+ * @param[in] tcp 是否是TCP上的查询，big.test的UDP应答只带TC位
+ */
+static std::string Answer(const std::string &query, std::string &name,
+                          bool tcp) {
+  size_t pos = 12;
+  while (pos < query.size() && query[pos]) {
+    if (!name.empty()) {
+      name.push_back('.');
+    }
+    name.append(query, pos + 1, (uint8_t)query[pos]);
+    pos += 1 + (uint8_t)query[pos];
+  }
+  uint16_t qtype = ((uint8_t)query[pos + 1] << 8) | (uint8_t)query[pos + 2];
+  std::string rt = query.substr(0, pos + 5);
+  // QR RD RA
+  uint16_t flags = 0x8180;
+  uint16_t ancount = 0;
+  uint16_t nscount = 0;
+  std::string records;
+  if (name == "a.test" || name == "slow.test") {
+    if (qtype == 1) {
+      AddRecord(records, 1, 1, Ipv4("10.0.0.1"));
+      ancount = 1;
+    }
+  } else if (name == "alias.test") {
+    if (qtype == 1) {
+      // CNAME到real.test，rdata中的名字不压缩
+      AddRecord(records, 5, 300, std::string("\x04real\x04test\x00", 11));
+      AddRecord(records, 1, 300, Ipv4("10.0.0.2"));
+      ancount = 2;
+    }
+  } else if (name == "big.test") {
+    if (qtype == 1) {
+      if (tcp) {
+        AddRecord(records, 1, 300, Ipv4("10.0.0.3"));
+        ancount = 1;
+      } else {
+        // UDP上放不下，只回TC位，不带记录
+        flags |= 0x0200;
+      }
+    }
+  } else if (name == "six.test") {
+    if (qtype == 28) {
+      AddRecord(records, 28, 300, Ipv6("fd00::6"));
+      ancount = 1;
+    }
+  } else {
+    // NXDOMAIN，SOA的TTL为60，MINIMUM为1，否定缓存1秒
+    flags |= 3;
+    std::string soa("\x00\x00", 2);
+    WriteU32(soa, 1);
+    WriteU32(soa, 3600);
+    WriteU32(soa, 600);
+    WriteU32(soa, 86400);
+    WriteU32(soa, 1);
+    AddRecord(records, 6, 60, soa);
+    nscount = 1;
+  }
+  rt[2] = flags >> 8;
+  rt[3] = flags & 0xff;
+  rt[6] = ancount >> 8;
+  rt[7] = ancount & 0xff;
+  rt[8] = nscount >> 8;
+  rt[9] = nscount & 0xff;
+  return rt + records;
+}
+
+static void Server(serverframework::Socket::ptr sock) {
+  char buf[512];
+  while (true) {
+    serverframework::Address::ptr from(new serverframework::IPv4Address);
+    int n = sock->RecvFrom(buf, sizeof(buf), from);
+    if (n <= 0) {
+      break;
+    }
+    std::string name;
+    std::string reply = Answer(std::string(buf, n), name, false);
+    ++s_queries[name];
+    if (name == "slow.test") {
+      // 延迟应答，让其他协程在查询进行中发起解析
+      serverframework::IOManager::GetThis()->Schedule([sock, reply, from]() {
+        usleep(200 * 1000);
+        sock->SendTo(reply.data(), reply.size(), from);
+      });
+      continue;
+    }
+    sock->SendTo(reply.data(), reply.size(), from);
+  }
+}
+
+/**
+ * @brief TCP上的DNS服务器，报文前有2字节的长度
+ */
+static void TcpDnsServer(serverframework::Socket::ptr sock) {
+  while (true) {
+    serverframework::Socket::ptr client = sock->accept();
+    if (!client) {
+      break;
+    }
+    serverframework::SocketStream stream(client);
+    uint8_t len[2];
+    if (stream.ReadFixSize(len, 2) <= 0) {
+      continue;
+    }
+    std::string query((len[0] << 8) | len[1], 0);
+    if (stream.ReadFixSize(&query[0], query.size()) <= 0) {
+      continue;
+    }
+    std::string name;
+    std::string reply = Answer(query, name, true);
+    ++s_tcp_queries[name];
+    std::string out;
+    WriteU16(out, reply.size());
+    out += reply;
+    stream.WriteFixSize(out.data(), out.size());
+    stream.Flush();
+  }
+}
+
+static std::vector<std::string> Resolve(const std::string &name,
+                                        int family = AF_INET) {
+  std::vector<serverframework::IPAddress::ptr> addrs;
+  serverframework::DnsMgr::GetInstance()->Resolve(name, family, addrs);
+  std::vector<std::string> rt;
+  for (auto &i : addrs) {
+    rt.push_back(i->ToString());
+  }
+  return rt;
+}
+
+static void test_dns() {
+  serverframework::DnsResolver *dns = serverframework::DnsMgr::GetInstance();
+  // 第一个服务器没有监听，查询被拒绝后换到第二个
+  dns->SetServers({s_dead_addr, s_server_addr});
+
+  std::vector<std::string> rt = Resolve("a.test");
+  ASSERT(rt.size() == 1 && rt[0] == "10.0.0.1:0");
+  std::vector<std::string> got = Resolve("A.Test.");
+  ASSERT(got == rt);
+  ASSERT(s_queries["a.test"] == 1);
+  // TTL为1秒，过期之后重新查询
+  usleep(1100 * 1000);
+  got = Resolve("a.test");
+  ASSERT(got == rt);
+  ASSERT(s_queries["a.test"] == 2);
+
+  rt = Resolve("alias.test");
+  ASSERT(rt.size() == 1 && rt[0] == "10.0.0.2:0");
+
+  rt = Resolve("six.test", AF_INET6);
+  ASSERT(rt.size() == 1 && rt[0] == "[fd00::6]:0");
+  // A记录没有数据，AAAA记录有
+  got = Resolve("six.test", AF_UNSPEC);
+  ASSERT(got == rt);
+  ASSERT(s_queries["six.test"] == 2);
+  got = Resolve("six.test");
+  ASSERT(got.empty());
+  ASSERT(s_queries["six.test"] == 2);
+
+  got = Resolve("missing.test");
+  ASSERT(got.empty());
+  got = Resolve("missing.test");
+  ASSERT(got.empty());
+  ASSERT(s_queries["missing.test"] == 1);
+  usleep(1100 * 1000);
+  got = Resolve("missing.test");
+  ASSERT(got.empty());
+  ASSERT(s_queries["missing.test"] == 2);
+
+  // 同时解析同一个名字
+  uint64_t coalesced = dns->GetCoalescedCount();
+  static const int kResolvers = 10;
+  std::shared_ptr<int> done(new int(0));
+  for (int i = 0; i < kResolvers; ++i) {
+    serverframework::IOManager::GetThis()->Schedule([done]() {
+      std::vector<std::string> rt = Resolve("slow.test");
+      ASSERT(rt.size() == 1 && rt[0] == "10.0.0.1:0");
+      ++*done;
+    });
+  }
+  while (*done < kResolvers) {
+    usleep(10 * 1000);
+  }
+  ASSERT(s_queries["slow.test"] == 1);
+  ASSERT(dns->GetCoalescedCount() - coalesced == kResolvers - 1);
+
+  // UDP应答被截断，从TCP取到完整的应答后按它的TTL缓存
+  rt = Resolve("big.test");
+  ASSERT(rt.size() == 1 && rt[0] == "10.0.0.3:0");
+  got = Resolve("big.test");
+  ASSERT(got == rt);
+  ASSERT(s_queries["big.test"] == 1 && s_tcp_queries["big.test"] == 1);
+
+  serverframework::IPAddress::ptr addr =
+      serverframework::Address::LookupAnyIPAddress("alias.test:80");
+  ASSERT(addr && addr->ToString() == "10.0.0.2:80");
+  addr = serverframework::Address::LookupAnyIPAddress("nothing.test:80");
+  ASSERT(!addr);
+
+  LOG_INFO(g_logger) << "dns ok, queries=" << dns->GetQueryCount()
+                     << " cache_hits=" << dns->GetCacheHitCount()
+                     << " coalesced=" << dns->GetCoalescedCount();
+}
+
+int main(int argc, char *argv[]) {
+  serverframework::EnvMgr::GetInstance()->Init(argc, argv);
+  serverframework::Config::LoadFromConfDir(
+      serverframework::EnvMgr::GetInstance()->GetConfigPath());
+  serverframework::Config::Lookup<bool>("dns.async")->SetValue(true);
+
+  s_server_addr = serverframework::IPAddress::Create("127.0.0.1", 15353);
+  s_dead_addr = serverframework::IPAddress::Create("127.0.0.1", 15354);
+  ASSERT(s_server_addr && s_dead_addr);
+
+  serverframework::IOManager iom(1, true, "dns");
+  iom.Schedule([]() {
+    serverframework::Socket::ptr sock =
+        serverframework::Socket::CreateUDP(s_server_addr);
+    bool ok = sock->bind(s_server_addr);
+    ASSERT(ok);
+    serverframework::IOManager::GetThis()->Schedule(std::bind(&Server, sock));
+    serverframework::Socket::ptr tcp =
+        serverframework::Socket::CreateTCP(s_server_addr);
+    ok = tcp->bind(s_server_addr) && tcp->listen();
+    ASSERT(ok);
+    serverframework::IOManager::GetThis()->Schedule(
+        std::bind(&TcpDnsServer, tcp));
+    test_dns();
+    sock->close();
+    tcp->CancelAll();
+    tcp->close();
+  });
+  return 0;
+}
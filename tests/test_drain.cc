@@ -0,0 +1,117 @@
+/**
+ * @file test_drain.cc
+ * @brief TcpServer排空测试
+ * @details 三条长连接：一条空闲，一条正在处理慢请求，一条请求体一直没有发完。
+ *          排空时空闲连接立即被半关闭，慢请求处理完后回复再被半关闭，
+ *          到期时没有发完请求体的连接被强制关闭；排空之后不再接收新连接，IOManager正常停止
+ */
+#include "serverframework.h"
+
+static serverframework::Logger::ptr g_logger = LOG_ROOT();
+
+static serverframework::Address::ptr s_addr;
+
+class KeepAliveServer : public serverframework::TcpServer {
+ protected:
+  /**
+   * @brief 每个请求一个字节：p立即回复，s处理300ms后回复，b之后还要再读一个字节的请求体
+   */
+  void HandleConnection(serverframework::Connection::ptr conn) override {
+    serverframework::Socket::ptr client = conn->GetSocket();
+    char c;
+    while (true) {
+      conn->SetIdle(true);
+      if (client->recv(&c, 1) != 1) {
+        break;
+      }
+      conn->SetIdle(false);
+      if (c == 's') {
+        usleep(300 * 1000);
+      } else if (c == 'b' && client->recv(&c, 1) != 1) {
+        break;
+      }
+      if (client->send(&c, 1) != 1) {
+        break;
+      }
+    }
+    client->close();
+  }
+};
+
+static serverframework::Socket::ptr Connect() {
+  serverframework::Socket::ptr sock =
+      serverframework::Socket::CreateTCP(s_addr);
+  sock->SetRecvTimeout(3000);
+  bool connected = sock->connect(s_addr, 3000);
+  ASSERT(connected);
+  return sock;
+}
+
+static void Run() {
+  serverframework::TcpServer::ptr server(new KeepAliveServer);
+  bool ok = server->bind(s_addr) && server->Start();
+  ASSERT(ok);
+  const serverframework::ConnectionRegistry &conns = server->GetConnections();
+
+  char c;
+  serverframework::Socket::ptr idle = Connect();
+  ok = idle->send("p", 1) == 1 && idle->recv(&c, 1) == 1;
+  ASSERT(ok);
+  serverframework::Socket::ptr slow = Connect();
+  ok = slow->send("p", 1) == 1 && slow->recv(&c, 1) == 1;
+  ASSERT(ok);
+  serverframework::Socket::ptr stuck = Connect();
+  ok = stuck->send("b", 1) == 1 && slow->send("s", 1) == 1;
+  ASSERT(ok);
+  usleep(50 * 1000);
+
+  // 客户端在各自的协程中读到EOF后关闭连接
+  std::shared_ptr<int> idle_eof(new int(0));
+  std::shared_ptr<int> slow_reply(new int(0));
+  serverframework::IOManager::GetThis()->Schedule([idle, idle_eof]() {
+    char c;
+    *idle_eof = idle->recv(&c, 1) == 0;
+    idle->close();
+  });
+  serverframework::IOManager::GetThis()->Schedule([slow, slow_reply]() {
+    char c;
+    *slow_reply = slow->recv(&c, 1) == 1 && c == 's' && slow->recv(&c, 1) == 0;
+    slow->close();
+  });
+
+  uint64_t begin = serverframework::Clock::NowMS();
+  bool drained = server->Drain(1000);
+  ASSERT(!drained);
+  uint64_t cost = serverframework::Clock::NowMS() - begin;
+  std::cout << "drained " << conns.GetDrainedCount() << " killed "
+            << conns.GetKilledCount() << " in " << cost << "ms" << std::endl;
+  ASSERT(*idle_eof && *slow_reply);
+  ASSERT(conns.GetDrainedCount() == 2 && conns.GetKilledCount() == 1);
+  ASSERT(conns.GetCount() == 0);
+  ASSERT(cost >= 1000 && cost < 2000);
+  int rt = stuck->recv(&c, 1);
+  ASSERT(rt <= 0);
+  stuck->close();
+
+  serverframework::Socket::ptr late =
+      serverframework::Socket::CreateTCP(s_addr);
+  bool connected = late->connect(s_addr, 1000);
+  ASSERT(!connected);
+}
+
+int main(int argc, char *argv[]) {
+  serverframework::EnvMgr::GetInstance()->Init(argc, argv);
+  serverframework::Config::LoadFromConfDir(
+      serverframework::EnvMgr::GetInstance()->GetConfigPath());
+
+  s_addr = serverframework::Address::LookupAnyIPAddress("127.0.0.1:12044");
+  ASSERT(s_addr);
+  uint64_t begin = serverframework::Clock::NowMS();
+  {
+    serverframework::IOManager iom(2, true, "main");
+    iom.Schedule(&Run);
+  }
+  std::cout << "iomanager stopped " << serverframework::Clock::NowMS() - begin
+            << "ms after start" << std::endl;
+  return 0;
+}
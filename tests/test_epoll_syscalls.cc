@@ -0,0 +1,229 @@
+/**
+ * @file test_epoll_syscalls.cc
+ * @brief IOManager常驻注册模式和hook就绪提示的系统调用计数测试
+ * @details 在回环地址上跑一个echo服务，分别在默认模式和常驻注册模式(iomanager.persistent_events)下，
+ *          关闭和打开就绪提示(hook.readiness_hint)，完成相同次数的请求/响应，
+ *          统计每个请求的系统调用次数，输出类似strace -c的结果。
+ *          epoll相关调用通过在可执行文件中重新定义epoll_ctl/epoll_wait/epoll_pwait2来计数，
+ *          recv/send通过替换hook保存的原始函数指针recv_f/send_f来计数，包括返回EAGAIN的调用。
+ *          另外校验fd未经hook关闭、fd号被hook的socket复用后，新fd的事件仍然能触发
+ */
+#include <dlfcn.h>
+#include <sys/epoll.h>
+
+#include <atomic>
+#include <iomanip>
+
+#include "serverframework.h"
+
+static serverframework::Logger::ptr g_logger = LOG_ROOT();
+
+static std::atomic<uint64_t> s_epoll_ctl = {0};
+static std::atomic<uint64_t> s_epoll_wait = {0};
+static std::atomic<uint64_t> s_recv = {0};
+static std::atomic<uint64_t> s_send = {0};
+
+extern "C" {
+// 覆盖libc中的epoll_ctl/epoll_wait/epoll_pwait2，计数后转发给原始实现
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event) {
+  typedef int (*epoll_ctl_fun)(int, int, int, struct epoll_event *);
+  static epoll_ctl_fun real = (epoll_ctl_fun)dlsym(RTLD_NEXT, "epoll_ctl");
+  ++s_epoll_ctl;
+  return real(epfd, op, fd, event);
+}
+
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+               int timeout) {
+  typedef int (*epoll_wait_fun)(int, struct epoll_event *, int, int);
+  static epoll_wait_fun real = (epoll_wait_fun)dlsym(RTLD_NEXT, "epoll_wait");
+  ++s_epoll_wait;
+  return real(epfd, events, maxevents, timeout);
+}
+
+int epoll_pwait2(int epfd, struct epoll_event *events, int maxevents,
+                 const struct timespec *timeout, const sigset_t *sigmask) {
+  typedef int (*epoll_pwait2_fun)(int, struct epoll_event *, int,
+                                  const struct timespec *, const sigset_t *);
+  static epoll_pwait2_fun real =
+      (epoll_pwait2_fun)dlsym(RTLD_NEXT, "epoll_pwait2");
+  ++s_epoll_wait;
+  return real(epfd, events, maxevents, timeout, sigmask);
+}
+}
+
+static recv_fun s_real_recv = nullptr;
+static send_fun s_real_send = nullptr;
+
+static ssize_t CountingRecv(int sockfd, void *buf, size_t len, int flags) {
+  ++s_recv;
+  return s_real_recv(sockfd, buf, len, flags);
+}
+
+static ssize_t CountingSend(int s, const void *msg, size_t len, int flags) {
+  ++s_send;
+  return s_real_send(s, msg, len, flags);
+}
+
+static const int kRequests = 20000;
+static const size_t kPayload = 64;
+// 接收缓冲区比请求大，和实际的服务一样，一次读不满就说明已经读空
+static const size_t kBufferSize = 4096;
+
+static serverframework::Address::ptr s_addr;
+
+/**
+ * @brief echo服务端，只服务一个连接
+ */
+static void EchoServer(serverframework::Socket::ptr listener) {
+  serverframework::Socket::ptr client = listener->accept();
+  ASSERT(client);
+  // 设置读超时，覆盖超时定时器的添加和取消
+  client->SetRecvTimeout(5000);
+  char buf[kBufferSize];
+  while (true) {
+    int rt = client->recv(buf, sizeof(buf));
+    if (rt <= 0) {
+      break;
+    }
+    client->send(buf, rt);
+  }
+  client->close();
+  listener->close();
+}
+
+/**
+ * @brief echo客户端，发送kRequests个请求并等待响应
+ */
+static void EchoClient() {
+  serverframework::Socket::ptr sock =
+      serverframework::Socket::CreateTCP(s_addr);
+  bool connected = sock->connect(s_addr);
+  ASSERT(connected);
+  sock->SetRecvTimeout(5000);
+  char buf[kBufferSize];
+  memset(buf, 'x', sizeof(buf));
+  for (int i = 0; i < kRequests; ++i) {
+    sock->send(buf, kPayload);
+    size_t got = 0;
+    while (got < kPayload) {
+      int rt = sock->recv(buf + got, sizeof(buf) - got);
+      ASSERT(rt > 0);
+      got += rt;
+    }
+  }
+  sock->close();
+}
+
+static double RunOnce(bool persistent, bool hint) {
+  serverframework::Config::Lookup<bool>("iomanager.persistent_events")
+      ->SetValue(persistent);
+  serverframework::Config::Lookup<bool>("hook.readiness_hint")->SetValue(hint);
+
+  s_epoll_ctl = s_epoll_wait = s_recv = s_send = 0;
+  uint64_t begin = serverframework::GetCurrentUS();
+  {
+    serverframework::IOManager iom(1, true, "bench");
+    iom.Schedule([]() {
+      serverframework::Socket::ptr listener =
+          serverframework::Socket::CreateTCP(s_addr);
+      bool ok = listener->bind(s_addr) && listener->listen();
+      ASSERT(ok);
+      serverframework::IOManager::GetThis()->Schedule(
+          std::bind(&EchoServer, listener));
+      serverframework::IOManager::GetThis()->Schedule(&EchoClient);
+    });
+  }
+  uint64_t cost = serverframework::GetCurrentUS() - begin;
+
+  uint64_t total = s_epoll_ctl + s_epoll_wait + s_recv + s_send;
+  std::cout << (persistent ? "persistent" : "default") << " mode, hint "
+            << (hint ? "on" : "off") << ", "
+            << kRequests << " requests, " << cost / 1000 << " ms" << std::endl;
+  std::cout << std::setw(14) << "calls" << std::setw(14) << "per request"
+            << "  syscall" << std::endl;
+#define XX(name, counter)                                             \
+  std::cout << std::setw(14) << counter << std::setw(14) << std::fixed \
+            << std::setprecision(2) << (double)counter / kRequests     \
+            << "  " << name << std::endl;
+  XX("epoll_ctl", s_epoll_ctl);
+  XX("epoll_wait", s_epoll_wait);
+  XX("recv", s_recv);
+  XX("send", s_send);
+  XX("total", total);
+#undef XX
+  std::cout << std::endl;
+  return (double)total / kRequests;
+}
+
+/**
+ * @brief 注册过事件的fd用close_f关闭，hook的socket复用同一个fd号后读事件仍然能唤醒
+ */
+static void ReusedFd(serverframework::Socket::ptr listener) {
+  int stale = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT(stale >= 0);
+  int rt = connect(stale, s_addr->GetAddrGetFamily(), s_addr->GetAddrLen());
+  ASSERT(rt == 0);
+  serverframework::Socket::ptr stale_peer = listener->accept();
+  ASSERT(stale_peer);
+  // 读超时一次，常驻注册模式下fd此后一直留在epoll中
+  struct timeval tv = {0, 10 * 1000};
+  setsockopt(stale, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  char c;
+  rt = recv(stale, &c, 1, 0);
+  ASSERT(rt == -1 && errno == ETIMEDOUT);
+  close_f(stale);
+
+  serverframework::Socket::ptr sock =
+      serverframework::Socket::CreateTCP(s_addr);
+  bool connected = sock->connect(s_addr);
+  ASSERT(connected);
+  ASSERT(sock->GetSocket() == stale);
+  serverframework::Socket::ptr peer = listener->accept();
+  ASSERT(peer);
+  sock->SetRecvTimeout(1000);
+  peer->send("x", 1);
+  rt = sock->recv(&c, 1);
+  ASSERT2(rt == 1, "rt=" << rt << " errno=" << errno);
+  sock->close();
+  peer->close();
+  stale_peer->close();
+  listener->close();
+}
+
+static void RunReusedFd(bool persistent) {
+  serverframework::Config::Lookup<bool>("iomanager.persistent_events")
+      ->SetValue(persistent);
+  serverframework::IOManager iom(1, true, "reuse");
+  iom.Schedule([]() {
+    serverframework::Socket::ptr listener =
+        serverframework::Socket::CreateTCP(s_addr);
+    bool ok = listener->bind(s_addr) && listener->listen();
+    ASSERT(ok);
+    ReusedFd(listener);
+  });
+}
+
+int main(int argc, char *argv[]) {
+  serverframework::EnvMgr::GetInstance()->Init(argc, argv);
+  serverframework::Config::LoadFromConfDir(
+      serverframework::EnvMgr::GetInstance()->GetConfigPath());
+
+  serverframework::Logger::ptr system_logger = LOG_NAME("system");
+  system_logger->SetLevel(serverframework::LogLevel::ERROR);
+
+  s_addr = serverframework::Address::LookupAnyIPAddress("127.0.0.1:12026");
+  ASSERT(s_addr);
+  s_real_recv = recv_f;
+  s_real_send = send_f;
+  recv_f = &CountingRecv;
+  send_f = &CountingSend;
+
+  for (bool persistent : {false, true}) {
+    double off = RunOnce(persistent, false);
+    double on = RunOnce(persistent, true);
+    // 打开就绪提示后，每个请求两端各省掉一次返回EAGAIN的recv
+    ASSERT(on < off);
+    RunReusedFd(persistent);
+  }
+  return 0;
+}
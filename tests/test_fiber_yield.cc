@@ -0,0 +1,74 @@
+/**
+ * @file test_fiber_yield.cc
+ * @brief 协程yield过程中被其他线程调度的测试
+ * @details 协程先把自己加入调度器，再Yield。另一个调度线程可能在Yield的swapcontext保存完上下文之前
+ *          就取到这个协程，此时协程状态仍为RUNNING，调度器必须跳过它，等运行它的线程切回调度协程、
+ *          Resume把状态改为READY之后再执行。校验：
+ *          1. Yield之后直到Resume返回状态一直是RUNNING，Resume返回后才变为READY
+ *          2. 两个调度线程之间来回指定线程调度同一批协程，每次都在指定的线程上恢复，
+ *             栈上的数据完整，所有协程都执行完
+ */
+#include <atomic>
+
+#include "serverframework.h"
+
+static serverframework::Logger::ptr g_logger = LOG_ROOT();
+
+static const int kFibers = 16;
+static const int kRounds = 500;
+
+static std::atomic<int> s_finished{0};
+
+/**
+ * @brief 单线程下检查状态切换的时机
+ */
+static void test_state() {
+  serverframework::Fiber::GetThis();
+  serverframework::Fiber::State before_yield = serverframework::Fiber::TERM;
+  serverframework::Fiber::ptr fiber(new serverframework::Fiber(
+      [&before_yield]() {
+        before_yield = serverframework::Fiber::GetThis()->GetState();
+        serverframework::Fiber::GetThis()->Yield();
+      },
+      0, false));
+  fiber->Resume();
+  ASSERT(before_yield == serverframework::Fiber::RUNNING);
+  ASSERT(fiber->GetState() == serverframework::Fiber::READY);
+  fiber->Resume();
+  ASSERT(fiber->GetState() == serverframework::Fiber::TERM);
+}
+
+/**
+ * @brief 每轮把自己指定到另一个调度线程上，然后Yield
+ */
+static void PingPong(int id) {
+  serverframework::Scheduler *sc = serverframework::Scheduler::GetThis();
+  const std::vector<int> &threads = sc->GetThreadIds();
+  // 上下文没保存完就被resume时，栈上的数据会错乱
+  uint64_t sum = 0;
+  for (int i = 0; i < kRounds; ++i) {
+    int next = threads[(i + id) % threads.size()];
+    sc->Schedule(serverframework::Fiber::GetThis(), next);
+    serverframework::Fiber::GetThis()->Yield();
+    int current = serverframework::GetThreadId();
+    ASSERT(current == next);
+    sum += i;
+  }
+  ASSERT(sum == (uint64_t)kRounds * (kRounds - 1) / 2);
+  ++s_finished;
+}
+
+int main(int argc, char *argv[]) {
+  test_state();
+
+  serverframework::Scheduler sc(2, false, "yield");
+  sc.Start();
+  for (int i = 0; i < kFibers; ++i) {
+    sc.Schedule(std::bind(&PingPong, i));
+  }
+  sc.Stop();
+  ASSERT(s_finished == kFibers);
+  LOG_INFO(g_logger) << kFibers << " fibers x " << kRounds
+                     << " cross-thread yields done";
+  return 0;
+}
@@ -0,0 +1,177 @@
+/**
+ * @file test_frame.cc
+ * @brief 分帧编解码测试
+ * @details 解码器按任意切分的输入逐步解出varint和定长前缀的帧，换接收缓冲区后已解出的帧仍然有效，
+ *          非法前缀和超长帧报错；FrameServer处理客户端一次writev发来的一批流水线请求，响应保持请求顺序
+ */
+#include <algorithm>
+
+#include "serverframework.h"
+
+static serverframework::Logger::ptr g_logger = LOG_ROOT();
+
+static const int kRequests = 1000;
+
+static serverframework::Address::ptr s_addr;
+
+/**
+ * @brief 把payloads编码成一段连续的数据
+ */
+static std::string Encode(serverframework::Frame::LengthType type,
+                          const std::vector<std::string> &payloads) {
+  std::string data;
+  char header[10];
+  for (auto &payload : payloads) {
+    size_t n =
+        serverframework::FrameEncoder::EncodeHeader(type, payload.size(), header);
+    ASSERT(n > 0);
+    data.append(header, n);
+    data += payload;
+  }
+  return data;
+}
+
+static void TestDecoder(serverframework::Frame::LengthType type) {
+  std::vector<std::string> payloads = {"", "hello", std::string(100000, 'x'),
+                                       "a", std::string(300, 'y')};
+  for (int i = 0; i < 100; ++i) {
+    payloads.push_back("frame-" + std::to_string(i));
+  }
+  std::string data = Encode(type, payloads);
+
+  // 每次追加7字节，接收缓冲区频繁更换
+  serverframework::FrameDecoder decoder(type, 0, 256);
+  decoder.SetCompactThreshold(512);
+  std::vector<serverframework::Frame> frames;
+  serverframework::Frame frame;
+  for (size_t i = 0; i < data.size(); i += 7) {
+    decoder.Append(data.data() + i, std::min((size_t)7, data.size() - i));
+    int rt;
+    while ((rt = decoder.Decode(frame)) > 0) {
+      frames.push_back(frame);
+    }
+    ASSERT(rt == 0);
+  }
+  ASSERT(decoder.GetPending() == 0);
+  ASSERT(frames.size() == payloads.size());
+  for (size_t i = 0; i < frames.size(); ++i) {
+    ASSERT(frames[i].ToString() == payloads[i]);
+  }
+}
+
+static void TestErrors() {
+  char header[10];
+  ASSERT(serverframework::FrameEncoder::EncodeHeader(
+             serverframework::Frame::FIXED16, 70000, header) == 0);
+
+  serverframework::FrameDecoder decoder(serverframework::Frame::VARINT, 1000);
+  serverframework::Frame frame;
+  std::string data = Encode(serverframework::Frame::VARINT,
+                            {std::string(2000, 'z')});
+  decoder.Append(data.data(), 2);
+  int rt = decoder.Decode(frame);
+  ASSERT(rt == -1);
+
+  serverframework::FrameDecoder varint(serverframework::Frame::VARINT);
+  std::string bad(10, '\xff');
+  varint.Append(bad.data(), 9);
+  rt = varint.Decode(frame);
+  ASSERT(rt == 0);
+  varint.Append(bad.data(), 1);
+  rt = varint.Decode(frame);
+  ASSERT(rt == -1);
+}
+
+class UpperServer : public serverframework::FrameServer {
+ protected:
+  bool HandleRequest(serverframework::Connection::ptr conn,
+                     const serverframework::Frame &request,
+                     serverframework::FrameEncoder &out) override {
+    std::string str = request.ToString();
+    if (str == "quit") {
+      return false;
+    }
+    // echo前缀的请求把请求帧原样作为响应，不拷贝负载
+    if (str.compare(0, 5, "echo ") == 0) {
+      return out.Add(request);
+    }
+    std::transform(str.begin(), str.end(), str.begin(), ::toupper);
+    return out.Add(std::move(str));
+  }
+};
+
+static void TestServer() {
+  serverframework::FrameServer::ptr server(new UpperServer);
+  bool ok = server->bind(s_addr) && server->Start();
+  ASSERT(ok);
+
+  serverframework::Socket::ptr sock =
+      serverframework::Socket::CreateTCP(s_addr);
+  sock->SetRecvTimeout(3000);
+  ok = sock->connect(s_addr, 3000);
+  ASSERT(ok);
+
+  // 所有请求一次writev发出，不等响应
+  serverframework::FrameEncoder encoder;
+  for (int i = 0; i < kRequests; ++i) {
+    encoder.Add((i % 2 ? "echo " : "msg-") + std::to_string(i));
+  }
+  size_t pending = encoder.GetPending();
+  int64_t flushed = encoder.Flush(sock);
+  ASSERT(flushed == (int64_t)pending);
+
+  serverframework::FrameDecoder decoder;
+  serverframework::Frame frame;
+  int got = 0;
+  while (got < kRequests) {
+    int rt = decoder.Decode(frame);
+    if (rt == 0) {
+      rt = decoder.ReadFrom(sock);
+      ASSERT(rt > 0);
+      continue;
+    }
+    ASSERT(rt == 1);
+    std::string expect =
+        (got % 2 ? "echo " : "MSG-") + std::to_string(got);
+    ASSERT(frame.ToString() == expect);
+    ++got;
+  }
+
+  // 一帧分两次发送
+  std::string data = Encode(serverframework::Frame::VARINT, {"split"});
+  int rt = sock->send(data.data(), 3);
+  ASSERT(rt == 3);
+  usleep(50 * 1000);
+  rt = sock->send(data.data() + 3, data.size() - 3);
+  ASSERT(rt == (int)data.size() - 3);
+  while (decoder.Decode(frame) == 0) {
+    rt = decoder.ReadFrom(sock);
+    ASSERT(rt > 0);
+  }
+  ASSERT(frame.ToString() == "SPLIT");
+
+  encoder.Add(std::string("quit"));
+  encoder.Flush(sock);
+  rt = decoder.ReadFrom(sock);
+  ASSERT(rt == 0);
+  sock->close();
+  std::cout << "pipelined " << got << " requests in one writev" << std::endl;
+  server->Stop();
+}
+
+int main(int argc, char *argv[]) {
+  serverframework::EnvMgr::GetInstance()->Init(argc, argv);
+  serverframework::Config::LoadFromConfDir(
+      serverframework::EnvMgr::GetInstance()->GetConfigPath());
+
+  TestDecoder(serverframework::Frame::VARINT);
+  TestDecoder(serverframework::Frame::FIXED32);
+  TestErrors();
+  std::cout << "decoder ok" << std::endl;
+
+  s_addr = serverframework::Address::LookupAnyIPAddress("127.0.0.1:12045");
+  ASSERT(s_addr);
+  serverframework::IOManager iom(2, true, "main");
+  iom.Schedule(&TestServer);
+  return 0;
+}
@@ -0,0 +1,95 @@
+/**
+ * @file test_histogram.cc
+ * @brief HDR直方图测试
+ * @details 百分位的相对误差不超过有效数字位数，超出范围的值按最大值记录，合并后与直接记录的结果一致，
+ *          并统计每秒可以记录的次数
+ */
+#include <math.h>
+
+#include <algorithm>
+
+#include "serverframework.h"
+
+static serverframework::Logger::ptr g_logger = LOG_ROOT();
+
+static const int kCalls = 10 * 1000 * 1000;
+
+static void test_accuracy() {
+  serverframework::Histogram hist(3600ull * 1000 * 1000, 3);
+  ASSERT(hist.GetCount() == 0 && hist.GetPercentile(50) == 0);
+
+  // 1~1000000均匀分布，第p百分位应当是p*10000
+  std::vector<uint64_t> values;
+  for (uint64_t v = 1; v <= 1000000; ++v) {
+    values.push_back(v);
+  }
+  std::random_shuffle(values.begin(), values.end());
+  for (auto v : values) {
+    hist.Record(v);
+  }
+  ASSERT(hist.GetCount() == 1000000);
+  ASSERT(hist.GetMin() == 1 && hist.GetMax() == 1000000);
+  ASSERT(fabs(hist.GetMean() - 500000.5) < 1);
+  const double percentiles[] = {1, 25, 50, 90, 99, 99.9, 99.99};
+  for (double p : percentiles) {
+    double expect = p * 10000;
+    double got = hist.GetPercentile(p);
+    ASSERT(got >= expect && (got - expect) / expect < 0.001);
+  }
+  ASSERT(hist.GetPercentile(0) == 1);
+  ASSERT(hist.GetPercentile(100) == 1000000);
+  std::cout << hist.ToString("us") << std::endl;
+
+  // 小于子桶数的值精确记录
+  serverframework::Histogram small;
+  for (uint64_t v = 0; v < 2000; ++v) {
+    small.Record(v, 2);
+  }
+  ASSERT(small.GetCount() == 4000);
+  ASSERT(small.GetPercentile(50) == 999);
+  ASSERT(small.GetMin() == 0);
+
+  // 超出范围的值按最大值记录
+  serverframework::Histogram limited(1000, 2);
+  limited.Record(5);
+  limited.Record(1000000);
+  ASSERT(limited.GetMax() == 1000);
+  ASSERT(limited.GetPercentile(100) == 1000);
+}
+
+static void test_merge() {
+  serverframework::Histogram all, a, b;
+  for (uint64_t v = 1; v < 100000; v += 7) {
+    all.Record(v * 13);
+    (v % 2 ? a : b).Record(v * 13);
+  }
+  a.Merge(b);
+  ASSERT(a.GetCount() == all.GetCount());
+  ASSERT(a.GetMin() == all.GetMin() && a.GetMax() == all.GetMax());
+  for (double p = 0; p <= 100; p += 0.5) {
+    ASSERT(a.GetPercentile(p) == all.GetPercentile(p));
+  }
+  a.Reset();
+  ASSERT(a.GetCount() == 0 && a.GetMax() == 0 && a.GetPercentile(99) == 0);
+}
+
+static void bench_record() {
+  serverframework::Histogram hist;
+  uint64_t begin = serverframework::Clock::NowUS();
+  for (int i = 0; i < kCalls; ++i) {
+    hist.Record((i * 2654435761u) % 10000000);
+  }
+  uint64_t cost = serverframework::Clock::NowUS() - begin;
+  ASSERT(hist.GetCount() == (uint64_t)kCalls);
+  std::cout << "Record " << (uint64_t)kCalls * 1000000 / (cost + 1)
+            << " calls/s " << cost * 1000.0 / kCalls << " ns/call"
+            << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  serverframework::EnvMgr::GetInstance()->Init(argc, argv);
+  test_accuracy();
+  test_merge();
+  bench_record();
+  return 0;
+}
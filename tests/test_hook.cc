@@ -79,6 +79,50 @@ void test_sock() {
   LOG_INFO(g_logger) << buff;
 }
 
+/**
+ * @brief 测试读超时，以及读不满之后跳过系统调用直接等待事件
+ */
+void test_recv_timeout() {
+  int fds[2];
+  int rt = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+  ASSERT(rt == 0);
+  serverframework::FdMgr::GetInstance()->Get(fds[0], true);
+  serverframework::FdMgr::GetInstance()->Get(fds[1], true);
+
+  struct timeval tv = {0, 50 * 1000};
+  rt = setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  ASSERT(rt == 0);
+
+  char buf[64];
+  // 连续超时，超时定时器被反复复用
+  for (int i = 0; i < 3; ++i) {
+    uint64_t begin = serverframework::GetElapsedMS();
+    rt = recv(fds[0], buf, sizeof(buf), 0);
+    uint64_t cost = serverframework::GetElapsedMS() - begin;
+    LOG_INFO(g_logger) << "recv rt=" << rt << " errno=" << errno
+                       << " cost=" << cost << "ms";
+    ASSERT(rt == -1 && errno == ETIMEDOUT && cost >= 50);
+  }
+
+  // 读不满之后fd被标记为未就绪，下一次recv直接等待事件，数据到达后仍能读到
+  int peer = fds[1];
+  rt = write(peer, "hello", 5);
+  ASSERT(rt == 5);
+  rt = recv(fds[0], buf, sizeof(buf), 0);
+  ASSERT(rt == 5);
+  serverframework::IOManager::GetThis()->AddTimer(10, [peer]() {
+    ssize_t n = write(peer, "world", 5);
+    ASSERT(n == 5);
+  });
+  rt = recv(fds[0], buf, sizeof(buf), 0);
+  ASSERT(rt == 5);
+  ASSERT(memcmp(buf, "world", 5) == 0);
+
+  close(fds[0]);
+  close(fds[1]);
+  LOG_INFO(g_logger) << "test_recv_timeout end";
+}
+
 int main(int argc, char *argv[]) {
   serverframework::EnvMgr::GetInstance()->Init(argc, argv);
   serverframework::Config::LoadFromConfDir(
@@ -88,6 +132,7 @@ int main(int argc, char *argv[]) {
 
   // 只有以协程调度的方式运行hook才能生效
   serverframework::IOManager iom;
+  iom.Schedule(test_recv_timeout);
   iom.Schedule(test_sock);
 
   LOG_INFO(g_logger) << "main end";
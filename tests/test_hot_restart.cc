@@ -0,0 +1,213 @@
+/**
+ * @file test_hot_restart.cc
+ * @brief 热重启测试
+ * @details 启动两代服务器进程：第一代正常bind，第二代等待信号后启动，从第一代继承监听socket。
+ *          客户端持续用短连接发送请求，同时保持一条长连接，服务器回复自己是第几代。
+ *          第二代开始接收连接后，第一代停止接收，长连接关闭后第一代退出。
+ *          要求整个过程中客户端没有任何失败，并且两代服务器都处理过请求
+ */
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "serverframework.h"
+
+static serverframework::Logger::ptr g_logger = LOG_ROOT();
+
+static const char *kPath = "/tmp/test_hot_restart.sock";
+static const int kClients = 4;
+
+static serverframework::Address::ptr s_addr;
+
+class EchoServer : public serverframework::TcpServer {
+ public:
+  EchoServer(int gen) : gen_(gen) {}
+
+ protected:
+  void HandleClient(serverframework::Socket::ptr client) override {
+    char buf[64];
+    char gen = '0' + gen_;
+    while (client->recv(buf, sizeof(buf)) > 0) {
+      if (client->send(&gen, 1) != 1) {
+        break;
+      }
+    }
+    client->close();
+  }
+
+ private:
+  int gen_;
+};
+
+/**
+ * @brief 服务器进程
+ * @param[in] start_fd 不为-1时先等待这个管道可读再启动
+ */
+static void RunServer(int gen, int start_fd) {
+  if (start_fd >= 0) {
+    char c;
+    ssize_t n = read(start_fd, &c, 1);
+    ASSERT(n == 1);
+  }
+  serverframework::IOManager iom(1, true, "server");
+  iom.Schedule([gen]() {
+    serverframework::HotRestart *hr =
+        serverframework::HotRestartMgr::GetInstance();
+    hr->SetPath(kPath);
+    bool inherited = hr->Inherit();
+    ASSERT(inherited == (gen == 2));
+    serverframework::TcpServer::ptr server(new EchoServer(gen));
+    bool ok = server->bind(s_addr) && server->Start();
+    ASSERT(ok);
+    hr->Ready();
+    ok = hr->Serve({server}, [server]() { server->Stop(); });
+    ASSERT(ok);
+  });
+}
+
+static bool s_running = true;
+static int s_failures = 0;
+static int s_replies[3] = {0, 0, 0};
+
+/**
+ * @brief 发一个请求，返回回复的服务器代数，失败返回0
+ */
+static int Request(serverframework::Socket::ptr sock) {
+  char gen;
+  if (sock->send("ping", 4) != 4 || sock->recv(&gen, 1) != 1) {
+    return 0;
+  }
+  return gen - '0';
+}
+
+static void ShortClient(std::shared_ptr<int> done) {
+  struct linger lg;
+  lg.l_onoff = 1;
+  lg.l_linger = 0;
+  while (s_running) {
+    serverframework::Socket::ptr sock =
+        serverframework::Socket::CreateTCP(s_addr);
+    sock->SetRecvTimeout(3000);
+    int gen = sock->connect(s_addr, 3000) ? Request(sock) : 0;
+    if (gen == 1 || gen == 2) {
+      ++s_replies[gen];
+    } else {
+      ++s_failures;
+      LOG_ERROR(g_logger) << "request failed errno=" << errno;
+    }
+    sock->SetOption(SOL_SOCKET, SO_LINGER, lg);
+    sock->close();
+  }
+  ++*done;
+}
+
+static void LongClient(std::shared_ptr<int> done) {
+  serverframework::Socket::ptr sock =
+      serverframework::Socket::CreateTCP(s_addr);
+  sock->SetRecvTimeout(3000);
+  bool connected = sock->connect(s_addr, 3000);
+  ASSERT(connected);
+  while (s_running) {
+    // 长连接一直由接收它的第一代服务器处理
+    if (Request(sock) != 1) {
+      ++s_failures;
+      LOG_ERROR(g_logger) << "long connection request failed";
+      break;
+    }
+    usleep(1000);
+  }
+  sock->close();
+  ++*done;
+}
+
+static bool WaitExit(pid_t pid, int &status, int timeout_ms) {
+  for (int i = 0; i < timeout_ms / 10; ++i) {
+    if (waitpid(pid, &status, WNOHANG) == pid) {
+      return true;
+    }
+    usleep(10 * 1000);
+  }
+  return false;
+}
+
+static void RunClients(pid_t gen1, pid_t gen2, int start_fd) {
+  // 等第一代服务器开始监听
+  bool up = false;
+  for (int i = 0; i < 500 && !up; ++i) {
+    serverframework::Socket::ptr sock =
+        serverframework::Socket::CreateTCP(s_addr);
+    up = sock->connect(s_addr, 100);
+    if (!up) {
+      usleep(10 * 1000);
+    }
+  }
+  ASSERT(up);
+
+  std::shared_ptr<int> done(new int(0));
+  for (int i = 0; i < kClients; ++i) {
+    serverframework::IOManager::GetThis()->Schedule(
+        std::bind(&ShortClient, done));
+  }
+  serverframework::IOManager::GetThis()->Schedule(
+      std::bind(&LongClient, done));
+  usleep(500 * 1000);
+
+  LOG_INFO(g_logger) << "start generation 2, replies from generation 1: "
+                     << s_replies[1];
+  ssize_t n = write(start_fd, "x", 1);
+  ASSERT(n == 1);
+  for (int i = 0; i < 500 && !s_replies[2]; ++i) {
+    usleep(10 * 1000);
+  }
+  usleep(500 * 1000);
+  s_running = false;
+  while (*done < kClients + 1) {
+    usleep(10 * 1000);
+  }
+
+  // 长连接关闭之后第一代服务器退出
+  int status = -1;
+  bool exited = WaitExit(gen1, status, 5000);
+  ASSERT(exited);
+  ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  kill(gen2, SIGTERM);
+  waitpid(gen2, &status, 0);
+
+  std::cout << "replies: generation 1=" << s_replies[1]
+            << " generation 2=" << s_replies[2] << " failures=" << s_failures
+            << std::endl;
+  ASSERT(s_failures == 0);
+  ASSERT(s_replies[1] > 0 && s_replies[2] > 0);
+  unlink(kPath);
+}
+
+int main(int argc, char *argv[]) {
+  serverframework::EnvMgr::GetInstance()->Init(argc, argv);
+  serverframework::Config::LoadFromConfDir(
+      serverframework::EnvMgr::GetInstance()->GetConfigPath());
+
+  unlink(kPath);
+  s_addr = serverframework::Address::LookupAnyIPAddress("127.0.0.1:12040");
+  ASSERT(s_addr);
+
+  int fds[2];
+  int rt = pipe(fds);
+  ASSERT(rt == 0);
+  pid_t gen1 = fork();
+  if (gen1 == 0) {
+    close(fds[0]);
+    close(fds[1]);
+    RunServer(1, -1);
+    return 0;
+  }
+  pid_t gen2 = fork();
+  if (gen2 == 0) {
+    close(fds[1]);
+    RunServer(2, fds[0]);
+    return 0;
+  }
+  close(fds[0]);
+
+  serverframework::IOManager iom(1, true, "client");
+  iom.Schedule(std::bind(&RunClients, gen1, gen2, fds[1]));
+  return 0;
+}
@@ -0,0 +1,341 @@
+/**
+ * @file test_http.cc
+ * @brief HTTP服务器测试
+ * @details 解析器按单字节输入解析流水线请求和chunked请求体，各种非法请求返回对应的状态码；
+ *          路由匹配参数和通配段，未注册的方法返回405；服务器处理一次发来的一批流水线请求，
+ *          响应保持顺序，长连接上继续处理请求，chunked响应和HEAD请求按协议编码
+ */
+#include "serverframework.h"
+
+static serverframework::Logger::ptr g_logger = LOG_ROOT();
+
+static serverframework::Address::ptr s_addr;
+
+static const std::string kPipelined =
+    "GET /users/42?verbose=1 HTTP/1.1\r\n"
+    "Host: localhost\r\n"
+    "X-Long-Header:   value with spaces  \r\n"
+    "\r\n"
+    "POST /echo HTTP/1.1\r\n"
+    "Host: localhost\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "\r\n"
+    "5;ext=1\r\nhello\r\n"
+    "7\r\n, world\r\n"
+    "0\r\n"
+    "Trailer: ignored\r\n"
+    "\r\n"
+    "PUT /echo HTTP/1.0\r\n"
+    "Content-Length: 4\r\n"
+    "\r\n"
+    "body";
+
+/**
+ * @brief 每次输入step字节，解析出所有请求
+ * @param[in] data 输入，必须在解析期间保持有效
+ */
+static void TestParser(const std::string &data, size_t step) {
+  serverframework::HttpRequestParser parser;
+  int got = 0;
+  for (size_t i = 0; i < data.size(); i += step) {
+    const char *p = data.data() + i;
+    size_t left = std::min(step, data.size() - i);
+    while (left) {
+      int n = parser.Execute(p, left);
+      ASSERT(n >= 0);
+      p += n;
+      left -= n;
+      if (!parser.IsFinished()) {
+        continue;
+      }
+      serverframework::HttpRequest &req = parser.GetRequest();
+      if (got == 0) {
+        ASSERT(req.GetMethod() == serverframework::HttpMethod::GET);
+        ASSERT(req.GetPath().Equals("/users/42"));
+        ASSERT(req.GetQuery().Equals("verbose=1"));
+        ASSERT(req.GetVersion() == 0x11);
+        ASSERT(req.IsKeepAlive());
+        ASSERT(req.GetHeaders().size() == 2);
+        ASSERT(req.GetHeader("host").Equals("localhost"));
+        ASSERT(req.GetHeader("x-long-header").Equals("value with spaces"));
+        ASSERT(req.GetBodySize() == 0);
+      } else if (got == 1) {
+        ASSERT(req.GetMethod() == serverframework::HttpMethod::POST);
+        ASSERT(req.IsChunked());
+        ASSERT(req.GetBody() == "hello, world");
+      } else {
+        ASSERT(req.GetMethod() == serverframework::HttpMethod::PUT);
+        ASSERT(req.GetVersion() == 0x10);
+        ASSERT(!req.IsKeepAlive());
+        ASSERT(req.GetContentLength() == 4);
+        ASSERT(req.GetBody() == "body");
+      }
+      ++got;
+      parser.Reset();
+    }
+  }
+  ASSERT(got == 3);
+  ASSERT(parser.IsIdle());
+}
+
+/**
+ * @brief 解析一个非法请求，返回状态码
+ */
+static int ParseError(const std::string &data, size_t max_header = 0,
+                      uint64_t max_body = 0) {
+  serverframework::HttpRequestParser parser(max_header, max_body);
+  int n = parser.Execute(data.data(), data.size());
+  ASSERT(n < 0);
+  return parser.GetError();
+}
+
+static void TestParserErrors() {
+  ASSERT(ParseError("BREW /pot HTTP/1.1\r\n\r\n") == 501);
+  ASSERT(ParseError("get / HTTP/1.1\r\n\r\n") == 400);
+  ASSERT(ParseError("GET / HTTP/2.0\r\n\r\n") == 505);
+  ASSERT(ParseError("GET / HTTP/1.1\r\nBad Header: x\r\n\r\n") == 400);
+  ASSERT(ParseError("GET / HTTP/1.1\r\nHost: x\r\n folded\r\n\r\n") == 400);
+  ASSERT(ParseError("GET /" + std::string(100, 'a') + " HTTP/1.1\r\n\r\n",
+                    64) == 431);
+  ASSERT(ParseError("POST / HTTP/1.1\r\nContent-Length: 100\r\n\r\n", 0, 10) ==
+         413);
+  ASSERT(ParseError("POST / HTTP/1.1\r\nContent-Length: 1\r\n"
+                    "Content-Length: 2\r\n\r\n") == 400);
+  ASSERT(ParseError("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+                    "zz\r\n") == 400);
+  ASSERT(ParseError("POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n") ==
+         501);
+}
+
+static void TestRouter() {
+  serverframework::Router router;
+  std::string last;
+  router.Add(serverframework::HttpMethod::GET, "/",
+             [&](serverframework::HttpRequest &req,
+                 serverframework::HttpResponse &rsp) { last = "root"; });
+  router.Add(serverframework::HttpMethod::GET, "/users/:id",
+             [&](serverframework::HttpRequest &req,
+                 serverframework::HttpResponse &rsp) {
+               last = "user " + req.GetParam("id").ToString();
+             });
+  router.Add(serverframework::HttpMethod::GET, "/users/me",
+             [&](serverframework::HttpRequest &req,
+                 serverframework::HttpResponse &rsp) { last = "me"; });
+  router.Add(serverframework::HttpMethod::GET, "/users/:id/posts/:post",
+             [&](serverframework::HttpRequest &req,
+                 serverframework::HttpResponse &rsp) {
+               last = req.GetParam("id").ToString() + "/" +
+                      req.GetParam("post").ToString();
+             });
+  router.Add(serverframework::HttpMethod::GET, "/static/*file",
+             [&](serverframework::HttpRequest &req,
+                 serverframework::HttpResponse &rsp) {
+               last = "file " + req.GetParam("file").ToString();
+             });
+  // 与已有的参数名或通配符冲突的路由添加失败
+  bool added = router.Add(serverframework::HttpMethod::GET, "/users/:name/x",
+                          [](serverframework::HttpRequest &,
+                             serverframework::HttpResponse &) {});
+  ASSERT(!added);
+  added = router.Add(serverframework::HttpMethod::GET, "/a/*rest/b",
+                     [](serverframework::HttpRequest &,
+                        serverframework::HttpResponse &) {});
+  ASSERT(!added);
+
+  auto dispatch = [&](const std::string &method, const std::string &path) {
+    std::string data = method + " " + path + " HTTP/1.1\r\n\r\n";
+    serverframework::HttpRequestParser parser;
+    int n = parser.Execute(data.data(), data.size());
+    ASSERT(n == (int)data.size());
+    serverframework::HttpResponse rsp;
+    last.clear();
+    router.Dispatch(parser.GetRequest(), rsp);
+    return rsp.GetStatus();
+  };
+  int status = dispatch("GET", "/");
+  ASSERT(status == 200 && last == "root");
+  status = dispatch("GET", "/users/7");
+  ASSERT(status == 200 && last == "user 7");
+  status = dispatch("GET", "/users/me");
+  ASSERT(status == 200 && last == "me");
+  status = dispatch("GET", "/users/me/posts/3");
+  ASSERT(status == 200 && last == "me/3");
+  status = dispatch("GET", "/static/css/a.css");
+  ASSERT(status == 200 && last == "file css/a.css");
+  status = dispatch("HEAD", "/users/7");
+  ASSERT(status == 200 && last == "user 7");
+  status = dispatch("POST", "/users/7");
+  ASSERT(status == 405);
+  status = dispatch("GET", "/nothing");
+  ASSERT(status == 404);
+  status = dispatch("GET", "/users/7/posts");
+  ASSERT(status == 404);
+}
+
+/**
+ * @brief 读取直到服务器关闭连接
+ */
+static std::string ReadAll(serverframework::Socket::ptr sock) {
+  std::string data;
+  char buf[4096];
+  int rt;
+  while ((rt = sock->recv(buf, sizeof(buf))) > 0) {
+    data.append(buf, rt);
+  }
+  return data;
+}
+
+/**
+ * @brief 读取直到收到一个以terminator结尾的响应
+ */
+static std::string ReadUntil(serverframework::Socket::ptr sock,
+                             const std::string &terminator) {
+  std::string data;
+  char buf[4096];
+  while (data.size() < terminator.size() ||
+         data.compare(data.size() - terminator.size(), terminator.size(),
+                      terminator)) {
+    int rt = sock->recv(buf, sizeof(buf));
+    ASSERT(rt > 0);
+    data.append(buf, rt);
+  }
+  return data;
+}
+
+static void TestServer() {
+  serverframework::HttpServer::ptr server(new serverframework::HttpServer);
+  serverframework::Router &router = server->GetRouter();
+  router.Add(serverframework::HttpMethod::GET, "/users/:id",
+             [](serverframework::HttpRequest &req,
+                serverframework::HttpResponse &rsp) {
+               rsp.SetHeader("Content-Type", "text/plain");
+               rsp.SetBody("user " + req.GetParam("id").ToString());
+             });
+  router.Any("/echo", [](serverframework::HttpRequest &req,
+                         serverframework::HttpResponse &rsp) {
+    rsp.SetBody(req.GetBody());
+  });
+  router.Add(serverframework::HttpMethod::GET, "/stream",
+             [](serverframework::HttpRequest &req,
+                serverframework::HttpResponse &rsp) {
+               rsp.AddChunk("hello");
+               rsp.AddChunk(std::string(20, 'x'));
+             });
+  bool ok = server->bind(s_addr) && server->Start();
+  ASSERT(ok);
+
+  serverframework::Socket::ptr sock =
+      serverframework::Socket::CreateTCP(s_addr);
+  sock->SetRecvTimeout(3000);
+  ok = sock->connect(s_addr, 3000);
+  ASSERT(ok);
+
+  // 长连接上的单个请求
+  std::string req = "GET /users/1 HTTP/1.1\r\nHost: x\r\n\r\n";
+  int rt = sock->send(req.data(), req.size());
+  ASSERT(rt == (int)req.size());
+  std::string rsp = ReadUntil(sock, "user 1");
+  ASSERT(rsp.compare(0, 17, "HTTP/1.1 200 OK\r\n") == 0);
+  ASSERT(rsp.find("Content-Length: 6\r\n") != std::string::npos);
+  ASSERT(rsp.find("Date: ") != std::string::npos);
+  ASSERT(rsp.find("Connection") == std::string::npos);
+
+  // 一个请求分两次到达
+  req = "GET /users/2 HT";
+  rt = sock->send(req.data(), req.size());
+  ASSERT(rt == (int)req.size());
+  usleep(50 * 1000);
+  req = "TP/1.1\r\n\r\n";
+  rt = sock->send(req.data(), req.size());
+  ASSERT(rt == (int)req.size());
+  rsp = ReadUntil(sock, "user 2");
+
+  // Expect: 100-continue先收到100响应
+  req = "POST /echo HTTP/1.1\r\nContent-Length: 3\r\n"
+        "Expect: 100-continue\r\n\r\n";
+  rt = sock->send(req.data(), req.size());
+  ASSERT(rt == (int)req.size());
+  rsp = ReadUntil(sock, "\r\n\r\n");
+  ASSERT(rsp == "HTTP/1.1 100 Continue\r\n\r\n");
+  rt = sock->send("abc", 3);
+  ASSERT(rt == 3);
+  rsp = ReadUntil(sock, "abc");
+  ASSERT(rsp.compare(0, 17, "HTTP/1.1 200 OK\r\n") == 0);
+
+  // 一批流水线请求，最后一个要求关闭连接
+  std::string batch;
+  for (int i = 0; i < 100; ++i) {
+    batch += "GET /users/" + std::to_string(i) + " HTTP/1.1\r\n\r\n";
+  }
+  batch +=
+      "POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+      "3\r\nabc\r\n3\r\ndef\r\n0\r\n\r\n"
+      "GET /stream HTTP/1.1\r\n\r\n"
+      "HEAD /users/9 HTTP/1.1\r\n\r\n"
+      "DELETE /users/9 HTTP/1.1\r\n\r\n"
+      "GET /missing HTTP/1.1\r\nConnection: close\r\n\r\n"
+      "GET /users/never HTTP/1.1\r\n\r\n";
+  rt = sock->send(batch.data(), batch.size());
+  ASSERT(rt == (int)batch.size());
+  rsp = ReadAll(sock);
+  size_t pos = 0;
+  for (int i = 0; i < 100; ++i) {
+    pos = rsp.find("\r\n\r\nuser " + std::to_string(i), pos);
+    ASSERT(pos != std::string::npos);
+  }
+  pos = rsp.find("Content-Length: 6\r\n", pos);
+  pos = rsp.find("\r\n\r\nabcdef", pos);
+  ASSERT(pos != std::string::npos);
+  pos = rsp.find(
+      "Transfer-Encoding: chunked\r\n\r\n"
+      "5\r\nhello\r\n14\r\nxxxxxxxxxxxxxxxxxxxx\r\n0\r\n\r\n",
+      pos);
+  ASSERT(pos != std::string::npos);
+  // HEAD响应有Content-Length没有响应体
+  pos = rsp.find("Content-Length: 6\r\n", pos);
+  ASSERT(pos != std::string::npos);
+  size_t head_end = rsp.find("\r\n\r\n", pos) + 4;
+  pos = rsp.find("HTTP/1.1 405 Method Not Allowed\r\nAllow: GET", pos);
+  ASSERT(pos == head_end);
+  pos = rsp.find("HTTP/1.1 404 Not Found\r\n", pos);
+  ASSERT(pos != std::string::npos);
+  ASSERT(rsp.find("Connection: close\r\n", pos) != std::string::npos);
+  ASSERT(rsp.find("never") == std::string::npos);
+  sock->close();
+
+  // 非法请求返回400后关闭连接
+  sock = serverframework::Socket::CreateTCP(s_addr);
+  sock->SetRecvTimeout(3000);
+  ok = sock->connect(s_addr, 3000);
+  ASSERT(ok);
+  req = "GET / HTTP/1.1\r\nBad Header: x\r\n\r\n";
+  rt = sock->send(req.data(), req.size());
+  ASSERT(rt == (int)req.size());
+  rsp = ReadAll(sock);
+  ASSERT(rsp.compare(0, 25, "HTTP/1.1 400 Bad Request\r") == 0);
+  sock->close();
+
+  std::cout << server->ToString();
+  ASSERT(server->GetRequestCount() == 108);
+  server->Stop();
+}
+
+int main(int argc, char *argv[]) {
+  serverframework::EnvMgr::GetInstance()->Init(argc, argv);
+  serverframework::Config::LoadFromConfDir(
+      serverframework::EnvMgr::GetInstance()->GetConfigPath());
+
+  TestParser(kPipelined, kPipelined.size());
+  TestParser(kPipelined, 1);
+  TestParser(kPipelined, 7);
+  TestParserErrors();
+  std::cout << "parser ok" << std::endl;
+  TestRouter();
+  std::cout << "router ok" << std::endl;
+
+  s_addr = serverframework::Address::LookupAnyIPAddress("127.0.0.1:12046");
+  ASSERT(s_addr);
+  serverframework::IOManager iom(2, true, "main");
+  iom.Schedule(&TestServer);
+  return 0;
+}
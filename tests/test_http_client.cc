@@ -0,0 +1,184 @@
+/**
+ * @file test_http_client.cc
+ * @brief HTTP客户端测试
+ * @details 对进程内的HttpServer：连续请求复用连接池中的长连接，大响应体直接读进ByteArray，
+ *          chunked响应去掉分块格式；流水线请求按顺序收到响应，服务器中途关闭连接时之后的请求失败；
+ *          慢请求在截止时间到达时返回TIMEOUT；并发请求的总耗时接近单个请求
+ */
+#include "serverframework.h"
+
+static serverframework::Logger::ptr g_logger = LOG_ROOT();
+
+static serverframework::Address::ptr s_addr;
+
+static const size_t kBigSize = 1024 * 1024 + 17;
+static const int kSlowMS = 300;
+static const int kTimeoutMS = 100;
+
+static void StartServer(serverframework::HttpServer::ptr server) {
+  serverframework::Router &router = server->GetRouter();
+  router.Add(serverframework::HttpMethod::GET, "/hello",
+             [](serverframework::HttpRequest &req,
+                serverframework::HttpResponse &rsp) { rsp.SetBody("world"); });
+  router.Add(serverframework::HttpMethod::GET, "/id/:n",
+             [](serverframework::HttpRequest &req,
+                serverframework::HttpResponse &rsp) {
+               rsp.SetBody(req.GetParam("n").ToString());
+             });
+  router.Add(serverframework::HttpMethod::GET, "/big",
+             [](serverframework::HttpRequest &req,
+                serverframework::HttpResponse &rsp) {
+               std::string body(kBigSize, 'b');
+               for (size_t i = 0; i < body.size(); i += 4096) {
+                 body[i] = 'a' + i / 4096 % 26;
+               }
+               rsp.SetBody(std::move(body));
+             });
+  router.Add(serverframework::HttpMethod::GET, "/chunks",
+             [](serverframework::HttpRequest &req,
+                serverframework::HttpResponse &rsp) {
+               for (int i = 0; i < 10; ++i) {
+                 rsp.AddChunk("chunk" + std::to_string(i) + ";");
+               }
+             });
+  router.Add(serverframework::HttpMethod::POST, "/echo",
+             [](serverframework::HttpRequest &req,
+                serverframework::HttpResponse &rsp) {
+               rsp.SetBody(req.GetBody());
+             });
+  router.Add(serverframework::HttpMethod::GET, "/close",
+             [](serverframework::HttpRequest &req,
+                serverframework::HttpResponse &rsp) {
+               rsp.SetClose(true);
+               rsp.SetBody("bye");
+             });
+  router.Add(serverframework::HttpMethod::GET, "/slow",
+             [](serverframework::HttpRequest &req,
+                serverframework::HttpResponse &rsp) {
+               usleep(kSlowMS * 1000);
+               rsp.SetBody("slow");
+             });
+  bool ok = server->bind(s_addr) && server->Start();
+  ASSERT(ok);
+}
+
+static void TestClient() {
+  serverframework::HttpServer::ptr server(new serverframework::HttpServer);
+  StartServer(server);
+  serverframework::HttpClient client(s_addr);
+  serverframework::SocketPool *pool = client.GetPool();
+
+  // 连续请求复用同一个长连接
+  for (int i = 0; i < 10; ++i) {
+    serverframework::HttpResult result = client.Get("/hello");
+    ASSERT(result.ok());
+    ASSERT(result.response->GetStatus() == 200);
+    ASSERT(result.response->GetBody() == "world");
+    ASSERT(result.response->IsKeepAlive());
+  }
+  ASSERT(pool->GetConnectCount() == 1);
+  ASSERT(pool->GetReuseCount() == 9);
+
+  std::string payload(100 * 1024, 'p');
+  serverframework::HttpResult result = client.Post("/echo", payload);
+  ASSERT(result.ok() && result.response->GetBody() == payload);
+
+  result = client.Get("/big");
+  ASSERT(result.ok());
+  serverframework::ByteArray::ptr body = result.response->GetBodyData();
+  ASSERT(body->GetReadSize() == kBigSize);
+  std::string big = body->ToString();
+  for (size_t i = 0; i < big.size(); i += 4096) {
+    ASSERT(big[i] == (char)('a' + i / 4096 % 26));
+  }
+
+  result = client.Get("/chunks");
+  ASSERT(result.ok());
+  ASSERT(result.response->GetBody() ==
+         "chunk0;chunk1;chunk2;chunk3;chunk4;chunk5;chunk6;chunk7;chunk8;"
+         "chunk9;");
+
+  result = client.Get("/missing");
+  ASSERT(result.ok() && result.response->GetStatus() == 404);
+
+  // 流水线：一次writev发出，按顺序收到响应，HEAD响应没有响应体
+  std::vector<serverframework::HttpClientRequest> reqs;
+  for (int i = 0; i < 50; ++i) {
+    reqs.emplace_back(i % 10 == 5 ? serverframework::HttpMethod::HEAD
+                                  : serverframework::HttpMethod::GET,
+                      i % 10 == 5 ? "/big" : "/id/" + std::to_string(i));
+  }
+  std::vector<serverframework::HttpResult> results = client.Pipeline(reqs);
+  for (int i = 0; i < 50; ++i) {
+    ASSERT(results[i].ok());
+    if (i % 10 == 5) {
+      ASSERT(results[i].response->GetHeader("content-length") ==
+             std::to_string(kBigSize));
+      ASSERT(results[i].response->GetBody().empty());
+    } else {
+      ASSERT(results[i].response->GetBody() == std::to_string(i));
+    }
+  }
+  uint64_t connects = pool->GetConnectCount();
+
+  // 服务器在中途关闭连接，之后的请求失败，连接不归还
+  reqs.clear();
+  reqs.emplace_back(serverframework::HttpMethod::GET, "/hello");
+  reqs.emplace_back(serverframework::HttpMethod::GET, "/close");
+  reqs.emplace_back(serverframework::HttpMethod::GET, "/hello");
+  results = client.Pipeline(reqs);
+  ASSERT(results[0].ok() && results[1].ok());
+  ASSERT(!results[1].response->IsKeepAlive());
+  ASSERT(results[2].result == serverframework::HttpResult::RECV_FAIL);
+  result = client.Get("/hello");
+  ASSERT(result.ok());
+  ASSERT(pool->GetConnectCount() == connects + 1);
+
+  // 截止时间：请求以超时结束且不早于截止时间。
+  // 调度可能有延迟，上限放得很宽，只用来发现卡住的请求
+  uint64_t begin = serverframework::Clock::NowMS();
+  result = client.Get("/slow", kTimeoutMS);
+  uint64_t elapsed = serverframework::Clock::NowMS() - begin;
+  ASSERT(result.result == serverframework::HttpResult::TIMEOUT);
+  ASSERT(elapsed >= (uint64_t)kTimeoutMS);
+  ASSERT(elapsed < (uint64_t)kTimeoutMS * 10);
+  std::cout << "timeout after " << elapsed << "ms" << std::endl;
+
+  // 并发请求
+  reqs.assign(20, serverframework::HttpClientRequest(
+                      serverframework::HttpMethod::GET, "/slow"));
+  begin = serverframework::Clock::NowMS();
+  results = client.FanOut(reqs);
+  elapsed = serverframework::Clock::NowMS() - begin;
+  for (auto &r : results) {
+    ASSERT(r.ok() && r.response->GetBody() == "slow");
+  }
+  ASSERT(elapsed < (uint64_t)kSlowMS * 3);
+  std::cout << "fan-out 20 slow requests in " << elapsed << "ms" << std::endl;
+
+  begin = serverframework::Clock::NowMS();
+  results = client.FanOut(reqs, 5);
+  elapsed = serverframework::Clock::NowMS() - begin;
+  for (auto &r : results) {
+    ASSERT(r.ok());
+  }
+  ASSERT(elapsed >= (uint64_t)kSlowMS * 4);
+  std::cout << "fan-out 20 slow requests 5 at a time in " << elapsed << "ms"
+            << std::endl;
+
+  std::cout << "connects=" << pool->GetConnectCount()
+            << " reuses=" << pool->GetReuseCount() << std::endl;
+  server->Stop();
+}
+
+int main(int argc, char *argv[]) {
+  serverframework::EnvMgr::GetInstance()->Init(argc, argv);
+  serverframework::Config::LoadFromConfDir(
+      serverframework::EnvMgr::GetInstance()->GetConfigPath());
+
+  s_addr = serverframework::Address::LookupAnyIPAddress("127.0.0.1:12048");
+  ASSERT(s_addr);
+  serverframework::IOManager iom(2, true, "main");
+  iom.Schedule(&TestClient);
+  return 0;
+}
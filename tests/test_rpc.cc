@@ -0,0 +1,156 @@
+/**
+ * @file test_rpc.cc
+ * @brief RPC测试
+ * @details 一个连接上同时发起多个调用，响应按id对应；慢调用不阻塞同一连接上的其他调用；
+ *          不存在的方法、业务错误码、超时和取消返回对应的状态码，服务端的方法统计随之更新；
+ *          连接关闭时未完成的调用返回RPC_CLOSED
+ */
+#include "serverframework.h"
+
+static serverframework::Logger::ptr g_logger = LOG_ROOT();
+
+static serverframework::Address::ptr s_addr;
+
+static const int kSlowMS = 300;
+static const int kDeadlineMS = 100;
+
+/**
+ * @brief 慢方法，每10ms检查一次是否被取消
+ */
+static int32_t Slow(serverframework::RpcContext::ptr ctx,
+                    const std::string &request, std::string &response) {
+  for (int i = 0; i < kSlowMS / 10; ++i) {
+    if (ctx->IsCancelled()) {
+      return serverframework::RPC_CANCELLED;
+    }
+    usleep(10 * 1000);
+  }
+  response = "slow";
+  return 0;
+}
+
+static void StartServer(serverframework::RpcServer::ptr server) {
+  bool ok = server->Register(
+      "echo",
+      [](serverframework::RpcContext::ptr ctx, const std::string &request,
+         std::string &response) {
+        response = request;
+        return 0;
+      },
+      true);
+  ok = ok && server->Register(
+                  "reverse", [](serverframework::RpcContext::ptr ctx,
+                                const std::string &request,
+                                std::string &response) {
+                    response.assign(request.rbegin(), request.rend());
+                    return 0;
+                  });
+  ok = ok && server->Register("fail", [](serverframework::RpcContext::ptr ctx,
+                                         const std::string &request,
+                                         std::string &response) {
+    response = "bad input";
+    return 7;
+  });
+  ok = ok && server->Register("slow", &Slow);
+  ASSERT(ok);
+  // 重复注册失败
+  ok = server->Register("slow", &Slow);
+  ASSERT(!ok);
+  ok = server->bind(s_addr) && server->Start();
+  ASSERT(ok);
+}
+
+static void TestRpc() {
+  serverframework::RpcServer::ptr server(new serverframework::RpcServer);
+  StartServer(server);
+  serverframework::RpcClient::ptr client(new serverframework::RpcClient);
+  bool connected = client->Connect(s_addr);
+  ASSERT(connected);
+
+  // 同一连接上并发的调用
+  std::vector<serverframework::RpcFuture::ptr> futures;
+  for (int i = 0; i < 500; ++i) {
+    futures.push_back(client->CallAsync(i % 2 ? "echo" : "reverse",
+                                        "call-" + std::to_string(i)));
+  }
+  for (int i = 0; i < 500; ++i) {
+    const serverframework::RpcResult &result = futures[i]->Wait();
+    std::string expect = "call-" + std::to_string(i);
+    if (i % 2 == 0) {
+      expect.assign(expect.rbegin(), expect.rend());
+    }
+    ASSERT(result.ok() && result.response == expect);
+  }
+  ASSERT(client->GetPendingCount() == 0);
+
+  std::string big(1024 * 1024, 'x');
+  serverframework::RpcResult result = client->Call("echo", big);
+  ASSERT(result.response == big);
+
+  // 慢调用不阻塞其他调用
+  uint64_t begin = serverframework::Clock::NowMS();
+  serverframework::RpcFuture::ptr slow = client->CallAsync("slow", "");
+  result = client->Call("reverse", "abc");
+  ASSERT(result.response == "cba");
+  ASSERT(serverframework::Clock::NowMS() - begin < (uint64_t)kSlowMS);
+  ASSERT(!slow->IsDone());
+  ASSERT(slow->Wait().response == "slow");
+
+  result = client->Call("missing", "");
+  ASSERT(result.status == serverframework::RPC_NOT_FOUND);
+  ASSERT(server->GetNotFoundCount() == 1);
+  result = client->Call("fail", "");
+  ASSERT(result.status == 7 && result.response == "bad input");
+
+  // 截止时间：客户端到期返回，服务端收到取消后提前结束
+  begin = serverframework::Clock::NowMS();
+  result = client->Call("slow", "", kDeadlineMS);
+  uint64_t elapsed = serverframework::Clock::NowMS() - begin;
+  ASSERT(result.status == serverframework::RPC_DEADLINE_EXCEEDED);
+  ASSERT(elapsed >= (uint64_t)kDeadlineMS);
+  // 不卡严格的时间窗口，只确认调用没有等到慢方法返回之后很久
+  ASSERT(elapsed < (uint64_t)kDeadlineMS * 10);
+  std::cout << "deadline exceeded after " << elapsed << "ms" << std::endl;
+
+  // 取消
+  slow = client->CallAsync("slow", "");
+  usleep(50 * 1000);
+  bool first = client->Cancel(slow);
+  bool second = client->Cancel(slow);
+  ASSERT(first && !second);
+  ASSERT(slow->Wait().status == serverframework::RPC_CANCELLED);
+  usleep(50 * 1000);
+
+  const serverframework::RpcMethodStats *stats = server->GetStats("slow");
+  ASSERT(stats && stats->calls == 3 && stats->cancelled == 2);
+  stats = server->GetStats("fail");
+  ASSERT(stats->calls == 1 && stats->errors == 1);
+  stats = server->GetStats("echo");
+  ASSERT(stats->calls == 251 && stats->errors == 0);
+  ASSERT(!server->GetStats("missing"));
+  std::cout << server->ToString() << std::endl;
+
+  // 关闭连接，未完成的调用失败
+  slow = client->CallAsync("slow", "");
+  client->Close();
+  ASSERT(slow->Wait().status == serverframework::RPC_CLOSED);
+  ASSERT(!client->IsConnected());
+  result = client->Call("echo", "x");
+  ASSERT(result.status == serverframework::RPC_CLOSED);
+  ASSERT(client->GetCallCount() == 509);
+
+  usleep(kSlowMS * 1000);
+  server->Stop();
+}
+
+int main(int argc, char *argv[]) {
+  serverframework::EnvMgr::GetInstance()->Init(argc, argv);
+  serverframework::Config::LoadFromConfDir(
+      serverframework::EnvMgr::GetInstance()->GetConfigPath());
+
+  s_addr = serverframework::Address::LookupAnyIPAddress("127.0.0.1:12050");
+  ASSERT(s_addr);
+  serverframework::IOManager iom(2, true, "main");
+  iom.Schedule(&TestRpc);
+  return 0;
+}
@@ -0,0 +1,197 @@
+/**
+ * @file test_sendfile.cc
+ * @brief 零拷贝发送测试
+ * @details 在回环地址上对比两种场景的吞吐：
+ *          1. 静态文件发送：read/send拷贝循环 vs Socket::SendFile
+ *          2. 代理转发：recv/send拷贝循环 vs Socket::SpliceTo
+ *          每种方式先发送一遍文件，接收端校验字节数和校验和，再发送多遍测吞吐，此时只校验字节数
+ */
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "serverframework.h"
+
+static serverframework::Logger::ptr g_logger = LOG_ROOT();
+
+static const char *kFile = "/tmp/test_sendfile.dat";
+static const size_t kFileSize = 64 * 1024 * 1024;
+static const int kRounds = 4;
+static const size_t kBufferSize = 64 * 1024;
+
+static uint64_t s_file_sum = 0;
+
+static uint64_t Sum(const char *buf, size_t len) {
+  uint64_t sum = 0;
+  for (size_t i = 0; i < len; ++i) {
+    sum += (unsigned char)buf[i];
+  }
+  return sum;
+}
+
+static void CreateFile() {
+  int fd = open(kFile, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+  ASSERT(fd >= 0);
+  std::vector<char> buf(kBufferSize);
+  for (size_t off = 0; off < kFileSize; off += buf.size()) {
+    for (size_t i = 0; i < buf.size(); ++i) {
+      buf[i] = (char)((off + i) * 131 >> 7);
+    }
+    s_file_sum += Sum(&buf[0], buf.size());
+    ssize_t n = write(fd, &buf[0], buf.size());
+    ASSERT(n == (ssize_t)buf.size());
+  }
+  close(fd);
+}
+
+/**
+ * @brief 接收端，读到对端关闭为止，校验字节数和校验和
+ * @param[in] rounds 文件发送的遍数，为1时校验校验和，否则输出吞吐
+ */
+static void Sink(serverframework::Socket::ptr sock, int rounds,
+                 uint64_t begin, const char *name) {
+  std::vector<char> buf(kBufferSize);
+  uint64_t total = 0;
+  uint64_t sum = 0;
+  while (true) {
+    int rt = sock->recv(&buf[0], buf.size());
+    if (rt <= 0) {
+      break;
+    }
+    total += rt;
+    if (rounds == 1) {
+      sum += Sum(&buf[0], rt);
+    }
+  }
+  ASSERT(total == kFileSize * rounds);
+  if (rounds == 1) {
+    ASSERT(sum == s_file_sum);
+  } else {
+    uint64_t cost = serverframework::GetCurrentUS() - begin;
+    std::cout << name << ": " << total / 1024 / 1024 << "MB in "
+              << cost / 1000 << "ms, "
+              << total * 1000000 / (cost + 1) / 1024 / 1024 << "MB/s"
+              << std::endl;
+  }
+  sock->close();
+}
+
+/**
+ * @brief 建立一对相连的TCP socket
+ */
+static void MakePair(serverframework::Address::ptr addr,
+                     serverframework::Socket::ptr &a,
+                     serverframework::Socket::ptr &b) {
+  serverframework::Socket::ptr listener =
+      serverframework::Socket::CreateTCP(addr);
+  bool ok = listener->bind(addr) && listener->listen();
+  ASSERT(ok);
+  a = serverframework::Socket::CreateTCP(addr);
+  ok = a->connect(addr);
+  ASSERT(ok);
+  b = listener->accept();
+  ASSERT(b);
+  listener->close();
+}
+
+static void ServeFile(bool zero_copy, int rounds) {
+  serverframework::Address::ptr addr =
+      serverframework::Address::LookupAnyIPAddress("127.0.0.1:12033");
+  serverframework::Socket::ptr client, server;
+  MakePair(addr, client, server);
+
+  uint64_t begin = serverframework::GetCurrentUS();
+  serverframework::IOManager::GetThis()->Schedule(
+      std::bind(&Sink, client, rounds, begin,
+                zero_copy ? "sendfile      " : "read/send copy"));
+
+  int fd = open(kFile, O_RDONLY);
+  ASSERT(fd >= 0);
+  std::vector<char> buf(kBufferSize);
+  for (int r = 0; r < rounds; ++r) {
+    if (zero_copy) {
+      int64_t sent = server->SendFile(fd, 0, kFileSize);
+      ASSERT(sent == (int64_t)kFileSize);
+      continue;
+    }
+    lseek(fd, 0, SEEK_SET);
+    while (true) {
+      ssize_t n = read(fd, &buf[0], buf.size());
+      if (n <= 0) {
+        break;
+      }
+      for (ssize_t off = 0; off < n;) {
+        int rt = server->send(&buf[off], n - off);
+        ASSERT(rt > 0);
+        off += rt;
+      }
+    }
+  }
+  close(fd);
+  server->close();
+}
+
+static void Proxy(bool zero_copy, int rounds) {
+  serverframework::Address::ptr addr1 =
+      serverframework::Address::LookupAnyIPAddress("127.0.0.1:12034");
+  serverframework::Address::ptr addr2 =
+      serverframework::Address::LookupAnyIPAddress("127.0.0.1:12035");
+  // source -> proxy_in | proxy_out -> sink
+  serverframework::Socket::ptr source, proxy_in, proxy_out, sink;
+  MakePair(addr1, source, proxy_in);
+  MakePair(addr2, proxy_out, sink);
+
+  uint64_t begin = serverframework::GetCurrentUS();
+  serverframework::IOManager::GetThis()->Schedule(
+      std::bind(&Sink, sink, rounds, begin,
+                zero_copy ? "splice proxy  " : "recv/send proxy"));
+  serverframework::IOManager::GetThis()->Schedule([source, rounds]() {
+    int fd = open(kFile, O_RDONLY);
+    ASSERT(fd >= 0);
+    for (int r = 0; r < rounds; ++r) {
+      int64_t sent = source->SendFile(fd, 0, kFileSize);
+      ASSERT(sent == (int64_t)kFileSize);
+    }
+    close(fd);
+    source->close();
+  });
+
+  if (zero_copy) {
+    int64_t spliced = proxy_in->SpliceTo(proxy_out);
+    ASSERT(spliced == (int64_t)(kFileSize * rounds));
+  } else {
+    std::vector<char> buf(kBufferSize);
+    while (true) {
+      int n = proxy_in->recv(&buf[0], buf.size());
+      if (n <= 0) {
+        break;
+      }
+      for (int off = 0; off < n;) {
+        int rt = proxy_out->send(&buf[off], n - off);
+        ASSERT(rt > 0);
+        off += rt;
+      }
+    }
+  }
+  proxy_in->close();
+  proxy_out->close();
+}
+
+int main(int argc, char *argv[]) {
+  serverframework::EnvMgr::GetInstance()->Init(argc, argv);
+  serverframework::Config::LoadFromConfDir(
+      serverframework::EnvMgr::GetInstance()->GetConfigPath());
+
+  CreateFile();
+  for (int rounds : {1, kRounds}) {
+    for (bool zero_copy : {false, true}) {
+      serverframework::IOManager iom(1, true, "file");
+      iom.Schedule(std::bind(&ServeFile, zero_copy, rounds));
+    }
+    for (bool zero_copy : {false, true}) {
+      serverframework::IOManager iom(1, true, "proxy");
+      iom.Schedule(std::bind(&Proxy, zero_copy, rounds));
+    }
+  }
+  unlink(kFile);
+  return 0;
+}
@@ -0,0 +1,210 @@
+/**
+ * @file test_socket_pool.cc
+ * @brief 连接池测试
+ * @details 在回环地址上起一个echo服务器，先校验连接池的语义：
+ *          复用归还的连接，连接数满时排队等待与超时，探测到对端关闭的连接后丢弃，
+ *          空闲过久的连接被回收，最少空闲连接数被补足。
+ *          然后对比每个请求新建连接与从连接池取连接两种方式每秒完成的请求数
+ */
+#include "serverframework.h"
+
+static serverframework::Logger::ptr g_logger = LOG_ROOT();
+
+static const int kRequests = 20000;
+static const int kClients = 8;
+
+static serverframework::Address::ptr s_addr;
+static serverframework::Socket::ptr s_listener;
+
+/**
+ * @brief echo一个连接，收到"quit"时关闭连接
+ */
+static void Echo(serverframework::Socket::ptr conn) {
+  char buf[256];
+  while (true) {
+    int n = conn->recv(buf, sizeof(buf));
+    if (n <= 0 || std::string(buf, n) == "quit") {
+      break;
+    }
+    if (conn->send(buf, n) != n) {
+      break;
+    }
+  }
+  conn->close();
+}
+
+static void Server() {
+  while (true) {
+    serverframework::Socket::ptr conn = s_listener->accept();
+    if (!conn) {
+      break;
+    }
+    serverframework::IOManager::GetThis()->Schedule(std::bind(&Echo, conn));
+  }
+}
+
+static bool Request(serverframework::Socket::ptr sock,
+                    const std::string &msg = "ping") {
+  char buf[256];
+  return sock->send(msg.data(), msg.size()) == (int)msg.size() &&
+         sock->recv(buf, sizeof(buf)) == (int)msg.size() &&
+         std::string(buf, msg.size()) == msg;
+}
+
+static void test_semantics() {
+  serverframework::SocketPool pool;
+  pool.SetMaxTotal(2);
+
+  serverframework::Socket::ptr a = pool.Checkout(s_addr);
+  ASSERT(a);
+  bool replied = Request(a);
+  ASSERT(replied);
+  a.reset();
+  ASSERT(pool.GetIdleCount(s_addr) == 1);
+  a = pool.Checkout(s_addr);
+  ASSERT(a);
+  replied = Request(a);
+  ASSERT(replied);
+  ASSERT(pool.GetConnectCount() == 1 && pool.GetReuseCount() == 1);
+
+  // 连接数已满，等待超时
+  serverframework::Socket::ptr b = pool.Checkout(s_addr);
+  ASSERT(b);
+  uint64_t begin = serverframework::Clock::NowMS();
+  serverframework::Socket::ptr timeout = pool.Checkout(s_addr, 100);
+  ASSERT(!timeout);
+  ASSERT(serverframework::Clock::NowMS() - begin >= 100);
+
+  // 排队的协程拿到归还的连接
+  std::shared_ptr<bool> got(new bool(false));
+  serverframework::IOManager::GetThis()->Schedule([&pool, got]() {
+    serverframework::Socket::ptr c = pool.Checkout(s_addr, 1000);
+    ASSERT(c);
+    bool replied = Request(c);
+    ASSERT(replied);
+    *got = true;
+  });
+  usleep(50 * 1000);
+  ASSERT(!*got);
+  b.reset();
+  usleep(50 * 1000);
+  ASSERT(*got);
+  ASSERT(pool.GetWaitCount() == 2);
+
+  // 服务器关闭了最近归还的空闲连接，取出时探测到并丢弃，改用另一个空闲连接
+  ASSERT(pool.GetTotalCount(s_addr) == 2);
+  int rt = a->send("quit", 4);
+  ASSERT(rt == 4);
+  a.reset();
+  usleep(50 * 1000);
+  uint64_t connects = pool.GetConnectCount();
+  a = pool.Checkout(s_addr);
+  ASSERT(a);
+  replied = Request(a);
+  ASSERT(replied);
+  ASSERT(pool.GetConnectCount() == connects);
+  ASSERT(pool.GetTotalCount(s_addr) == 1);
+  // 出错的连接先close再归还，不会回到池中
+  a->close();
+  a.reset();
+  ASSERT(pool.GetTotalCount(s_addr) == 0);
+
+  a = pool.Checkout(s_addr);
+  b = pool.Checkout(s_addr);
+  ASSERT(a && b && pool.GetConnectCount() == connects + 2);
+  a.reset();
+  b.reset();
+  ASSERT(pool.GetIdleCount(s_addr) == 2);
+
+  // 空闲过久的连接被回收
+  pool.SetIdleTimeout(100);
+  usleep(300 * 1000);
+  ASSERT(pool.GetIdleCount(s_addr) == 0 && pool.GetTotalCount(s_addr) == 0);
+
+  // 补足最少空闲连接数
+  pool.SetMinIdle(2);
+  usleep(300 * 1000);
+  ASSERT(pool.GetIdleCount(s_addr) == 2);
+
+  // 为min_idle保留的连接超过空闲时间后仍然可以复用
+  connects = pool.GetConnectCount();
+  uint64_t reuses = pool.GetReuseCount();
+  a = pool.Checkout(s_addr);
+  ASSERT(a);
+  replied = Request(a);
+  ASSERT(replied);
+  ASSERT(pool.GetConnectCount() == connects);
+  ASSERT(pool.GetReuseCount() == reuses + 1);
+  a.reset();
+  LOG_INFO(g_logger) << "socket pool semantics ok";
+}
+
+static void Client(serverframework::SocketPool *pool, int count,
+                   std::shared_ptr<int> done) {
+  struct linger lg;
+  lg.l_onoff = 1;
+  lg.l_linger = 0;
+  for (int i = 0; i < count; ++i) {
+    if (pool) {
+      serverframework::Socket::ptr sock = pool->Checkout(s_addr);
+      ASSERT(sock);
+      bool replied = Request(sock);
+      ASSERT(replied);
+      continue;
+    }
+    serverframework::Socket::ptr sock =
+        serverframework::Socket::CreateTCP(s_addr);
+    bool ok = sock->connect(s_addr, 3000) && Request(sock);
+    ASSERT(ok);
+    // SO_LINGER为0关闭，避免TIME_WAIT耗尽端口
+    sock->SetOption(SOL_SOCKET, SO_LINGER, lg);
+    sock->close();
+  }
+  ++*done;
+}
+
+static void bench(bool pooled) {
+  serverframework::SocketPool pool;
+  std::shared_ptr<int> done(new int(0));
+  uint64_t begin = serverframework::GetCurrentUS();
+  for (int i = 0; i < kClients; ++i) {
+    serverframework::IOManager::GetThis()->Schedule(std::bind(
+        &Client, pooled ? &pool : nullptr, kRequests / kClients, done));
+  }
+  while (*done < kClients) {
+    usleep(10 * 1000);
+  }
+  uint64_t cost = serverframework::GetCurrentUS() - begin;
+  std::cout << (pooled ? "pooled       : " : "connect/close: ") << kRequests
+            << " requests in " << cost / 1000 << "ms, "
+            << (uint64_t)kRequests * 1000000 / (cost + 1) << " req/s, "
+            << (pooled ? pool.GetConnectCount() : kRequests) << " connects"
+            << std::endl;
+}
+
+static void Run(std::function<void()> cb, size_t threads) {
+  serverframework::IOManager iom(threads, true, "pool");
+  iom.Schedule([cb]() {
+    s_listener = serverframework::Socket::CreateTCP(s_addr);
+    bool ok = s_listener->bind(s_addr) && s_listener->listen(1024);
+    ASSERT(ok);
+    serverframework::IOManager::GetThis()->Schedule(&Server);
+    cb();
+    s_listener->close();
+  });
+}
+
+int main(int argc, char *argv[]) {
+  serverframework::EnvMgr::GetInstance()->Init(argc, argv);
+  serverframework::Config::LoadFromConfDir(
+      serverframework::EnvMgr::GetInstance()->GetConfigPath());
+
+  s_addr = serverframework::Address::LookupAnyIPAddress("127.0.0.1:12038");
+  ASSERT(s_addr);
+  // 语义测试依赖连接归还到哪个线程分片，只用一个线程
+  Run(&test_semantics, 1);
+  for (bool pooled : {false, true}) {
+    Run(std::bind(&bench, pooled), 2);
+  }
+  return 0;
+}
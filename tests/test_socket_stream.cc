@@ -0,0 +1,167 @@
+/**
+ * @file test_socket_stream.cc
+ * @brief SocketStream测试
+ * @details 先校验读写语义：合并写入的行用ReadUntil逐行读出，Peek不取走数据，
+ *          大块数据绕过写缓冲区，ByteArray读写，超过读缓冲区的行返回EMSGSIZE。
+ *          然后对比按行收发的消息速率：直接用Socket每行send一次、逐字节recv找换行符，
+ *          与用SocketStream合并写、缓冲读
+ */
+#include "serverframework.h"
+
+static serverframework::Logger::ptr g_logger = LOG_ROOT();
+
+static const int kLines = 1000;
+static const size_t kBlobSize = 256 * 1024;
+static const int kMessages = 50000;
+
+static serverframework::Address::ptr s_addr;
+
+/**
+ * @brief 建立一对相连的TCP socket
+ */
+static void MakePair(serverframework::Socket::ptr &a,
+                     serverframework::Socket::ptr &b) {
+  serverframework::Socket::ptr listener =
+      serverframework::Socket::CreateTCP(s_addr);
+  bool ok = listener->bind(s_addr) && listener->listen();
+  ASSERT(ok);
+  a = serverframework::Socket::CreateTCP(s_addr);
+  ok = a->connect(s_addr);
+  ASSERT(ok);
+  b = listener->accept();
+  ASSERT(b);
+  listener->close();
+}
+
+static std::string Line(int i) { return "line " + std::to_string(i) + "\r\n"; }
+
+static void test_semantics() {
+  serverframework::Socket::ptr a, b;
+  MakePair(a, b);
+  serverframework::SocketStream::ptr out(new serverframework::SocketStream(a));
+  serverframework::SocketStream::ptr in(new serverframework::SocketStream(b));
+
+  std::string blob(kBlobSize, 0);
+  for (size_t i = 0; i < blob.size(); ++i) {
+    blob[i] = i * 7;
+  }
+
+  serverframework::IOManager::GetThis()->Schedule([out, blob]() {
+    for (int i = 0; i < kLines; ++i) {
+      std::string line = Line(i);
+      int rt = out->WriteFixSize(line.data(), line.size());
+      ASSERT(rt == (int)line.size());
+    }
+    // 小块数据留在写缓冲区，还没有发出
+    ASSERT(out->GetWriteBuffered() > 0);
+    int rt = out->WriteFixSize(blob.data(), blob.size());
+    ASSERT(rt == (int)blob.size());
+    serverframework::ByteArray::ptr ba(new serverframework::ByteArray);
+    ba->write(blob.data(), blob.size());
+    ba->SetPosition(0);
+    rt = out->WriteFixSize(ba, blob.size());
+    ASSERT(rt == (int)blob.size());
+    rt = out->Flush();
+    ASSERT(rt >= 0);
+    ASSERT(out->GetWriteBuffered() == 0);
+    // 没有换行符的一行，比读缓冲区大
+    std::string longline(20 * 1024, 'x');
+    rt = out->WriteFixSize(longline.data(), longline.size());
+    ASSERT(rt == (int)longline.size());
+    out->close();
+  });
+
+  std::string line;
+  for (int i = 0; i < kLines; ++i) {
+    char head[4];
+    int rt = in->Peek(head, sizeof(head));
+    ASSERT(rt == sizeof(head));
+    ASSERT(std::string(head, 4) == "line");
+    rt = in->ReadUntil(line, "\r\n");
+    ASSERT(rt == (int)Line(i).size());
+    ASSERT(line == Line(i));
+  }
+
+  std::string buf(kBlobSize, 0);
+  int rt = in->ReadFixSize(&buf[0], buf.size());
+  ASSERT(rt == (int)buf.size());
+  ASSERT(buf == blob);
+  serverframework::ByteArray::ptr ba(new serverframework::ByteArray);
+  rt = in->ReadFixSize(ba, blob.size());
+  ASSERT(rt == (int)blob.size());
+  ba->SetPosition(0);
+  ASSERT(ba->ToString() == blob);
+
+  rt = in->ReadUntil(line, "\n");
+  ASSERT(rt == -1 && errno == EMSGSIZE);
+  // 读缓冲区中的数据依然可以读出
+  size_t left = 20 * 1024;
+  while (left > 0) {
+    rt = in->read(&buf[0], left);
+    ASSERT(rt > 0);
+    left -= rt;
+  }
+  rt = in->read(&buf[0], buf.size());
+  ASSERT(rt == 0);
+  in->close();
+  LOG_INFO(g_logger) << "socket stream semantics ok";
+}
+
+static void bench(bool stream) {
+  serverframework::Socket::ptr a, b;
+  MakePair(a, b);
+
+  uint64_t begin = serverframework::GetCurrentUS();
+  serverframework::IOManager::GetThis()->Schedule([a, stream]() {
+    serverframework::SocketStream out(a);
+    for (int i = 0; i < kMessages; ++i) {
+      std::string line = Line(i);
+      int rt = stream ? out.WriteFixSize(line.data(), line.size())
+                      : a->send(line.data(), line.size());
+      ASSERT(rt == (int)line.size());
+    }
+    out.close();
+  });
+
+  serverframework::SocketStream in(b);
+  std::string line;
+  for (int i = 0; i < kMessages; ++i) {
+    if (stream) {
+      int rt = in.ReadUntil(line, "\r\n");
+      ASSERT(rt > 0);
+    } else {
+      line.clear();
+      char c;
+      while (line.size() < 2 || line.compare(line.size() - 2, 2, "\r\n")) {
+        int rt = b->recv(&c, 1);
+        ASSERT(rt == 1);
+        line.push_back(c);
+      }
+    }
+    ASSERT(line == Line(i));
+  }
+  uint64_t cost = serverframework::GetCurrentUS() - begin;
+  std::cout << (stream ? "SocketStream   : " : "Socket recv/send: ")
+            << kMessages << " lines in " << cost / 1000 << "ms, "
+            << (uint64_t)kMessages * 1000000 / (cost + 1) << " lines/s"
+            << std::endl;
+  in.close();
+}
+
+int main(int argc, char *argv[]) {
+  serverframework::EnvMgr::GetInstance()->Init(argc, argv);
+  serverframework::Config::LoadFromConfDir(
+      serverframework::EnvMgr::GetInstance()->GetConfigPath());
+
+  s_addr = serverframework::Address::LookupAnyIPAddress("127.0.0.1:12037");
+  ASSERT(s_addr);
+  {
+    serverframework::IOManager iom(1, true, "stream");
+    iom.Schedule(&test_semantics);
+  }
+  for (bool stream : {false, true}) {
+    serverframework::IOManager iom(1, true, "stream");
+    iom.Schedule(std::bind(&bench, stream));
+  }
+  return 0;
+}
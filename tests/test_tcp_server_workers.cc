@@ -0,0 +1,156 @@
+/**
+ * @file test_tcp_server_workers.cc
+ * @brief TcpServer多接收者模式测试
+ * @details 在回环地址上对比三种模式每秒处理的短连接数(连接、收发1字节、关闭)：
+ *          1. 单个接收协程，新连接转交给多线程的io_worker
+ *          2. 每个单线程工作调度器一个SO_REUSEPORT监听socket，连接在接收它的线程上处理
+ *          3. 单个接收协程批量接收，轮询转交给各工作调度器
+ *          同时统计每个工作调度器处理的连接数，多接收者模式下校验连接在接收它的调度器上处理
+ */
+#include <map>
+
+#include "serverframework.h"
+
+static serverframework::Logger::ptr g_logger = LOG_ROOT();
+
+static const int kWorkers = 4;
+static const int kClients = 16;
+static const int kConnections = 20000;
+
+static serverframework::Address::ptr s_addr;
+
+enum Mode { POOL, REUSE_PORT, ROUND_ROBIN };
+
+static const char *ModeName(Mode mode) {
+  switch (mode) {
+    case POOL:
+      return "single acceptor + pool";
+    case REUSE_PORT:
+      return "SO_REUSEPORT per worker";
+    default:
+      return "round-robin handoff    ";
+  }
+}
+
+class EchoServer : public serverframework::TcpServer {
+ public:
+  EchoServer(serverframework::IOManager *io_worker,
+             serverframework::IOManager *accept_worker)
+      : TcpServer(io_worker, accept_worker) {}
+
+  /**
+   * @brief 每个调度器处理的连接数
+   */
+  std::map<serverframework::IOManager *, int> GetCounts() {
+    serverframework::Mutex::Lock lock(mutex_);
+    return counts_;
+  }
+
+ protected:
+  void HandleClient(serverframework::Socket::ptr client) override {
+    serverframework::IOManager *iom = serverframework::IOManager::GetThis();
+    {
+      serverframework::Mutex::Lock lock(mutex_);
+      ++counts_[iom];
+    }
+    char c;
+    if (client->recv(&c, 1) == 1) {
+      client->send(&c, 1);
+    }
+    client->close();
+  }
+
+ private:
+  serverframework::Mutex mutex_;
+  std::map<serverframework::IOManager *, int> counts_;
+};
+
+static void Client(int count) {
+  struct linger lg;
+  lg.l_onoff = 1;
+  lg.l_linger = 0;
+  for (int i = 0; i < count; ++i) {
+    serverframework::Socket::ptr sock =
+        serverframework::Socket::CreateTCP(s_addr);
+    bool connected = sock->connect(s_addr);
+    ASSERT(connected);
+    char c = 'x';
+    int rt = sock->send(&c, 1);
+    ASSERT(rt == 1);
+    rt = sock->recv(&c, 1);
+    ASSERT(rt == 1 && c == 'x');
+    sock->SetOption(SOL_SOCKET, SO_LINGER, lg);
+    sock->close();
+  }
+}
+
+static void Run(Mode mode) {
+  std::vector<std::shared_ptr<serverframework::IOManager>> workers;
+  std::vector<serverframework::IOManager *> raw;
+  std::shared_ptr<serverframework::IOManager> pool, acceptor;
+  std::shared_ptr<EchoServer> server;
+  if (mode == POOL) {
+    pool.reset(new serverframework::IOManager(kWorkers, false, "pool"));
+    server.reset(new EchoServer(pool.get(), pool.get()));
+  } else {
+    for (int i = 0; i < kWorkers; ++i) {
+      workers.emplace_back(new serverframework::IOManager(
+          1, false, "worker_" + std::to_string(i)));
+      raw.push_back(workers.back().get());
+    }
+    acceptor.reset(new serverframework::IOManager(1, false, "acceptor"));
+    server.reset(new EchoServer(acceptor.get(), acceptor.get()));
+    server->SetWorkers(raw, mode == REUSE_PORT);
+  }
+  {
+    // 监听socket要在hook开启的线程上创建，才是非阻塞的，才能批量accept
+    serverframework::IOManager setup(1, true, "setup");
+    setup.Schedule([server]() {
+      bool ok = server->bind(s_addr);
+      ASSERT(ok);
+    });
+  }
+  server->Start();
+
+  uint64_t begin = serverframework::GetCurrentUS();
+  {
+    serverframework::IOManager client(1, true, "client");
+    for (int i = 0; i < kClients; ++i) {
+      client.Schedule(std::bind(&Client, kConnections / kClients));
+    }
+  }
+  uint64_t cost = serverframework::GetCurrentUS() - begin;
+  server->Stop();
+
+  std::map<serverframework::IOManager *, int> counts = server->GetCounts();
+  std::cout << ModeName(mode) << ": " << kConnections << " connections in "
+            << cost / 1000 << "ms, "
+            << (uint64_t)kConnections * 1000000 / (cost + 1) << " conn/s,";
+  int total = 0;
+  for (auto &i : counts) {
+    std::cout << " " << i.first->GetName() << "=" << i.second;
+    total += i.second;
+    if (mode != POOL) {
+      // 连接只在工作调度器上处理
+      ASSERT(std::find(raw.begin(), raw.end(), i.first) != raw.end());
+    }
+  }
+  std::cout << std::endl;
+  ASSERT(total == kConnections);
+  if (mode == REUSE_PORT) {
+    ASSERT(counts.size() == (size_t)kWorkers);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  serverframework::EnvMgr::GetInstance()->Init(argc, argv);
+  serverframework::Config::LoadFromConfDir(
+      serverframework::EnvMgr::GetInstance()->GetConfigPath());
+
+  s_addr = serverframework::Address::LookupAnyIPAddress("127.0.0.1:12037");
+  ASSERT(s_addr);
+  Run(POOL);
+  Run(REUSE_PORT);
+  Run(ROUND_ROBIN);
+  return 0;
+}
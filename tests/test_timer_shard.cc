@@ -0,0 +1,121 @@
+/**
+ * @file test_timer_shard.cc
+ * @brief 定时器按线程分片测试
+ * @details 多个调度线程并发添加定时器，再由其他线程取消其中一部分，验证被取消的定时器不会触发、
+ *          其余定时器全部触发；非调度线程添加的短定时器能唤醒阻塞中的分片线程按时触发；
+ *          最后统计多线程并发添加/取消定时器的吞吐
+ */
+#include <thread>
+
+#include "serverframework.h"
+
+static serverframework::Logger::ptr g_logger = LOG_ROOT();
+
+static const int kThreads = 4;
+static const int kTimersPerTask = 1000;
+static const int kTasks = 64;
+
+static std::atomic<int> s_fired = {0};
+static std::atomic<int> s_cancelled = {0};
+static std::atomic<int> s_cancelled_fired = {0};
+
+static serverframework::Mutex s_mutex;
+static std::vector<serverframework::Timer::ptr> s_timers;
+
+static void test_cross_thread_cancel() {
+  serverframework::IOManager iom(kThreads, false, "shard");
+  for (int i = 0; i < kTasks; ++i) {
+    iom.Schedule([]() {
+      std::vector<serverframework::Timer::ptr> timers;
+      for (int j = 0; j < kTimersPerTask; ++j) {
+        timers.push_back(serverframework::IOManager::GetThis()->AddTimer(
+            50 + j % 200, []() { ++s_fired; }));
+      }
+      serverframework::Mutex::Lock lock(s_mutex);
+      s_timers.insert(s_timers.end(), timers.begin(), timers.end());
+    });
+  }
+  // 在其他调度线程上取消一半定时器
+  for (int i = 0; i < kTasks; ++i) {
+    iom.Schedule([]() {
+      std::vector<serverframework::Timer::ptr> timers;
+      {
+        serverframework::Mutex::Lock lock(s_mutex);
+        size_t n = std::min(s_timers.size(), (size_t)kTimersPerTask / 2);
+        timers.assign(s_timers.end() - n, s_timers.end());
+        s_timers.resize(s_timers.size() - n);
+      }
+      for (auto &timer : timers) {
+        if (timer->Cancel()) {
+          ++s_cancelled;
+        }
+        if (timer->Cancel()) {
+          ++s_cancelled_fired;
+        }
+      }
+    });
+  }
+}
+
+static void test_foreign_wakeup() {
+  serverframework::IOManager iom(kThreads, false, "wakeup");
+  // 等待所有调度线程进入idle并绑定分片
+  usleep(100 * 1000);
+  for (int i = 0; i < 20; ++i) {
+    uint64_t start = serverframework::GetElapsedMS();
+    std::atomic<uint64_t> cost = {0};
+    iom.AddTimer(10, [&cost, start]() {
+      cost = serverframework::GetElapsedMS() - start;
+    });
+    while (!cost) {
+      usleep(1000);
+    }
+    ASSERT2(cost < 30, "foreign timer fired late: " + std::to_string(cost));
+  }
+  LOG_INFO(g_logger) << "foreign timers fired on time";
+}
+
+static void bench(int threads, int n) {
+  serverframework::IOManager iom(threads, false, "bench");
+  std::atomic<uint64_t> total_us = {0};
+  for (int i = 0; i < threads; ++i) {
+    iom.Schedule([n, &total_us]() {
+      serverframework::IOManager *iom = serverframework::IOManager::GetThis();
+      std::vector<serverframework::Timer::ptr> timers;
+      timers.reserve(n);
+      uint64_t begin = serverframework::GetCurrentUS();
+      for (int j = 0; j < n; ++j) {
+        timers.push_back(iom->AddTimer(60 * 1000 + j % 1000, []() {}));
+      }
+      for (auto &timer : timers) {
+        timer->Cancel();
+      }
+      total_us += serverframework::GetCurrentUS() - begin;
+    });
+  }
+  iom.Stop();
+  std::cout << threads << " threads x " << n
+            << " add+cancel: " << (uint64_t)threads * n * 1000000 /
+                                      (total_us / threads + 1)
+            << " ops/s" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  serverframework::EnvMgr::GetInstance()->Init(argc, argv);
+  serverframework::Config::LoadFromConfDir(
+      serverframework::EnvMgr::GetInstance()->GetConfigPath());
+
+  uint64_t begin = serverframework::GetElapsedMS();
+  test_cross_thread_cancel();
+  LOG_INFO(g_logger) << "fired=" << s_fired << " cancelled=" << s_cancelled
+                     << " cost=" << serverframework::GetElapsedMS() - begin
+                     << "ms";
+  ASSERT(s_fired + s_cancelled == kTasks * kTimersPerTask);
+  ASSERT(s_cancelled_fired == 0);
+
+  test_foreign_wakeup();
+
+  bench(1, 200000);
+  bench(kThreads, 200000);
+  return 0;
+}
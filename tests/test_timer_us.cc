@@ -0,0 +1,93 @@
+/**
+ * @file test_timer_us.cc
+ * @brief 微秒精度定时器测试
+ * @details 统计200微秒定时器从添加到触发的实际延迟，并验证没有定时器时idle线程不会被周期性唤醒。
+ *          epoll等待调用通过在可执行文件中重新定义epoll_wait/epoll_pwait2来计数
+ */
+#include <dlfcn.h>
+#include <sys/epoll.h>
+
+#include <algorithm>
+
+#include "serverframework.h"
+
+static serverframework::Logger::ptr g_logger = LOG_ROOT();
+
+static std::atomic<uint64_t> s_epoll_wait = {0};
+
+extern "C" {
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+               int timeout) {
+  typedef int (*epoll_wait_fun)(int, struct epoll_event *, int, int);
+  static epoll_wait_fun real = (epoll_wait_fun)dlsym(RTLD_NEXT, "epoll_wait");
+  ++s_epoll_wait;
+  return real(epfd, events, maxevents, timeout);
+}
+
+int epoll_pwait2(int epfd, struct epoll_event *events, int maxevents,
+                 const struct timespec *timeout, const sigset_t *sigmask) {
+  typedef int (*epoll_pwait2_fun)(int, struct epoll_event *, int,
+                                  const struct timespec *, const sigset_t *);
+  static epoll_pwait2_fun real =
+      (epoll_pwait2_fun)dlsym(RTLD_NEXT, "epoll_pwait2");
+  ++s_epoll_wait;
+  return real(epfd, events, maxevents, timeout, sigmask);
+}
+}
+
+static const int kTicks = 1000;
+static const uint64_t kIntervalUS = 200;
+
+static std::vector<uint64_t> s_delays;
+static uint64_t s_armed_at = 0;
+
+/**
+ * @brief 每次触发后重新添加一个单次定时器，记录从添加到触发的实际延迟
+ */
+static void OnTick() {
+  s_delays.push_back(serverframework::Clock::NowUS() - s_armed_at);
+  if (s_delays.size() < kTicks) {
+    s_armed_at = serverframework::Clock::NowUS();
+    serverframework::IOManager::GetThis()->AddTimerUS(kIntervalUS, &OnTick);
+  }
+}
+
+static void test_precision() {
+  serverframework::IOManager iom(1, false, "precision");
+  s_delays.reserve(kTicks);
+  iom.Schedule([]() {
+    s_armed_at = serverframework::Clock::NowUS();
+    serverframework::IOManager::GetThis()->AddTimerUS(kIntervalUS, &OnTick);
+  });
+  iom.Stop();
+
+  std::sort(s_delays.begin(), s_delays.end());
+  uint64_t p50 = s_delays[s_delays.size() / 2];
+  uint64_t p99 = s_delays[s_delays.size() * 99 / 100];
+  LOG_INFO(g_logger) << kTicks << " timers of " << kIntervalUS
+                     << "us: min=" << s_delays.front() << "us p50=" << p50
+                     << "us p99=" << p99 << "us";
+  ASSERT(s_delays.front() >= kIntervalUS);
+  ASSERT(p50 < 1000);
+}
+
+static void test_idle_wakeups() {
+  serverframework::IOManager iom(1, false, "idle");
+  // 等待调度线程进入idle
+  usleep(100 * 1000);
+  uint64_t before = s_epoll_wait;
+  sleep(6);
+  uint64_t wakeups = s_epoll_wait - before;
+  LOG_INFO(g_logger) << "epoll waits in 6s idle: " << wakeups;
+  ASSERT(wakeups == 0);
+}
+
+int main(int argc, char *argv[]) {
+  serverframework::EnvMgr::GetInstance()->Init(argc, argv);
+  serverframework::Config::LoadFromConfDir(
+      serverframework::EnvMgr::GetInstance()->GetConfigPath());
+
+  test_precision();
+  test_idle_wakeups();
+  return 0;
+}
@@ -0,0 +1,106 @@
+/**
+ * @file test_timer_wheel.cc
+ * @brief 分层时间轮测试
+ * @details 先在时间轮模式下验证定时器的触发时间、循环、取消和刷新语义，
+ *          再分别以std::set和时间轮管理定时器，对比大量定时器添加/取消的耗时
+ */
+#include "serverframework.h"
+
+static serverframework::Logger::ptr g_logger = LOG_ROOT();
+
+/**
+ * @brief 只用于压测的定时器管理器，不需要唤醒调度器
+ */
+class BenchTimerManager : public serverframework::TimerManager {
+ protected:
+  void OnTimerInsertedAtFront(int) override {}
+};
+
+static void test_semantics() {
+  serverframework::Config::Lookup<bool>("timer.wheel")->SetValue(true);
+  serverframework::IOManager iom;
+  ASSERT(iom.IsUseWheel());
+
+  uint64_t start = serverframework::GetElapsedMS();
+  uint64_t delays[] = {10, 50, 300, 1000, 3000};
+  for (uint64_t d : delays) {
+    iom.AddTimer(d, [start, d]() {
+      uint64_t cost = serverframework::GetElapsedMS() - start;
+      LOG_INFO(g_logger) << "timer " << d << "ms fired after " << cost << "ms";
+      ASSERT(cost >= d && cost < d + 20);
+    });
+  }
+
+  // 循环定时器，触发3次后取消
+  static int s_count = 0;
+  static serverframework::Timer::ptr s_recurring;
+  s_recurring = iom.AddTimer(
+      100,
+      []() {
+        LOG_INFO(g_logger) << "recurring timer count=" << ++s_count;
+        if (s_count == 3) {
+          bool first = s_recurring->Cancel();
+          bool second = s_recurring->Cancel();
+          ASSERT(first && !second);
+        }
+      },
+      true);
+
+  // 被取消的定时器不会触发
+  serverframework::Timer::ptr cancelled =
+      iom.AddTimer(200, []() { ASSERT2(false, "cancelled timer fired"); });
+  bool ok = cancelled->Cancel();
+  ASSERT(ok);
+
+  // 刷新后的定时器从刷新时刻重新计时
+  static serverframework::Timer::ptr s_refreshed;
+  s_refreshed = iom.AddTimer(500, [start]() {
+    uint64_t cost = serverframework::GetElapsedMS() - start;
+    LOG_INFO(g_logger) << "refreshed timer fired after " << cost << "ms";
+    ASSERT(cost >= 700);
+  });
+  iom.AddTimer(200, []() {
+    bool ok = s_refreshed->Refresh();
+    ASSERT(ok);
+  });
+}
+
+static void bench(bool wheel, size_t n) {
+  serverframework::Config::Lookup<bool>("timer.wheel")->SetValue(wheel);
+  BenchTimerManager mgr;
+  // 绑定当前线程的分片，之后的添加和取消都直接操作分片
+  mgr.GetNextTimer();
+  std::vector<serverframework::Timer::ptr> timers;
+  timers.reserve(n);
+
+  uint64_t begin = serverframework::GetCurrentUS();
+  for (size_t i = 0; i < n; ++i) {
+    // 模拟读超时，到期时间分散在60~180秒
+    timers.push_back(mgr.AddTimer(60 * 1000 + i % (120 * 1000), []() {}));
+  }
+  uint64_t add_cost = serverframework::GetCurrentUS() - begin;
+
+  begin = serverframework::GetCurrentUS();
+  for (size_t i = 0; i < n; ++i) {
+    timers[i]->Cancel();
+  }
+  uint64_t cancel_cost = serverframework::GetCurrentUS() - begin;
+
+  std::cout << (wheel ? "wheel" : "set  ") << " n=" << n
+            << " add=" << add_cost / 1000 << "ms ("
+            << n * 1000000 / (add_cost + 1) << "/s)"
+            << " cancel=" << cancel_cost / 1000 << "ms ("
+            << n * 1000000 / (cancel_cost + 1) << "/s)" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  serverframework::EnvMgr::GetInstance()->Init(argc, argv);
+  serverframework::Config::LoadFromConfDir(
+      serverframework::EnvMgr::GetInstance()->GetConfigPath());
+
+  test_semantics();
+
+  bench(false, 500000);
+  bench(true, 500000);
+  return 0;
+}
@@ -0,0 +1,169 @@
+/**
+ * @file test_udp_batch.cc
+ * @brief UDP批量收发测试
+ * @details 在回环地址上对比三种方式每秒收发的数据报个数：
+ *          1. 每次系统调用收发一个数据报(SendTo/recv)
+ *          2. recvmmsg/sendmmsg批量收发(SendBatch/RecvBatch)
+ *          3. 在批量收发的基础上，发送端开启GSO，接收端开启GRO
+ *          发送端每发一个窗口的数据报就等待接收端的确认，接收端收齐一个窗口后回复确认，
+ *          两端都在IO协程中运行，等待时由hook让出协程
+ */
+#include <netinet/udp.h>
+
+#include "serverframework.h"
+
+static serverframework::Logger::ptr g_logger = LOG_ROOT();
+
+static const size_t kPayload = 64;
+static const int kWindow = 128;
+static const int kWindows = 4000;
+static const int kBatch = 64;
+// GSO模式下每个数据报缓冲区包含的分段数
+static const int kSegments = 32;
+
+enum Mode { SINGLE, BATCH, GSO };
+
+static const char *ModeName(Mode mode) {
+  switch (mode) {
+    case SINGLE:
+      return "single   ";
+    case BATCH:
+      return "mmsg     ";
+    default:
+      return "mmsg+gso ";
+  }
+}
+
+static serverframework::Address::ptr s_data_addr;
+static serverframework::Address::ptr s_ack_addr;
+
+static void Receiver(serverframework::Socket::ptr sock, Mode mode) {
+  sock->SetRecvTimeout(1000);
+  if (mode == GSO) {
+    bool ok = sock->SetGro(true);
+    ASSERT(ok);
+  }
+  static const size_t kBufferSize = 64 * 1024;
+  std::vector<char> buf(kBatch * kBufferSize);
+  std::vector<char> control(kBatch * CMSG_SPACE(sizeof(int)));
+  std::vector<iovec> iovs(kBatch);
+  std::vector<mmsghdr> msgs(kBatch);
+  serverframework::Socket::ptr ack =
+      serverframework::Socket::CreateUDP(s_ack_addr);
+
+  uint64_t total = 0;
+  uint64_t begin = serverframework::GetCurrentUS();
+  for (int w = 0; w < kWindows; ++w) {
+    int got = 0;
+    while (got < kWindow) {
+      if (mode == SINGLE) {
+        int rt = sock->recv(&buf[0], kBufferSize);
+        ASSERT2(rt == (int)kPayload, "recv timeout, datagram lost?");
+        ++got;
+        continue;
+      }
+      for (int i = 0; i < kBatch; ++i) {
+        iovs[i].iov_base = &buf[i * kBufferSize];
+        iovs[i].iov_len = kBufferSize;
+        memset(&msgs[i], 0, sizeof(mmsghdr));
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = &control[i * CMSG_SPACE(sizeof(int))];
+        msgs[i].msg_hdr.msg_controllen = CMSG_SPACE(sizeof(int));
+      }
+      int rt = sock->RecvBatch(&msgs[0], kBatch);
+      ASSERT2(rt > 0, "recvmmsg timeout, datagram lost?");
+      for (int i = 0; i < rt; ++i) {
+        uint16_t seg = serverframework::Socket::GetGroSegment(msgs[i].msg_hdr);
+        got += seg ? (msgs[i].msg_len + seg - 1) / seg : 1;
+      }
+    }
+    ASSERT(got == kWindow);
+    total += got;
+    int rt = ack->SendTo("k", 1, s_ack_addr);
+    ASSERT(rt == 1);
+  }
+  uint64_t cost = serverframework::GetCurrentUS() - begin;
+  std::cout << ModeName(mode) << total << " datagrams in " << cost / 1000
+            << "ms, " << total * 1000000 / (cost + 1) << " pps" << std::endl;
+  sock->close();
+  ack->close();
+}
+
+static void Sender(serverframework::Socket::ptr ack, Mode mode) {
+  serverframework::Socket::ptr sock =
+      serverframework::Socket::CreateUDP(s_data_addr);
+  if (mode == GSO) {
+    bool ok = sock->SetGsoSegment(kPayload);
+    ASSERT(ok);
+  }
+  std::vector<char> payload(kPayload * kSegments, 'x');
+  // 每个mmsghdr携带的数据报个数
+  int per_msg = mode == GSO ? kSegments : 1;
+  std::vector<iovec> iovs(kBatch);
+  std::vector<mmsghdr> msgs(kBatch);
+  for (int i = 0; i < kBatch; ++i) {
+    iovs[i].iov_base = &payload[0];
+    iovs[i].iov_len = kPayload * per_msg;
+  }
+
+  char buf[16];
+  for (int w = 0; w < kWindows; ++w) {
+    int sent = 0;
+    while (sent < kWindow) {
+      if (mode == SINGLE) {
+        int rt = sock->SendTo(&payload[0], kPayload, s_data_addr);
+        ASSERT(rt == (int)kPayload);
+        ++sent;
+        continue;
+      }
+      int n = std::min(kBatch, (kWindow - sent) / per_msg);
+      for (int i = 0; i < n; ++i) {
+        memset(&msgs[i], 0, sizeof(mmsghdr));
+        msgs[i].msg_hdr.msg_name = s_data_addr->GetAddrGetFamily();
+        msgs[i].msg_hdr.msg_namelen = s_data_addr->GetAddrLen();
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+      }
+      int rt = sock->SendBatch(&msgs[0], n);
+      ASSERT(rt > 0);
+      sent += rt * per_msg;
+    }
+    // 等待接收端确认，收齐一个窗口再发下一个，避免接收缓冲区溢出丢包
+    int rt = ack->recv(buf, sizeof(buf));
+    ASSERT(rt == 1);
+  }
+  sock->close();
+  ack->close();
+}
+
+static void Run(Mode mode) {
+  serverframework::IOManager iom(1, true, "udp");
+  iom.Schedule([mode]() {
+    serverframework::Socket::ptr data =
+        serverframework::Socket::CreateUDP(s_data_addr);
+    serverframework::Socket::ptr ack =
+        serverframework::Socket::CreateUDP(s_ack_addr);
+    bool ok = data->bind(s_data_addr) && ack->bind(s_ack_addr);
+    ASSERT(ok);
+    serverframework::IOManager::GetThis()->Schedule(
+        std::bind(&Receiver, data, mode));
+    serverframework::IOManager::GetThis()->Schedule(
+        std::bind(&Sender, ack, mode));
+  });
+}
+
+int main(int argc, char *argv[]) {
+  serverframework::EnvMgr::GetInstance()->Init(argc, argv);
+  serverframework::Config::LoadFromConfDir(
+      serverframework::EnvMgr::GetInstance()->GetConfigPath());
+
+  s_data_addr = serverframework::Address::LookupAnyIPAddress("127.0.0.1:12034");
+  s_ack_addr = serverframework::Address::LookupAnyIPAddress("127.0.0.1:12035");
+  ASSERT(s_data_addr && s_ack_addr);
+
+  Run(SINGLE);
+  Run(BATCH);
+  Run(GSO);
+  return 0;
+}
@@ -0,0 +1,231 @@
+/**
+ * @file test_workers.cc
+ * @brief 主进程/工作进程模式测试
+ * @details 启动3个工作进程，每个进程各自bind同一个SO_REUSEPORT地址，回复自己的序号和pid。
+ *          校验连接分发到了多个工作进程；一个工作进程崩溃后其它进程继续服务，
+ *          它按退避间隔单独重启；滚动重载后所有工作进程都被替换；热重启时每个新进程从同一槽位的
+ *          旧进程继承监听socket，全部替换且没有失败的请求；主进程收到SIGTERM后全部退出
+ */
+#include <signal.h>
+#include <sys/wait.h>
+
+#include <map>
+#include <set>
+
+#include "serverframework.h"
+
+static serverframework::Logger::ptr g_logger = LOG_ROOT();
+
+static const uint32_t kWorkers = 3;
+static const char *kHotRestartPath = "/tmp/test_workers_hot_restart.sock";
+
+static serverframework::Address::ptr s_addr;
+
+class InfoServer : public serverframework::TcpServer {
+ protected:
+  void HandleClient(serverframework::Socket::ptr client) override {
+    char buf[64];
+    int n = client->recv(buf, sizeof(buf));
+    if (n > 0 && std::string(buf, n) == "crash") {
+      _exit(3);
+    }
+    serverframework::ProcessInfo *info =
+        serverframework::ProcessInfoMgr::GetInstance();
+    std::string reply =
+        std::to_string(info->worker_id_) + " " + std::to_string(getpid());
+    client->send(reply.data(), reply.size());
+    client->close();
+  }
+};
+
+static int WorkerMain(int argc, char **argv) {
+  serverframework::IOManager iom(1, true, "worker");
+  iom.Schedule([]() {
+    serverframework::HotRestart *hr =
+        serverframework::HotRestartMgr::GetInstance();
+    hr->SetPath(kHotRestartPath);
+    hr->Inherit();
+    serverframework::TcpServer::ptr server(new InfoServer);
+    bool ok = server->bind(s_addr) && server->Start();
+    ASSERT(ok);
+    hr->Ready();
+    serverframework::NotifyReady();
+    ok = hr->Serve({server}, [server]() { server->Stop(); });
+    ASSERT(ok);
+  });
+  return 0;
+}
+
+/**
+ * @brief 发一个请求，返回回复的工作进程序号和pid，失败时pid为0
+ */
+static std::pair<int, pid_t> Request(const std::string &msg = "info") {
+  serverframework::Socket::ptr sock =
+      serverframework::Socket::CreateTCP(s_addr);
+  sock->SetRecvTimeout(3000);
+  char buf[64];
+  int n;
+  if (!sock->connect(s_addr, 3000) ||
+      sock->send(msg.data(), msg.size()) != (int)msg.size() ||
+      (n = sock->recv(buf, sizeof(buf) - 1)) <= 0) {
+    return std::make_pair(-1, 0);
+  }
+  buf[n] = 0;
+  int id;
+  int pid;
+  if (sscanf(buf, "%d %d", &id, &pid) != 2) {
+    return std::make_pair(-1, 0);
+  }
+  return std::make_pair(id, (pid_t)pid);
+}
+
+/**
+ * @brief 发count个请求，返回每个工作进程序号对应的pid，有失败的请求时记入failures
+ */
+static std::map<int, std::set<pid_t>> Collect(int count, int &failures) {
+  std::map<int, std::set<pid_t>> pids;
+  for (int i = 0; i < count; ++i) {
+    std::pair<int, pid_t> rt = Request();
+    if (!rt.second) {
+      ++failures;
+      continue;
+    }
+    pids[rt.first].insert(rt.second);
+  }
+  return pids;
+}
+
+/**
+ * @brief 等到每个工作进程都有一个满足条件的pid回复
+ */
+static std::map<int, pid_t> WaitWorkers(
+    std::function<bool(int, pid_t)> accept) {
+  std::map<int, pid_t> pids;
+  uint64_t deadline = serverframework::Clock::NowMS() + 10000;
+  while (pids.size() < kWorkers && serverframework::Clock::NowMS() < deadline) {
+    std::pair<int, pid_t> rt = Request();
+    if (rt.second && accept(rt.first, rt.second)) {
+      pids[rt.first] = rt.second;
+    }
+    usleep(5 * 1000);
+  }
+  return pids;
+}
+
+static void RunClients(pid_t master) {
+  std::map<int, pid_t> first = WaitWorkers([](int, pid_t) { return true; });
+  ASSERT(first.size() == kWorkers);
+  int failures = 0;
+  std::map<int, std::set<pid_t>> pids = Collect(300, failures);
+  ASSERT(failures == 0);
+  for (auto &i : pids) {
+    std::cout << "worker " << i.first << " pid " << *i.second.begin()
+              << " handled requests" << std::endl;
+  }
+
+  // 处理崩溃请求的工作进程退出，其它工作进程继续服务
+  serverframework::Socket::ptr sock =
+      serverframework::Socket::CreateTCP(s_addr);
+  bool connected = sock->connect(s_addr, 3000);
+  ASSERT(connected);
+  int rt = sock->send("crash", 5);
+  ASSERT(rt == 5);
+  char c;
+  rt = sock->recv(&c, 1);
+  ASSERT(rt <= 0);
+  usleep(100 * 1000);
+  failures = 0;
+  pids = Collect(300, failures);
+  std::cout << "after crash: " << pids.size() << " workers serving, "
+            << failures << " failures" << std::endl;
+  ASSERT(failures == 0 && pids.size() == kWorkers - 1);
+  int crashed = -1;
+  for (auto &i : first) {
+    if (!pids.count(i.first)) {
+      crashed = i.first;
+    }
+  }
+
+  // 崩溃的工作进程按daemon.restart_interval单独重启，序号不变
+  uint64_t begin = serverframework::Clock::NowMS();
+  std::map<int, pid_t> restarted =
+      WaitWorkers([&first, crashed](int id, pid_t pid) {
+        return id != crashed || pid != first[id];
+      });
+  ASSERT(restarted.size() == kWorkers);
+  std::cout << "worker " << crashed << " restarted in "
+            << serverframework::Clock::NowMS() - begin << "ms" << std::endl;
+  for (auto &i : restarted) {
+    ASSERT((i.second != first[i.first]) == (i.first == crashed));
+  }
+
+  // 滚动重载替换所有工作进程
+  rt = kill(master, SIGHUP);
+  ASSERT(rt == 0);
+  std::map<int, pid_t> reloaded = WaitWorkers([&restarted](int id, pid_t pid) {
+    return pid != restarted[id];
+  });
+  ASSERT(reloaded.size() == kWorkers);
+  // 旧进程全部停止后，只有新进程在服务
+  usleep(300 * 1000);
+  failures = 0;
+  pids = Collect(300, failures);
+  ASSERT(failures == 0);
+  for (auto &i : pids) {
+    for (pid_t pid : i.second) {
+      ASSERT(pid != restarted[i.first]);
+    }
+  }
+  std::cout << "rolling reload replaced " << reloaded.size() << " workers"
+            << std::endl;
+
+  // 热重启：每个槽位的新进程从同一槽位的旧进程接过监听socket
+  rt = kill(master, SIGUSR2);
+  ASSERT(rt == 0);
+  std::map<int, pid_t> restarted2 =
+      WaitWorkers([&reloaded](int id, pid_t pid) {
+        return pid != reloaded[id];
+      });
+  ASSERT(restarted2.size() == kWorkers);
+  usleep(300 * 1000);
+  failures = 0;
+  pids = Collect(300, failures);
+  ASSERT(failures == 0 && pids.size() == kWorkers);
+  for (auto &i : pids) {
+    for (pid_t pid : i.second) {
+      ASSERT(pid != reloaded[i.first]);
+    }
+  }
+  std::cout << "hot restart replaced " << restarted2.size() << " workers"
+            << std::endl;
+
+  rt = kill(master, SIGTERM);
+  ASSERT(rt == 0);
+  int status = -1;
+  pid_t exited = waitpid(master, &status, 0);
+  ASSERT(exited == master);
+  ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  failures = 0;
+  Collect(1, failures);
+  ASSERT(failures == 1);
+}
+
+int main(int argc, char *argv[]) {
+  serverframework::EnvMgr::GetInstance()->Init(argc, argv);
+  serverframework::Config::LoadFromConfDir(
+      serverframework::EnvMgr::GetInstance()->GetConfigPath());
+  serverframework::Config::Lookup<uint32_t>("daemon.restart_interval")
+      ->SetValue(1);
+
+  s_addr = serverframework::Address::LookupAnyIPAddress("127.0.0.1:12041");
+  ASSERT(s_addr);
+
+  pid_t master = fork();
+  if (master == 0) {
+    return serverframework::StartWorkers(argc, argv, &WorkerMain, kWorkers,
+                                         false);
+  }
+  serverframework::IOManager iom(1, true, "client");
+  iom.Schedule(std::bind(&RunClients, master));
+  return 0;
+}